@@ -4,200 +4,238 @@
 
 /////fconvsMT.cpp  convolute features and filter  /////////////////////////////////////////////////////////////////
 
-//C++ library (thread-functions are only supported by windows)
+//C++ library
 #include <cstdio>
 #include <cstdlib>
-
-#include <pthread.h>
+#include <cstring>
+#include <vector>
 
 //Original header
 #include "MODEL_info.h"		//File information
 #include "common.hpp"
 #include "switch_float.h"
+#include "thread_pool.hpp"
+
+//AVX2/FMA kernel is selected at run time, so the library still runs on older CPUs
+#if defined(FLOAT_IS_float) && (defined(__x86_64__) || defined(__i386__)) && \
+	(defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define DPM_TTIC_USE_AVX2
+#include <immintrin.h>
+#endif
+
+//output columns of one task
+#define COLUMNS_PER_TASK 4
 
 struct thread_data {
 	FLOAT *A;
 	FLOAT *B;
 	FLOAT *C;
 	FLOAT *F;
-	FLOAT *T;
+	int sym;
 	int A_dims[3];
 	int B_dims[3];
 	int C_dims[2];
 };
 
-//thread process
-// convolve A and B(non_symmetric)
-static void* process(void *thread_arg) {
-	thread_data *args = (thread_data *)thread_arg;
-	FLOAT *A = args->A;	//feature
-	FLOAT *B = args->B;	//filter
-	FLOAT *C = args->C;	//output
-	int *A_dims = args->A_dims;
-	int *B_dims = args->B_dims;
-	int *C_dims = args->C_dims;
-	int num_features = A_dims[2];
-
-	const int A_SQ = A_dims[0]*A_dims[1];
-	const int B_SQ = B_dims[0]*B_dims[1];
+struct conv_task {
+	thread_data *td;
+	int x_start;
+	int x_end;
+};
 
+// add the filter response of one output column over all features
+// dst[y] += sum(f,xp,yp) B[f][xp][yp] * A[f][xp][y+yp]
+static void conv_column(FLOAT *dst, int height, const FLOAT *A, int A_col, int A_SQ,
+			const FLOAT *B, int B_col, int B_width, int B_SQ, int num_features)
+{
 	for (int f = 0; f < num_features; f++)
 	{
-		FLOAT *dst = C;
-		FLOAT *A_src = A + f*A_SQ;
-		FLOAT *B_src = B + f*B_SQ;
-		int XA0 = 0;
-		for (int x = 0; x < C_dims[1]; x++)
+		const FLOAT *A_src = A + f*A_SQ;
+		const FLOAT *B_src = B + f*B_SQ;
+		for (int y = 0; y < height; y++)
 		{
-			FLOAT *A_src2 =A_src+XA0;
-			XA0+=A_dims[0];
-			for (int y = 0; y < C_dims[0]; y++)
+			FLOAT val = 0;
+			const FLOAT *A_off = A_src + y;
+			const FLOAT *B_off = B_src;
+			for (int xp = 0; xp < B_width; xp++)
 			{
-				FLOAT val = 0;
-				FLOAT *A_off = A_src2+y;
-				FLOAT *B_off = B_src;
-				for (int xp = 0; xp < B_dims[1]; xp++)
+				switch(B_col)
 				{
-					switch(B_dims[0])
-					{
-					case 20: val += A_off[19] * B_off[19];
-					case 19: val += A_off[18] * B_off[18];
-					case 18: val += A_off[17] * B_off[17];
-					case 17: val += A_off[16] * B_off[16];
-					case 16: val += A_off[15] * B_off[15];
-					case 15: val += A_off[14] * B_off[14];
-					case 14: val += A_off[13] * B_off[13];
-					case 13: val += A_off[12] * B_off[12];
-					case 12: val += A_off[11] * B_off[11];
-					case 11: val += A_off[10] * B_off[10];
-					case 10: val += A_off[9] * B_off[9];
-					case 9: val += A_off[8] * B_off[8];
-					case 8: val += A_off[7] * B_off[7];
-					case 7: val += A_off[6] * B_off[6];
-					case 6: val += A_off[5] * B_off[5];
-					case 5: val += A_off[4] * B_off[4];
-					case 4: val += A_off[3] * B_off[3];
-					case 3: val += A_off[2] * B_off[2];
-					case 2: val += A_off[1] * B_off[1];
-					case 1: val += A_off[0] * B_off[0];
-						break;
-					default:
-						FLOAT *A_temp = A_off;
-						FLOAT *B_temp = B_off;
-						for (int yp = 0; yp < B_dims[0]; yp++)
-						{
-							val += *(A_temp++) * *(B_temp++);
-						}
-					}
-					A_off+=A_dims[0];
-					B_off+=B_dims[0];
+				case 20: val += A_off[19] * B_off[19];
+				case 19: val += A_off[18] * B_off[18];
+				case 18: val += A_off[17] * B_off[17];
+				case 17: val += A_off[16] * B_off[16];
+				case 16: val += A_off[15] * B_off[15];
+				case 15: val += A_off[14] * B_off[14];
+				case 14: val += A_off[13] * B_off[13];
+				case 13: val += A_off[12] * B_off[12];
+				case 12: val += A_off[11] * B_off[11];
+				case 11: val += A_off[10] * B_off[10];
+				case 10: val += A_off[9] * B_off[9];
+				case 9: val += A_off[8] * B_off[8];
+				case 8: val += A_off[7] * B_off[7];
+				case 7: val += A_off[6] * B_off[6];
+				case 6: val += A_off[5] * B_off[5];
+				case 5: val += A_off[4] * B_off[4];
+				case 4: val += A_off[3] * B_off[3];
+				case 3: val += A_off[2] * B_off[2];
+				case 2: val += A_off[1] * B_off[1];
+				case 1: val += A_off[0] * B_off[0];
+					break;
+				default:
+					for (int yp = 0; yp < B_col; yp++)
+						val += A_off[yp] * B_off[yp];
 				}
-				*(dst++) += val;
+				A_off += A_col;
+				B_off += B_col;
 			}
+			dst[y] += val;
 		}
-		A_src+=A_SQ;
-		B_src+=B_SQ;
 	}
+}
+
+#ifdef DPM_TTIC_USE_AVX2
+// same as conv_column, the output rows are kept in registers while all features are accumulated
+__attribute__((target("avx2,fma")))
+static void conv_column_avx2(FLOAT *dst, int height, const FLOAT *A, int A_col, int A_SQ,
+			     const FLOAT *B, int B_col, int B_width, int B_SQ, int num_features)
+{
+	int y = 0;
+	for (; y + 32 <= height; y += 32)
+	{
+		__m256 acc0 = _mm256_loadu_ps(dst + y);
+		__m256 acc1 = _mm256_loadu_ps(dst + y + 8);
+		__m256 acc2 = _mm256_loadu_ps(dst + y + 16);
+		__m256 acc3 = _mm256_loadu_ps(dst + y + 24);
+		for (int f = 0; f < num_features; f++)
+		{
+			const FLOAT *A_src = A + f*A_SQ + y;
+			const FLOAT *B_src = B + f*B_SQ;
+			for (int xp = 0; xp < B_width; xp++)
+			{
+				for (int yp = 0; yp < B_col; yp++)
+				{
+					const __m256 b = _mm256_broadcast_ss(B_src + yp);
+					const FLOAT *A_off = A_src + yp;
+					acc0 = _mm256_fmadd_ps(b, _mm256_loadu_ps(A_off), acc0);
+					acc1 = _mm256_fmadd_ps(b, _mm256_loadu_ps(A_off + 8), acc1);
+					acc2 = _mm256_fmadd_ps(b, _mm256_loadu_ps(A_off + 16), acc2);
+					acc3 = _mm256_fmadd_ps(b, _mm256_loadu_ps(A_off + 24), acc3);
+				}
+				A_src += A_col;
+				B_src += B_col;
+			}
+		}
+		_mm256_storeu_ps(dst + y, acc0);
+		_mm256_storeu_ps(dst + y + 8, acc1);
+		_mm256_storeu_ps(dst + y + 16, acc2);
+		_mm256_storeu_ps(dst + y + 24, acc3);
+	}
+
+	for (; y + 8 <= height; y += 8)
+	{
+		__m256 acc = _mm256_loadu_ps(dst + y);
+		for (int f = 0; f < num_features; f++)
+		{
+			const FLOAT *A_src = A + f*A_SQ + y;
+			const FLOAT *B_src = B + f*B_SQ;
+			for (int xp = 0; xp < B_width; xp++)
+			{
+				for (int yp = 0; yp < B_col; yp++)
+					acc = _mm256_fmadd_ps(_mm256_broadcast_ss(B_src + yp), _mm256_loadu_ps(A_src + yp), acc);
+				A_src += A_col;
+				B_src += B_col;
+			}
+		}
+		_mm256_storeu_ps(dst + y, acc);
+	}
+
+	if (y < height)
+		conv_column(dst + y, height - y, A + y, A_col, A_SQ, B, B_col, B_width, B_SQ, num_features);
+}
+
+static bool cpu_has_avx2()
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+#endif
+
+static void conv_column_best(FLOAT *dst, int height, const FLOAT *A, int A_col, int A_SQ,
+			     const FLOAT *B, int B_col, int B_width, int B_SQ, int num_features)
+{
+#ifdef DPM_TTIC_USE_AVX2
+	static const bool has_avx2 = cpu_has_avx2();
+	if (has_avx2)
+	{
+		conv_column_avx2(dst, height, A, A_col, A_SQ, B, B_col, B_width, B_SQ, num_features);
+		return;
+	}
+#endif
+	conv_column(dst, height, A, A_col, A_SQ, B, B_col, B_width, B_SQ, num_features);
+}
 
-	pthread_exit((void*)thread_arg);
-	return nullptr;
+// convolve A and B(non_symmetric)
+static void process(thread_data *args, int x_start, int x_end)
+{
+	const int *A_dims = args->A_dims;
+	const int *B_dims = args->B_dims;
+	const int *C_dims = args->C_dims;
+	const int A_SQ = A_dims[0]*A_dims[1];
+	const int B_SQ = B_dims[0]*B_dims[1];
+
+	for (int x = x_start; x < x_end; x++)
+	{
+		conv_column_best(args->C + x*C_dims[0], C_dims[0], args->A + x*A_dims[0], A_dims[0], A_SQ,
+				 args->B, B_dims[0], B_dims[1], B_SQ, A_dims[2]);
+	}
 }
 
 // convolve A and B when B is symmetric
-static void* processS(void *thread_arg)
+// the left half of B is applied to the sum of the features and the flipped features
+static void processS(thread_data *args, int x_start, int x_end)
 {
-	thread_data *args = (thread_data *)thread_arg;
-	FLOAT *A = args->A;
-	FLOAT *B = args->B;
-	FLOAT *C = args->C;
-	FLOAT *F = args->F;
-	FLOAT *T = args->T;
-	int *A_dims = args->A_dims;
-	int *B_dims = args->B_dims;
-	int *C_dims = args->C_dims;
-	int num_features = A_dims[2];
-	int width1 = (int)(B_dims[1]/2.0+0.99);
-	int width2 = (int)(B_dims[1]/2.0);
+	const int *A_dims = args->A_dims;
+	const int *B_dims = args->B_dims;
+	const int *C_dims = args->C_dims;
+	const int num_features = A_dims[2];
+	const int width1 = (int)(B_dims[1]/2.0+0.99);
+	const int width2 = (int)(B_dims[1]/2.0);
 
 	const int A_SQ = A_dims[0]*A_dims[1];
 	const int B_SQ = B_dims[0]*B_dims[1];
 	const int T_L  = width2*A_dims[0];
 	const int CP_L = width1*A_dims[0];
 	const int XF_L = A_dims[1]-width1-width2;
-	const int CP_L_S = CP_L*sizeof(FLOAT);
 
-	for (int f = 0; f < num_features; f++)
+	//band of all features for one output column
+	std::vector<FLOAT> T(num_features*CP_L);
+
+	for (int x = x_start; x < x_end; x++)
 	{
-		FLOAT *dst = C;
-		FLOAT *A_src = A + f*A_SQ;
-		FLOAT *B_src = B + f*B_SQ;
-		FLOAT *F_src = F + f*A_SQ;
-		int XA = 0;
-		for (int x = 0; x < C_dims[1]; x++)
+		const int xf = XF_L-x;
+		for (int f = 0; f < num_features; f++)
 		{
-			// generate tmp data for band of output
-			memcpy(T, A_src + XA, CP_L_S);
-			XA+=A_dims[0];
-			int xf = XF_L-x;
-			FLOAT *copy_dst = T;
-			FLOAT *copy_end = T + T_L;
-			FLOAT *copy_src = F_src + xf*A_dims[0];
-			while (copy_dst < copy_end)
-			{
-				*copy_dst += *copy_src;
-				copy_dst++;
-				copy_src++;
-			}
-
-			for (int y = 0; y < C_dims[0]; y++)
-			{
-				FLOAT val = 0;
-				FLOAT *T_off = T+y;
-				FLOAT *B_off = B_src;
-				for (int xp = 0; xp < width1; xp++)
-				{
-					switch(B_dims[0]) {
-					case 20: val += T_off[19] * B_off[19];
-					case 19: val += T_off[18] * B_off[18];
-					case 18: val += T_off[17] * B_off[17];
-					case 17: val += T_off[16] * B_off[16];
-					case 16: val += T_off[15] * B_off[15];
-					case 15: val += T_off[14] * B_off[14];
-					case 14: val += T_off[13] * B_off[13];
-					case 13: val += T_off[12] * B_off[12];
-					case 12: val += T_off[11] * B_off[11];
-					case 11: val += T_off[10] * B_off[10];
-					case 10: val += T_off[9] * B_off[9];
-					case 9: val += T_off[8] * B_off[8];
-					case 8: val += T_off[7] * B_off[7];
-					case 7: val += T_off[6] * B_off[6];
-					case 6: val += T_off[5] * B_off[5];
-					case 5: val += T_off[4] * B_off[4];
-					case 4: val += T_off[3] * B_off[3];
-					case 3: val += T_off[2] * B_off[2];
-					case 2: val += T_off[1] * B_off[1];
-					case 1: val += T_off[0] * B_off[0];
-						break;
-					default:
-						FLOAT *T_temp = T_off;
-						FLOAT *B_temp = B_off;
-						for (int yp = 0; yp < B_dims[0]; yp++)
-						{
-							val += *(T_temp++) * *(B_temp++);
-						}
-					}
-					T_off+=A_dims[0];
-					B_off+=B_dims[0];
-				}
-
-				*(dst++) += val;
-			}
+			FLOAT *T_f = &T[f*CP_L];
+			const FLOAT *F_src = args->F + f*A_SQ + xf*A_dims[0];
+			memcpy(T_f, args->A + f*A_SQ + x*A_dims[0], CP_L*sizeof(FLOAT));
+			for (int i = 0; i < T_L; i++)
+				T_f[i] += F_src[i];
 		}
+
+		conv_column_best(args->C + x*C_dims[0], C_dims[0], &T[0], A_dims[0], CP_L,
+				 args->B, B_dims[0], width1, B_SQ, num_features);
 	}
+}
 
-	pthread_exit((void*)thread_arg);
+static void conv_task_process(void *arg, int index)
+{
+	conv_task *task = (conv_task *)arg + index;
 
-	return nullptr;
+	if (task->td->sym == 0)
+		process(task->td, task->x_start, task->x_end);
+	else
+		processS(task->td, task->x_start, task->x_end);
 }
 
 //Input(feat,flipfeat,filter,symmetric info,1,length)
@@ -210,15 +248,15 @@ FLOAT **dpm_ttic_cpu_fconvsMT(FLOAT*feat,FLOAT*flfeat,FLOAT**filter,int *sym_inf
 
 	const int len=end-start+1;
 	FLOAT **Output=(FLOAT**)malloc(sizeof(FLOAT*)*len);		//Output (cell)
-	// start threads
-	thread_data *td = (thread_data *)calloc(len, sizeof(thread_data));
-	pthread_t *ts = (pthread_t *)calloc(len, sizeof(pthread_t));
+	std::vector<thread_data> td(len);
+	std::vector<conv_task> tasks;
 
 	for(int ii=0;ii<len;ii++)
 	{
 		td[ii].A=feat;
 		td[ii].B=filter[ii+start];
 		td[ii].F=flfeat;
+		td[ii].sym=sym_info[ii+start];
 		td[ii].A_dims[0]=A_SIZE[0];
 		td[ii].A_dims[1]=A_SIZE[1];
 		td[ii].A_dims[2]=31;
@@ -240,45 +278,24 @@ FLOAT **dpm_ttic_cpu_fconvsMT(FLOAT*feat,FLOAT*flfeat,FLOAT**filter,int *sym_inf
 		td[ii].C_dims[1]=width;
 		td[ii].C=(FLOAT*)calloc(height*width,sizeof(FLOAT));
 
-		int sym = sym_info[ii+start];
-
-		//non_symmetric
-		if (sym ==0)
+		//split output columns into tasks
+		for (int x = 0; x < width; x += COLUMNS_PER_TASK)
 		{
-			if (pthread_create(&ts[ii], NULL, process, (void*)&td[ii]))
-			{
-				printf("Error creating thread\n");
-				exit(0);
-			}
-		}
-		//symmetric
-		else
-		{
-			int T_dims[2];
-			T_dims[0] = td[ii].A_dims[0];
-			T_dims[1] = (int)(td[ii].B_dims[1]/2.0+0.99);
-			td[ii].T=(FLOAT*)calloc(T_dims[0]*T_dims[1],sizeof(FLOAT));
-			if (pthread_create(&ts[ii], NULL, processS, (void*)&td[ii]))
-			{
-				printf("Error creating thread\n");
-				exit(0);
-			}
+			conv_task task;
+			task.td = &td[ii];
+			task.x_start = x;
+			task.x_end = (x + COLUMNS_PER_TASK < width) ? x + COLUMNS_PER_TASK : width;
+			tasks.push_back(task);
 		}
 
 		M_size[ii*2]=height;
 		M_size[ii*2+1]=width;
-
 	}
 
-	//close handle and get output
-	for (int i = 0; i < len; i++)
-	{
-		pthread_join(ts[i], NULL);
+	dpm_ttic_cpu_parallel_for(tasks.size(), conv_task_process, tasks.data());
 
+	for (int i = 0; i < len; i++)
 		Output[i]=td[i].C;
-		s_free(td[i].T);
-	}
-	s_free(td);
-	s_free(ts);
+
 	return(Output);
 }
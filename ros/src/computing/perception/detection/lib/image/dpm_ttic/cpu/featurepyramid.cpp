@@ -15,7 +15,7 @@
 
 #include <time.h>
 #include <iostream>
-#include <pthread.h>
+#include <vector>
 
 using namespace std;
 
@@ -25,6 +25,7 @@ using namespace std;
 #include "common.hpp"
 #include "resize.hpp"
 #include "featurepyramid.hpp"
+#include "thread_pool.hpp"
 
 //definition of constant
 #define eps 0.0001
@@ -59,6 +60,16 @@ static inline FLOAT min_2(FLOAT x)
 	return (x <= 0.2 ? x :0.2);
 }
 
+//zero-filled scratch memory of the calling thread, reused for every level and frame
+static FLOAT *scratch_buffer(size_t num)
+{
+	static thread_local std::vector<FLOAT> buffer;
+	if (buffer.size() < num)
+		buffer.resize(num);
+	memset(&buffer[0], 0, num*sizeof(FLOAT));
+	return &buffer[0];
+}
+
 //initialization functions
 
 //initialize scales
@@ -164,8 +175,8 @@ static FLOAT *calc_feature(FLOAT *SRC,int *ISIZE,int *FTSIZE,int sbin)
 
 
 	//HOG Histgram and Norm
-	FLOAT *HHist = (FLOAT*)calloc(BLOCK_SQ*18,sizeof(FLOAT));	// HOG histgram
-	FLOAT *Norm = (FLOAT*)calloc(BLOCK_SQ,sizeof(FLOAT));		// Norm
+	FLOAT *HHist = scratch_buffer(BLOCK_SQ*19);	// HOG histgram
+	FLOAT *Norm = HHist+BLOCK_SQ*18;		// Norm
 
 	//feature(Output)
 	FLOAT *feat=(FLOAT*)calloc(OUT_SIZE[0]*OUT_SIZE[1]*OUT_SIZE[2],sizeof(FLOAT));
@@ -349,10 +360,6 @@ static FLOAT *calc_feature(FLOAT *SRC,int *ISIZE,int *FTSIZE,int sbin)
 		}
 	}
 
-	//Release
-	s_free(HHist);
-	s_free(Norm);
-
 	//size of feature(output)
 	*FTSIZE=OUT_SIZE[0];
 	*(FTSIZE+1)=OUT_SIZE[1];
@@ -401,14 +408,11 @@ static FLOAT *Ipl_to_FLOAT(IplImage *Input)	//get intensity data (FLOAT) of inpu
 }
 
 // feature calculation
-static void* feat_calc(void *thread_arg)
+static void feat_calc(void *thread_arg, int index)
 {
-	thread_data *args = (thread_data *)thread_arg;
+	thread_data *args = (thread_data *)thread_arg + index;
 	FLOAT *Out =calc_feature(args->IM,args->ISIZE,args->FSIZE,args->sbin);
 	args->Out =Out;
-	//_endthreadex(0);
-	//return(0);
-	pthread_exit((void*)thread_arg);
 }
 
 //void initialize thread data
@@ -442,9 +446,8 @@ FLOAT **dpm_ttic_cpu_calc_f_pyramid(IplImage *Image,Model_info *MI,int *FTSIZE,F
 	//features
 	FLOAT **feat=(FLOAT**)malloc(sizeof(FLOAT*)*LEN);		//Model information
 
-	//thread for feature calculation
+	//tasks for feature calculation
 	thread_data *td = (thread_data *)calloc(LEN, sizeof(thread_data));
-	pthread_t *ts = (pthread_t *)calloc(LEN, sizeof(pthread_t));
 
 	FLOAT **RIM_S =(FLOAT**)calloc(LEN,sizeof(FLOAT*));
 
@@ -467,8 +470,6 @@ FLOAT **dpm_ttic_cpu_calc_f_pyramid(IplImage *Image,Model_info *MI,int *FTSIZE,F
 
 		//"first" 2x interval
 		ini_thread_data(&td[t_count],RIM_S[ii],RISIZE,sbin2,ii);  //initialize thread
-		if( pthread_create(&ts[t_count], NULL, feat_calc, (void*)&td[t_count]))
-		{printf("Error thread\n");exit(0);}
 		*(scale+ii)=st*2;									//save scale
 		t_count++;
 
@@ -476,10 +477,6 @@ FLOAT **dpm_ttic_cpu_calc_f_pyramid(IplImage *Image,Model_info *MI,int *FTSIZE,F
 		RIM_S[ii+interval]=RIM_S[ii];
 
 		ini_thread_data(&td[t_count],RIM_S[ii+interval],RISIZE,sbin,ii+interval);	//initialize thread
-		//ts[t_count]=(HANDLE)_beginthreadex(NULL,0,feat_calc,(void*)&td[t_count],0,&threadID);
-		if(pthread_create(&ts[t_count], NULL, feat_calc, (void*)&td[t_count]))
-			//if (ts[t_count]==INVALID_HANDLE_VALUE)
-		{printf("Error thread\n");exit(0);}
 		*(scale+ii+interval)=st;							//save scale
 		t_count++;
 
@@ -491,10 +488,6 @@ FLOAT **dpm_ttic_cpu_calc_f_pyramid(IplImage *Image,Model_info *MI,int *FTSIZE,F
 			RIM_S[jj+interval] = dpm_ttic_cpu_resize(RIM_T,RISIZE,OUTSIZE,0.5);
 			memcpy(RISIZE, OUTSIZE,sizeof(int)*3);
 			ini_thread_data(&td[t_count],RIM_S[jj+interval],RISIZE,sbin,jj+interval); //initialize thread
-			//ts[t_count]=(HANDLE)_beginthreadex(NULL,0,feat_calc,(void*)&td[t_count],0,&threadID);
-			if(pthread_create(&ts[t_count], NULL, feat_calc, (void*)&td[t_count]))
-				//if (ts[t_count]==INVALID_HANDLE_VALUE)
-			{printf("Error thread\n");exit(0);}
 			*(scale+jj+interval)=0.5*(*(scale+jj));			//save scale
 			RIM_T = RIM_S[jj+interval];
 			t_count++;
@@ -502,10 +495,12 @@ FLOAT **dpm_ttic_cpu_calc_f_pyramid(IplImage *Image,Model_info *MI,int *FTSIZE,F
 	}
 
 
+	//calculate features of all levels on the worker threads
+	dpm_ttic_cpu_parallel_for(t_count, feat_calc, td);
+
 	//get thread data
 	for(int ss=0;ss<LEN;ss++)
 	{
-		pthread_join(ts[ss], NULL);
 		feat[td[ss].F_C]=td[ss].Out;
 		memcpy(&FTSIZE[td[ss].F_C*2], td[ss].FSIZE,sizeof(int)*2);
 	}
@@ -521,7 +516,6 @@ FLOAT **dpm_ttic_cpu_calc_f_pyramid(IplImage *Image,Model_info *MI,int *FTSIZE,F
 
 	//release thread information
 	s_free(td);
-	s_free(ts);
 
 	return(feat);
 }
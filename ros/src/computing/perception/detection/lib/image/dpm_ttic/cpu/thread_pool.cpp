@@ -0,0 +1,150 @@
+/*
+ *  Copyright (c) 2015, Nagoya University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  * Neither the name of Autoware nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/////thread_pool.cpp  worker threads shared by feature and convolution calculation
+
+//C++ library
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Header files
+#include "thread_pool.hpp"
+
+namespace {
+
+class ThreadPool
+{
+public:
+	ThreadPool() : task_(nullptr), arg_(nullptr), num_(0), next_(0), active_(0), generation_(0), stop_(false)
+	{
+		//the calling thread works as well
+		unsigned int num_workers = std::thread::hardware_concurrency();
+		if (num_workers > 1)
+			num_workers--;
+		else
+			num_workers = 0;
+
+		for (unsigned int i = 0; i < num_workers; i++)
+			workers_.push_back(std::thread(&ThreadPool::worker, this));
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stop_ = true;
+		}
+		work_cond_.notify_all();
+		for (size_t i = 0; i < workers_.size(); i++)
+			workers_[i].join();
+	}
+
+	void run(int num, dpm_ttic_cpu_task task, void *arg)
+	{
+		std::lock_guard<std::mutex> call_lock(call_mutex_);
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			task_ = task;
+			arg_ = arg;
+			num_ = num;
+			next_ = 0;
+			active_ = workers_.size();
+			generation_++;
+		}
+		work_cond_.notify_all();
+
+		process();
+
+		std::unique_lock<std::mutex> lock(mutex_);
+		done_cond_.wait(lock, [this] { return active_ == 0; });
+	}
+
+private:
+	std::vector<std::thread> workers_;
+	std::mutex call_mutex_;
+	std::mutex mutex_;
+	std::condition_variable work_cond_;
+	std::condition_variable done_cond_;
+
+	dpm_ttic_cpu_task task_;
+	void *arg_;
+	int num_;
+	std::atomic<int> next_;
+	size_t active_;
+	unsigned long generation_;
+	bool stop_;
+
+	void process()
+	{
+		for (int i = next_++; i < num_; i = next_++)
+			task_(arg_, i);
+	}
+
+	void worker()
+	{
+		unsigned long seen = 0;
+		for (;;)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				work_cond_.wait(lock, [this, seen] { return stop_ || generation_ != seen; });
+				if (stop_)
+					return;
+				seen = generation_;
+			}
+
+			process();
+
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				if (--active_ == 0)
+					done_cond_.notify_one();
+			}
+		}
+	}
+};
+
+} // namespace
+
+void dpm_ttic_cpu_parallel_for(int num, dpm_ttic_cpu_task task, void *arg)
+{
+	//started on first use, kept for the lifetime of the process
+	static ThreadPool pool;
+
+	if (num == 1)
+	{
+		task(arg, 0);
+		return;
+	}
+	pool.run(num, task, arg);
+}
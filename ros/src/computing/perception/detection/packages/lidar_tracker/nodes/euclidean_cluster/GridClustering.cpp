@@ -0,0 +1,196 @@
+/*
+ * GridClustering.cpp
+ *
+ *  Euclidean clustering on a voxel grid with union-find
+ */
+
+#include "GridClustering.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+static const int64_t CELL_BIAS = 1 << 20;	//21 bits per axis
+
+static bool compareClusterSize(const pcl::PointIndices& a, const pcl::PointIndices& b)
+{
+	return a.indices.size() > b.indices.size();
+}
+
+GridClustering::GridClustering() :
+		tolerance_(0.5), min_cluster_size_(1), max_cluster_size_(std::numeric_limits<int>::max()), use_2d_(false)
+{}
+
+GridClustering::~GridClustering()
+{}
+
+void GridClustering::SetClusterTolerance(float in_tolerance)
+{
+	tolerance_ = in_tolerance;
+}
+
+void GridClustering::SetMinClusterSize(int in_size)
+{
+	min_cluster_size_ = in_size;
+}
+
+void GridClustering::SetMaxClusterSize(int in_size)
+{
+	max_cluster_size_ = in_size;
+}
+
+void GridClustering::SetUse2D(bool in_use_2d)
+{
+	use_2d_ = in_use_2d;
+}
+
+int GridClustering::Find(int in_node)
+{
+	while (parents_[in_node] != in_node)
+	{
+		parents_[in_node] = parents_[parents_[in_node]];
+		in_node = parents_[in_node];
+	}
+	return in_node;
+}
+
+void GridClustering::Union(int in_node_a, int in_node_b)
+{
+	int root_a = Find(in_node_a);
+	int root_b = Find(in_node_b);
+	if (root_a < root_b)
+		parents_[root_b] = root_a;
+	else if (root_b < root_a)
+		parents_[root_a] = root_b;
+}
+
+int64_t GridClustering::CellKey(int in_x, int in_y, int in_z) const
+{
+	return ((in_x + CELL_BIAS) << 42) | ((in_y + CELL_BIAS) << 21) | (in_z + CELL_BIAS);
+}
+
+int GridClustering::FindCell(int64_t in_key) const
+{
+	std::vector<std::pair<int64_t, int> >::const_iterator it =
+			std::lower_bound(cells_.begin(), cells_.end(), std::make_pair(in_key, -1));
+	if (it == cells_.end() || it->first != in_key)
+		return -1;
+	return it - cells_.begin();
+}
+
+void GridClustering::Extract(const pcl::PointCloud<pcl::PointXYZ>::Ptr in_cloud_ptr, std::vector<pcl::PointIndices>& out_cluster_indices)
+{
+	out_cluster_indices.clear();
+	cells_.clear();
+
+	const std::vector<pcl::PointXYZ, Eigen::aligned_allocator<pcl::PointXYZ> >& points = in_cloud_ptr->points;
+	float inverse_tolerance = 1.0f / tolerance_;
+	float squared_tolerance = tolerance_ * tolerance_;
+
+	//bucket the points into cells of tolerance_ size
+	cells_.reserve(points.size());
+	for (unsigned int i = 0; i < points.size(); i++)
+	{
+		const pcl::PointXYZ& p = points[i];
+		if (!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z))
+			continue;
+		int x = static_cast<int>(std::floor(p.x * inverse_tolerance));
+		int y = static_cast<int>(std::floor(p.y * inverse_tolerance));
+		int z = use_2d_ ? 0 : static_cast<int>(std::floor(p.z * inverse_tolerance));
+		cells_.push_back(std::make_pair(CellKey(x, y, z), static_cast<int>(i)));
+	}
+	std::sort(cells_.begin(), cells_.end());
+
+	int nodes = cells_.size();
+	parents_.resize(nodes);
+	for (int i = 0; i < nodes; i++)
+		parents_[i] = i;
+
+	//half of the neighborhood, every pair of adjacent cells is visited once
+	static const int offsets_3d[13][3] = {
+		{0, 0, 1},
+		{0, 1, -1}, {0, 1, 0}, {0, 1, 1},
+		{1, -1, -1}, {1, -1, 0}, {1, -1, 1},
+		{1, 0, -1}, {1, 0, 0}, {1, 0, 1},
+		{1, 1, -1}, {1, 1, 0}, {1, 1, 1}
+	};
+	static const int offsets_2d[4][3] = {
+		{0, 1, 0}, {1, -1, 0}, {1, 0, 0}, {1, 1, 0}
+	};
+	const int (*offsets)[3] = use_2d_ ? offsets_2d : offsets_3d;
+	int offsets_size = use_2d_ ? 4 : 13;
+
+	for (int begin = 0, end = 0; begin < nodes; begin = end)
+	{
+		int64_t key = cells_[begin].first;
+		end = begin + 1;
+		while (end < nodes && cells_[end].first == key)
+			end++;
+
+		int x = static_cast<int>((key >> 42) - CELL_BIAS);
+		int y = static_cast<int>(((key >> 21) & ((1 << 21) - 1)) - CELL_BIAS);
+		int z = static_cast<int>((key & ((1 << 21) - 1)) - CELL_BIAS);
+
+		//points in the same cell
+		for (int i = begin; i < end; i++)
+		{
+			const pcl::PointXYZ& p = points[cells_[i].second];
+			for (int j = i + 1; j < end; j++)
+			{
+				if (Find(i) == Find(j))
+					continue;
+				const pcl::PointXYZ& q = points[cells_[j].second];
+				float dx = p.x - q.x, dy = p.y - q.y, dz = use_2d_ ? 0 : p.z - q.z;
+				if (dx*dx + dy*dy + dz*dz <= squared_tolerance)
+					Union(i, j);
+			}
+		}
+
+		//points in the adjacent cells
+		for (int k = 0; k < offsets_size; k++)
+		{
+			int64_t neighbor_key = CellKey(x + offsets[k][0], y + offsets[k][1], z + offsets[k][2]);
+			int neighbor_begin = FindCell(neighbor_key);
+			if (neighbor_begin < 0)
+				continue;
+			for (int i = begin; i < end; i++)
+			{
+				const pcl::PointXYZ& p = points[cells_[i].second];
+				for (int j = neighbor_begin; j < nodes && cells_[j].first == neighbor_key; j++)
+				{
+					if (Find(i) == Find(j))
+						continue;
+					const pcl::PointXYZ& q = points[cells_[j].second];
+					float dx = p.x - q.x, dy = p.y - q.y, dz = use_2d_ ? 0 : p.z - q.z;
+					if (dx*dx + dy*dy + dz*dz <= squared_tolerance)
+						Union(i, j);
+				}
+			}
+		}
+	}
+
+	//collect the connected components
+	std::vector<int> cluster_ids(nodes, -1);
+	std::vector<pcl::PointIndices> clusters;
+	for (int i = 0; i < nodes; i++)
+	{
+		int root = Find(i);
+		if (cluster_ids[root] < 0)
+		{
+			cluster_ids[root] = clusters.size();
+			clusters.push_back(pcl::PointIndices());
+		}
+		clusters[cluster_ids[root]].indices.push_back(cells_[i].second);
+	}
+
+	for (unsigned int i = 0; i < clusters.size(); i++)
+	{
+		int size = clusters[i].indices.size();
+		if (size < min_cluster_size_ || size > max_cluster_size_)
+			continue;
+		std::sort(clusters[i].indices.begin(), clusters[i].indices.end());
+		clusters[i].header = in_cloud_ptr->header;
+		out_cluster_indices.push_back(clusters[i]);
+	}
+	std::stable_sort(out_cluster_indices.begin(), out_cluster_indices.end(), compareClusterSize);
+}
@@ -56,6 +56,9 @@
 #include <vector>
 
 #include "Cluster.h"
+#include "GridClustering.h"
+
+#include "points_preprocessor/radial_ground_segmentation.h"
 
 //#include <vector_map/vector_map.h>
 //#include <vector_map_server/GetSignal.h>
@@ -93,6 +96,10 @@ static int _cluster_size_min;
 static int _cluster_size_max;
 
 static bool _remove_ground;	//only ground
+static double _sensor_height;
+static RadialGroundSegmentation _ground_segmentation;
+static std::vector<int> _ground_indices;
+static std::vector<int> _no_ground_indices;
 
 static bool _using_sensor_cloud;
 static bool _use_diffnormals;
@@ -107,6 +114,9 @@ static double _keep_lane_right_distance;
 static double _max_boundingbox_side;
 static double _remove_points_upto;
 
+static bool _use_grid_clustering;
+static bool _clustering_2d;
+
 void transformBoundingBox(const jsk_recognition_msgs::BoundingBox& in_boundingbox, jsk_recognition_msgs::BoundingBox& out_boundingbox, const std::string& in_target_frame, const std_msgs::Header& in_header)
 {
 	geometry_msgs::PoseStamped pose_in, pose_out;
@@ -273,20 +283,32 @@ std::vector<ClusterPtr> clusterAndColor(const pcl::PointCloud<pcl::PointXYZ>::Pt
 		lidar_tracker::centroids& in_out_centroids,
 		double in_max_cluster_distance=0.5)
 {
-	pcl::search::KdTree<pcl::PointXYZ>::Ptr tree (new pcl::search::KdTree<pcl::PointXYZ>);
-
-	if (in_cloud_ptr->points.size() > 0)
-		tree->setInputCloud (in_cloud_ptr);
-
 	std::vector<pcl::PointIndices> cluster_indices;
 
-	pcl::EuclideanClusterExtraction<pcl::PointXYZ> ec;
-	ec.setClusterTolerance (in_max_cluster_distance); //
-	ec.setMinClusterSize (_cluster_size_min);
-	ec.setMaxClusterSize (_cluster_size_max);
-	ec.setSearchMethod(tree);
-	ec.setInputCloud (in_cloud_ptr);
-	ec.extract (cluster_indices);
+	if (_use_grid_clustering)
+	{
+		GridClustering gc;
+		gc.SetClusterTolerance(in_max_cluster_distance);
+		gc.SetMinClusterSize(_cluster_size_min);
+		gc.SetMaxClusterSize(_cluster_size_max);
+		gc.SetUse2D(_clustering_2d);
+		gc.Extract(in_cloud_ptr, cluster_indices);
+	}
+	else
+	{
+		pcl::search::KdTree<pcl::PointXYZ>::Ptr tree (new pcl::search::KdTree<pcl::PointXYZ>);
+
+		if (in_cloud_ptr->points.size() > 0)
+			tree->setInputCloud (in_cloud_ptr);
+
+		pcl::EuclideanClusterExtraction<pcl::PointXYZ> ec;
+		ec.setClusterTolerance (in_max_cluster_distance); //
+		ec.setMinClusterSize (_cluster_size_min);
+		ec.setMaxClusterSize (_cluster_size_max);
+		ec.setSearchMethod(tree);
+		ec.setInputCloud (in_cloud_ptr);
+		ec.extract (cluster_indices);
+	}
 
 
 	/*pcl::ConditionalEuclideanClustering<pcl::PointXYZ> cec (true);
@@ -300,18 +322,17 @@ std::vector<ClusterPtr> clusterAndColor(const pcl::PointCloud<pcl::PointXYZ>::Pt
 	/////////////////////////////////
 	//---	3. Color clustered points
 	/////////////////////////////////
-	unsigned int k = 0;
 	//pcl::PointCloud<pcl::PointXYZRGB>::Ptr final_cluster (new pcl::PointCloud<pcl::PointXYZRGB>);
 
-	std::vector<ClusterPtr> clusters;
+	std::vector<ClusterPtr> clusters(cluster_indices.size());
 	//pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud_cluster (new pcl::PointCloud<pcl::PointXYZRGB>);//coord + color cluster
-	for (auto it = cluster_indices.begin(); it != cluster_indices.end(); ++it)
+	//bounding box, centroid and pose of each cluster are independent
+	#pragma omp parallel for schedule(dynamic)
+	for (int k = 0; k < (int)cluster_indices.size(); k++)
 	{
 		ClusterPtr cluster(new Cluster());
-		cluster->SetCloud(in_cloud_ptr, it->indices, _velodyne_header, k, (int)_colors[k].val[0], (int)_colors[k].val[1], (int)_colors[k].val[2], "", _pose_estimation);
-		clusters.push_back(cluster);
-
-		k++;
+		cluster->SetCloud(in_cloud_ptr, cluster_indices[k].indices, _velodyne_header, k, (int)_colors[k].val[0], (int)_colors[k].val[1], (int)_colors[k].val[2], "", _pose_estimation);
+		clusters[k] = cluster;
 	}
 	//std::cout << "Clusters: " << k << std::endl;
 	return clusters;
@@ -357,12 +378,18 @@ void segmentByDistance(const pcl::PointCloud<pcl::PointXYZ>::Ptr in_cloud_ptr,
 		else													{cloud_segments_array[4]->points.push_back (current_point);}
 	}
 
-	std::vector <ClusterPtr> all_clusters;
-	for(unsigned int i=0; i<cloud_segments_array.size(); i++)
+	//the segments are clustered concurrently, then joined in segment order
+	std::vector<std::vector<ClusterPtr> > segment_clusters(cloud_segments_array.size());
+	#pragma omp parallel for schedule(dynamic)
+	for(int i=0; i<(int)cloud_segments_array.size(); i++)
 	{
-		std::vector<ClusterPtr> local_clusters = clusterAndColor(cloud_segments_array[i], out_cloud_ptr, in_out_boundingbox_array, in_out_centroids, _clustering_thresholds[i]);
+		segment_clusters[i] = clusterAndColor(cloud_segments_array[i], out_cloud_ptr, in_out_boundingbox_array, in_out_centroids, _clustering_thresholds[i]);
+	}
 
-		all_clusters.insert(all_clusters.end(), local_clusters.begin(), local_clusters.end());
+	std::vector <ClusterPtr> all_clusters;
+	for(unsigned int i=0; i<segment_clusters.size(); i++)
+	{
+		all_clusters.insert(all_clusters.end(), segment_clusters[i].begin(), segment_clusters[i].end());
 	}
 
 	//Clusters can be merged or checked in here
@@ -371,7 +398,7 @@ void segmentByDistance(const pcl::PointCloud<pcl::PointXYZ>::Ptr in_cloud_ptr,
 
 	for(unsigned int i=0; i<all_clusters.size(); i++)
 	{
-		*out_cloud_ptr = *out_cloud_ptr + *(all_clusters[i]->GetCloud());
+		*out_cloud_ptr += *(all_clusters[i]->GetCloud());
 
 		jsk_recognition_msgs::BoundingBox bounding_box = all_clusters[i]->GetBoundingBox();
 		pcl::PointXYZ min_point = all_clusters[i]->GetMinPoint();
@@ -400,36 +427,18 @@ void segmentByDistance(const pcl::PointCloud<pcl::PointXYZ>::Ptr in_cloud_ptr,
 
 void removeFloor(const pcl::PointCloud<pcl::PointXYZ>::Ptr in_cloud_ptr, pcl::PointCloud<pcl::PointXYZ>::Ptr out_nofloor_cloud_ptr, pcl::PointCloud<pcl::PointXYZ>::Ptr out_onlyfloor_cloud_ptr, float in_max_height=0.2, float in_floor_max_angle=0.35)
 {
-	pcl::SACSegmentation<pcl::PointXYZ> seg;
-	pcl::PointIndices::Ptr inliers (new pcl::PointIndices);
-	pcl::ModelCoefficients::Ptr coefficients (new pcl::ModelCoefficients);
-
-	seg.setOptimizeCoefficients (true);
-	seg.setModelType(pcl::SACMODEL_PERPENDICULAR_PLANE);
-	seg.setMethodType(pcl::SAC_RANSAC);
-	seg.setMaxIterations(100);
-	seg.setAxis(Eigen::Vector3f(0,0,1));
-	seg.setEpsAngle(in_floor_max_angle);
-
-	seg.setDistanceThreshold (in_max_height);//floor distance
-	seg.setOptimizeCoefficients(true);
-	seg.setInputCloud(in_cloud_ptr);
-	seg.segment(*inliers, *coefficients);
-	if (inliers->indices.size () == 0)
-	{
-		std::cout << "Could not estimate a planar model for the given dataset." << std::endl;
-	}
+	/*the cloud has no ring field here, the sectors are walked by distance*/
+	_ground_segmentation.SetHeightThreshold(in_max_height);
+	_ground_segmentation.SetLocalMaxSlope(in_floor_max_angle);
+	_ground_segmentation.SetGeneralMaxSlope(in_floor_max_angle);
+	_ground_segmentation.SetSensorHeight(_sensor_height);
+	_ground_segmentation.Segment(*in_cloud_ptr, _ground_indices, _no_ground_indices);
 
 	/*REMOVE THE FLOOR FROM THE CLOUD*/
-	pcl::ExtractIndices<pcl::PointXYZ> extract;
-	extract.setInputCloud (in_cloud_ptr);
-	extract.setIndices(inliers);
-	extract.setNegative(true);//true removes the indices, false leaves only the indices
-	extract.filter(*out_nofloor_cloud_ptr);
+	pcl::copyPointCloud(*in_cloud_ptr, _no_ground_indices, *out_nofloor_cloud_ptr);
 
 	/*EXTRACT THE FLOOR FROM THE CLOUD*/
-	extract.setNegative(false);//true removes the indices, false leaves only the indices
-	extract.filter(*out_onlyfloor_cloud_ptr);
+	pcl::copyPointCloud(*in_cloud_ptr, _ground_indices, *out_onlyfloor_cloud_ptr);
 }
 
 void downsampleCloud(const pcl::PointCloud<pcl::PointXYZ>::Ptr in_cloud_ptr, pcl::PointCloud<pcl::PointXYZ>::Ptr out_cloud_ptr, float in_leaf_size=0.2)
@@ -712,6 +721,7 @@ int main (int argc, char** argv)
 	/* Initialize tuning parameter */
 	private_nh.param("downsample_cloud", _downsample_cloud, false);	ROS_INFO("downsample_cloud: %d", _downsample_cloud);
 	private_nh.param("remove_ground", _remove_ground, true);		ROS_INFO("remove_ground: %d", _remove_ground);
+	private_nh.param("sensor_height", _sensor_height, 1.8);			ROS_INFO("sensor_height: %f", _sensor_height);
 	private_nh.param("leaf_size", _leaf_size, 0.1);					ROS_INFO("leaf_size: %f", _leaf_size);
 	private_nh.param("cluster_size_min", _cluster_size_min, 20);	ROS_INFO("cluster_size_min %d", _cluster_size_min);
 	private_nh.param("cluster_size_max", _cluster_size_max, 100000);ROS_INFO("cluster_size_max: %d", _cluster_size_max);
@@ -726,6 +736,8 @@ int main (int argc, char** argv)
 	private_nh.param("max_boundingbox_side", _max_boundingbox_side, 10.0);			ROS_INFO("_max_boundingbox_side: %f", _max_boundingbox_side);
 	private_nh.param<std::string>("output_frame", _output_frame, "velodyne");			ROS_INFO("output_frame: %s", _output_frame.c_str());
 	private_nh.param("remove_points_upto", _remove_points_upto, 0.0);		ROS_INFO("remove_points_upto: %f", _remove_points_upto);
+	private_nh.param("use_grid_clustering", _use_grid_clustering, true);	ROS_INFO("use_grid_clustering: %d", _use_grid_clustering);
+	private_nh.param("clustering_2d", _clustering_2d, false);				ROS_INFO("clustering_2d: %d", _clustering_2d);
 
 	_velodyne_transform_available = false;
 
@@ -0,0 +1,56 @@
+/*
+ * GridClustering.h
+ *
+ *  Euclidean clustering on a voxel grid with union-find
+ */
+#ifndef GRID_CLUSTERING_H_
+#define GRID_CLUSTERING_H_
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+#include <pcl/PointIndices.h>
+
+#include <stdint.h>
+#include <vector>
+
+/* \brief Euclidean cluster extraction that replaces per point kd-tree radius queries.
+ * Points are bucketed into cells of the cluster tolerance, so every neighbor of a point
+ * lies in its own or an adjacent cell. Pairs of points in adjacent cells closer than the
+ * tolerance are joined with union-find. The result is the same partition as
+ * pcl::EuclideanClusterExtraction, ordered by decreasing size.
+ * */
+class GridClustering {
+	float								tolerance_;
+	int									min_cluster_size_;
+	int									max_cluster_size_;
+	bool								use_2d_;
+
+	std::vector<std::pair<int64_t, int> >	cells_;		//cell key and point index, sorted by key
+	std::vector<int>					parents_;
+
+	int		Find(int in_node);
+	void	Union(int in_node_a, int in_node_b);
+	int64_t	CellKey(int in_x, int in_y, int in_z) const;
+	/* \brief Returns the first position of the cell in cells_, or -1 if it is empty */
+	int		FindCell(int64_t in_key) const;
+public:
+	GridClustering();
+	virtual ~GridClustering();
+
+	/* \brief Sets the maximum distance between two points of the same cluster */
+	void	SetClusterTolerance(float in_tolerance);
+	/* \brief Sets the minimum number of points of a valid cluster */
+	void	SetMinClusterSize(int in_size);
+	/* \brief Sets the maximum number of points of a valid cluster */
+	void	SetMaxClusterSize(int in_size);
+	/* \brief Ignores the height of the points, clustering on the XY plane */
+	void	SetUse2D(bool in_use_2d);
+
+	/* \brief Extracts the clusters of the cloud
+	 * \param[in] in_cloud_ptr 				Origin PointCloud
+	 * \param[out] out_cluster_indices 	Indices of the points of each cluster
+	 * */
+	void	Extract(const pcl::PointCloud<pcl::PointXYZ>::Ptr in_cloud_ptr, std::vector<pcl::PointIndices>& out_cluster_indices);
+};
+
+#endif /* GRID_CLUSTERING_H_ */
@@ -45,6 +45,7 @@
 #include "fast_pcl/filters/voxel_grid_covariance.h"
 #include <Eigen/Dense>
 #include <Eigen/Cholesky>
+#include <algorithm>
 
 //////////////////////////////////////////////////////////////////////////////////////////
 template<typename PointT> void
@@ -99,6 +100,8 @@ pcl::VoxelGridCovariance<PointT>::applyFilter (PointCloud &output)
 
   // Clear the leaves
   leaves_.clear ();
+  leaf_keys_.clear ();
+  leaf_table_.clear ();
 
   // Set up the division multiplier
   divb_mul_ = Eigen::Vector4i (1, div_b_[0], div_b_[0] * div_b_[1], 0);
@@ -157,14 +160,19 @@ pcl::VoxelGridCovariance<PointT>::applyFilter (PointCloud &output)
           continue;
       }
 
-      int ijk0 = static_cast<int> (floor (input_->points[cp].x * inverse_leaf_size_[0]) - static_cast<float> (min_b_[0]));
-      int ijk1 = static_cast<int> (floor (input_->points[cp].y * inverse_leaf_size_[1]) - static_cast<float> (min_b_[1]));
-      int ijk2 = static_cast<int> (floor (input_->points[cp].z * inverse_leaf_size_[2]) - static_cast<float> (min_b_[2]));
+      int ijk0 = static_cast<int> (floor (input_->points[cp].x * inverse_leaf_size_[0]));
+      int ijk1 = static_cast<int> (floor (input_->points[cp].y * inverse_leaf_size_[1]));
+      int ijk2 = static_cast<int> (floor (input_->points[cp].z * inverse_leaf_size_[2]));
 
-      // Compute the centroid leaf index
-      int idx = ijk0 * divb_mul_[0] + ijk1 * divb_mul_[1] + ijk2 * divb_mul_[2];
+      // Find the leaf of the voxel, appending a new one if the voxel was empty so far
+      int leaf_idx = leaf_table_.insert (getLeafKey (ijk0, ijk1, ijk2), static_cast<int> (leaves_.size ()));
+      if (leaf_idx == static_cast<int> (leaves_.size ()))
+      {
+        leaves_.push_back (Leaf ());
+        leaf_keys_.push_back (getLeafKey (ijk0, ijk1, ijk2));
+      }
 
-      Leaf& leaf = leaves_[idx];
+      Leaf& leaf = leaves_[leaf_idx];
       if (leaf.nr_points == 0)
       {
         leaf.centroid.resize (centroid_size);
@@ -216,15 +224,19 @@ pcl::VoxelGridCovariance<PointT>::applyFilter (PointCloud &output)
             !pcl_isfinite (input_->points[cp].z))
           continue;
 
-      int ijk0 = static_cast<int> (floor (input_->points[cp].x * inverse_leaf_size_[0]) - static_cast<float> (min_b_[0]));
-      int ijk1 = static_cast<int> (floor (input_->points[cp].y * inverse_leaf_size_[1]) - static_cast<float> (min_b_[1]));
-      int ijk2 = static_cast<int> (floor (input_->points[cp].z * inverse_leaf_size_[2]) - static_cast<float> (min_b_[2]));
+      int ijk0 = static_cast<int> (floor (input_->points[cp].x * inverse_leaf_size_[0]));
+      int ijk1 = static_cast<int> (floor (input_->points[cp].y * inverse_leaf_size_[1]));
+      int ijk2 = static_cast<int> (floor (input_->points[cp].z * inverse_leaf_size_[2]));
 
-      // Compute the centroid leaf index
-      int idx = ijk0 * divb_mul_[0] + ijk1 * divb_mul_[1] + ijk2 * divb_mul_[2];
+      // Find the leaf of the voxel, appending a new one if the voxel was empty so far
+      int leaf_idx = leaf_table_.insert (getLeafKey (ijk0, ijk1, ijk2), static_cast<int> (leaves_.size ()));
+      if (leaf_idx == static_cast<int> (leaves_.size ()))
+      {
+        leaves_.push_back (Leaf ());
+        leaf_keys_.push_back (getLeafKey (ijk0, ijk1, ijk2));
+      }
 
-      //int idx = (((input_->points[cp].getArray4fmap () * inverse_leaf_size_).template cast<int> ()).matrix () - min_b_).dot (divb_mul_);
-      Leaf& leaf = leaves_[idx];
+      Leaf& leaf = leaves_[leaf_idx];
       if (leaf.nr_points == 0)
       {
         leaf.centroid.resize (centroid_size);
@@ -272,33 +284,28 @@ pcl::VoxelGridCovariance<PointT>::applyFilter (PointCloud &output)
   if (save_leaf_layout_)
     leaf_layout_.resize (div_b_[0] * div_b_[1] * div_b_[2], -1);
 
-  // Eigen values and vectors calculated to prevent near singluar matrices
-  Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> eigensolver;
-  Eigen::Matrix3d eigen_val;
-  Eigen::Vector3d pt_sum;
-
-  // Eigen values less than a threshold of max eigen value are inflated to a set fraction of the max eigen value.
-  double min_covar_eigvalue;
-
-  for (typename std::map<size_t, Leaf>::iterator it = leaves_.begin (); it != leaves_.end (); ++it)
+  for (size_t leaf_idx = 0; leaf_idx < leaves_.size (); ++leaf_idx)
   {
+    Leaf& leaf = leaves_[leaf_idx];
 
-    // Normalize the centroid
-    Leaf& leaf = it->second;
+    // Keep the raw sums so that the leaf can be updated incrementally
+    leaf.pt_sum_ = leaf.mean_;
+    leaf.pt_sq_sum_ = leaf.cov_;
+    leaf.pt_count_ = leaf.nr_points;
 
     // Normalize the centroid
     leaf.centroid /= static_cast<float> (leaf.nr_points);
-    // Point sum used for single pass covariance calculation
-    pt_sum = leaf.mean_;
-    // Normalize mean
-    leaf.mean_ /= leaf.nr_points;
 
     // If the voxel contains sufficient points, its covariance is calculated and is added to the voxel centroids and output clouds.
     // Points with less than the minimum points will have a can not be accuratly approximated using a normal distribution.
     if (leaf.nr_points >= min_points_per_voxel_)
     {
       if (save_leaf_layout_)
-        leaf_layout_[it->first] = cp++;
+      {
+        int ijk0, ijk1, ijk2;
+        getLeafCoordinates (leaf_keys_[leaf_idx], ijk0, ijk1, ijk2);
+        leaf_layout_[(ijk0 - min_b_[0]) * divb_mul_[0] + (ijk1 - min_b_[1]) * divb_mul_[1] + (ijk2 - min_b_[2]) * divb_mul_[2]] = cp++;
+      }
 
       output.push_back (PointT ());
 
@@ -324,50 +331,445 @@ pcl::VoxelGridCovariance<PointT>::applyFilter (PointCloud &output)
 
       // Stores the voxel indice for fast access searching
       if (searchable_)
-        voxel_centroids_leaf_indices_.push_back (static_cast<int> (it->first));
+        voxel_centroids_leaf_indices_.push_back (static_cast<int> (leaf_idx));
+    }
 
-      // Single pass covariance calculation
-      leaf.cov_ = (leaf.cov_ - 2 * (pt_sum * leaf.mean_.transpose ())) / leaf.nr_points + leaf.mean_ * leaf.mean_.transpose ();
-      leaf.cov_ *= (leaf.nr_points - 1.0) / leaf.nr_points;
+    computeLeafDistribution (leaf);
+  }
 
-      //Normalize Eigen Val such that max no more than 100x min.
-      eigensolver.compute (leaf.cov_);
-      eigen_val = eigensolver.eigenvalues ().asDiagonal ();
-      leaf.evecs_ = eigensolver.eigenvectors ();
+  output.width = static_cast<uint32_t> (output.points.size ());
 
-      if (eigen_val (0, 0) < 0 || eigen_val (1, 1) < 0 || eigen_val (2, 2) <= 0)
-      {
-        leaf.nr_points = -1;
-        continue;
-      }
+  // The kdtree built from the output holds every searchable leaf
+  leaf_search_indices_.assign (leaves_.size (), -1);
+  for (size_t i = 0; i < voxel_centroids_leaf_indices_.size (); ++i)
+    leaf_search_indices_[voxel_centroids_leaf_indices_[i]] = static_cast<int> (i);
+  stale_centroids_ = 0;
+  pending_leaf_indices_.clear ();
+}
 
-      // Avoids matrices near singularities (eq 6.11)[Magnusson 2009]
+//////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointT> void
+pcl::VoxelGridCovariance<PointT>::computeLeafDistribution (Leaf &leaf)
+{
+  leaf.nr_points = leaf.pt_count_;
+  // Normalize mean
+  leaf.mean_ = leaf.pt_sum_ / leaf.nr_points;
 
-      min_covar_eigvalue = min_covar_eigvalue_mult_ * eigen_val (2, 2);
-      if (eigen_val (0, 0) < min_covar_eigvalue)
-      {
-        eigen_val (0, 0) = min_covar_eigvalue;
+  // Points with less than the minimum points can not be accuratly approximated using a normal distribution.
+  if (leaf.nr_points < min_points_per_voxel_)
+    return;
 
-        if (eigen_val (1, 1) < min_covar_eigvalue)
-        {
-          eigen_val (1, 1) = min_covar_eigvalue;
-        }
+  // Eigen values and vectors calculated to prevent near singluar matrices
+  Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> eigensolver;
+  Eigen::Matrix3d eigen_val;
 
-        leaf.cov_ = leaf.evecs_ * eigen_val * leaf.evecs_.inverse ();
-      }
-      leaf.evals_ = eigen_val.diagonal ();
+  // Eigen values less than a threshold of max eigen value are inflated to a set fraction of the max eigen value.
+  double min_covar_eigvalue;
+
+  // Single pass covariance calculation
+  leaf.cov_ = (leaf.pt_sq_sum_ - 2 * (leaf.pt_sum_ * leaf.mean_.transpose ())) / leaf.nr_points + leaf.mean_ * leaf.mean_.transpose ();
+  leaf.cov_ *= (leaf.nr_points - 1.0) / leaf.nr_points;
+
+  //Normalize Eigen Val such that max no more than 100x min.
+  eigensolver.compute (leaf.cov_);
+  eigen_val = eigensolver.eigenvalues ().asDiagonal ();
+  leaf.evecs_ = eigensolver.eigenvectors ();
+
+  if (eigen_val (0, 0) < 0 || eigen_val (1, 1) < 0 || eigen_val (2, 2) <= 0)
+  {
+    leaf.nr_points = -1;
+    return;
+  }
+
+  // Avoids matrices near singularities (eq 6.11)[Magnusson 2009]
+
+  min_covar_eigvalue = min_covar_eigvalue_mult_ * eigen_val (2, 2);
+  if (eigen_val (0, 0) < min_covar_eigvalue)
+  {
+    eigen_val (0, 0) = min_covar_eigvalue;
+
+    if (eigen_val (1, 1) < min_covar_eigvalue)
+    {
+      eigen_val (1, 1) = min_covar_eigvalue;
+    }
+
+    leaf.cov_ = leaf.evecs_ * eigen_val * leaf.evecs_.inverse ();
+  }
+  leaf.evals_ = eigen_val.diagonal ();
+
+  leaf.icov_ = leaf.cov_.inverse ();
+  if (leaf.icov_.maxCoeff () == std::numeric_limits<float>::infinity ( )
+      || leaf.icov_.minCoeff () == -std::numeric_limits<float>::infinity ( ) )
+  {
+    leaf.nr_points = -1;
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointT> void
+pcl::VoxelGridCovariance<PointT>::accumulatePoints (const PointCloud &cloud, int sign, std::vector<int> &touched, std::vector<char> &touched_flags)
+{
+  for (size_t cp = 0; cp < cloud.points.size (); ++cp)
+  {
+    const PointT &pt = cloud.points[cp];
+    if (!cloud.is_dense)
+      // Check if the point is invalid
+      if (!pcl_isfinite (pt.x) || !pcl_isfinite (pt.y) || !pcl_isfinite (pt.z))
+        continue;
+
+    int ijk0 = static_cast<int> (floor (pt.x * inverse_leaf_size_[0]));
+    int ijk1 = static_cast<int> (floor (pt.y * inverse_leaf_size_[1]));
+    int ijk2 = static_cast<int> (floor (pt.z * inverse_leaf_size_[2]));
+    int64_t key = getLeafKey (ijk0, ijk1, ijk2);
 
-      leaf.icov_ = leaf.cov_.inverse ();
-      if (leaf.icov_.maxCoeff () == std::numeric_limits<float>::infinity ( )
-          || leaf.icov_.minCoeff () == -std::numeric_limits<float>::infinity ( ) )
+    int leaf_idx;
+    if (sign > 0)
+    {
+      leaf_idx = leaf_table_.insert (key, static_cast<int> (leaves_.size ()));
+      if (leaf_idx == static_cast<int> (leaves_.size ()))
       {
-        leaf.nr_points = -1;
+        leaves_.push_back (Leaf ());
+        leaf_keys_.push_back (key);
       }
 
+      // Grow the bounding box used by the neighbor checks
+      min_b_[0] = std::min (min_b_[0], ijk0);
+      min_b_[1] = std::min (min_b_[1], ijk1);
+      min_b_[2] = std::min (min_b_[2], ijk2);
+      max_b_[0] = std::max (max_b_[0], ijk0);
+      max_b_[1] = std::max (max_b_[1], ijk1);
+      max_b_[2] = std::max (max_b_[2], ijk2);
+    }
+    else
+    {
+      leaf_idx = leaf_table_.find (key);
+      // Points which were never added are ignored
+      if (leaf_idx < 0)
+        continue;
+    }
+
+    if (static_cast<size_t> (leaf_idx) >= touched_flags.size ())
+      touched_flags.resize (leaves_.size (), 0);
+    if (!touched_flags[leaf_idx])
+    {
+      touched_flags[leaf_idx] = 1;
+      touched.push_back (leaf_idx);
+    }
+
+    Leaf &leaf = leaves_[leaf_idx];
+    Eigen::Vector3d pt3d (pt.x, pt.y, pt.z);
+    if (sign > 0)
+    {
+      leaf.pt_sum_ += pt3d;
+      leaf.pt_sq_sum_ += pt3d * pt3d.transpose ();
+      ++leaf.pt_count_;
+    }
+    else if (leaf.pt_count_ > 0)
+    {
+      leaf.pt_sum_ -= pt3d;
+      leaf.pt_sq_sum_ -= pt3d * pt3d.transpose ();
+      --leaf.pt_count_;
     }
   }
+}
 
-  output.width = static_cast<uint32_t> (output.points.size ());
+//////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointT> void
+pcl::VoxelGridCovariance<PointT>::incrementalFilter (const PointCloud &added, const PointCloud &removed, bool searchable)
+{
+  // The kdtree has to be built from scratch if it was not maintained so far
+  bool rebuild = searchable && !searchable_;
+  searchable_ = searchable;
+
+  if (leaves_.empty ())
+  {
+    // Nothing was voxelized yet, start the bounding box at the first added point
+    min_b_.setConstant (std::numeric_limits<int>::max ());
+    max_b_.setConstant (std::numeric_limits<int>::min ());
+    min_b_[3] = max_b_[3] = 0;
+    leaf_table_.clear ();
+  }
+
+  // Accumulate the point sums of the affected voxels only
+  std::vector<int> touched;
+  std::vector<char> touched_flags (leaves_.size (), 0);
+  accumulatePoints (removed, -1, touched, touched_flags);
+  accumulatePoints (added, 1, touched, touched_flags);
+  leaf_search_indices_.resize (leaves_.size (), -1);
+
+  if (leaves_.empty ())
+  {
+    min_b_.setZero ();
+    max_b_.setZero ();
+  }
+  div_b_ = max_b_ - min_b_ + Eigen::Vector4i::Ones ();
+  div_b_[3] = 0;
+  divb_mul_ = Eigen::Vector4i (1, div_b_[0], div_b_[0] * div_b_[1], 0);
+
+  // The leaf layout is not maintained by incremental updates
+  leaf_layout_.clear ();
+
+  // Recompute the normal distributions of the touched voxels
+  std::vector<int> emptied;
+  for (size_t i = 0; i < touched.size (); ++i)
+  {
+    int leaf_idx = touched[i];
+    Leaf &leaf = leaves_[leaf_idx];
+
+    // The centroid in the kdtree is out of date, mask it
+    int search_idx = leaf_search_indices_[leaf_idx];
+    if (search_idx >= 0)
+    {
+      voxel_centroids_leaf_indices_[search_idx] = -1;
+      leaf_search_indices_[leaf_idx] = -1;
+      ++stale_centroids_;
+    }
+
+    if (leaf.pt_count_ <= 0)
+    {
+      removePendingLeaf (leaf_idx);
+      emptied.push_back (leaf_idx);
+      continue;
+    }
+    leaf.centroid = Eigen::Vector4f (static_cast<float> (leaf.pt_sum_[0] / leaf.pt_count_),
+                                     static_cast<float> (leaf.pt_sum_[1] / leaf.pt_count_),
+                                     static_cast<float> (leaf.pt_sum_[2] / leaf.pt_count_), 0);
+    computeLeafDistribution (leaf);
+
+    if (leaf.pt_count_ >= min_points_per_voxel_)
+      addPendingLeaf (leaf_idx);
+    else
+      removePendingLeaf (leaf_idx);
+  }
+
+  // Drop the voxels that lost all their points, highest index first so that the leaf moved into the hole is never an emptied one
+  std::sort (emptied.begin (), emptied.end ());
+  for (std::vector<int>::reverse_iterator it = emptied.rbegin (); it != emptied.rend (); ++it)
+  {
+    int last = static_cast<int> (leaves_.size ()) - 1;
+    leaf_table_.erase (leaf_keys_[*it]);
+    if (*it != last)
+    {
+      leaves_[*it] = leaves_[last];
+      leaf_keys_[*it] = leaf_keys_[last];
+      leaf_table_.assign (leaf_keys_[*it], *it);
+
+      // Follow the moved leaf in the search structures
+      int search_idx = leaf_search_indices_[last];
+      leaf_search_indices_[*it] = search_idx;
+      if (search_idx >= 0)
+        voxel_centroids_leaf_indices_[search_idx] = *it;
+      else if (search_idx <= -2)
+        pending_leaf_indices_[-2 - search_idx] = *it;
+    }
+    leaves_.pop_back ();
+    leaf_keys_.pop_back ();
+    leaf_search_indices_.pop_back ();
+  }
+
+  // The centroid cloud is only rebuilt when it is asked for
+  centroids_outdated_ = true;
+
+  if (!searchable_)
+    return;
+
+  if (rebuild || 4 * (stale_centroids_ + pending_leaf_indices_.size ()) > voxel_centroids_leaf_indices_.size ())
+  {
+    // Too many changes to search them on the side, merge everything into a new kdtree
+    rebuildSearchTree ();
+  }
+  else if (!pending_leaf_indices_.empty ())
+  {
+    // Only the changed voxels go into the pending kdtree
+    PointCloudPtr pending_centroids (new PointCloud);
+    pending_centroids->points.resize (pending_leaf_indices_.size ());
+    for (size_t i = 0; i < pending_leaf_indices_.size (); ++i)
+    {
+      const Leaf &leaf = leaves_[pending_leaf_indices_[i]];
+      pending_centroids->points[i].x = leaf.centroid[0];
+      pending_centroids->points[i].y = leaf.centroid[1];
+      pending_centroids->points[i].z = leaf.centroid[2];
+    }
+    pending_centroids->width = static_cast<uint32_t> (pending_centroids->points.size ());
+    pending_centroids->height = 1;
+    pending_centroids->is_dense = true;
+    pending_kdtree_.setInputCloud (pending_centroids);
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointT> typename pcl::VoxelGridCovariance<PointT>::PointCloudPtr
+pcl::VoxelGridCovariance<PointT>::buildCentroids (std::vector<int> *leaf_indices) const
+{
+  PointCloudPtr centroids (new PointCloud);
+  centroids->points.reserve (leaves_.size ());
+  if (leaf_indices)
+  {
+    leaf_indices->clear ();
+    leaf_indices->reserve (leaves_.size ());
+  }
+  for (size_t leaf_idx = 0; leaf_idx < leaves_.size (); ++leaf_idx)
+  {
+    const Leaf &leaf = leaves_[leaf_idx];
+    if (leaf.pt_count_ < min_points_per_voxel_)
+      continue;
+
+    PointT pt;
+    pt.x = leaf.centroid[0];
+    pt.y = leaf.centroid[1];
+    pt.z = leaf.centroid[2];
+    centroids->points.push_back (pt);
+    if (leaf_indices)
+      leaf_indices->push_back (static_cast<int> (leaf_idx));
+  }
+  centroids->width = static_cast<uint32_t> (centroids->points.size ());
+  centroids->height = 1;
+  centroids->is_dense = true;
+  return (centroids);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointT> void
+pcl::VoxelGridCovariance<PointT>::rebuildSearchTree ()
+{
+  voxel_centroids_ = buildCentroids (&voxel_centroids_leaf_indices_);
+  centroids_outdated_ = false;
+
+  leaf_search_indices_.assign (leaves_.size (), -1);
+  for (size_t i = 0; i < voxel_centroids_leaf_indices_.size (); ++i)
+    leaf_search_indices_[voxel_centroids_leaf_indices_[i]] = static_cast<int> (i);
+  stale_centroids_ = 0;
+  pending_leaf_indices_.clear ();
+
+  if (voxel_centroids_->size () > 0)
+  {
+    // Initiates kdtree of the centroids of voxels containing a sufficient number of points
+    kdtree_.setInputCloud (voxel_centroids_);
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointT> void
+pcl::VoxelGridCovariance<PointT>::addPendingLeaf (int leaf_idx)
+{
+  if (leaf_search_indices_[leaf_idx] <= -2)
+    return;
+  leaf_search_indices_[leaf_idx] = -2 - static_cast<int> (pending_leaf_indices_.size ());
+  pending_leaf_indices_.push_back (leaf_idx);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointT> void
+pcl::VoxelGridCovariance<PointT>::removePendingLeaf (int leaf_idx)
+{
+  int search_idx = leaf_search_indices_[leaf_idx];
+  if (search_idx > -2)
+    return;
+
+  // Move the last pending leaf into the hole
+  int pending_idx = -2 - search_idx;
+  int last_leaf_idx = pending_leaf_indices_.back ();
+  pending_leaf_indices_[pending_idx] = last_leaf_idx;
+  leaf_search_indices_[last_leaf_idx] = search_idx;
+  pending_leaf_indices_.pop_back ();
+  leaf_search_indices_[leaf_idx] = -1;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointT> int
+pcl::VoxelGridCovariance<PointT>::nearestKSearch (const PointT &point, int k,
+                                                  std::vector<LeafConstPtr> &k_leaves, std::vector<float> &k_sqr_distances)
+{
+  k_leaves.clear ();
+  k_sqr_distances.clear ();
+
+  // Check if kdtree has been built
+  if (!searchable_)
+  {
+    PCL_WARN ("%s: Not Searchable", this->getClassName ().c_str ());
+    return 0;
+  }
+
+  std::vector<std::pair<float, int> > candidates;
+  std::vector<int> k_indices;
+  std::vector<float> distances;
+
+  // Find k-nearest neighbors in the occupied voxel centroid cloud, the masked entries do not count
+  if (!voxel_centroids_leaf_indices_.empty ())
+  {
+    int nr_search = static_cast<int> (std::min (k + stale_centroids_, voxel_centroids_leaf_indices_.size ()));
+    nr_search = kdtree_.nearestKSearch (point, nr_search, k_indices, distances);
+    for (int i = 0; i < nr_search; ++i)
+      if (voxel_centroids_leaf_indices_[k_indices[i]] >= 0)
+        candidates.push_back (std::make_pair (distances[i], voxel_centroids_leaf_indices_[k_indices[i]]));
+  }
+  if (!pending_leaf_indices_.empty ())
+  {
+    int nr_search = static_cast<int> (std::min (static_cast<size_t> (k), pending_leaf_indices_.size ()));
+    nr_search = pending_kdtree_.nearestKSearch (point, nr_search, k_indices, distances);
+    for (int i = 0; i < nr_search; ++i)
+      candidates.push_back (std::make_pair (distances[i], pending_leaf_indices_[k_indices[i]]));
+  }
+
+  // Find leaves corresponding to neighbors
+  std::sort (candidates.begin (), candidates.end ());
+  k = std::min (k, static_cast<int> (candidates.size ()));
+  k_leaves.reserve (k);
+  k_sqr_distances.reserve (k);
+  for (int i = 0; i < k; ++i)
+  {
+    k_leaves.push_back (&leaves_[candidates[i].second]);
+    k_sqr_distances.push_back (candidates[i].first);
+  }
+  return k;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointT> int
+pcl::VoxelGridCovariance<PointT>::radiusSearch (const PointT &point, double radius, std::vector<LeafConstPtr> &k_leaves,
+                                                std::vector<float> &k_sqr_distances, unsigned int max_nn)
+{
+  k_leaves.clear ();
+
+  // Check if kdtree has been built
+  if (!searchable_)
+  {
+    PCL_WARN ("%s: Not Searchable", this->getClassName ().c_str ());
+    return 0;
+  }
+
+  // Find neighbors within radius in the occupied voxel centroid cloud, skipping the masked entries
+  std::vector<int> k_indices;
+  int k = 0;
+  if (!voxel_centroids_leaf_indices_.empty ())
+    k = kdtree_.radiusSearch (point, radius, k_indices, k_sqr_distances, max_nn);
+  k_sqr_distances.resize (k);
+
+  // Find leaves corresponding to neighbors
+  k_leaves.reserve (k);
+  int nr_found = 0;
+  for (int i = 0; i < k; ++i)
+  {
+    int leaf_idx = voxel_centroids_leaf_indices_[k_indices[i]];
+    if (leaf_idx < 0)
+      continue;
+    k_leaves.push_back (&leaves_[leaf_idx]);
+    k_sqr_distances[nr_found++] = k_sqr_distances[i];
+  }
+  k_sqr_distances.resize (nr_found);
+
+  // Then in the voxels changed since the kdtree was built
+  if (!pending_leaf_indices_.empty () && (max_nn == 0 || nr_found < static_cast<int> (max_nn)))
+  {
+    std::vector<float> distances;
+    k = pending_kdtree_.radiusSearch (point, radius, k_indices, distances, max_nn == 0 ? 0 : max_nn - nr_found);
+    for (int i = 0; i < k; ++i)
+    {
+      k_leaves.push_back (&leaves_[pending_leaf_indices_[k_indices[i]]]);
+      k_sqr_distances.push_back (distances[i]);
+    }
+  }
+  return (static_cast<int> (k_leaves.size ()));
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////
@@ -393,18 +795,63 @@ pcl::VoxelGridCovariance<PointT>::getNeighborhoodAtPoint (const PointT& referenc
     // Checking if the specified cell is in the grid
     if ((diff2min <= displacement.array ()).all () && (diff2max >= displacement.array ()).all ())
     {
-      typename std::map<size_t, Leaf>::iterator leaf_iter = leaves_.find (((ijk + displacement - min_b_).dot (divb_mul_)));
-      if (leaf_iter != leaves_.end () && leaf_iter->second.nr_points >= min_points_per_voxel_)
-      {
-        LeafConstPtr leaf = &(leaf_iter->second);
+      LeafConstPtr leaf = findLeaf (ijk[0] + displacement[0], ijk[1] + displacement[1], ijk[2] + displacement[2]);
+      if (leaf != NULL && leaf->nr_points >= min_points_per_voxel_)
         neighbors.push_back (leaf);
-      }
     }
   }
 
   return (static_cast<int> (neighbors.size ()));
 }
 
+//////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointT> int
+pcl::VoxelGridCovariance<PointT>::directSearch (const PointT &point, NeighborSearchMethod method, std::vector<LeafConstPtr> &k_leaves) const
+{
+  // Center voxel first, then the 6 face neighbors, then the remaining 20 voxels of the 3x3x3 block
+  static const int offsets[27][3] = {
+    { 0,  0,  0},
+    { 1,  0,  0}, {-1,  0,  0}, { 0,  1,  0}, { 0, -1,  0}, { 0,  0,  1}, { 0,  0, -1},
+    { 1,  1,  0}, { 1, -1,  0}, {-1,  1,  0}, {-1, -1,  0},
+    { 1,  0,  1}, { 1,  0, -1}, {-1,  0,  1}, {-1,  0, -1},
+    { 0,  1,  1}, { 0,  1, -1}, { 0, -1,  1}, { 0, -1, -1},
+    { 1,  1,  1}, { 1,  1, -1}, { 1, -1,  1}, { 1, -1, -1},
+    {-1,  1,  1}, {-1,  1, -1}, {-1, -1,  1}, {-1, -1, -1}
+  };
+
+  k_leaves.clear ();
+
+  int num_offsets;
+  switch (method)
+  {
+    case DIRECT1:
+      num_offsets = 1;
+      break;
+    case DIRECT7:
+      num_offsets = 7;
+      break;
+    case DIRECT26:
+      num_offsets = 27;
+      break;
+    default:
+      PCL_WARN ("[pcl::%s::directSearch] Unsupported neighbor search method!\n", this->getClassName ().c_str ());
+      return 0;
+  }
+
+  int ijk0 = static_cast<int> (floor (point.x * inverse_leaf_size_[0]));
+  int ijk1 = static_cast<int> (floor (point.y * inverse_leaf_size_[1]));
+  int ijk2 = static_cast<int> (floor (point.z * inverse_leaf_size_[2]));
+
+  for (int ni = 0; ni < num_offsets; ni++)
+  {
+    LeafConstPtr leaf = findLeaf (ijk0 + offsets[ni][0], ijk1 + offsets[ni][1], ijk2 + offsets[ni][2]);
+    if (leaf != NULL && leaf->nr_points >= min_points_per_voxel_)
+      k_leaves.push_back (leaf);
+  }
+
+  return (static_cast<int> (k_leaves.size ()));
+}
+
 //////////////////////////////////////////////////////////////////////////////////////////
 template<typename PointT> void
 pcl::VoxelGridCovariance<PointT>::getDisplayCloud (pcl::PointCloud<PointXYZ>& cell_cloud)
@@ -423,9 +870,9 @@ pcl::VoxelGridCovariance<PointT>::getDisplayCloud (pcl::PointCloud<PointXYZ>& ce
   Eigen::Vector3d dist_point;
 
   // Generate points for each occupied voxel with sufficient points.
-  for (typename std::map<size_t, Leaf>::iterator it = leaves_.begin (); it != leaves_.end (); ++it)
+  for (typename std::vector<Leaf>::iterator it = leaves_.begin (); it != leaves_.end (); ++it)
   {
-    Leaf& leaf = it->second;
+    Leaf& leaf = *it;
 
     if (leaf.nr_points >= min_points_per_voxel_)
     {
@@ -44,11 +44,24 @@
 #include "fast_pcl/filters/voxel_grid.h"
 
 #include <map>
+#include <vector>
 #include <pcl/point_types.h>
 #include <pcl/kdtree/kdtree_flann.h>
 
 namespace pcl
 {
+  /** \brief Method used to find the voxels neighboring a query point.
+    * KDTREE performs a radius search on the voxel centroids, DIRECT1 returns only the voxel containing the point,
+    * DIRECT7 adds its 6 face neighbors and DIRECT26 returns the full 3x3x3 block around it.
+    */
+  enum NeighborSearchMethod
+  {
+    KDTREE,
+    DIRECT26,
+    DIRECT7,
+    DIRECT1
+  };
+
   /** \brief A searchable voxel strucure containing the mean and covariance of the data.
     * \note For more information please see
     * <b>Magnusson, M. (2009). The Three-Dimensional Normal-Distributions Transform —
@@ -105,7 +118,10 @@ namespace pcl
           cov_ (Eigen::Matrix3d::Identity ()),
           icov_ (Eigen::Matrix3d::Zero ()),
           evecs_ (Eigen::Matrix3d::Identity ()),
-          evals_ (Eigen::Vector3d::Zero ())
+          evals_ (Eigen::Vector3d::Zero ()),
+          pt_count_ (0),
+          pt_sum_ (Eigen::Vector3d::Zero ()),
+          pt_sq_sum_ (Eigen::Matrix3d::Identity ())
         {
         }
 
@@ -188,6 +204,15 @@ namespace pcl
         /** \brief Eigen values of voxel covariance matrix */
         Eigen::Vector3d evals_;
 
+        /** \brief Number of points accumulated in \ref pt_sum_ and \ref pt_sq_sum_ */
+        int pt_count_;
+
+        /** \brief Sum of the points contained by voxel (used for incremental updates) */
+        Eigen::Vector3d pt_sum_;
+
+        /** \brief Sum of x*xT of the points contained by voxel (used for incremental updates) */
+        Eigen::Matrix3d pt_sq_sum_;
+
       };
 
       /** \brief Pointer to VoxelGridCovariance leaf structure */
@@ -196,6 +221,163 @@ namespace pcl
       /** \brief Const pointer to VoxelGridCovariance leaf structure */
       typedef const Leaf* LeafConstPtr;
 
+      /** \brief Open addressing hash table mapping packed voxel coordinates to indices in \ref leaves_.
+        * Keys and values are stored in flat arrays and collisions are resolved by linear probing,
+        * so a lookup touches one or two cache lines instead of walking a tree.
+        */
+      class LeafIndexTable
+      {
+        public:
+          LeafIndexTable () : keys_ (), values_ (), mask_ (0), size_ (0) {}
+
+          /** \brief Remove all entries and reserve room for at least n of them. */
+          void
+          clear (size_t n = 0)
+          {
+            size_t capacity = 16;
+            while (capacity < 2 * n)
+              capacity <<= 1;
+            keys_.assign (capacity, emptyKey ());
+            values_.assign (capacity, -1);
+            mask_ = capacity - 1;
+            size_ = 0;
+          }
+
+          /** \brief Number of entries stored in the table. */
+          inline size_t
+          size () const
+          {
+            return (size_);
+          }
+
+          /** \brief Find the value stored for key.
+            * \return the stored value or -1 if key is not in the table
+            */
+          inline int
+          find (int64_t key) const
+          {
+            if (size_ == 0)
+              return (-1);
+            for (size_t slot = hash (key) & mask_; ; slot = (slot + 1) & mask_)
+            {
+              if (keys_[slot] == key)
+                return (values_[slot]);
+              if (keys_[slot] == emptyKey ())
+                return (-1);
+            }
+          }
+
+          /** \brief Find the value stored for key, inserting value if key is not in the table yet.
+            * \return the value stored for key after the call
+            */
+          int
+          insert (int64_t key, int value)
+          {
+            if (keys_.empty () || 2 * (size_ + 1) > keys_.size ())
+              rehash (keys_.empty () ? 16 : 2 * keys_.size ());
+
+            size_t slot = hash (key) & mask_;
+            while (keys_[slot] != emptyKey ())
+            {
+              if (keys_[slot] == key)
+                return (values_[slot]);
+              slot = (slot + 1) & mask_;
+            }
+            keys_[slot] = key;
+            values_[slot] = value;
+            ++size_;
+            return (value);
+          }
+
+          /** \brief Change the value stored for a key which is already in the table. */
+          void
+          assign (int64_t key, int value)
+          {
+            for (size_t slot = hash (key) & mask_; keys_[slot] != emptyKey (); slot = (slot + 1) & mask_)
+            {
+              if (keys_[slot] == key)
+              {
+                values_[slot] = value;
+                return;
+              }
+            }
+          }
+
+          /** \brief Remove key from the table.
+            * The following entries of the probe sequence are shifted back, so no tombstones are left behind.
+            */
+          void
+          erase (int64_t key)
+          {
+            if (size_ == 0)
+              return;
+
+            size_t slot = hash (key) & mask_;
+            while (keys_[slot] != key)
+            {
+              if (keys_[slot] == emptyKey ())
+                return;
+              slot = (slot + 1) & mask_;
+            }
+
+            size_t next = slot;
+            while (true)
+            {
+              next = (next + 1) & mask_;
+              if (keys_[next] == emptyKey ())
+                break;
+              // Move the entry back unless its home slot lies cyclically in (slot, next]
+              size_t home = hash (keys_[next]) & mask_;
+              if ((slot <= next) ? (slot < home && home <= next) : (slot < home || home <= next))
+                continue;
+              keys_[slot] = keys_[next];
+              values_[slot] = values_[next];
+              slot = next;
+            }
+            keys_[slot] = emptyKey ();
+            values_[slot] = -1;
+            --size_;
+          }
+
+        private:
+          /** \brief Marks unused slots, packed voxel keys are never negative. */
+          static inline int64_t
+          emptyKey ()
+          {
+            return (-1);
+          }
+
+          static inline size_t
+          hash (int64_t key)
+          {
+            uint64_t h = static_cast<uint64_t> (key) * 0x9E3779B97F4A7C15ULL;
+            return (static_cast<size_t> (h ^ (h >> 32)));
+          }
+
+          void
+          rehash (size_t capacity)
+          {
+            std::vector<int64_t> old_keys;
+            std::vector<int> old_values;
+            old_keys.swap (keys_);
+            old_values.swap (values_);
+
+            keys_.assign (capacity, emptyKey ());
+            values_.assign (capacity, -1);
+            mask_ = capacity - 1;
+            size_ = 0;
+
+            for (size_t i = 0; i < old_keys.size (); ++i)
+              if (old_keys[i] != emptyKey ())
+                insert (old_keys[i], old_values[i]);
+          }
+
+          std::vector<int64_t> keys_;
+          std::vector<int> values_;
+          size_t mask_;
+          size_t size_;
+      };
+
     public:
 
       /** \brief Constructor.
@@ -208,7 +390,14 @@ namespace pcl
         leaves_ (),
         voxel_centroids_ (),
         voxel_centroids_leaf_indices_ (),
-        kdtree_ ()
+        centroids_outdated_ (false),
+        leaf_keys_ (),
+        leaf_table_ (),
+        kdtree_ (),
+        leaf_search_indices_ (),
+        stale_centroids_ (0),
+        pending_leaf_indices_ (),
+        pending_kdtree_ ()
       {
         downsample_all_data_ = false;
         save_leaf_layout_ = false;
@@ -273,6 +462,7 @@ namespace pcl
         applyFilter (output);
 
         voxel_centroids_ = PointCloudPtr (new PointCloud (output));
+        centroids_outdated_ = false;
 
         if (searchable_ && voxel_centroids_->size() > 0)
         {
@@ -290,6 +480,7 @@ namespace pcl
         searchable_ = searchable;
         voxel_centroids_ = PointCloudPtr (new PointCloud);
         applyFilter (*voxel_centroids_);
+        centroids_outdated_ = false;
 
         if (searchable_ && voxel_centroids_->size() > 0)
         {
@@ -298,6 +489,20 @@ namespace pcl
         }
       }
 
+      /** \brief Update the voxel structure with points added to and removed from the input.
+       * Only the voxels touched by the given points are recomputed, voxels left without points are dropped.
+       * The kdtree entries of the touched voxels are masked and the voxels are put in a second, small kdtree
+       * which is searched as well. Both are merged into a new kdtree once the changed voxels reach a quarter
+       * of the kdtree, so the cost of an update stays proportional to the number of points given.
+       * \note The removed points must be the ones added before, the sums of their voxels are decremented.
+       * Only the x, y and z fields are used and the leaf layout is not maintained.
+       * \param[in] added points added to the voxel structure
+       * \param[in] removed points removed from the voxel structure
+       * \param[in] searchable flag if voxel structure is searchable, if true then the kdtrees are maintained
+       */
+      void
+      incrementalFilter (const PointCloud &added, const PointCloud &removed, bool searchable = false);
+
       /** \brief Get the voxel containing point p.
        * \param[in] index the index of the leaf structure node
        * \return const pointer to leaf structure
@@ -305,14 +510,15 @@ namespace pcl
       inline LeafConstPtr
       getLeaf (int index)
       {
-        typename std::map<size_t, Leaf>::iterator leaf_iter = leaves_.find (index);
-        if (leaf_iter != leaves_.end ())
-        {
-          LeafConstPtr ret (&(leaf_iter->second));
-          return ret;
-        }
-        else
+        if (index < 0 || div_b_[0] <= 0 || div_b_[1] <= 0)
           return NULL;
+
+        // Recover the voxel coordinates from the centroid leaf index
+        int ijk0 = index % div_b_[0] + min_b_[0];
+        int ijk1 = (index / div_b_[0]) % div_b_[1] + min_b_[1];
+        int ijk2 = index / (div_b_[0] * div_b_[1]) + min_b_[2];
+
+        return (findLeaf (ijk0, ijk1, ijk2));
       }
 
       /** \brief Get the voxel containing point p.
@@ -322,24 +528,9 @@ namespace pcl
       inline LeafConstPtr
       getLeaf (PointT &p)
       {
-        // Generate index associated with p
-        int ijk0 = static_cast<int> (floor (p.x * inverse_leaf_size_[0]) - min_b_[0]);
-        int ijk1 = static_cast<int> (floor (p.y * inverse_leaf_size_[1]) - min_b_[1]);
-        int ijk2 = static_cast<int> (floor (p.z * inverse_leaf_size_[2]) - min_b_[2]);
-
-        // Compute the centroid leaf index
-        int idx = ijk0 * divb_mul_[0] + ijk1 * divb_mul_[1] + ijk2 * divb_mul_[2];
-
-        // Find leaf associated with index
-        typename std::map<size_t, Leaf>::iterator leaf_iter = leaves_.find (idx);
-        if (leaf_iter != leaves_.end ())
-        {
-          // If such a leaf exists return the pointer to the leaf structure
-          LeafConstPtr ret (&(leaf_iter->second));
-          return ret;
-        }
-        else
-          return NULL;
+        return (findLeaf (static_cast<int> (floor (p.x * inverse_leaf_size_[0])),
+                          static_cast<int> (floor (p.y * inverse_leaf_size_[1])),
+                          static_cast<int> (floor (p.z * inverse_leaf_size_[2]))));
       }
 
       /** \brief Get the voxel containing point p.
@@ -349,25 +540,9 @@ namespace pcl
       inline LeafConstPtr
       getLeaf (Eigen::Vector3f &p)
       {
-        // Generate index associated with p
-        int ijk0 = static_cast<int> (floor (p[0] * inverse_leaf_size_[0]) - min_b_[0]);
-        int ijk1 = static_cast<int> (floor (p[1] * inverse_leaf_size_[1]) - min_b_[1]);
-        int ijk2 = static_cast<int> (floor (p[2] * inverse_leaf_size_[2]) - min_b_[2]);
-
-        // Compute the centroid leaf index
-        int idx = ijk0 * divb_mul_[0] + ijk1 * divb_mul_[1] + ijk2 * divb_mul_[2];
-
-        // Find leaf associated with index
-        typename std::map<size_t, Leaf>::iterator leaf_iter = leaves_.find (idx);
-        if (leaf_iter != leaves_.end ())
-        {
-          // If such a leaf exists return the pointer to the leaf structure
-          LeafConstPtr ret (&(leaf_iter->second));
-          return ret;
-        }
-        else
-          return NULL;
-
+        return (findLeaf (static_cast<int> (floor (p[0] * inverse_leaf_size_[0])),
+                          static_cast<int> (floor (p[1] * inverse_leaf_size_[1])),
+                          static_cast<int> (floor (p[2] * inverse_leaf_size_[2]))));
       }
 
       /** \brief Get the voxels surrounding point p, not including the voxel contating point p.
@@ -379,10 +554,20 @@ namespace pcl
       int
       getNeighborhoodAtPoint (const PointT& reference_point, std::vector<LeafConstPtr> &neighbors);
 
-      /** \brief Get the leaf structure map
-       * \return a map contataining all leaves
+      /** \brief Get the voxels around point p by direct lookup of the neighboring voxel coordinates.
+       * \note Only voxels containing a sufficient number of points are used. Does not require the kdtree.
+       * \param[in] point the given query point
+       * \param[in] method which neighborhood to look up (DIRECT1, DIRECT7 or DIRECT26)
+       * \param[out] k_leaves the resultant leaves
+       * \return number of neighbors found
+       */
+      int
+      directSearch (const PointT &point, NeighborSearchMethod method, std::vector<LeafConstPtr> &k_leaves) const;
+
+      /** \brief Get the leaf structures
+       * \return a vector contataining all leaves
        */
-      inline const std::map<size_t, Leaf>&
+      inline const std::vector<Leaf>&
       getLeaves ()
       {
         return leaves_;
@@ -390,11 +575,14 @@ namespace pcl
 
       /** \brief Get a pointcloud containing the voxel centroids
        * \note Only voxels containing a sufficient number of points are used.
+       * After \ref incrementalFilter the cloud is rebuilt on the first call.
        * \return a map contataining all leaves
        */
       inline PointCloudPtr
       getCentroids ()
       {
+        if (centroids_outdated_)
+          voxel_centroids_ = buildCentroids (NULL);
         return voxel_centroids_;
       }
 
@@ -415,29 +603,7 @@ namespace pcl
        */
       int
       nearestKSearch (const PointT &point, int k,
-                      std::vector<LeafConstPtr> &k_leaves, std::vector<float> &k_sqr_distances)
-      {
-        k_leaves.clear ();
-
-        // Check if kdtree has been built
-        if (!searchable_)
-        {
-          PCL_WARN ("%s: Not Searchable", this->getClassName ().c_str ());
-          return 0;
-        }
-
-        // Find k-nearest neighbors in the occupied voxel centroid cloud
-        std::vector<int> k_indices;
-        k = kdtree_.nearestKSearch (point, k, k_indices, k_sqr_distances);
-
-        // Find leaves corresponding to neighbors
-        k_leaves.reserve (k);
-        for (std::vector<int>::iterator iter = k_indices.begin (); iter != k_indices.end (); iter++)
-        {
-          k_leaves.push_back (&leaves_[voxel_centroids_leaf_indices_[*iter]]);
-        }
-        return k;
-      }
+                      std::vector<LeafConstPtr> &k_leaves, std::vector<float> &k_sqr_distances);
 
       /** \brief Search for the k-nearest occupied voxels for the given query point.
        * \note Only voxels containing a sufficient number of points are used.
@@ -469,29 +635,7 @@ namespace pcl
        */
       int
       radiusSearch (const PointT &point, double radius, std::vector<LeafConstPtr> &k_leaves,
-                    std::vector<float> &k_sqr_distances, unsigned int max_nn = 0)
-      {
-        k_leaves.clear ();
-
-        // Check if kdtree has been built
-        if (!searchable_)
-        {
-          PCL_WARN ("%s: Not Searchable", this->getClassName ().c_str ());
-          return 0;
-        }
-
-        // Find neighbors within radius in the occupied voxel centroid cloud
-        std::vector<int> k_indices;
-        int k = kdtree_.radiusSearch (point, radius, k_indices, k_sqr_distances, max_nn);
-
-        // Find leaves corresponding to neighbors
-        k_leaves.reserve (k);
-        for (std::vector<int>::iterator iter = k_indices.begin (); iter != k_indices.end (); iter++)
-        {
-          k_leaves.push_back (&leaves_[voxel_centroids_leaf_indices_[*iter]]);
-        }
-        return k;
-      }
+                    std::vector<float> &k_sqr_distances, unsigned int max_nn = 0);
 
       /** \brief Search for all the nearest occupied voxels of the query point in a given radius.
        * \note Only voxels containing a sufficient number of points are used.
@@ -520,6 +664,68 @@ namespace pcl
        */
       void applyFilter (PointCloud &output);
 
+      /** \brief Pack absolute voxel coordinates into a single hash key (21 bits per axis). */
+      static inline int64_t
+      getLeafKey (int ijk0, int ijk1, int ijk2)
+      {
+        return ((static_cast<int64_t> (ijk0 + (1 << 20)) & 0x1FFFFF) << 42 |
+                (static_cast<int64_t> (ijk1 + (1 << 20)) & 0x1FFFFF) << 21 |
+                (static_cast<int64_t> (ijk2 + (1 << 20)) & 0x1FFFFF));
+      }
+
+      /** \brief Unpack absolute voxel coordinates from a hash key generated by \ref getLeafKey. */
+      static inline void
+      getLeafCoordinates (int64_t key, int &ijk0, int &ijk1, int &ijk2)
+      {
+        ijk0 = static_cast<int> ((key >> 42) & 0x1FFFFF) - (1 << 20);
+        ijk1 = static_cast<int> ((key >> 21) & 0x1FFFFF) - (1 << 20);
+        ijk2 = static_cast<int> (key & 0x1FFFFF) - (1 << 20);
+      }
+
+      /** \brief Compute mean, covariance and inverse covariance of a leaf from its accumulated point sums. */
+      void
+      computeLeafDistribution (Leaf &leaf);
+
+      /** \brief Add (sign > 0) or subtract (sign < 0) the points of cloud to the sums of their voxels.
+       * \param[in] cloud the points
+       * \param[in] sign whether the points are added or removed
+       * \param[in,out] touched indices of the leaves touched so far
+       * \param[in,out] touched_flags per leaf flag set for the leaves in touched
+       */
+      void
+      accumulatePoints (const PointCloud &cloud, int sign, std::vector<int> &touched, std::vector<char> &touched_flags);
+
+      /** \brief Build a cloud of the centroids of the voxels containing a sufficient number of points.
+       * \param[out] leaf_indices if not NULL, the index in \ref leaves_ of each centroid
+       * \return the centroid cloud
+       */
+      PointCloudPtr
+      buildCentroids (std::vector<int> *leaf_indices) const;
+
+      /** \brief Rebuild \ref kdtree_ from all the searchable voxels and empty the pending voxels. */
+      void
+      rebuildSearchTree ();
+
+      /** \brief Put a voxel in the pending voxels (searched through \ref pending_kdtree_) unless it is already there. */
+      void
+      addPendingLeaf (int leaf_idx);
+
+      /** \brief Take a voxel out of the pending voxels if it is there. */
+      void
+      removePendingLeaf (int leaf_idx);
+
+      /** \brief Get the leaf at absolute voxel coordinates.
+       * \return const pointer to leaf structure or NULL if the voxel is empty
+       */
+      inline LeafConstPtr
+      findLeaf (int ijk0, int ijk1, int ijk2) const
+      {
+        int leaf_idx = leaf_table_.find (getLeafKey (ijk0, ijk1, ijk2));
+        if (leaf_idx < 0)
+          return NULL;
+        return (&leaves_[leaf_idx]);
+      }
+
       /** \brief Flag to determine if voxel structure is searchable. */
       bool searchable_;
 
@@ -530,16 +736,39 @@ namespace pcl
       double min_covar_eigvalue_mult_;
 
       /** \brief Voxel structure containing all leaf nodes (includes voxels with less than a sufficient number of points). */
-      std::map<size_t, Leaf> leaves_;
+      std::vector<Leaf> leaves_;
 
       /** \brief Point cloud containing centroids of voxels containing atleast minimum number of points. */
       PointCloudPtr voxel_centroids_;
 
-      /** \brief Indices of leaf structurs associated with each point in \ref voxel_centroids_ (used for searching). */
+      /** \brief Indices of leaf structurs associated with each point of \ref kdtree_ (used for searching).
+        * Entries of voxels changed by \ref incrementalFilter are set to -1. */
       std::vector<int> voxel_centroids_leaf_indices_;
 
+      /** \brief Whether \ref voxel_centroids_ must be rebuilt before it is returned by \ref getCentroids. */
+      bool centroids_outdated_;
+
+      /** \brief Hash keys of the voxel coordinates of each leaf in \ref leaves_. */
+      std::vector<int64_t> leaf_keys_;
+
+      /** \brief Hash of voxel coordinates to indices in \ref leaves_ (used for direct lookup). */
+      LeafIndexTable leaf_table_;
+
       /** \brief KdTree generated using \ref voxel_centroids_ (used for searching). */
       KdTreeFLANN<PointT> kdtree_;
+
+      /** \brief Where each leaf is searched: its index in \ref kdtree_ if >= 0, not searched if -1,
+        * or at index -2 - value in \ref pending_leaf_indices_. */
+      std::vector<int> leaf_search_indices_;
+
+      /** \brief Number of entries of \ref kdtree_ masked by \ref incrementalFilter. */
+      size_t stale_centroids_;
+
+      /** \brief Searchable leaves changed by \ref incrementalFilter since \ref kdtree_ was built. */
+      std::vector<int> pending_leaf_indices_;
+
+      /** \brief KdTree of the centroids of \ref pending_leaf_indices_. */
+      KdTreeFLANN<PointT> pending_kdtree_;
   };
 }
 
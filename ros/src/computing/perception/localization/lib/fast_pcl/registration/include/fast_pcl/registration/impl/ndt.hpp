@@ -45,6 +45,11 @@
 template<typename PointSource, typename PointTarget>
 pcl::NormalDistributionsTransform<PointSource, PointTarget>::NormalDistributionsTransform ()
   : target_cells_ ()
+  , search_method_ (KDTREE)
+  , target_blocks_ ()
+  , block_target_ ()
+  , block_target_outdated_ (false)
+  , block_trees_ ()
   , resolution_ (1.0f)
   , step_size_ (0.1)
   , outlier_ratio_ (0.55)
@@ -72,6 +77,283 @@ pcl::NormalDistributionsTransform<PointSource, PointTarget>::NormalDistributions
   max_iterations_ = 35;
 }
 
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointSource, typename PointTarget> void
+pcl::NormalDistributionsTransform<PointSource, PointTarget>::addTargetBlock (int block_id, const PointCloudTargetConstPtr &cloud)
+{
+  updateTargetBlocks (std::vector<std::pair<int, PointCloudTargetConstPtr> > (1, std::make_pair (block_id, cloud)), std::vector<int> ());
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointSource, typename PointTarget> void
+pcl::NormalDistributionsTransform<PointSource, PointTarget>::addTargetBlocks (const std::vector<std::pair<int, PointCloudTargetConstPtr> > &blocks)
+{
+  updateTargetBlocks (blocks, std::vector<int> ());
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointSource, typename PointTarget> void
+pcl::NormalDistributionsTransform<PointSource, PointTarget>::removeTargetBlock (int block_id)
+{
+  updateTargetBlocks (std::vector<std::pair<int, PointCloudTargetConstPtr> > (), std::vector<int> (1, block_id));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointSource, typename PointTarget> void
+pcl::NormalDistributionsTransform<PointSource, PointTarget>::removeTargetBlocks (const std::vector<int> &block_ids)
+{
+  updateTargetBlocks (std::vector<std::pair<int, PointCloudTargetConstPtr> > (), block_ids);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointSource, typename PointTarget> void
+pcl::NormalDistributionsTransform<PointSource, PointTarget>::updateTargetBlocks (
+    const std::vector<std::pair<int, PointCloudTargetConstPtr> > &added, const std::vector<int> &removed_ids)
+{
+  PointCloudTarget added_points, removed_points;
+
+  if (target_blocks_.empty () && !added.empty ())
+  {
+    // Start from an empty voxel structure, a target given by setInputTarget is subtracted
+    target_cells_.setLeafSize (resolution_, resolution_, resolution_);
+    if (target_)
+      removed_points.points.insert (removed_points.points.end (), target_->points.begin (), target_->points.end ());
+    block_trees_.clear ();
+  }
+
+  for (size_t i = 0; i < removed_ids.size (); ++i)
+  {
+    typename std::map<int, PointCloudTargetConstPtr>::iterator block_it = target_blocks_.find (removed_ids[i]);
+    if (block_it == target_blocks_.end ())
+      continue;
+    removed_points.points.insert (removed_points.points.end (), block_it->second->points.begin (), block_it->second->points.end ());
+    target_blocks_.erase (block_it);
+    removeFromBlockTrees (removed_ids[i]);
+  }
+
+  std::vector<int> added_ids;
+  for (size_t i = 0; i < added.size (); ++i)
+  {
+    // A replaced block takes its old points out
+    typename std::map<int, PointCloudTargetConstPtr>::iterator block_it = target_blocks_.find (added[i].first);
+    if (block_it != target_blocks_.end ())
+    {
+      removed_points.points.insert (removed_points.points.end (), block_it->second->points.begin (), block_it->second->points.end ());
+      removeFromBlockTrees (added[i].first);
+    }
+    if (std::find (added_ids.begin (), added_ids.end (), added[i].first) == added_ids.end ())
+      added_ids.push_back (added[i].first);
+    added_points.points.insert (added_points.points.end (), added[i].second->points.begin (), added[i].second->points.end ());
+    target_blocks_[added[i].first] = added[i].second;
+  }
+  if (!added_ids.empty ())
+    addBlockTree (added_ids);
+
+  if (added_points.points.empty () && removed_points.points.empty ())
+    return;
+  added_points.width = static_cast<uint32_t> (added_points.points.size ());
+  added_points.height = 1;
+  removed_points.width = static_cast<uint32_t> (removed_points.points.size ());
+  removed_points.height = 1;
+
+  // Recompute the voxels touched by the old and new points of all the blocks
+  target_cells_.incrementalFilter (added_points, removed_points, search_method_ == KDTREE);
+
+  if (target_blocks_.empty ())
+  {
+    target_.reset ();
+    block_target_.reset ();
+    block_target_outdated_ = false;
+    block_trees_.clear ();
+    return;
+  }
+
+  // The target is set directly rather than through Registration::setInputTarget, so that align does not rebuild the
+  // kdtree of the whole target. It is only filled in when asked for, the fitness score searches block_trees_.
+  if (!block_target_)
+    block_target_.reset (new PointCloudTarget);
+  target_ = block_target_;
+  target_cloud_updated_ = false;
+  block_target_outdated_ = true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointSource, typename PointTarget> void
+pcl::NormalDistributionsTransform<PointSource, PointTarget>::updateTargetFromBlocks ()
+{
+  if (!block_target_outdated_)
+    return;
+  block_target_outdated_ = false;
+
+  size_t nr_points = 0;
+  for (typename std::map<int, PointCloudTargetConstPtr>::const_iterator block_it = target_blocks_.begin (); block_it != target_blocks_.end (); ++block_it)
+    nr_points += block_it->second->points.size ();
+
+  block_target_->points.clear ();
+  block_target_->points.reserve (nr_points);
+  for (typename std::map<int, PointCloudTargetConstPtr>::const_iterator block_it = target_blocks_.begin (); block_it != target_blocks_.end (); ++block_it)
+    block_target_->points.insert (block_target_->points.end (), block_it->second->points.begin (), block_it->second->points.end ());
+  block_target_->width = static_cast<uint32_t> (block_target_->points.size ());
+  block_target_->height = 1;
+  block_target_->is_dense = false;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointSource, typename PointTarget> typename pcl::NormalDistributionsTransform<PointSource, PointTarget>::BlockTree
+pcl::NormalDistributionsTransform<PointSource, PointTarget>::buildBlockTree (const std::vector<int> &block_ids) const
+{
+  BlockTree block_tree;
+  block_tree.cloud.reset (new PointCloudTarget);
+  block_tree.nr_removed = 0;
+
+  for (size_t i = 0; i < block_ids.size (); ++i)
+  {
+    const PointCloudTarget &block = *target_blocks_.find (block_ids[i])->second;
+    int begin = static_cast<int> (block_tree.cloud->points.size ());
+    block_tree.cloud->points.insert (block_tree.cloud->points.end (), block.points.begin (), block.points.end ());
+    block_tree.ranges[block_ids[i]] = std::make_pair (begin, static_cast<int> (block_tree.cloud->points.size ()));
+  }
+  block_tree.cloud->width = static_cast<uint32_t> (block_tree.cloud->points.size ());
+  block_tree.cloud->height = 1;
+  block_tree.cloud->is_dense = false;
+  block_tree.removed.assign (block_tree.cloud->points.size (), 0);
+
+  if (!block_tree.cloud->points.empty ())
+  {
+    block_tree.tree.reset (new KdTree);
+    block_tree.tree->setInputCloud (block_tree.cloud);
+  }
+  return (block_tree);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointSource, typename PointTarget> void
+pcl::NormalDistributionsTransform<PointSource, PointTarget>::addBlockTree (const std::vector<int> &block_ids)
+{
+  block_trees_.push_back (buildBlockTree (block_ids));
+
+  while (block_trees_.size () >= 2)
+  {
+    const BlockTree &last = block_trees_[block_trees_.size () - 1];
+    const BlockTree &prev = block_trees_[block_trees_.size () - 2];
+    if (prev.cloud->points.size () - prev.nr_removed > 2 * (last.cloud->points.size () - last.nr_removed))
+      break;
+
+    std::vector<int> merged_ids;
+    for (typename std::map<int, std::pair<int, int> >::const_iterator it = prev.ranges.begin (); it != prev.ranges.end (); ++it)
+      merged_ids.push_back (it->first);
+    for (typename std::map<int, std::pair<int, int> >::const_iterator it = last.ranges.begin (); it != last.ranges.end (); ++it)
+      merged_ids.push_back (it->first);
+    BlockTree merged = buildBlockTree (merged_ids);
+    block_trees_.pop_back ();
+    block_trees_.back () = merged;
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointSource, typename PointTarget> void
+pcl::NormalDistributionsTransform<PointSource, PointTarget>::removeFromBlockTrees (int block_id)
+{
+  for (size_t i = 0; i < block_trees_.size (); ++i)
+  {
+    BlockTree &block_tree = block_trees_[i];
+    typename std::map<int, std::pair<int, int> >::iterator range_it = block_tree.ranges.find (block_id);
+    if (range_it == block_tree.ranges.end ())
+      continue;
+
+    std::fill (block_tree.removed.begin () + range_it->second.first, block_tree.removed.begin () + range_it->second.second, 1);
+    block_tree.nr_removed += range_it->second.second - range_it->second.first;
+    block_tree.ranges.erase (range_it);
+
+    if (block_tree.ranges.empty ())
+    {
+      block_trees_.erase (block_trees_.begin () + i);
+    }
+    else if (2 * block_tree.nr_removed > block_tree.cloud->points.size ())
+    {
+      std::vector<int> kept_ids;
+      for (typename std::map<int, std::pair<int, int> >::const_iterator it = block_tree.ranges.begin (); it != block_tree.ranges.end (); ++it)
+        kept_ids.push_back (it->first);
+      block_tree = buildBlockTree (kept_ids);
+    }
+    return;
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointSource, typename PointTarget> bool
+pcl::NormalDistributionsTransform<PointSource, PointTarget>::nearestBlockPoint (const PointTarget &point, float &sqr_distance) const
+{
+  bool found = false;
+  std::vector<int> k_indices;
+  std::vector<float> k_sqr_distances;
+
+  for (size_t i = 0; i < block_trees_.size (); ++i)
+  {
+    const BlockTree &block_tree = block_trees_[i];
+    int nr_points = static_cast<int> (block_tree.cloud->points.size ());
+    if (!block_tree.tree || block_tree.nr_removed == block_tree.cloud->points.size ())
+      continue;
+
+    // Widen the search until a point of a block still in the target is found, at most half of the points are masked
+    for (int k = 1; ; k = std::min (2 * k, nr_points))
+    {
+      int nr_found = block_tree.tree->nearestKSearch (point, k, k_indices, k_sqr_distances);
+      if (nr_found == 0 || (found && k_sqr_distances[0] >= sqr_distance))
+        break;
+
+      int j = 0;
+      while (j < nr_found && block_tree.removed[k_indices[j]])
+        ++j;
+      if (j < nr_found)
+      {
+        if (!found || k_sqr_distances[j] < sqr_distance)
+          sqr_distance = k_sqr_distances[j];
+        found = true;
+        break;
+      }
+      if (nr_found < k || k == nr_points)
+        break;
+    }
+  }
+  return (found);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointSource, typename PointTarget> double
+pcl::NormalDistributionsTransform<PointSource, PointTarget>::getBlockFitnessScore (double max_range, bool use_openmp) const
+{
+  double fitness_score = 0.0;
+  int nr = 0;
+  int nr_points = static_cast<int> (input_->points.size ());
+
+  // For each point in the source dataset, transformed by the final transformation
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+:fitness_score, nr) if (use_openmp)
+#endif
+  for (int i = 0; i < nr_points; ++i)
+  {
+    const PointSource &src = input_->points[i];
+    PointTarget point;
+    point.x = final_transformation_ (0, 0) * src.x + final_transformation_ (0, 1) * src.y + final_transformation_ (0, 2) * src.z + final_transformation_ (0, 3);
+    point.y = final_transformation_ (1, 0) * src.x + final_transformation_ (1, 1) * src.y + final_transformation_ (1, 2) * src.z + final_transformation_ (1, 3);
+    point.z = final_transformation_ (2, 0) * src.x + final_transformation_ (2, 1) * src.y + final_transformation_ (2, 2) * src.z + final_transformation_ (2, 3);
+
+    // Find its nearest neighbor in the target, and deal with occlusions (incomplete targets)
+    float sqr_distance;
+    if (nearestBlockPoint (point, sqr_distance) && sqr_distance <= max_range)
+    {
+      fitness_score += sqr_distance;
+      nr++;
+    }
+  }
+
+  if (nr > 0)
+    return (fitness_score / nr);
+  else
+    return (std::numeric_limits<double>::max ());
+}
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 template<typename PointSource, typename PointTarget> void
 pcl::NormalDistributionsTransform<PointSource, PointTarget>::computeTransformation (PointCloudSource &output, const Eigen::Matrix4f &guess)
@@ -154,7 +436,10 @@ pcl::NormalDistributionsTransform<PointSource, PointTarget>::computeTransformati
 
     // Update Visualizer (untested)
     if (update_visualizer_ != 0)
+    {
+      updateTargetFromBlocks ();
       update_visualizer_ (output, std::vector<int>(), *target_, std::vector<int>() );
+    }
 
     if (nr_iterations_ > max_iterations_ ||
         (nr_iterations_ && (std::fabs (delta_p_norm) < transformation_epsilon_)))
@@ -253,7 +538,10 @@ pcl::NormalDistributionsTransform<PointSource, PointTarget>::omp_computeTransfor
 
     // Update Visualizer (untested)
     if (update_visualizer_ != 0)
+    {
+      updateTargetFromBlocks ();
       update_visualizer_ (output, std::vector<int>(), *target_, std::vector<int>() );
+    }
 
     if (nr_iterations_ > max_iterations_ ||
         (nr_iterations_ && (std::fabs (delta_p_norm) < transformation_epsilon_)))
@@ -299,10 +587,9 @@ pcl::NormalDistributionsTransform<PointSource, PointTarget>::computeDerivatives
   {
     x_trans_pt = trans_cloud.points[idx];
 
-    // Find nieghbors (Radius search has been experimentally faster than direct neighbor checking.
+    // Find nieghbors (radius search on the centroid kdtree or direct lookup of the neighboring voxels)
     std::vector<TargetGridLeafConstPtr> neighborhood;
-    std::vector<float> distances;
-    target_cells_.radiusSearch (x_trans_pt, resolution_, neighborhood, distances);
+    findNeighborhood (x_trans_pt, neighborhood);
 
     for (typename std::vector<TargetGridLeafConstPtr>::iterator neighborhood_it = neighborhood.begin (); neighborhood_it != neighborhood.end (); neighborhood_it++)
     {
@@ -371,10 +658,9 @@ pcl::NormalDistributionsTransform<PointSource, PointTarget>::omp_computeDerivati
   {
     x_trans_pt = trans_cloud.points[idx];
 
-    // Find nieghbors (Radius search has been experimentally faster than direct neighbor checking.
+    // Find nieghbors (radius search on the centroid kdtree or direct lookup of the neighboring voxels)
     std::vector<TargetGridLeafConstPtr> neighborhood;
-    std::vector<float> distances;
-    target_cells_.radiusSearch (x_trans_pt, resolution_, neighborhood, distances);
+    findNeighborhood (x_trans_pt, neighborhood);
 
     for (typename std::vector<TargetGridLeafConstPtr>::iterator neighborhood_it = neighborhood.begin (); neighborhood_it != neighborhood.end (); neighborhood_it++)
     {
@@ -640,10 +926,9 @@ pcl::NormalDistributionsTransform<PointSource, PointTarget>::computeHessian (Eig
   {
     x_trans_pt = trans_cloud.points[idx];
 
-    // Find nieghbors (Radius search has been experimentally faster than direct neighbor checking.
+    // Find nieghbors (radius search on the centroid kdtree or direct lookup of the neighboring voxels)
     std::vector<TargetGridLeafConstPtr> neighborhood;
-    std::vector<float> distances;
-    target_cells_.radiusSearch (x_trans_pt, resolution_, neighborhood, distances);
+    findNeighborhood (x_trans_pt, neighborhood);
 
     for (typename std::vector<TargetGridLeafConstPtr>::iterator neighborhood_it = neighborhood.begin (); neighborhood_it != neighborhood.end (); neighborhood_it++)
     {
@@ -48,6 +48,12 @@
 
 #include <unsupported/Eigen/NonLinearOptimization>
 
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <utility>
+#include <vector>
+
 namespace pcl
 {
   /** \brief A 3D Normal Distribution Transform registration implementation for point cloud data.
@@ -77,6 +83,9 @@ namespace pcl
       typedef PointIndices::Ptr PointIndicesPtr;
       typedef PointIndices::ConstPtr PointIndicesConstPtr;
 
+      typedef typename Registration<PointSource, PointTarget>::KdTree KdTree;
+      typedef typename Registration<PointSource, PointTarget>::KdTreePtr KdTreePtr;
+
       /** \brief Typename of searchable voxel grid containing mean and covariance. */
       typedef VoxelGridCovariance<PointTarget> TargetGrid;
       /** \brief Typename of pointer to searchable voxel grid. */
@@ -107,10 +116,94 @@ namespace pcl
       inline void
       setInputTarget (const PointCloudTargetConstPtr &cloud)
       {
+        target_blocks_.clear ();
+        block_target_.reset ();
+        block_target_outdated_ = false;
+        block_trees_.clear ();
         Registration<PointSource, PointTarget>::setInputTarget (cloud);
         init ();
       }
 
+      /** \brief Get a pointer to the input point cloud dataset target.
+        * \note When the target is made of blocks, their concatenation is built by this call if they changed.
+        */
+      inline PointCloudTargetConstPtr const
+      getInputTarget ()
+      {
+        updateTargetFromBlocks ();
+        return (target_);
+      }
+
+      using Registration<PointSource, PointTarget>::getFitnessScore;
+
+      /** \brief Obtain the Euclidean fitness score (e.g., sum of squared distances from the source to the target)
+        * \note When the target is made of blocks, the correspondences are searched in \ref block_trees_.
+        * \param[in] max_range maximum allowable distance between a point and its correspondence in the target
+        */
+      inline double
+      getFitnessScore (double max_range = std::numeric_limits<double>::max ())
+      {
+        if (!target_blocks_.empty ())
+          return (getBlockFitnessScore (max_range, false));
+        return (Registration<PointSource, PointTarget>::getFitnessScore (max_range));
+      }
+
+      /** \brief OpenMP version of \ref getFitnessScore. */
+      inline double
+      omp_getFitnessScore (double max_range = std::numeric_limits<double>::max ())
+      {
+        if (!target_blocks_.empty ())
+          return (getBlockFitnessScore (max_range, true));
+        return (Registration<PointSource, PointTarget>::omp_getFitnessScore (max_range));
+      }
+
+      /** \brief Add a block of the target (e.g. a map tile), replacing the block previously added with the same id.
+        * Only the voxels touched by the old and new points of the block are recomputed, the rest of the target is kept.
+        * \note Blocks are an alternative to \ref setInputTarget, the first block drops a target given by setInputTarget
+        * and setInputTarget drops all blocks.
+        * \param[in] block_id id of the block
+        * \param[in] cloud the points of the block
+        */
+      void
+      addTargetBlock (int block_id, const PointCloudTargetConstPtr &cloud);
+
+      /** \brief Add or replace several blocks of the target at once, the touched voxels are only recomputed once.
+        * \param[in] blocks ids and points of the blocks
+        */
+      void
+      addTargetBlocks (const std::vector<std::pair<int, PointCloudTargetConstPtr> > &blocks);
+
+      /** \brief Remove a block of the target added by \ref addTargetBlock.
+        * \param[in] block_id id of the block
+        */
+      void
+      removeTargetBlock (int block_id);
+
+      /** \brief Remove several blocks of the target at once, the touched voxels are only recomputed once.
+        * \param[in] block_ids ids of the blocks
+        */
+      void
+      removeTargetBlocks (const std::vector<int> &block_ids);
+
+      /** \brief Add, replace and remove blocks of the target in one step. The voxels touched by all the blocks are
+        * recomputed once. The concatenated target cloud is only built when it is asked for by \ref getInputTarget.
+        * \param[in] added ids and points of the blocks to add or replace
+        * \param[in] removed_ids ids of the blocks to remove
+        */
+      void
+      updateTargetBlocks (const std::vector<std::pair<int, PointCloudTargetConstPtr> > &added,
+                          const std::vector<int> &removed_ids);
+
+      /** \brief Check whether a block of the target is present.
+        * \param[in] block_id id of the block
+        * \return true if the block was added and not removed since
+        */
+      inline bool
+      hasTargetBlock (int block_id) const
+      {
+        return (target_blocks_.find (block_id) != target_blocks_.end ());
+      }
+
       /** \brief Set/change the voxel grid resolution.
         * \param[in] resolution side length of voxels
         */
@@ -126,6 +219,30 @@ namespace pcl
         }
       }
 
+      /** \brief Set/change the method used to find the target voxels around each transformed source point.
+        * \param[in] method KDTREE for a radius search on the voxel centroids, DIRECT1, DIRECT7 or DIRECT26 for direct voxel lookup
+        */
+      inline void
+      setNeighborhoodSearchMethod (NeighborSearchMethod method)
+      {
+        if (search_method_ != method)
+        {
+          search_method_ = method;
+          // The centroid kdtree is only built when it is going to be searched
+          if (target_)
+            init ();
+        }
+      }
+
+      /** \brief Get the method used to find the target voxels around each transformed source point.
+        * \return neighbor search method
+        */
+      inline NeighborSearchMethod
+      getNeighborhoodSearchMethod () const
+      {
+        return (search_method_);
+      }
+
       /** \brief Get voxel grid resolution.
         * \return side length of voxels
         */
@@ -221,6 +338,8 @@ namespace pcl
       using Registration<PointSource, PointTarget>::input_;
       using Registration<PointSource, PointTarget>::indices_;
       using Registration<PointSource, PointTarget>::target_;
+      using Registration<PointSource, PointTarget>::tree_;
+      using Registration<PointSource, PointTarget>::target_cloud_updated_;
       using Registration<PointSource, PointTarget>::nr_iterations_;
       using Registration<PointSource, PointTarget>::max_iterations_;
       using Registration<PointSource, PointTarget>::previous_transformation_;
@@ -256,10 +375,87 @@ namespace pcl
       void inline
       init ()
       {
+        updateTargetFromBlocks ();
         target_cells_.setLeafSize (resolution_, resolution_, resolution_);
         target_cells_.setInputCloud ( target_ );
-        // Initiate voxel structure.
-        target_cells_.filter (true);
+        // Initiate voxel structure, the kdtree is not needed for direct neighbor search.
+        target_cells_.filter (search_method_ == KDTREE);
+      }
+
+      /** \brief If the target blocks changed, set the target cloud to their concatenation.
+        * \note The voxel structure and \ref block_trees_ are updated by \ref updateTargetBlocks, this is only needed
+        * by \ref getInputTarget and the visualizer.
+        */
+      void
+      updateTargetFromBlocks ();
+
+      /** \brief A kdtree over the points of some of the target blocks. */
+      struct BlockTree
+      {
+        /** \brief The points of the blocks, concatenated. */
+        PointCloudTargetPtr cloud;
+
+        /** \brief The kdtree of \ref cloud, null when it has no points. */
+        KdTreePtr tree;
+
+        /** \brief The points of \ref cloud of each block still in the target. */
+        std::map<int, std::pair<int, int> > ranges;
+
+        /** \brief Whether each point of \ref cloud belongs to a block removed since the kdtree was built. */
+        std::vector<char> removed;
+
+        /** \brief The number of removed points. */
+        size_t nr_removed;
+      };
+
+      /** \brief Build a kdtree over the points of target blocks.
+        * \param[in] block_ids ids of blocks in \ref target_blocks_
+        */
+      BlockTree
+      buildBlockTree (const std::vector<int> &block_ids) const;
+
+      /** \brief Add a kdtree over new target blocks to \ref block_trees_, then merge the last trees while the one
+        * before the last is at most twice as large.
+        * \param[in] block_ids ids of blocks in \ref target_blocks_
+        */
+      void
+      addBlockTree (const std::vector<int> &block_ids);
+
+      /** \brief Mask the points of a block in \ref block_trees_. A kdtree is rebuilt once half of its points are masked.
+        * \param[in] block_id id of the block
+        */
+      void
+      removeFromBlockTrees (int block_id);
+
+      /** \brief Find the nearest point of the target blocks.
+        * \param[in] point the query point
+        * \param[out] sqr_distance squared distance to the nearest point
+        * \return false if the target blocks have no points
+        */
+      bool
+      nearestBlockPoint (const PointTarget &point, float &sqr_distance) const;
+
+      /** \brief \ref getFitnessScore of a target made of blocks.
+        * \param[in] max_range maximum allowable distance between a point and its correspondence in the target
+        * \param[in] use_openmp whether the source points are searched in parallel
+        */
+      double
+      getBlockFitnessScore (double max_range, bool use_openmp) const;
+
+      /** \brief Find the occupied target voxels around a transformed source point.
+        * \param[in] x_trans_pt transformed source point
+        * \param[out] neighborhood the resultant leaves
+        * \return number of neighbors found
+        */
+      inline int
+      findNeighborhood (const PointSource &x_trans_pt, std::vector<TargetGridLeafConstPtr> &neighborhood)
+      {
+        if (search_method_ == KDTREE)
+        {
+          std::vector<float> distances;
+          return (target_cells_.radiusSearch (x_trans_pt, resolution_, neighborhood, distances));
+        }
+        return (target_cells_.directSearch (x_trans_pt, search_method_, neighborhood));
       }
 
       /** \brief Compute derivatives of probability function w.r.t. the transformation vector.
@@ -429,6 +625,24 @@ namespace pcl
       /** \brief The voxel grid generated from target cloud containing point means and covariances. */
       TargetGrid target_cells_;
 
+      /** \brief The method used to find the target voxels around each transformed source point. */
+      NeighborSearchMethod search_method_;
+
+      /** \brief The blocks the target is made of when it is built with \ref addTargetBlock. */
+      std::map<int, PointCloudTargetConstPtr> target_blocks_;
+
+      /** \brief The concatenation of \ref target_blocks_, \ref target_ points to it while there are blocks. */
+      PointCloudTargetPtr block_target_;
+
+      /** \brief Whether \ref block_target_ must be rebuilt from \ref target_blocks_. */
+      bool block_target_outdated_;
+
+      /** \brief Kdtrees over \ref target_blocks_, used in place of \ref tree_ for the fitness score. Each tree is built
+        * over the blocks added at once and merged with the trees before it while they are comparable in size, so a point
+        * is only part of a logarithmic number of rebuilds and the whole target is never rebuilt for a new block.
+        */
+      std::vector<BlockTree> block_trees_;
+
       //double fitness_epsilon_;
 
       /** \brief The side length of voxels. */
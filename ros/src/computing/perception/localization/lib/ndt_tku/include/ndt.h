@@ -237,17 +237,26 @@ typedef struct Normaldistribution{
 
 typedef struct nd_map *NDMapPtr;
 
+#define ND_BLOCK_BITS 3
+#define ND_BLOCK_SIZE (1 << ND_BLOCK_BITS)
+
 typedef struct nd_map{
-  NDPtr *nd;
   int layer;
-  int x;
+  int x;/*extent in cells*/
   int y;
   int z;
-  int to_x;
-  int to_y;
   double size;
   char name[30];
 
+  /*sparse cells, open addressing hash table from the block coordinates to
+    a block of ND_BLOCK_SIZE^3 cells, so that neighbor cells share a lookup*/
+  unsigned long long *keys;
+  NDPtr **blocks;
+  int capacity;
+  int num;
+  unsigned long long last_key;
+  NDPtr *last_block;
+
   NDMapPtr next;
 }NDMap;
 
@@ -285,12 +294,20 @@ void idle (void);
 void draw_cell(NDPtr nd);
 double probability_on_ND(NDPtr nd,double x,double y,double z);
 
+/*NDs are pool allocated, NDs is the empty ND returned for missing cells*/
+extern NDPtr NDs;
+extern int NDs_num;
+
 //void add_ND(NDPtr);
 NDPtr add_ND(void);
+NDMapPtr create_NDmap_layer(int layer, int x, int y, int z, double size, NDMapPtr child);
+NDPtr find_ND_cell(NDMapPtr ndmap, int x, int y, int z);
+NDPtr add_ND_cell(NDMapPtr ndmap, int x, int y, int z);
+int next_ND_cell(NDMapPtr ndmap, int *it, int *x, int *y, int *z, NDPtr *nd);
 double calc_summand2d(PointPtr p,NDPtr nd,PosturePtr pose,double *g,double H[3][3]);
 int adjust2d(PointPtr scan, int num, PosturePtr initial);
 
-double calc_summand3d(PointPtr p,NDPtr nd,PosturePtr pose,double *g,double H[6][6],double qd3[6][3],double dist);
+double calc_summand3d(PointPtr p,NDPtr nd,PosturePtr pose,double *g,double H[6][6],double qd3[6][3],double qdd3[6][6][3],double dist);
 double adjust3d(PointPtr scan, int num, PosturePtr initial,int target);
 void set_sincos2(double a,double b,double g,double sc[3][3]);
 void scan_transrate(PointPtr src, PointPtr dst ,PosturePtr pose, int num);
@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ndt.h"
+
+/*NDs are allocated in blocks which are never moved, so NDPtr stays valid*/
+#define ND_POOL_BLOCK (1 << 16)
+
+/*bits of each block coordinate in the key*/
+#define CELL_BITS 21
+#define CELL_MASK ((1ULL << CELL_BITS) - 1)
+
+#define INITIAL_BLOCK_CAPACITY 256
+
+NDPtr NDs = 0;
+int NDs_num = 0;
+
+static NDPtr *nd_pool = 0;
+static int nd_pool_num = 0;
+
+NDPtr add_ND(void)
+{
+  NDPtr ndp;
+
+  if (NDs_num >= MAX_ND_NUM)
+  {
+    printf("over flow\n");
+    return 0;
+  }
+
+  /*open a new block*/
+  if (NDs_num == nd_pool_num * ND_POOL_BLOCK)
+  {
+    NDPtr *pool = (NDPtr *)realloc(nd_pool, (nd_pool_num + 1) * sizeof(NDPtr));
+    NDPtr block = (NDPtr)malloc(ND_POOL_BLOCK * sizeof(NormalDistribution));
+    if (!pool || !block)
+    {
+      printf("out of memory\n");
+      free(block);
+      if (pool)
+        nd_pool = pool;
+      return 0;
+    }
+    nd_pool = pool;
+    nd_pool[nd_pool_num++] = block;
+  }
+
+  ndp = nd_pool[NDs_num / ND_POOL_BLOCK] + NDs_num % ND_POOL_BLOCK;
+  NDs_num++;
+
+  ndp->flag = 0;
+  ndp->sign = 0;
+  ndp->num = 0;
+  ndp->m_x = 0;
+  ndp->m_y = 0;
+  ndp->m_z = 0;
+  ndp->c_xx = 0;
+  ndp->c_yy = 0;
+  ndp->c_zz = 0;
+  ndp->c_xy = 0;
+  ndp->c_yz = 0;
+  ndp->c_zx = 0;
+  ndp->w = 1;
+  ndp->is_source = 0;
+
+  return ndp;
+}
+
+static unsigned long long block_key(int x, int y, int z)
+{
+  return ((unsigned long long)(x >> ND_BLOCK_BITS) << (2 * CELL_BITS)) |
+         ((unsigned long long)(y >> ND_BLOCK_BITS) << CELL_BITS) | (unsigned long long)(z >> ND_BLOCK_BITS);
+}
+
+static int cell_index(int x, int y, int z)
+{
+  return (((x & (ND_BLOCK_SIZE - 1)) << ND_BLOCK_BITS | (y & (ND_BLOCK_SIZE - 1))) << ND_BLOCK_BITS) |
+         (z & (ND_BLOCK_SIZE - 1));
+}
+
+/*slot of the key, or the empty slot where it goes*/
+static int block_slot(NDMapPtr ndmap, unsigned long long key)
+{
+  int mask = ndmap->capacity - 1;
+  int slot = (int)(((key * 0x9E3779B97F4A7C15ULL) >> 32) & mask);
+
+  while (ndmap->blocks[slot] && ndmap->keys[slot] != key)
+    slot = (slot + 1) & mask;
+  return slot;
+}
+
+static NDPtr *find_block(NDMapPtr ndmap, unsigned long long key)
+{
+  NDPtr *block;
+
+  /*consecutive lookups mostly hit the same block*/
+  if (ndmap->last_block && ndmap->last_key == key)
+    return ndmap->last_block;
+
+  block = ndmap->blocks[block_slot(ndmap, key)];
+  if (block)
+  {
+    ndmap->last_key = key;
+    ndmap->last_block = block;
+  }
+  return block;
+}
+
+static int grow_blocks(NDMapPtr ndmap)
+{
+  unsigned long long *old_keys = ndmap->keys;
+  NDPtr **old_blocks = ndmap->blocks;
+  int old_capacity = ndmap->capacity;
+  int i, slot;
+
+  ndmap->capacity = old_capacity * 2;
+  ndmap->keys = (unsigned long long *)malloc(ndmap->capacity * sizeof(unsigned long long));
+  ndmap->blocks = (NDPtr **)calloc(ndmap->capacity, sizeof(NDPtr *));
+  if (!ndmap->keys || !ndmap->blocks)
+  {
+    free(ndmap->keys);
+    free(ndmap->blocks);
+    ndmap->keys = old_keys;
+    ndmap->blocks = old_blocks;
+    ndmap->capacity = old_capacity;
+    return 0;
+  }
+
+  for (i = 0; i < old_capacity; i++)
+  {
+    if (!old_blocks[i])
+      continue;
+    slot = block_slot(ndmap, old_keys[i]);
+    ndmap->keys[slot] = old_keys[i];
+    ndmap->blocks[slot] = old_blocks[i];
+  }
+  free(old_keys);
+  free(old_blocks);
+  return 1;
+}
+
+NDMapPtr create_NDmap_layer(int layer, int x, int y, int z, double size, NDMapPtr child)
+{
+  NDMapPtr ndmap;
+
+  ndmap = (NDMapPtr)malloc(sizeof(NDMap));
+  ndmap->x = x;
+  ndmap->y = y;
+  ndmap->z = z;
+  ndmap->layer = layer;
+  ndmap->size = size;
+  ndmap->next = child;
+
+  /*only the blocks with points are stored*/
+  ndmap->capacity = INITIAL_BLOCK_CAPACITY;
+  ndmap->num = 0;
+  ndmap->keys = (unsigned long long *)malloc(ndmap->capacity * sizeof(unsigned long long));
+  ndmap->blocks = (NDPtr **)calloc(ndmap->capacity, sizeof(NDPtr *));
+  ndmap->last_key = 0;
+  ndmap->last_block = 0;
+
+  return ndmap;
+}
+
+NDPtr find_ND_cell(NDMapPtr ndmap, int x, int y, int z)
+{
+  NDPtr *block = find_block(ndmap, block_key(x, y, z));
+
+  if (!block)
+    return 0;
+  return block[cell_index(x, y, z)];
+}
+
+NDPtr add_ND_cell(NDMapPtr ndmap, int x, int y, int z)
+{
+  unsigned long long key = block_key(x, y, z);
+  NDPtr *block = find_block(ndmap, key);
+  NDPtr *ndp;
+  int slot;
+
+  if (!block)
+  {
+    /*keep the table at most half full*/
+    if (2 * (ndmap->num + 1) > ndmap->capacity && !grow_blocks(ndmap))
+      return 0;
+
+    block = (NDPtr *)calloc(ND_BLOCK_SIZE * ND_BLOCK_SIZE * ND_BLOCK_SIZE, sizeof(NDPtr));
+    if (!block)
+      return 0;
+    slot = block_slot(ndmap, key);
+    ndmap->keys[slot] = key;
+    ndmap->blocks[slot] = block;
+    ndmap->num++;
+  }
+
+  ndp = block + cell_index(x, y, z);
+  if (!*ndp)
+    *ndp = add_ND();
+  return *ndp;
+}
+
+/*iterate the cells with ND, *it starts at 0*/
+int next_ND_cell(NDMapPtr ndmap, int *it, int *x, int *y, int *z, NDPtr *nd)
+{
+  const int block_cells = ND_BLOCK_SIZE * ND_BLOCK_SIZE * ND_BLOCK_SIZE;
+  long long i;
+  int slot, cell;
+  unsigned long long key;
+
+  for (i = *it; i < (long long)ndmap->capacity * block_cells; i++)
+  {
+    slot = i / block_cells;
+    cell = i % block_cells;
+    if (!ndmap->blocks[slot])
+    {
+      i = (long long)(slot + 1) * block_cells - 1;
+      continue;
+    }
+    if (!ndmap->blocks[slot][cell])
+      continue;
+
+    key = ndmap->keys[slot];
+    *x = ((int)(key >> (2 * CELL_BITS)) << ND_BLOCK_BITS) | (cell >> (2 * ND_BLOCK_BITS));
+    *y = ((int)((key >> CELL_BITS) & CELL_MASK) << ND_BLOCK_BITS) | ((cell >> ND_BLOCK_BITS) & (ND_BLOCK_SIZE - 1));
+    *z = ((int)(key & CELL_MASK) << ND_BLOCK_BITS) | (cell & (ND_BLOCK_SIZE - 1));
+    *nd = ndmap->blocks[slot][cell];
+    *it = (int)(i + 1);
+    return 1;
+  }
+  *it = (int)i;
+  return 0;
+}
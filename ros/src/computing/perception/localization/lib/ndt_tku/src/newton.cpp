@@ -2,6 +2,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include "ndt.h"
 #include "algebra.h"
@@ -22,8 +29,6 @@ extern int _downsampler_num;
 
 double qdd[3][3][2];
 double qd[3][2];
-double qd3[6][3];
-double qdd3[6][6][3];
 
 void set_sincos(double a, double b, double g, double sc_d[3][3][3]);
 void set_sincos2(double a, double b, double g, double sc[3][3]);
@@ -35,12 +40,13 @@ void depth(PointPtr scan, int num, PosturePtr pose);
 �����̤���뤿��η׻��ʰ���ʬ��
 �إå�����η׻��⤦�����ڤǤ��뤫�⡣
 �켡��ʬ�����ο������׻����ơ��إå�����Ϥ���κ�ʬ������롣*/
-double calc_summand3d(PointPtr p, NDPtr nd, PosturePtr pose, double *g, double H[6][6], double qd3_d[6][3], double dist)
+double calc_summand3d(PointPtr p, NDPtr nd, PosturePtr pose, double *g, double H[6][6], double qd3_d[6][3],
+                      double qdd3_d[6][6][3], double dist)
 {
   double a[3];
   double e;
   double q[3];
-  double qda[6][3], *qda_p;  //,*qdd_p;
+  double qda[6][3];
   int i, j;
 
   /*q�η׻�*/
@@ -78,23 +84,20 @@ double calc_summand3d(PointPtr p, NDPtr nd, PosturePtr pose, double *g, double H
 
   for (j = 0; j < 6; j++)
   {
-    qda[j][0] = qd3[j][0] * nd->inv_covariance[0][0] + qd3[j][1] * nd->inv_covariance[1][0] +
-                qd3[j][2] * nd->inv_covariance[2][0];
-    qda_p++;
-    qda[j][1] = qd3[j][0] * nd->inv_covariance[0][1] + qd3[j][1] * nd->inv_covariance[1][1] +
-                qd3[j][2] * nd->inv_covariance[2][1];
-    qda_p++;
-    qda[j][2] = qd3[j][0] * nd->inv_covariance[0][2] + qd3[j][1] * nd->inv_covariance[1][2] +
-                qd3[j][2] * nd->inv_covariance[2][2];
-    qda_p++;
+    qda[j][0] = qd3_d[j][0] * nd->inv_covariance[0][0] + qd3_d[j][1] * nd->inv_covariance[1][0] +
+                qd3_d[j][2] * nd->inv_covariance[2][0];
+    qda[j][1] = qd3_d[j][0] * nd->inv_covariance[0][1] + qd3_d[j][1] * nd->inv_covariance[1][1] +
+                qd3_d[j][2] * nd->inv_covariance[2][1];
+    qda[j][2] = qd3_d[j][0] * nd->inv_covariance[0][2] + qd3_d[j][1] * nd->inv_covariance[1][2] +
+                qd3_d[j][2] * nd->inv_covariance[2][2];
   }
 
   for (i = 0; i < 6; i++)
   {
     for (j = 0; j < 6; j++)
     {
-      H[i][j] = -e * ((-g[i]) * (g[j]) - (a[0] * qdd3[i][j][0] + a[1] * qdd3[i][j][1] + a[2] * qdd3[i][j][2]) -
-                      (qda[j][0] * qd3[i][0] + qda[j][1] * qd3[i][1] + qda[j][2] * qd3[i][2]));
+      H[i][j] = -e * ((-g[i]) * (g[j]) - (a[0] * qdd3_d[i][j][0] + a[1] * qdd3_d[i][j][1] + a[2] * qdd3_d[i][j][2]) -
+                      (qda[j][0] * qd3_d[i][0] + qda[j][1] * qd3_d[i][1] + qda[j][2] * qd3_d[i][2]));
     }
   }
 
@@ -191,38 +194,303 @@ void depth(PointPtr scan, int num, PosturePtr pose)
   }
 }
 
+/*point selected for the summation, with its ND voxel*/
+struct summand_point
+{
+  double x, y, z; /*scan point*/
+  Point p;        /*point on the map*/
+  NDPtr nd;
+};
+
+/*partial sums of one thread*/
+struct summand_partial
+{
+  double esum;
+  double gsum[6];
+  double Hsum[6][6];
+};
+
+/*derivatives of the transformed point by the pose, qd3[txtytzabg][xyz] and qdd3[txtytzabg][txtytzabg][xyz].
+  the derivatives by the translation do not depend on the point and are left as initialized*/
+static void calc_point_derivatives(const summand_point &sp, double sc_d[3][3][3], double sc_dd[3][3][3][3],
+                                   double qd3[6][3], double qdd3[6][6][3])
+{
+  double *work;
+  int n, m, k;
+
+  /*q�ΰ켡��ʬ(�Ѳ�������Τ�)*/
+  work = (double *)sc_d;
+  for (m = 0; m < 3; m++)
+  {
+    for (k = 0; k < 3; k++)
+    {
+      qd3[m + 3][k] = sp.x * (*work) + sp.y * (*(work + 1)) + sp.z * (*(work + 2));
+      work += 3;
+    }
+  }
+
+  /*q������ʬ���Ѳ�������Τߡ�*/
+  work = (double *)sc_dd;
+  for (n = 0; n < 3; n++)
+  {
+    for (m = 0; m < 3; m++)
+    {
+      for (k = 0; k < 3; k++)
+      {
+        qdd3[n + 3][m + 3][k] = (*work * sp.x + *(work + 1) * sp.y + *(work + 2) * sp.z - qd3[m + 3][k]) / E_THETA;
+        work += 3;
+      }
+    }
+  }
+}
+
+#ifdef __SSE2__
+/*calc_summand3d for two points at once, one in each lane, with dist 1.
+  the sums of the two lanes are accumulated separately in esum, gsum and Hsum*/
+static void calc_summand3d_x2(const summand_point &sp0, const summand_point &sp1, double sc_d[3][3][3],
+                              double sc_dd[3][3][3][3], __m128d *esum, __m128d gsum[6], __m128d Hsum[6][6])
+{
+  __m128d x, y, z, q[3], inv[3][3], a[3], g[6], qd3[6][3], qdd3[6][6][3], qda[6][3], e, h;
+  const __m128d zero = _mm_setzero_pd();
+  double e0, e1;
+  double *work;
+  int i, j, k;
+
+  x = _mm_set_pd(sp1.x, sp0.x);
+  y = _mm_set_pd(sp1.y, sp0.y);
+  z = _mm_set_pd(sp1.z, sp0.z);
+
+  q[0] = _mm_set_pd(sp1.p.x - sp1.nd->mean.x, sp0.p.x - sp0.nd->mean.x);
+  q[1] = _mm_set_pd(sp1.p.y - sp1.nd->mean.y, sp0.p.y - sp0.nd->mean.y);
+  q[2] = _mm_set_pd(sp1.p.z - sp1.nd->mean.z, sp0.p.z - sp0.nd->mean.z);
+  for (i = 0; i < 3; i++)
+    for (j = 0; j < 3; j++)
+      inv[i][j] = _mm_set_pd(sp1.nd->inv_covariance[i][j], sp0.nd->inv_covariance[i][j]);
+
+  /*a lane below the threshold adds nothing, like calc_summand3d returning zeros*/
+  e0 = probability_on_ND(sp0.nd, sp0.p.x - sp0.nd->mean.x, sp0.p.y - sp0.nd->mean.y, sp0.p.z - sp0.nd->mean.z);
+  e1 = probability_on_ND(sp1.nd, sp1.p.x - sp1.nd->mean.x, sp1.p.y - sp1.nd->mean.y, sp1.p.z - sp1.nd->mean.z);
+  if (e0 < 0.000000001 && e1 < 0.000000001)
+    return;
+  e = _mm_set_pd(e1 < 0.000000001 ? 0 : e1, e0 < 0.000000001 ? 0 : e0);
+
+  for (i = 0; i < 6; i++)
+  {
+    for (k = 0; k < 3; k++)
+    {
+      qd3[i][k] = (i == k) ? _mm_set1_pd(1) : zero;
+      for (j = 0; j < 6; j++)
+        qdd3[i][j][k] = zero;
+    }
+  }
+  work = (double *)sc_d;
+  for (i = 0; i < 3; i++)
+  {
+    for (k = 0; k < 3; k++)
+    {
+      qd3[i + 3][k] = _mm_add_pd(_mm_add_pd(_mm_mul_pd(x, _mm_set1_pd(work[0])), _mm_mul_pd(y, _mm_set1_pd(work[1]))),
+                                 _mm_mul_pd(z, _mm_set1_pd(work[2])));
+      work += 3;
+    }
+  }
+  work = (double *)sc_dd;
+  for (i = 0; i < 3; i++)
+  {
+    for (j = 0; j < 3; j++)
+    {
+      for (k = 0; k < 3; k++)
+      {
+        h = _mm_add_pd(_mm_add_pd(_mm_mul_pd(_mm_set1_pd(work[0]), x), _mm_mul_pd(_mm_set1_pd(work[1]), y)),
+                       _mm_mul_pd(_mm_set1_pd(work[2]), z));
+        qdd3[i + 3][j + 3][k] = _mm_div_pd(_mm_sub_pd(h, qd3[j + 3][k]), _mm_set1_pd(E_THETA));
+        work += 3;
+      }
+    }
+  }
+
+  for (k = 0; k < 3; k++)
+    a[k] = _mm_add_pd(_mm_add_pd(_mm_mul_pd(q[0], inv[0][k]), _mm_mul_pd(q[1], inv[1][k])), _mm_mul_pd(q[2], inv[2][k]));
+
+  for (i = 0; i < 6; i++)
+  {
+    g[i] = _mm_add_pd(_mm_add_pd(_mm_mul_pd(a[0], qd3[i][0]), _mm_mul_pd(a[1], qd3[i][1])), _mm_mul_pd(a[2], qd3[i][2]));
+    for (k = 0; k < 3; k++)
+      qda[i][k] = _mm_add_pd(_mm_add_pd(_mm_mul_pd(qd3[i][0], inv[0][k]), _mm_mul_pd(qd3[i][1], inv[1][k])),
+                             _mm_mul_pd(qd3[i][2], inv[2][k]));
+  }
+
+  for (i = 0; i < 6; i++)
+  {
+    for (j = 0; j < 6; j++)
+    {
+      h = _mm_sub_pd(_mm_mul_pd(_mm_sub_pd(zero, g[i]), g[j]),
+                     _mm_add_pd(_mm_add_pd(_mm_mul_pd(a[0], qdd3[i][j][0]), _mm_mul_pd(a[1], qdd3[i][j][1])),
+                                _mm_mul_pd(a[2], qdd3[i][j][2])));
+      h = _mm_sub_pd(h, _mm_add_pd(_mm_add_pd(_mm_mul_pd(qda[j][0], qd3[i][0]), _mm_mul_pd(qda[j][1], qd3[i][1])),
+                                   _mm_mul_pd(qda[j][2], qd3[i][2])));
+      Hsum[i][j] = _mm_add_pd(Hsum[i][j], _mm_mul_pd(_mm_sub_pd(zero, e), h));
+    }
+  }
+
+  for (i = 0; i < 6; i++)
+    gsum[i] = _mm_add_pd(gsum[i], _mm_mul_pd(g[i], e));
+  *esum = _mm_add_pd(*esum, e);
+}
+#endif
+
+/*sum the gradients and Hessians of the selected points, the points are split among threads.
+  with SSE2 every thread takes the points two at a time, one in each lane, and adds up the lanes at the end.
+  the partial sums are merged in thread order, so the result only depends on the number of threads*/
+static double sum_summand3d(const std::vector<summand_point> &points, PosturePtr pose, double sc_d[3][3][3],
+                            double sc_dd[3][3][3][3], double gsum[6], double Hsumh[6][6])
+{
+  double esum = 0;
+  int size = (int)points.size();
+  int step = 1;
+  int thread_num = 1;
+  int t, n;
+
+#ifdef __SSE2__
+  step = 2;
+#endif
+#ifdef _OPENMP
+  thread_num = omp_get_max_threads();
+#endif
+  std::vector<summand_partial> partials(thread_num + 1); /*zero initialized, the last one for the odd point*/
+
+#pragma omp parallel num_threads(thread_num)
+  {
+    double g[6], hH[6][6], qd3_local[6][3], qdd3_local[6][6][3];
+    int i, n, m, k;
+    summand_partial *partial = &partials[0];
+
+#ifdef _OPENMP
+    partial = &partials[omp_get_thread_num()];
+#endif
+
+    for (n = 0; n < 6; n++)
+    {
+      for (k = 0; k < 3; k++)
+      {
+        qd3_local[n][k] = (n == k) ? 1 : 0;
+        for (m = 0; m < 6; m++)
+          qdd3_local[n][m][k] = 0;
+      }
+    }
+
+#ifdef __SSE2__
+    __m128d esum_x2 = _mm_setzero_pd();
+    __m128d gsum_x2[6], Hsum_x2[6][6];
+    for (n = 0; n < 6; n++)
+    {
+      gsum_x2[n] = _mm_setzero_pd();
+      for (m = 0; m < 6; m++)
+        Hsum_x2[n][m] = _mm_setzero_pd();
+    }
+#endif
+
+#pragma omp for schedule(static)
+    for (i = 0; i < size / step; i++)
+    {
+#ifdef __SSE2__
+      calc_summand3d_x2(points[2 * i], points[2 * i + 1], sc_d, sc_dd, &esum_x2, gsum_x2, Hsum_x2);
+#else
+      const summand_point &sp = points[i];
+      Point p = sp.p;
+
+      calc_point_derivatives(sp, sc_d, sc_dd, qd3_local, qdd3_local);
+      partial->esum += calc_summand3d(&p, sp.nd, pose, g, hH, qd3_local, qdd3_local, 1);
+      add_matrix6d(partial->Hsum, hH, partial->Hsum);
+      for (n = 0; n < 6; n++)
+        partial->gsum[n] += g[n];
+#endif
+    }
+
+#ifdef __SSE2__
+    double lanes[2];
+    _mm_storeu_pd(lanes, esum_x2);
+    partial->esum += lanes[0] + lanes[1];
+    for (n = 0; n < 6; n++)
+    {
+      _mm_storeu_pd(lanes, gsum_x2[n]);
+      partial->gsum[n] += lanes[0] + lanes[1];
+      for (m = 0; m < 6; m++)
+      {
+        _mm_storeu_pd(lanes, Hsum_x2[n][m]);
+        partial->Hsum[n][m] += lanes[0] + lanes[1];
+      }
+    }
+
+    /*the odd point is left to one thread, in its own partial so the order of the sums does not change*/
+#pragma omp single
+    if (size % 2 == 1)
+    {
+      const summand_point &sp = points[size - 1];
+      Point p = sp.p;
+
+      calc_point_derivatives(sp, sc_d, sc_dd, qd3_local, qdd3_local);
+      partials[thread_num].esum = calc_summand3d(&p, sp.nd, pose, g, hH, qd3_local, qdd3_local, 1);
+      add_matrix6d(partials[thread_num].Hsum, hH, partials[thread_num].Hsum);
+      for (n = 0; n < 6; n++)
+        partials[thread_num].gsum[n] = g[n];
+    }
+#endif
+  }
+
+  for (t = 0; t <= thread_num; t++)
+  {
+    esum += partials[t].esum;
+    add_matrix6d(Hsumh, partials[t].Hsum, Hsumh);
+    for (n = 0; n < 6; n++)
+      gsum[n] += partials[t].gsum[n];
+  }
+
+  return esum;
+}
+
+/*transform the point, and keep it if it falls in a valid ND voxel*/
+static void select_point(PointPtr scanptr, NDMapPtr nd_map, double sc[3][3], PosturePtr pose, int target,
+                         std::vector<summand_point> *points)
+{
+  summand_point sp;
+  NDPtr nd[8];
+
+  sp.x = scanptr->x;
+  sp.y = scanptr->y;
+  sp.z = scanptr->z;
+  sp.p.x = sp.x * sc[0][0] + sp.y * sc[0][1] + sp.z * sc[0][2] + pose->x;
+  sp.p.y = sp.x * sc[1][0] + sp.y * sc[1][1] + sp.z * sc[1][2] + pose->y;
+  sp.p.z = sp.x * sc[2][0] + sp.y * sc[2][1] + sp.z * sc[2][2] + pose->z;
+
+  /*�����б�����ND�ܥ�����������Ʊ���˼�������ND�ܥ�����򹹿���
+    �٤����Τ�Ĥ������Ӥ���Ĥ�Ĥ�����*/
+  if (!get_ND(nd_map, &sp.p, nd, target))
+    return;
+
+  if (nd[0] && nd[0]->num > 10 && nd[0]->sign == 1)
+  {
+    sp.nd = nd[0];
+    points->push_back(sp);
+  }
+}
+
 /*���ʬ�ν���*/
 double adjust3d(PointPtr scan, int num, PosturePtr initial, int target)
 {
-  // double gsum[6], Hsum[6][6],Hsumh[6][6],Hinv[6][6],g[6],gd[6],ge[6][6],H[6][6],hH[6][6];
-  double gsum[6], Hsum[6][6], Hsumh[6][6], Hinv[6][6], g[6], H[6][6], hH[6][6];
-  // double sc[3][3],sc_d[3][3][3],sc_dd[3][3][3][3],sce[3][3][3];
+  static std::vector<summand_point> points;
+  double gsum[6], Hsumh[6][6], Hinv[6][6], H[6][6];
   double sc[3][3], sc_d[3][3][3], sc_dd[3][3][3][3];
-  // double *work,*work2,*work3;
-  double *work;
   double esum = 0, gnum = 0;
-  NDPtr nd[8];
   NDMapPtr nd_map;
-  int i, j, n, m, k, layer;
-  double x, y, z;  //,sa,ca,sb,cb,sg,cg;
+  int i, layer;
   PosturePtr pose;
-  // Point p,pe[6],pd;
-  Point p;
-  PointPtr scanptr;
-  // int inc,count;
   int inc;
   int ndmode;
-  double dist, weight_total, weight_sum, weight_next;
+  double weight_total, weight_sum, weight_next;
 
   /*initialize*/
-  gsum[0] = 0;
-  gsum[1] = 0;
-  gsum[2] = 0;
-  gsum[3] = 0;
-  gsum[4] = 0;
-  gsum[5] = 0;
-  j = 0;
-  zero_matrix6d(Hsum);
+  for (i = 0; i < 6; i++)
+    gsum[i] = 0;
   zero_matrix6d(Hsumh);
   pose = initial;
 
@@ -235,182 +503,51 @@ double adjust3d(PointPtr scan, int num, PosturePtr initial, int target)
   /*��ɸ�Ѵ���*/
   set_sincos2(pose->theta, pose->theta2, pose->theta3, sc);
 
-  /*�켡��ʬ������Ѳ����ʤ���ʬ�η׻�*/
-  qd3[0][0] = 1;
-  qd3[0][1] = 0;
-  qd3[0][2] = 0;
-
-  qd3[1][0] = 0;
-  qd3[1][1] = 1;
-  qd3[1][2] = 0;
-
-  qd3[2][0] = 0;
-  qd3[2][1] = 0;
-  qd3[2][2] = 1;
-  for (n = 0; n < 6; n++)
+  /*�ǡ��������Ф�����1=��ĤŤġ�*/
+  inc = 1;
+  ndmode = 0;
+  switch (target)
   {
-    for (m = 0; m < 6; m++)
-    {
-      for (k = 0; k < 3; k++)
-      {
-        qdd3[n][m][k] = 0;
-      }
-    }
+    case 3:
+      inc = 1;
+      ndmode = 0;
+      break;
+    case 2:
+      inc = (_downsampler_num == 0) ? 500 : 1;
+      ndmode = 1;
+      break;
+    default:
+      inc = (_downsampler_num == 0) ? 5000 : 1;
+      ndmode = 0;
+      break;
   }
 
-  //#if WEIGHTED_SELECT
-  if (_downsampler_num == 0)
-  {
-    /*�ǡ��������Ф�����1=��ĤŤġ�*/
-    switch (target)
-    {
-      case 3:
-        inc = 1;
-        ndmode = 0;
-        break;
-      case 2:
-        inc = 500;
-        ndmode = 1;
-        break;
-      case 1:
-        inc = 5000;
-        ndmode = 0;
-        break;
-      default:
-        inc = 5000;
-        ndmode = 0;
-        break;
-    }
-  }
-  //#else
-  if (_downsampler_num == 1)
+  /*���ϥ������ˤ�����������*/
+  layer = (ndmode == 1) ? 1 : 0;  // layer_select;
+  nd_map = NDmap;
+  while (layer > 0)
   {
-    /*�ǡ��������Ф�����1=��ĤŤġ�*/
-    switch (target)
-    {
-      case 3:
-        inc = 1;
-        ndmode = 0;
-        break;
-      case 2:
-        inc = 1;
-        ndmode = 1;
-        break;
-      case 1:
-        inc = 1;
-        ndmode = 0;
-        break;
-      default:
-        inc = 1;
-        ndmode = 0;
-        break;
-    }
+    if (nd_map->next)
+      nd_map = nd_map->next;
+    layer--;
   }
-  //#endif
-
-  scanptr = scan;
 
-  /*����ˤĤ��Ʒ����֤��׻�*/
+  /*select the points and their voxels first, get_ND updates the covariances it touches*/
+  points.clear();
 
   //#if WEIGHTED_SELECT
   if (_downsampler_num == 0)
   {
     weight_total = scan_points_totalweight;
-    ;
     weight_next = 0;
     weight_sum = 0;
-
-    //  FILE *point_fp;
-    // point_fp=fopen("/tmp/range","w");
     for (i = 0; i < num; i++)
     {
       weight_sum += scan_points_weight[i];
       if (weight_sum < weight_next)
-      {
-        scanptr++;
         continue;
-      }
-
-      /*���κ�ɸ�Ѵ��׻�*/
-      x = scanptr->x;
-      y = scanptr->y;
-      z = scanptr->z;
-      //    fprintf(point_fp,"%f %f %f \n",x,y,z);
-
-      scanptr++;
       weight_next += weight_total / (double)inc;  // 1000;
-      dist = 1;
-
-      p.x = x * sc[0][0] + y * sc[0][1] + z * sc[0][2] + pose->x;
-      p.y = x * sc[1][0] + y * sc[1][1] + z * sc[1][2] + pose->y;
-      p.z = x * sc[2][0] + y * sc[2][1] + z * sc[2][2] + pose->z;
-
-      /*���ϥ������ˤ�����������*/
-      if (ndmode == 1)
-        layer = 1;  // layer_select;
-      if (ndmode == 0)
-        layer = 0;  // layer_select;
-      nd_map = NDmap;
-
-      while (layer > 0)
-      {
-        if (nd_map->next)
-          nd_map = nd_map->next;
-        layer--;
-      }
-
-      /*�����б�����ND�ܥ�����������Ʊ���˼�������ND�ܥ�����򹹿���
-        �٤����Τ�Ĥ������Ӥ���Ĥ�Ĥ�����*/
-
-      if (!get_ND(nd_map, &p, nd, target))
-        continue;
-
-      /*q�ΰ켡��ʬ(�Ѳ�������Τ�)*/
-      work = (double *)sc_d;
-      for (m = 0; m < 3; m++)
-      {
-        for (k = 0; k < 3; k++)
-        {
-          // qd3[txtytzabg][xyz]
-          qd3[m + 3][k] = x * (*work) + y * (*(work + 1)) + z * (*(work + 2));
-          // x*sc_d[m][k][0] + y*sc_d[m][k][1] + z*sc_d[m][k][2];
-          work += 3;
-        }
-      }
-
-      /*q������ʬ���Ѳ�������Τߡ�*/
-      work = (double *)sc_dd;
-      for (n = 0; n < 3; n++)
-      {
-        for (m = 0; m < 3; m++)
-        {
-          for (k = 0; k < 3; k++)
-          {
-            qdd3[n + 3][m + 3][k] = (*work * x + *(work + 1) * y + *(work + 2) * z - qd3[m + 3][k]) / E_THETA;
-            work += 3;
-          }
-        }
-      }
-
-      /*�����̷׻�*/
-      if (nd[j])
-      {
-        if (nd[j]->num > 10 && nd[j]->sign == 1)
-        {
-          //	double e;
-          esum += calc_summand3d(&p, nd[j], pose, g, hH, qd3, dist);
-          add_matrix6d(Hsumh, hH, Hsumh);
-
-          //	  dist =1;
-          gsum[0] += g[0];                //*nd[j]->w;
-          gsum[1] += g[1];                //*nd[j]->w;
-          gsum[2] += g[2] + pose->z * 0;  //*nd[j]->w;
-          gsum[3] += g[3];                //*nd[j]->w;
-          gsum[4] += g[4];                //+(pose->theta2-(0.0))*1;//*nd[j]->w;
-          gsum[5] += g[5];                //*nd[j]->w;
-          gnum += 1;  // nd[j]->w;
-        }
-      }
+      select_point(&scan[i], nd_map, sc, pose, target, &points);
     }
   }
 
@@ -418,95 +555,16 @@ double adjust3d(PointPtr scan, int num, PosturePtr initial, int target)
   if (_downsampler_num == 1)
   {
     for (i = 0; i < num; i += inc)
-    {
-      //    dist = (x*x+y*y+z*z);
-      // dist *= (1.2-exp(-1*(-1 - z)*(-1 - z)/4.0));
-      //    if(dist>2500)dist=2500;
-      /*���κ�ɸ�Ѵ��׻�*/
-      x = scanptr->x;
-      y = scanptr->y;
-      z = scanptr->z;
-      dist = 1;
-      scanptr += inc;
-
-      p.x = x * sc[0][0] + y * sc[0][1] + z * sc[0][2] + pose->x;
-      p.y = x * sc[1][0] + y * sc[1][1] + z * sc[1][2] + pose->y;
-      p.z = x * sc[2][0] + y * sc[2][1] + z * sc[2][2] + pose->z;
-
-      /*���ϥ������ˤ�����������*/
-      if (ndmode == 1)
-        layer = 1;  // layer_select;
-      if (ndmode == 0)
-        layer = 0;  // layer_select;
-      nd_map = NDmap;
-
-      while (layer > 0)
-      {
-        if (nd_map->next)
-          nd_map = nd_map->next;
-        layer--;
-      }
-
-      /*�����б�����ND�ܥ�����������Ʊ���˼�������ND�ܥ�����򹹿���
-        �٤����Τ�Ĥ������Ӥ���Ĥ�Ĥ�����*/
-
-      if (!get_ND(nd_map, &p, nd, target))
-        continue;
-
-      /*q�ΰ켡��ʬ(�Ѳ�������Τ�)*/
-      work = (double *)sc_d;
-      for (m = 0; m < 3; m++)
-      {
-        for (k = 0; k < 3; k++)
-        {
-          // qd3[txtytzabg][xyz]
-          qd3[m + 3][k] = x * (*work) + y * (*(work + 1)) + z * (*(work + 2));
-          // x*sc_d[m][k][0] + y*sc_d[m][k][1] + z*sc_d[m][k][2];
-          work += 3;
-        }
-      }
-
-      /*q������ʬ���Ѳ�������Τߡ�*/
-      work = (double *)sc_dd;
-      for (n = 0; n < 3; n++)
-      {
-        for (m = 0; m < 3; m++)
-        {
-          for (k = 0; k < 3; k++)
-          {
-            qdd3[n + 3][m + 3][k] = (*work * x + *(work + 1) * y + *(work + 2) * z - qd3[m + 3][k]) / E_THETA;
-            work += 3;
-          }
-        }
-      }
-
-      /*�����̷׻�*/
-      if (nd[j])
-      {
-        if (nd[j]->num > 10 && nd[j]->sign == 1)
-        {
-          //	double e;
-          esum += calc_summand3d(&p, nd[j], pose, g, hH, qd3, dist);
-          add_matrix6d(Hsumh, hH, Hsumh);
-
-          //	  dist =1;
-          gsum[0] += g[0];                //*nd[j]->w;
-          gsum[1] += g[1];                //*nd[j]->w;
-          gsum[2] += g[2] + pose->z * 0;  //*nd[j]->w;
-          gsum[3] += g[3];                //*nd[j]->w;
-          gsum[4] += g[4];                //+(pose->theta2-(0.0))*1;//*nd[j]->w;
-          gsum[5] += g[5];                //*nd[j]->w;
-          gnum += 1;  // nd[j]->w;
-        }
-      }
-    }
+      select_point(&scan[i], nd_map, sc, pose, target, &points);
   }
   //#endif
+  gnum = points.size();
+
+  /*�����̷׻�*/
+  esum = sum_summand3d(points, pose, sc_d, sc_dd, gsum, Hsumh);
 
   if (gnum > 1)
   {
-    //  printf("gnum=%lf\n",gnum);
-    //    fclose(point_fp);
     identity_matrix6d(H);
     H[0][0] = H[0][0] / (gnum * gnum * 1000.001);
     H[1][1] = H[1][1] / (gnum * gnum * 1000.001);
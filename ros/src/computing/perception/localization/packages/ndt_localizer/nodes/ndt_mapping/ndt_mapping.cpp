@@ -36,10 +36,17 @@
 
 #define OUTPUT  // If you want to output "position_log.txt", "#define OUTPUT".
 
+#include <cmath>
 #include <iostream>
 #include <sstream>
 #include <fstream>
 #include <string>
+#include <deque>
+#include <map>
+#include <utility>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #include <ros/ros.h>
 #include <std_msgs/Bool.h>
@@ -120,6 +127,41 @@ static bool _use_openmp = false;
 
 static double fitness_score;
 
+// Submap mode: only the scans around the vehicle are the NDT target, and the map is kept in blocks which are
+// written to disk and dropped once the vehicle has left them.
+static bool _use_submap = false;
+static double _submap_size = 100.0;    // [m] Distance from the vehicle to the edge of the submap
+static double _map_block_size = 50.0;  // [m]
+static std::string _submap_directory = "/tmp";
+
+// Scan added to the submap
+struct submap_scan
+{
+  int id;  // Target block id
+  double x, y;
+  pcl::PointCloud<pcl::PointXYZI>::Ptr cloud;
+};
+
+// Block of the map saved to its own file
+struct map_block
+{
+  int x, y;
+  pcl::PointCloud<pcl::PointXYZI>::Ptr cloud;
+  std::string file;       // File the block is written to, empty until the first write
+  size_t saved_size = 0;  // Number of points already written
+};
+
+static std::deque<submap_scan> submap_scans;
+static std::map<std::pair<int, int>, map_block> map_blocks;
+static int submap_scan_count = 0;
+static int saved_block_count = 0;
+
+// The blocks are written by a background thread
+static std::deque<std::pair<std::string, pcl::PointCloud<pcl::PointXYZI>::Ptr> > save_queue;
+static std::mutex save_mutex;
+static std::condition_variable save_cond;
+static bool save_exit = false;
+
 static void param_callback(const runtime_manager::ConfigNdtMapping::ConstPtr& input)
 {
   ndt_res = input->resolution;
@@ -140,6 +182,133 @@ static void param_callback(const runtime_manager::ConfigNdtMapping::ConstPtr& in
   std::cout << "min_add_scan_shift: " << min_add_scan_shift << std::endl;
 }
 
+static void save_thread()
+{
+  while (true)
+  {
+    std::pair<std::string, pcl::PointCloud<pcl::PointXYZI>::Ptr> job;
+    {
+      std::unique_lock<std::mutex> lock(save_mutex);
+      save_cond.wait(lock, [] { return !save_queue.empty() || save_exit; });
+      if (save_queue.empty())
+        return;
+      job = save_queue.front();
+      save_queue.pop_front();
+    }
+
+    pcl::io::savePCDFileBinary(job.first, *job.second);
+    std::cout << "Saved " << job.second->points.size() << " data points to " << job.first << "." << std::endl;
+  }
+}
+
+// The cloud must not be modified after it is handed to the save thread.
+static void save_cloud(const std::string& file, const pcl::PointCloud<pcl::PointXYZI>::Ptr& cloud)
+{
+  {
+    std::lock_guard<std::mutex> lock(save_mutex);
+    save_queue.push_back(std::make_pair(file, cloud));
+  }
+  save_cond.notify_one();
+}
+
+// Save the block to its file in _submap_directory unless it is unchanged since it was last written there.
+// A block which has been written before is rewritten to the same file.
+static void save_block_if_changed(map_block& block)
+{
+  if (!block.file.empty() && block.cloud->size() == block.saved_size)
+    return;
+
+  if (block.file.empty())
+  {
+    std::ostringstream filename;
+    filename << _submap_directory << "/submap_" << block.x << "_" << block.y << "_" << saved_block_count++ << ".pcd";
+    block.file = filename.str();
+  }
+  block.saved_size = block.cloud->size();
+  save_cloud(block.file, block.cloud);
+}
+
+// Add a scan in the map frame to the submap and to the blocks of the map
+static void add_to_submap(const pcl::PointCloud<pcl::PointXYZI>::Ptr& cloud, const pose& scan_pose)
+{
+  submap_scan scan;
+  scan.id = submap_scan_count++;
+  scan.x = scan_pose.x;
+  scan.y = scan_pose.y;
+  scan.cloud = cloud;
+  submap_scans.push_back(scan);
+
+#ifdef USE_FAST_PCL
+  // Only the voxels touched by the new scan are recomputed
+  ndt.addTargetBlock(scan.id, cloud);
+#endif
+
+  for (const auto& p : *cloud)
+  {
+    int block_x = static_cast<int>(std::floor(p.x / _map_block_size));
+    int block_y = static_cast<int>(std::floor(p.y / _map_block_size));
+    map_block& block = map_blocks[std::make_pair(block_x, block_y)];
+    if (!block.cloud)
+    {
+      block.x = block_x;
+      block.y = block_y;
+      block.cloud.reset(new pcl::PointCloud<pcl::PointXYZI>());
+      block.cloud->header.frame_id = "map";
+    }
+    block.cloud->push_back(p);
+  }
+}
+
+// Drop the scans farther than _submap_size from the vehicle from the submap, and save the blocks the vehicle has left.
+// Returns true if the submap changed.
+static bool update_submap(const pose& vehicle_pose)
+{
+  std::vector<int> removed_ids;
+  for (std::deque<submap_scan>::iterator it = submap_scans.begin(); it != submap_scans.end();)
+  {
+    if (std::hypot(it->x - vehicle_pose.x, it->y - vehicle_pose.y) > _submap_size)
+    {
+      removed_ids.push_back(it->id);
+      it = submap_scans.erase(it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+
+#ifdef USE_FAST_PCL
+  if (!removed_ids.empty())
+    ndt.removeTargetBlocks(removed_ids);
+#endif
+
+  for (std::map<std::pair<int, int>, map_block>::iterator it = map_blocks.begin(); it != map_blocks.end();)
+  {
+    double dx = std::fabs((it->second.x + 0.5) * _map_block_size - vehicle_pose.x) - _map_block_size / 2;
+    double dy = std::fabs((it->second.y + 0.5) * _map_block_size - vehicle_pose.y) - _map_block_size / 2;
+    if (dx > _submap_size || dy > _submap_size)
+    {
+      save_block_if_changed(it->second);
+      it = map_blocks.erase(it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+
+  return !removed_ids.empty();
+}
+
+static pcl::PointCloud<pcl::PointXYZI>::Ptr get_submap()
+{
+  pcl::PointCloud<pcl::PointXYZI>::Ptr submap_ptr(new pcl::PointCloud<pcl::PointXYZI>());
+  for (const auto& scan : submap_scans)
+    *submap_ptr += *scan.cloud;
+  submap_ptr->header.frame_id = "map";
+  return submap_ptr;
+}
+
 static void output_callback(const runtime_manager::ConfigNdtMappingOutput::ConstPtr& input)
 {
   double filter_res = input->filter_res;
@@ -148,6 +317,35 @@ static void output_callback(const runtime_manager::ConfigNdtMappingOutput::Const
   std::cout << "filter_res: " << filter_res << std::endl;
   std::cout << "filename: " << filename << std::endl;
 
+  if (_use_submap == true)
+  {
+    // The blocks left behind are already saved in _submap_directory, save copies of the ones still in use as
+    // <filename>_<x>_<y>.pcd. The copies are not tracked, the blocks are still saved to _submap_directory when left.
+    std::string prefix = filename;
+    if (prefix.size() > 4 && prefix.compare(prefix.size() - 4, 4, ".pcd") == 0)
+      prefix.erase(prefix.size() - 4);
+    for (auto& block : map_blocks)
+    {
+      pcl::PointCloud<pcl::PointXYZI>::Ptr block_ptr(new pcl::PointCloud<pcl::PointXYZI>());
+      if (filter_res == 0.0)
+      {
+        *block_ptr = *block.second.cloud;
+      }
+      else
+      {
+        pcl::VoxelGrid<pcl::PointXYZI> voxel_grid_filter;
+        voxel_grid_filter.setLeafSize(filter_res, filter_res, filter_res);
+        voxel_grid_filter.setInputCloud(block.second.cloud);
+        voxel_grid_filter.filter(*block_ptr);
+      }
+      std::ostringstream block_filename;
+      block_filename << prefix << "_" << block.second.x << "_" << block.second.y << ".pcd";
+      save_cloud(block_filename.str(), block_ptr);
+    }
+    std::cout << map_blocks.size() << " blocks are saved to " << prefix << "_*.pcd." << std::endl;
+    return;
+  }
+
   pcl::PointCloud<pcl::PointXYZI>::Ptr map_ptr(new pcl::PointCloud<pcl::PointXYZI>(map));
   pcl::PointCloud<pcl::PointXYZI>::Ptr map_filtered(new pcl::PointCloud<pcl::PointXYZI>());
   map_ptr->header.frame_id = "map";
@@ -176,12 +374,12 @@ static void output_callback(const runtime_manager::ConfigNdtMappingOutput::Const
   // Writing Point Cloud data to PCD file
   if (filter_res == 0.0)
   {
-    pcl::io::savePCDFileASCII(filename, *map_ptr);
+    pcl::io::savePCDFileBinary(filename, *map_ptr);
     std::cout << "Saved " << map_ptr->points.size() << " data points to " << filename << "." << std::endl;
   }
   else
   {
-    pcl::io::savePCDFileASCII(filename, *map_filtered);
+    pcl::io::savePCDFileBinary(filename, *map_filtered);
     std::cout << "Saved " << map_filtered->points.size() << " data points to " << filename << "." << std::endl;
   }
 }
@@ -220,11 +418,25 @@ static void points_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
 
   pcl::PointCloud<pcl::PointXYZI>::Ptr scan_ptr(new pcl::PointCloud<pcl::PointXYZI>(scan));
 
+  ndt.setTransformationEpsilon(trans_eps);
+  ndt.setStepSize(step_size);
+  ndt.setResolution(ndt_res);
+  ndt.setMaximumIterations(max_iter);
+
   // Add initial point cloud to velodyne_map
   if (initial_scan_loaded == 0)
   {
-    pcl::transformPointCloud(*scan_ptr, *transformed_scan_ptr, tf_btol);
-    map += *transformed_scan_ptr;
+    if (_use_submap == true)
+    {
+      pcl::PointCloud<pcl::PointXYZI>::Ptr initial_scan_ptr(new pcl::PointCloud<pcl::PointXYZI>());
+      pcl::transformPointCloud(*scan_ptr, *initial_scan_ptr, tf_btol);
+      add_to_submap(initial_scan_ptr, added_pose);
+    }
+    else
+    {
+      pcl::transformPointCloud(*scan_ptr, *transformed_scan_ptr, tf_btol);
+      map += *transformed_scan_ptr;
+    }
     initial_scan_loaded = 1;
   }
 
@@ -234,17 +446,21 @@ static void points_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
   voxel_grid_filter.setInputCloud(scan_ptr);
   voxel_grid_filter.filter(*filtered_scan_ptr);
 
-  pcl::PointCloud<pcl::PointXYZI>::Ptr map_ptr(new pcl::PointCloud<pcl::PointXYZI>(map));
-
-  ndt.setTransformationEpsilon(trans_eps);
-  ndt.setStepSize(step_size);
-  ndt.setResolution(ndt_res);
-  ndt.setMaximumIterations(max_iter);
   ndt.setInputSource(filtered_scan_ptr);
 
   if (isMapUpdate == true)
   {
-    ndt.setInputTarget(map_ptr);
+    if (_use_submap == false)
+    {
+      pcl::PointCloud<pcl::PointXYZI>::Ptr map_ptr(new pcl::PointCloud<pcl::PointXYZI>(map));
+      ndt.setInputTarget(map_ptr);
+    }
+#ifndef USE_FAST_PCL
+    else
+    {
+      ndt.setInputTarget(get_submap());
+    }
+#endif
     isMapUpdate = false;
   }
 
@@ -347,7 +563,10 @@ static void points_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
   double shift = sqrt(pow(current_pose.x - added_pose.x, 2.0) + pow(current_pose.y - added_pose.y, 2.0));
   if (shift >= min_add_scan_shift)
   {
-    map += *transformed_scan_ptr;
+    if (_use_submap == true)
+      add_to_submap(transformed_scan_ptr, current_pose);
+    else
+      map += *transformed_scan_ptr;
     added_pose.x = current_pose.x;
     added_pose.y = current_pose.y;
     added_pose.z = current_pose.z;
@@ -357,9 +576,19 @@ static void points_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
     isMapUpdate = true;
   }
 
-  sensor_msgs::PointCloud2::Ptr map_msg_ptr(new sensor_msgs::PointCloud2);
-  pcl::toROSMsg(*map_ptr, *map_msg_ptr);
-  ndt_map_pub.publish(*map_msg_ptr);
+  if (_use_submap == true && update_submap(current_pose) == true)
+    isMapUpdate = true;
+
+  // Publish the map only when it changed
+  if (isMapUpdate == true)
+  {
+    sensor_msgs::PointCloud2::Ptr map_msg_ptr(new sensor_msgs::PointCloud2);
+    if (_use_submap == true)
+      pcl::toROSMsg(*get_submap(), *map_msg_ptr);
+    else
+      pcl::toROSMsg(map, *map_msg_ptr);
+    ndt_map_pub.publish(*map_msg_ptr);
+  }
 
   q.setRPY(current_pose.roll, current_pose.pitch, current_pose.yaw);
   current_pose_msg.header.frame_id = "map";
@@ -379,7 +608,10 @@ static void points_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
   std::cout << "Number of scan points: " << scan_ptr->size() << " points." << std::endl;
   std::cout << "Number of filtered scan points: " << filtered_scan_ptr->size() << " points." << std::endl;
   std::cout << "transformed_scan_ptr: " << transformed_scan_ptr->points.size() << " points." << std::endl;
-  std::cout << "map: " << map.points.size() << " points." << std::endl;
+  if (_use_submap == true)
+    std::cout << "submap: " << submap_scans.size() << " scans, " << map_blocks.size() << " blocks." << std::endl;
+  else
+    std::cout << "map: " << map.points.size() << " points." << std::endl;
   std::cout << "NDT has converged: " << ndt.hasConverged() << std::endl;
   std::cout << "Fitness score: " << fitness_score << std::endl;
   std::cout << "Number of iteration: " << ndt.getFinalNumIteration() << std::endl;
@@ -442,6 +674,14 @@ int main(int argc, char** argv)
   // setting parameters
   private_nh.getParam("use_openmp", _use_openmp);
   std::cout << "use_openmp: " << _use_openmp << std::endl;
+  private_nh.getParam("use_submap", _use_submap);
+  private_nh.getParam("submap_size", _submap_size);
+  private_nh.getParam("map_block_size", _map_block_size);
+  private_nh.getParam("submap_directory", _submap_directory);
+  std::cout << "use_submap: " << _use_submap << std::endl;
+  std::cout << "submap_size: " << _submap_size << std::endl;
+  std::cout << "map_block_size: " << _map_block_size << std::endl;
+  std::cout << "submap_directory: " << _submap_directory << std::endl;
 
   if (nh.getParam("tf_x", _tf_x) == false)
   {
@@ -498,7 +738,24 @@ int main(int argc, char** argv)
   ros::Subscriber output_sub = nh.subscribe("config/ndt_mapping_output", 10, output_callback);
   ros::Subscriber points_sub = nh.subscribe("points_raw", 100000, points_callback);
 
+  std::thread saver;
+  if (_use_submap == true)
+    saver = std::thread(save_thread);
+
   ros::spin();
 
+  if (_use_submap == true)
+  {
+    // Save the rest of the map and wait for the writes
+    for (auto& block : map_blocks)
+      save_block_if_changed(block.second);
+    {
+      std::lock_guard<std::mutex> lock(save_mutex);
+      save_exit = true;
+    }
+    save_cond.notify_one();
+    saver.join();
+  }
+
   return 0;
 }
@@ -39,6 +39,10 @@
 #include <fstream>
 #include <string>
 #include <chrono>
+#include <map>
+#include <vector>
+#include <utility>
+#include <algorithm>
 
 #include <ros/ros.h>
 #include <std_msgs/Float32.h>
@@ -71,8 +75,17 @@
 
 #include <runtime_manager/ConfigNdt.h>
 
+#ifdef USE_FAST_PCL
+#include <map_file/PointsMapTile.h>
+#endif
+
 #include <ndt_localizer/ndt_stat.h>
 
+#ifdef BUILD_NODELET
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+#endif
+
 #define PREDICT_POSE_THRESHOLD 0.5
 
 #define Wa 0.4
@@ -180,9 +193,31 @@ static std::string _offset = "linear";  // linear, zero, quadratic
 static ros::Publisher ndt_reliability_pub;
 static std_msgs::Float32 ndt_reliability;
 
+static ros::Subscriber param_sub, gnss_sub, map_sub, initialpose_sub, points_sub;
+static ros::Subscriber tile_added_sub, tile_removed_sub;
+
 static bool _use_openmp = false;
 static bool _get_height = false;
 static bool _use_local_transform = false;
+static std::string _search_method = "kdtree";  // kdtree, direct1, direct7, direct26
+static bool _incremental_map = false;
+static double _map_block_size = 100.0;  // [m]
+
+#ifdef USE_FAST_PCL
+// Block of the map which is added to or evicted from the NDT target as a whole.
+struct map_block
+{
+  pcl::PointCloud<pcl::PointXYZ>::Ptr cloud;
+  double sum_x, sum_y, sum_z;  // Used with the number of points to detect changed blocks
+};
+
+static std::map<int, map_block> map_blocks;
+
+// Tiles of points_map_loader (publish_tiles), applied to NDT together before the next scan is matched.
+static std::map<int, pcl::PointCloud<pcl::PointXYZ>::Ptr> pending_tiles_added;
+static std::vector<int> pending_tiles_removed;
+static bool map_tiles_used = false;
+#endif
 
 static std::ofstream ofs;
 static std::string filename;
@@ -283,8 +318,174 @@ static void param_callback(const runtime_manager::ConfigNdt::ConstPtr& input)
   }
 }
 
+static void lookup_local_transform()
+{
+  tf::TransformListener local_transform_listener;
+  try
+  {
+    ros::Time now = ros::Time(0);
+    local_transform_listener.waitForTransform("/map", "/world", now, ros::Duration(10.0));
+    local_transform_listener.lookupTransform("/map", "world", now, local_transform);
+  }
+  catch (tf::TransformException& ex)
+  {
+    ROS_ERROR("%s", ex.what());
+  }
+}
+
+#ifdef USE_FAST_PCL
+static void set_default_ndt_params()
+{
+  ndt.setMaximumIterations(max_iter);
+  ndt.setResolution(ndt_res);
+  ndt.setStepSize(step_size);
+  ndt.setTransformationEpsilon(trans_eps);
+}
+
+static int get_map_block_id(const pcl::PointXYZ& p)
+{
+  int block_x = static_cast<int>(std::floor(p.x / _map_block_size));
+  int block_y = static_cast<int>(std::floor(p.y / _map_block_size));
+  // 16 bits per axis, shifted as unsigned so that negative blocks do not overflow
+  return static_cast<int>(((static_cast<uint32_t>(block_x) & 0xFFFF) << 16) | (static_cast<uint32_t>(block_y) & 0xFFFF));
+}
+
+// Split the map into blocks and only hand the blocks that entered, left or changed to NDT, in one update.
+static void update_map_blocks(const pcl::PointCloud<pcl::PointXYZ>& new_map)
+{
+  std::map<int, map_block> blocks;
+  for (const auto& p : new_map)
+  {
+    map_block& block = blocks[get_map_block_id(p)];
+    if (!block.cloud)
+    {
+      block.cloud.reset(new pcl::PointCloud<pcl::PointXYZ>);
+      block.sum_x = block.sum_y = block.sum_z = 0.0;
+    }
+    block.cloud->push_back(p);
+    block.sum_x += p.x;
+    block.sum_y += p.y;
+    block.sum_z += p.z;
+  }
+
+  std::vector<std::pair<int, pcl::PointCloud<pcl::PointXYZ>::ConstPtr> > added;
+  std::vector<int> removed;
+
+  // Evict the blocks which are not in the map anymore
+  for (const auto& old_block : map_blocks)
+  {
+    if (blocks.find(old_block.first) == blocks.end())
+      removed.push_back(old_block.first);
+  }
+
+  // Add the new and changed blocks
+  for (auto& block : blocks)
+  {
+    std::map<int, map_block>::const_iterator old_block = map_blocks.find(block.first);
+    if (old_block != map_blocks.end() && old_block->second.cloud->size() == block.second.cloud->size() &&
+        old_block->second.sum_x == block.second.sum_x && old_block->second.sum_y == block.second.sum_y &&
+        old_block->second.sum_z == block.second.sum_z)
+    {
+      continue;
+    }
+    added.push_back(std::make_pair(block.first, block.second.cloud));
+  }
+
+  if (!added.empty() || !removed.empty())
+    ndt.updateTargetBlocks(added, removed);
+
+  map_blocks.swap(blocks);
+
+  std::cout << "Map blocks updated: " << added.size() << " added, " << removed.size() << " removed, "
+            << map_blocks.size() << " in use." << std::endl;
+}
+
+static void tile_added_callback(const map_file::PointsMapTile::ConstPtr& input)
+{
+  pcl::PointCloud<pcl::PointXYZ>::Ptr tile(new pcl::PointCloud<pcl::PointXYZ>);
+  pcl::fromROSMsg(input->points, *tile);
+
+  if (_use_local_transform == true)
+  {
+    if (map_loaded == 0 && map_tiles_used == false)
+      lookup_local_transform();
+    pcl_ros::transformPointCloud(*tile, *tile, local_transform.inverse());
+  }
+
+  // Drop the blocks split from points_map, their ids do not share a namespace with the tile ids
+  if (map_tiles_used == false && !map_blocks.empty())
+  {
+    std::vector<int> block_ids;
+    for (const auto& block : map_blocks)
+      block_ids.push_back(block.first);
+    ndt.removeTargetBlocks(block_ids);
+    map_blocks.clear();
+  }
+
+  pending_tiles_removed.erase(std::remove(pending_tiles_removed.begin(), pending_tiles_removed.end(), input->info.id),
+                              pending_tiles_removed.end());
+  pending_tiles_added[input->info.id] = tile;
+  map_tiles_used = true;
+}
+
+static void tile_removed_callback(const map_file::PointsMapTileInfo::ConstPtr& input)
+{
+  pending_tiles_added.erase(input->id);
+  pending_tiles_removed.push_back(input->id);
+}
+
+// The tiles received since the last scan are voxelized in one step, their ids are the block ids.
+static void apply_pending_tiles()
+{
+  if (pending_tiles_added.empty() && pending_tiles_removed.empty())
+    return;
+
+  if (map_loaded == 0)
+    set_default_ndt_params();
+
+  std::vector<std::pair<int, pcl::PointCloud<pcl::PointXYZ>::ConstPtr> > added(pending_tiles_added.begin(),
+                                                                               pending_tiles_added.end());
+  ndt.updateTargetBlocks(added, pending_tiles_removed);
+
+  std::cout << "Map tiles updated: " << added.size() << " added, " << pending_tiles_removed.size() << " removed."
+            << std::endl;
+
+  pending_tiles_added.clear();
+  pending_tiles_removed.clear();
+  map_loaded = 1;
+}
+#endif
+
 static void map_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
 {
+#ifdef USE_FAST_PCL
+  if (_incremental_map == true)
+  {
+    // The tiles already come as blocks, do not mix them with blocks of the whole map
+    if (map_tiles_used == true)
+      return;
+
+    pcl::fromROSMsg(*input, map);
+
+    if (_use_local_transform == true)
+    {
+      if (map_loaded == 0)
+        lookup_local_transform();
+
+      pcl_ros::transformPointCloud(map, map, local_transform.inverse());
+    }
+
+    if (map_loaded == 0)
+      set_default_ndt_params();
+
+    // Only the blocks which changed since the previous map are voxelized
+    update_map_blocks(map);
+
+    map_loaded = 1;
+    return;
+  }
+#endif
+
   if (map_loaded == 0)
   {
     // Convert the data type(from sensor_msgs to pcl).
@@ -292,18 +493,7 @@ static void map_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
 
     if (_use_local_transform == true)
     {
-      tf::TransformListener local_transform_listener;
-      try
-      {
-        ros::Time now = ros::Time(0);
-        local_transform_listener.waitForTransform("/map", "/world", now, ros::Duration(10.0));
-        local_transform_listener.lookupTransform("/map", "world", now, local_transform);
-      }
-      catch (tf::TransformException& ex)
-      {
-        ROS_ERROR("%s", ex.what());
-      }
-
+      lookup_local_transform();
       pcl_ros::transformPointCloud(map, map, local_transform.inverse());
     }
 
@@ -427,6 +617,10 @@ static void initialpose_callback(const geometry_msgs::PoseWithCovarianceStamped:
 
 static void points_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
 {
+#ifdef USE_FAST_PCL
+  apply_pending_tiles();
+#endif
+
   if (map_loaded == 1 && init_pos_set == 1)
   {
     matching_start = std::chrono::system_clock::now();
@@ -840,13 +1034,8 @@ static void points_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
   }
 }
 
-int main(int argc, char** argv)
+static bool setup(ros::NodeHandle& nh, ros::NodeHandle& private_nh)
 {
-  ros::init(argc, argv, "ndt_matching");
-
-  ros::NodeHandle nh;
-  ros::NodeHandle private_nh("~");
-
   // Set log file name.
   char buffer[80];
   std::time_t now = std::time(NULL);
@@ -862,42 +1051,45 @@ int main(int argc, char** argv)
   private_nh.getParam("use_openmp", _use_openmp);
   private_nh.getParam("get_height", _get_height);
   private_nh.getParam("use_local_transform", _use_local_transform);
+  private_nh.getParam("search_method", _search_method);
+  private_nh.getParam("incremental_map", _incremental_map);
+  private_nh.getParam("map_block_size", _map_block_size);
 
   if (nh.getParam("localizer", _localizer) == false)
   {
     std::cout << "localizer is not set." << std::endl;
-    return 1;
+    return false;
   }
 
   if (nh.getParam("tf_x", _tf_x) == false)
   {
     std::cout << "tf_x is not set." << std::endl;
-    return 1;
+    return false;
   }
   if (nh.getParam("tf_y", _tf_y) == false)
   {
     std::cout << "tf_y is not set." << std::endl;
-    return 1;
+    return false;
   }
   if (nh.getParam("tf_z", _tf_z) == false)
   {
     std::cout << "tf_z is not set." << std::endl;
-    return 1;
+    return false;
   }
   if (nh.getParam("tf_roll", _tf_roll) == false)
   {
     std::cout << "tf_roll is not set." << std::endl;
-    return 1;
+    return false;
   }
   if (nh.getParam("tf_pitch", _tf_pitch) == false)
   {
     std::cout << "tf_pitch is not set." << std::endl;
-    return 1;
+    return false;
   }
   if (nh.getParam("tf_yaw", _tf_yaw) == false)
   {
     std::cout << "tf_yaw is not set." << std::endl;
-    return 1;
+    return false;
   }
 
   std::cout << "-----------------------------------------------------------------" << std::endl;
@@ -908,6 +1100,9 @@ int main(int argc, char** argv)
   std::cout << "use_openmp: " << _use_openmp << std::endl;
   std::cout << "get_height: " << _get_height << std::endl;
   std::cout << "use_local_transform: " << _use_local_transform << std::endl;
+  std::cout << "search_method: " << _search_method << std::endl;
+  std::cout << "incremental_map: " << _incremental_map << std::endl;
+  std::cout << "map_block_size: " << _map_block_size << std::endl;
   std::cout << "localizer: " << _localizer << std::endl;
   std::cout << "(tf_x,tf_y,tf_z,tf_roll,tf_pitch,tf_yaw): (" << _tf_x << ", " << _tf_y << ", " << _tf_z << ", "
             << _tf_roll << ", " << _tf_pitch << ", " << _tf_yaw << ")" << std::endl;
@@ -925,6 +1120,17 @@ int main(int argc, char** argv)
   Eigen::AngleAxisf rot_z_ltob((-1.0) * _tf_yaw, Eigen::Vector3f::UnitZ());
   tf_ltob = (tl_ltob * rot_z_ltob * rot_y_ltob * rot_x_ltob).matrix();
 
+#ifdef USE_FAST_PCL
+  if (_search_method == "direct1")
+    ndt.setNeighborhoodSearchMethod(pcl::DIRECT1);
+  else if (_search_method == "direct7")
+    ndt.setNeighborhoodSearchMethod(pcl::DIRECT7);
+  else if (_search_method == "direct26")
+    ndt.setNeighborhoodSearchMethod(pcl::DIRECT26);
+  else if (_search_method != "kdtree")
+    std::cout << "Unknown search_method: " << _search_method << ", using kdtree." << std::endl;
+#endif
+
   // Updated in initialpose_callback or gnss_callback
   initial_pose.x = 0.0;
   initial_pose.y = 0.0;
@@ -947,13 +1153,49 @@ int main(int argc, char** argv)
   ndt_reliability_pub = nh.advertise<std_msgs::Float32>("/ndt_reliability", 1000);
 
   // Subscribers
-  ros::Subscriber param_sub = nh.subscribe("config/ndt", 10, param_callback);
-  ros::Subscriber gnss_sub = nh.subscribe("gnss_pose", 10, gnss_callback);
-  ros::Subscriber map_sub = nh.subscribe("points_map", 10, map_callback);
-  ros::Subscriber initialpose_sub = nh.subscribe("initialpose", 1000, initialpose_callback);
-  ros::Subscriber points_sub = nh.subscribe("filtered_points", _queue_size, points_callback);
+  param_sub = nh.subscribe("config/ndt", 10, param_callback);
+  gnss_sub = nh.subscribe("gnss_pose", 10, gnss_callback);
+  map_sub = nh.subscribe("points_map", 10, map_callback);
+  initialpose_sub = nh.subscribe("initialpose", 1000, initialpose_callback);
+  points_sub = nh.subscribe("filtered_points", _queue_size, points_callback);
+#ifdef USE_FAST_PCL
+  if (_incremental_map == true)
+  {
+    tile_added_sub = nh.subscribe("points_map_tile_added", 100, tile_added_callback);
+    tile_removed_sub = nh.subscribe("points_map_tile_removed", 100, tile_removed_callback);
+  }
+#endif
+
+  return true;
+}
+
+#ifdef BUILD_NODELET
+namespace ndt_localizer
+{
+class NdtMatchingNodelet : public nodelet::Nodelet
+{
+  virtual void onInit()
+  {
+    if (setup(getNodeHandle(), getPrivateNodeHandle()) == false)
+      NODELET_ERROR("ndt_matching is not configured.");
+  }
+};
+}  // namespace ndt_localizer
+
+PLUGINLIB_EXPORT_CLASS(ndt_localizer::NdtMatchingNodelet, nodelet::Nodelet)
+#else
+int main(int argc, char** argv)
+{
+  ros::init(argc, argv, "ndt_matching");
+
+  ros::NodeHandle nh;
+  ros::NodeHandle private_nh("~");
+
+  if (setup(nh, private_nh) == false)
+    return 1;
 
   ros::spin();
 
   return 0;
 }
+#endif
@@ -42,8 +42,6 @@
 
 /*grobal variables*/
 NDMapPtr NDmap; /*���ֲ�����*/
-NDPtr NDs;
-int NDs_num;
 
 char scan_file_base_name[100];
 
@@ -625,11 +623,15 @@ int update_covariance(NDPtr nd)
   return 1;
 }
 
+/*root ND and the cells below it on each axis*/
+static const int nd_offset[8][3] = { { 0, 0, 0 }, { 1, 0, 0 }, { 0, 1, 0 }, { 1, 1, 0 },
+                                     { 0, 0, 1 }, { 1, 0, 1 }, { 0, 1, 1 }, { 1, 1, 1 } };
+
 /*add point to ndmap*/
 int add_point_map(NDMapPtr ndmap, PointPtr point)
 {
   int x, y, z, i;
-  NDPtr *ndp[8];
+  NDPtr ndp;
 
   /*
 
@@ -654,23 +656,12 @@ int add_point_map(NDMapPtr ndmap, PointPtr point)
   if (z < 1 || z >= ndmap->z)
     return 0;
 
-  /*select root ND*/
-  ndp[0] = ndmap->nd + x * ndmap->to_x + y * ndmap->to_y + z;
-  ndp[1] = ndp[0] - ndmap->to_x;
-  ndp[2] = ndp[0] - ndmap->to_y;
-  ndp[4] = ndp[0] - 1;
-  ndp[3] = ndp[2] - ndmap->to_x;
-  ndp[5] = ndp[4] - ndmap->to_x;
-  ndp[6] = ndp[4] - ndmap->to_y;
-  ndp[7] = ndp[3] - 1;
-
   /*add  point to map */
   for (i = 0; i < 8; i++)
   {
-    if ((*ndp[i]) == 0)
-      *ndp[i] = add_ND();
-    if ((*ndp[i]) != 0)
-      add_point_covariance(*ndp[i], point);
+    ndp = add_ND_cell(ndmap, x - nd_offset[i][0], y - nd_offset[i][1], z - nd_offset[i][2]);
+    if (ndp != 0)
+      add_point_covariance(ndp, point);
   }
 
   if (ndmap->next)
@@ -686,7 +677,7 @@ int get_ND(NDMapPtr ndmap, PointPtr point, NDPtr *nd, int ndmode)
 {
   int x, y, z;
   int i;
-  NDPtr *ndp[8];
+  NDPtr ndp;
 
   /*
     
@@ -725,23 +716,14 @@ int get_ND(NDMapPtr ndmap, PointPtr point, NDPtr *nd, int ndmode)
   if (z < 1 || z >= ndmap->z)
     return 0;
 
-  /*select root ND*/
-  ndp[0] = ndmap->nd + x * ndmap->to_x + y * ndmap->to_y + z;
-  ndp[1] = ndp[0] - ndmap->to_x;
-  ndp[2] = ndp[0] - ndmap->to_y;
-  ndp[4] = ndp[0] - 1;
-  ndp[3] = ndp[2] - ndmap->to_x;
-  ndp[5] = ndp[4] - ndmap->to_x;
-  ndp[6] = ndp[4] - ndmap->to_y;
-  ndp[7] = ndp[3] - 1;
-
   for (i = 0; i < 8; i++)
   {
-    if (*ndp[i] != 0)
+    ndp = find_ND_cell(ndmap, x - nd_offset[i][0], y - nd_offset[i][1], z - nd_offset[i][2]);
+    if (ndp != 0)
     {
-      if (!(*ndp[i])->flag)
-        update_covariance(*ndp[i]);
-      nd[i] = *ndp[i];
+      if (!ndp->flag)
+        update_covariance(ndp);
+      nd[i] = ndp;
     }
     else
     {
@@ -753,85 +735,16 @@ int get_ND(NDMapPtr ndmap, PointPtr point, NDPtr *nd, int ndmode)
   return 1;
 }
 
-NDPtr add_ND(void)
-{
-  NDPtr ndp;
-  // int m;
-
-  if (NDs_num >= MAX_ND_NUM)
-  {
-    printf("over flow\n");
-    return 0;
-  }
-
-  ndp = NDs + NDs_num;
-  NDs_num++;
-
-  ndp->flag = 0;
-  ndp->sign = 0;
-  ndp->num = 0;
-  ndp->m_x = 0;
-  ndp->m_y = 0;
-  ndp->m_z = 0;
-  ndp->c_xx = 0;
-  ndp->c_yy = 0;
-  ndp->c_zz = 0;
-  ndp->c_xy = 0;
-  ndp->c_yz = 0;
-  ndp->c_zx = 0;
-  ndp->w = 1;
-  ndp->is_source = 0;
-
-  return ndp;
-}
-
 NDMapPtr initialize_NDmap_layer(int layer, NDMapPtr child)
 {
-  // int i,j,k,i2,i3,m;
-  int i, j, k;
   int x, y, z;
-  NDPtr *nd, *ndp;
-  NDMapPtr ndmap;
-
-  //  i2 = i3 = 0;
-  //  printf("Initializing...layer %d\n",layer);
 
   x = (g_map_x >> layer) + 1;
   y = (g_map_y >> layer) + 1;
   z = (g_map_z >> layer) + 1;
 
-  /*����γ��ݡ�*/
-  nd = (NDPtr *)malloc(x * y * z * sizeof(NDPtr));
-  ndmap = (NDMapPtr)malloc(sizeof(NDMap));
-
-  ndmap->x = x;
-  ndmap->y = y;
-  ndmap->z = z;
-  ndmap->to_x = y * z;
-  ndmap->to_y = z;
-  ndmap->layer = layer;
-  ndmap->nd = nd;
-  ndmap->next = child;
-  ndmap->size = g_map_cellsize * ((int)1 << layer);
-  //  printf("size %f\n",ndmap->size);
-
-  ndp = nd;
-
-  /*�쥤�䡼�ν��*/
-  for (i = 0; i < x; i++)
-  {
-    for (j = 0; j < y; j++)
-    {
-      for (k = 0; k < z; k++)
-      {
-        *ndp = 0;
-        ndp++;
-      }
-    }
-  }
-
-  /*�쥤�䡼�֤�Ϣ�롩*/
-  return ndmap;
+  /*cells are only allocated where points are added*/
+  return create_NDmap_layer(layer, x, y, z, g_map_cellsize * ((int)1 << layer), child);
 }
 
 /*ND�ܥ�����ν��*/
@@ -839,16 +752,12 @@ NDMapPtr initialize_NDmap(void)
 {
   int i;
   NDMapPtr ndmap;
-  NDPtr null_nd;
 
   printf("Initialize NDmap\n");
   ndmap = 0;
 
-  // init NDs
-  NDs = (NDPtr)malloc(sizeof(NormalDistribution) * MAX_ND_NUM);
-  NDs_num = 0;
-
-  null_nd = add_ND();
+  // init NDs, the first one is the empty ND
+  NDs = add_ND();
 
   for (i = LAYER_NUM - 1; i >= 0; i--)
   {
@@ -949,10 +858,10 @@ void load(char *name)
 
 void save_nd_map(char *name)
 {
-  int i, j, k, layer;
+  int i, layer;
   NDData nddat;
   NDMapPtr ndmap;
-  NDPtr *ndp;
+  NDPtr ndp;
   FILE *ofp;
 
   // for pcd
@@ -970,35 +879,20 @@ void save_nd_map(char *name)
 
   for (layer = 0; layer < 2; layer++)
   {
-    ndp = ndmap->nd;
-    /*�쥤�䡼�ν��*/
-    for (i = 0; i < ndmap->x; i++)
+    i = 0;
+    while (next_ND_cell(ndmap, &i, &nddat.x, &nddat.y, &nddat.z, &ndp))
     {
-      for (j = 0; j < ndmap->y; j++)
-      {
-        for (k = 0; k < ndmap->z; k++)
-        {
-          if (*ndp)
-          {
-            update_covariance(*ndp);
-            nddat.nd = **ndp;
-            nddat.x = i;
-            nddat.y = j;
-            nddat.z = k;
-            nddat.layer = layer;
-
-            fwrite(&nddat, sizeof(NDData), 1, ofp);
-
-            // regist the point to pcd data;
-            p.x = (*ndp)->mean.x;
-            p.y = (*ndp)->mean.y;
-            p.z = (*ndp)->mean.z;
-            cloud.points.push_back(p);
-          }
-          ndp++;
-        }
-      }
-      //      printf("a\n");
+      update_covariance(ndp);
+      nddat.nd = *ndp;
+      nddat.layer = layer;
+
+      fwrite(&nddat, sizeof(NDData), 1, ofp);
+
+      // regist the point to pcd data;
+      p.x = ndp->mean.x;
+      p.y = ndp->mean.y;
+      p.z = ndp->mean.z;
+      cloud.points.push_back(p);
     }
     ndmap = ndmap->next;
   }
@@ -1068,9 +962,10 @@ int load_nd_map(char *name)
 
   while (fread(&nddat, sizeof(NDData), 1, ifp) > 0)
   {
-    ndp = add_ND();
+    ndp = add_ND_cell(ndmap[nddat.layer], nddat.x, nddat.y, nddat.z);
+    if (!ndp)
+      continue;
     *ndp = nddat.nd;
-    *(ndmap[nddat.layer]->nd + nddat.x * ndmap[nddat.layer]->to_x + nddat.y * ndmap[nddat.layer]->to_y + nddat.z) = ndp;
     ndp->flag = 0;
     update_covariance(ndp);
     // fprintf(logfp,"%f %f %f \n",ndp->mean.x, ndp->mean.y, ndp->mean.z);
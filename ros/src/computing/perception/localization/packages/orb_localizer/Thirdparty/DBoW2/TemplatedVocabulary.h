@@ -26,6 +26,8 @@
 #include <algorithm>
 #include <opencv2/core/core.hpp>
 #include <limits>
+#include <cstring>
+#include <stdint.h>
 
 #include "DUtils/Random.h"
 #include "BowVector.h"
@@ -245,6 +247,23 @@ public:
    */
   void saveToTextFile(const std::string &filename) const;  
 
+  /**
+   * Loads the vocabulary from a binary file written by saveToBinaryFile.
+   * The descriptors of all the nodes share one block, so the descriptor
+   * type must be a single row cv::Mat of F::L bytes (binary descriptors
+   * such as FORB)
+   * @param filename
+   * @return false if the file cannot be read or is not a binary vocabulary
+   */
+  bool loadFromBinaryFile(const std::string &filename);
+
+  /**
+   * Saves the vocabulary into a binary file
+   * @param filename
+   * @return false if the file cannot be written
+   */
+  bool saveToBinaryFile(const std::string &filename) const;
+
   /**
    * Saves the vocabulary into a file
    * @param filename
@@ -1449,6 +1468,192 @@ void TemplatedVocabulary<TDescriptor,F>::saveToTextFile(const std::string &filen
 
 // --------------------------------------------------------------------------
 
+// Binary vocabulary file:
+//   header (BinaryVocabularyHeader)
+//   parent id of nodes 1..N-1 (uint32)
+//   leaf flag of nodes 1..N-1 (uint8)
+//   weight of nodes 1..N-1 (double)
+//   descriptor of nodes 1..N-1 (F::L bytes each)
+// Nodes are stored in id order, as in the text file, so the children and
+// word ids come out the same as with loadFromTextFile. The node and word
+// counts of the header are checked against the file size before reading.
+
+struct BinaryVocabularyHeader
+{
+  char signature[8];
+  int32_t k;
+  int32_t L;
+  int32_t scoring;
+  int32_t weighting;
+  int32_t descriptor_length;
+  uint32_t nodes;
+  uint32_t words;
+};
+
+static const char BinaryVocabularySignature[8] = {'D','B','o','W','2','B','N','2'};
+
+template<class TDescriptor, class F>
+bool TemplatedVocabulary<TDescriptor,F>::loadFromBinaryFile(const std::string &filename)
+{
+    ifstream f(filename.c_str(), ios_base::in | ios_base::binary);
+    if(!f.is_open())
+        return false;
+
+    BinaryVocabularyHeader header;
+    f.read((char*)&header, sizeof(header));
+    if(!f || memcmp(header.signature, BinaryVocabularySignature, sizeof(header.signature)) != 0 ||
+       header.descriptor_length != F::L)
+    {
+        std::cerr << "Vocabulary loading failure: This is not a correct binary file!" << endl;
+        return false;
+    }
+
+    if(header.k<0 || header.k>20 || header.L<1 || header.L>10 ||
+       header.scoring<0 || header.scoring>5 || header.weighting<0 || header.weighting>3)
+    {
+        std::cerr << "Vocabulary loading failure: This is not a correct binary file!" << endl;
+        return false;
+    }
+
+    // a tree of branching k and depth L has at most k + k^2 + ... + k^L nodes
+    // besides the root, and the file must hold exactly the nodes announced
+    double max_nodes = 0, level = 1;
+    for(int i=0; i<header.L; i++)
+        max_nodes += (level *= header.k);
+
+    const size_t n = header.nodes;
+    const std::streamoff data_begin = f.tellg();
+    f.seekg(0, ios_base::end);
+    const std::streamoff data_size = f.tellg() - data_begin;
+    f.seekg(data_begin);
+
+    if(!f || n > max_nodes || header.words > n ||
+       data_size != (std::streamoff)(n*(sizeof(uint32_t) + sizeof(uint8_t) + sizeof(double) + F::L)))
+    {
+        std::cerr << "Vocabulary loading failure: The binary file is truncated or corrupted!" << endl;
+        return false;
+    }
+
+    vector<uint32_t> parents(n);
+    vector<uint8_t> leaves(n);
+    vector<double> weights(n);
+    // one block for all the descriptors instead of one allocation per node
+    cv::Mat descriptors(n, F::L, CV_8U);
+
+    if(n > 0)
+    {
+        f.read((char*)&parents[0], n*sizeof(uint32_t));
+        f.read((char*)&leaves[0], n*sizeof(uint8_t));
+        f.read((char*)&weights[0], n*sizeof(double));
+        f.read((char*)descriptors.data, n*F::L);
+    }
+    size_t words = 0;
+    for(size_t i=0; i<n; i++)
+        if(leaves[i]) words++;
+
+    if(!f || words != header.words)
+    {
+        std::cerr << "Vocabulary loading failure: The binary file is truncated or corrupted!" << endl;
+        return false;
+    }
+
+    m_k = header.k;
+    m_L = header.L;
+    m_scoring = (ScoringType)header.scoring;
+    m_weighting = (WeightingType)header.weighting;
+    createScoringObject();
+
+    m_words.clear();
+    m_nodes.clear();
+
+    m_nodes.resize(n+1);
+    m_words.resize(words);
+    m_nodes[0].id = 0;
+
+    int wid = 0;
+    for(size_t i=0; i<n; i++)
+    {
+        const NodeId nid = i+1;
+        Node &node = m_nodes[nid];
+        node.id = nid;
+        node.parent = parents[i];
+        if(node.parent >= nid)
+        {
+            std::cerr << "Vocabulary loading failure: Bad parent in the binary file!" << endl;
+            m_nodes.clear();
+            m_words.clear();
+            return false;
+        }
+        m_nodes[node.parent].children.push_back(nid);
+
+        node.descriptor = descriptors.row(i);
+        node.weight = weights[i];
+
+        if(leaves[i])
+        {
+            node.word_id = wid;
+            m_words[wid++] = &node;
+        }
+        else
+        {
+            node.children.reserve(m_k);
+        }
+    }
+
+    return true;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+bool TemplatedVocabulary<TDescriptor,F>::saveToBinaryFile(const std::string &filename) const
+{
+    ofstream f(filename.c_str(), ios_base::out | ios_base::binary | ios_base::trunc);
+    if(!f.is_open())
+        return false;
+
+    BinaryVocabularyHeader header;
+    memcpy(header.signature, BinaryVocabularySignature, sizeof(header.signature));
+    header.k = m_k;
+    header.L = m_L;
+    header.scoring = m_scoring;
+    header.weighting = m_weighting;
+    header.descriptor_length = F::L;
+    header.nodes = m_nodes.empty() ? 0 : m_nodes.size()-1;
+    header.words = 0;
+
+    const size_t n = header.nodes;
+    vector<uint32_t> parents(n);
+    vector<uint8_t> leaves(n);
+    vector<double> weights(n);
+    vector<unsigned char> descriptors(n*F::L);
+
+    for(size_t i=0; i<n; i++)
+    {
+        const Node &node = m_nodes[i+1];
+        parents[i] = node.parent;
+        // a word is a node of m_words, a childless node is not necessarily one
+        leaves[i] = (node.word_id < m_words.size() && m_words[node.word_id] == &node) ? 1 : 0;
+        weights[i] = node.weight;
+        memcpy(&descriptors[i*F::L], node.descriptor.data, F::L);
+        header.words += leaves[i];
+    }
+
+    f.write((const char*)&header, sizeof(header));
+    if(n > 0)
+    {
+        f.write((const char*)&parents[0], n*sizeof(uint32_t));
+        f.write((const char*)&leaves[0], n*sizeof(uint8_t));
+        f.write((const char*)&weights[0], n*sizeof(double));
+        f.write((const char*)&descriptors[0], descriptors.size());
+    }
+    f.close();
+
+    return !f.fail();
+}
+
+// --------------------------------------------------------------------------
+
 template<class TDescriptor, class F>
 void TemplatedVocabulary<TDescriptor,F>::save(const std::string &filename) const
 {
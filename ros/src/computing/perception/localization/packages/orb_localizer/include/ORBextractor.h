@@ -23,6 +23,7 @@
 
 #include <vector>
 #include <list>
+#include <utility>
 #include <opencv/cv.h>
 
 
@@ -108,6 +109,21 @@ protected:
     std::vector<float> mvInvScaleFactor;    
     std::vector<float> mvLevelSigma2;
     std::vector<float> mvInvLevelSigma2;
+
+    // Grid of FAST cells of one level
+    struct CellGrid
+    {
+        int minBorderX, minBorderY, maxBorderX, maxBorderY;
+        int nCols, nRows, wCell, hCell;
+    };
+
+    // Work buffers kept between frames: bordered images the pyramid levels point into,
+    // blurred levels for the descriptors, FAST corners per level and row of cells
+    std::vector<cv::Mat> mvPyramidBuffer;
+    std::vector<cv::Mat> mvBlurredPyramid;
+    std::vector<std::vector<std::vector<cv::KeyPoint> > > mvRowKeys;
+    std::vector<std::vector<cv::KeyPoint> > mvToDistributeKeys;
+    std::vector<std::pair<int,int> > mvFastTasks;
 };
 
 } //namespace ORB_SLAM
@@ -43,6 +43,10 @@ public:
     // Computes the Hamming distance between two ORB descriptors
     static int DescriptorDistance(const cv::Mat &a, const cv::Mat &b);
 
+    // Computes the Hamming distances between descriptor a and n candidate descriptors stored back to back (32 bytes each).
+    // Uses AVX2 or POPCNT when the CPU supports them
+    static void DescriptorDistances(const unsigned char *a, const unsigned char *candidates, int n, int *dists);
+
     // Search matches between Frame keypoints and projected MapPoints. Returns number of matches
     // Used to track the local map (Tracking)
     int SearchByProjection(Frame &F, const std::vector<MapPoint*> &vpMapPoints, const float th=3);
@@ -20,11 +20,15 @@
 
 
 #include <cstdlib>
+#include <ctime>
 #include <vector>
 #include <cmath>
 #include <mutex>
 #include <thread>
-//#include <functional>
+#include <atomic>
+#include <random>
+#include <algorithm>
+#include "ThreadPool.h"
 
 
 
@@ -34,22 +38,91 @@ using namespace std;
 namespace PF
 {
 
+/*
+ * Random numbers for the vehicle models. Inside a ParticleFilter step
+ * every chunk of particles draws from a generator of its own (see
+ * RandomStreamBinding), so the particles do not depend on which thread
+ * runs which chunk. Anywhere else every thread draws from its own
+ * generator. seedRandom() reseeds all of them.
+ */
+inline std::atomic<unsigned int> &randomSeed()
+{
+	static std::atomic<unsigned int> seed (5489u);
+	return seed;
+}
+
+inline std::atomic<unsigned int> &randomGeneration()
+{
+	static std::atomic<unsigned int> generation (0);
+	return generation;
+}
+
+inline void seedRandom (unsigned int seed)
+{
+	randomSeed() = seed;
+	randomGeneration()++;
+}
+
+// generator bound to the calling thread by RandomStreamBinding, if any
+inline std::mt19937_64 *&boundRandomEngine()
+{
+	thread_local std::mt19937_64 *engine = NULL;
+	return engine;
+}
+
+// Makes the calling thread draw from the given generator until the end of the scope
+class RandomStreamBinding
+{
+public:
+	explicit RandomStreamBinding (std::mt19937_64 &engine) :
+		previous (boundRandomEngine())
+	{ boundRandomEngine() = &engine; }
+
+	~RandomStreamBinding ()
+	{ boundRandomEngine() = previous; }
+
+private:
+	RandomStreamBinding (const RandomStreamBinding&);
+	RandomStreamBinding &operator= (const RandomStreamBinding&);
+
+	std::mt19937_64 *previous;
+};
+
+inline std::mt19937_64 &randomEngine()
+{
+	if (boundRandomEngine() != NULL)
+		return *boundRandomEngine();
+
+	static std::atomic<unsigned int> streams (0);
+	thread_local std::mt19937_64 engine;
+	thread_local unsigned int generation = (unsigned int)-1;
+
+	if (generation != randomGeneration()) {
+		generation = randomGeneration();
+		engine.seed (randomSeed() + 7919u * (streams++));
+	}
+	return engine;
+}
+
+// uniform in [0, 1), 53 random bits from one draw
 inline double frandom()
-{ return (double)rand() / (double)RAND_MAX; }
+{ return (randomEngine()() >> 11) * (1.0/9007199254740992.0); }
 
 
 inline double nrand(double stdDev)
 {
 	return
 		stdDev * sqrt(-2.0*log(
-			frandom())) * cos(2.0*M_PI*frandom());
+			1.0-frandom())) * cos(2.0*M_PI*frandom());
 }
 
 
 /*
  * Base Class for Particle Fusion
  * What you need is implement these virtual functions,
- * and add your own callback for incoming measurement
+ * and add your own callback for incoming measurement.
+ * The models are called from several threads at once,
+ * so they must not modify shared data.
  */
 template <
 	class State, class Observation, class MotionCtrl
@@ -65,29 +138,20 @@ public:
 };
 
 
-template<class State>
-class Particle
-{
-//friend class ParticleFilter<S, class _obs, class _ctrl>;
-public:
-	inline Particle ():
-		weight(0) {}
-
-	inline void swapState ()
-	{
-		State tmp;
-		tmp = previous;
-		previous = current;
-		current = previous;
-	}
-
-	State current;
-	State previous;
-	double weight;
-};
-
-
-
+/*
+ * Particles are kept as separate arrays of states and weights, and the
+ * prediction, weighting and resampling steps run in chunks of particles
+ * on a thread pool (the shared ORB_SLAM2::ThreadPool unless one is given).
+ * Resampling is systematic, each thread searches the prefix sum of the
+ * weights for the start of its chunk.
+ * The states stay an array of State: the filter does not know the fields
+ * of State, the models take and return whole states, and the only per
+ * particle numbers the filter itself touches, the weights, are already
+ * arrays of their own.
+ * Every chunk has its own generator, seeded from the seed and the chunk
+ * index, so a given seed and number of particles give the same particles
+ * whatever the number of threads.
+ */
 template <
 	class State, class Observation, class MotionCtrl
 	>
@@ -96,95 +160,117 @@ class ParticleFilter
 public:
 	ParticleFilter (
 		int numPart,
-		VehicleBase<State, Observation, MotionCtrl> &vh
+		VehicleBase<State, Observation, MotionCtrl> &vh,
+		ORB_SLAM2::ThreadPool *pool=NULL
 	) :
 		vehicle (vh),
-		numberOfParticle (numPart)
+		numberOfParticle (numPart),
+		threadPool (pool!=NULL ? *pool : ORB_SLAM2::ThreadPool::Instance())
 	{
-
-		particleList.resize(numberOfParticle);
-//		std::fill(particleList.begin(), particleList.end(), Particle<state>(stateInitializer));
-		srand(time(0));
+		states.resize(numberOfParticle);
+		resampled.resize(numberOfParticle);
+		weights.resize(numberOfParticle);
+		cumulativeWeights.resize(numberOfParticle);
+		chunkEngines.resize(numberOfChunks());
+		engineGeneration = randomGeneration() - 1;
+		seedRandom(time(0));
 	}
 
 	void initializeParticles ()
 	{
-		for (Particle<State> &particle: particleList) {
-			particle.current = vehicle.initializeParticleState();
-			particle.previous = vehicle.initializeParticleState();
-		}
+		reseedEngines();
+		forEachChunk ([this] (int begin, int end, int) {
+			for (int i=begin; i<end; i++)
+				states[i] = vehicle.initializeParticleState();
+		});
 	}
 
 	inline void update (const MotionCtrl &control, const vector<Observation> &observationList)
 	{
+		reseedEngines();
+
 		// Prediction
-		for (Particle<State> &p: particleList) {
-			p.current = vehicle.motionModel (p.previous, control);
-			p.swapState();
-		}
+		forEachChunk ([&] (int begin, int end, int) {
+			for (int i=begin; i<end; i++)
+				states[i] = vehicle.motionModel (states[i], control);
+		});
 
 		if (observationList.size()==0)
 			return;
 
-		// Importance factor
+		// Importance factor, and prefix sum of the weights inside each chunk
+		chunkSums.resize(numberOfChunks());
+		forEachChunk ([&] (int begin, int end, int chunk) {
+			double sum = 0;
+			for (int i=begin; i<end; i++) {
+				weights[i] = vehicle.measurementModel (states[i], observationList);
+				sum += weights[i];
+				cumulativeWeights[i] = sum;
+			}
+			chunkSums[chunk] = sum;
+		});
+
+		// Offsets of the chunks
 		double w_all = 0;
-		for (Particle<State> &p: particleList) {
-			p.weight = vehicle.measurementModel (p.current, observationList);
-			w_all += p.weight;
+		for (size_t c=0; c<chunkSums.size(); c++) {
+			double s = chunkSums[c];
+			chunkSums[c] = w_all;
+			w_all += s;
 		}
 
-		// Resampling
-		double r = frandom() / (double)numberOfParticle;
-		int i = 0;
-		double c = particleList[0].weight / w_all;
-
-		for (int p=0; p<numberOfParticle; p++) {
-			double U = r + p/((double)numberOfParticle);
-			while (U > c) {
-				i += 1;
-				c += particleList[i].weight / w_all;
-			}
-			particleList[p].current = particleList[i].previous;
+		forEachChunk ([&] (int begin, int end, int chunk) {
+			for (int i=begin; i<end; i++)
+				cumulativeWeights[i] += chunkSums[chunk];
+		});
+
+		// Systematic resampling: particle p takes the first state whose
+		// cumulative weight reaches (r + p) / N of the total
+		double r;
+		{
+			RandomStreamBinding binding (resampleEngine);
+			r = frandom();
 		}
+		const double step = w_all / numberOfParticle;
+		forEachChunk ([&] (int begin, int end, int) {
+			int i = std::lower_bound (cumulativeWeights.begin(), cumulativeWeights.end(), (r+begin)*step)
+				- cumulativeWeights.begin();
+			for (int p=begin; p<end; p++) {
+				const double U = (r+p)*step;
+				while (i < numberOfParticle-1 && U > cumulativeWeights[i])
+					i++;
+				resampled[p] = states[i];
+			}
+		});
 
-		for (Particle<State> &particle: particleList) {
-			particle.swapState();
-		}
+		states.swap(resampled);
 	}
 
 
 	inline vector<State> getStates ()
 	{
-		vector<State> states;
-		states.reserve(numberOfParticle);
-
-		for (Particle<State> &p: particleList) {
-			states.push_back(p.current);
-		}
-
 		return states;
 	}
 
 
+	// The pointers, like the references of getState() and getStateList(),
+	// are only valid until the next update(): resampling swaps the state
+	// array with a buffer that the update after it overwrites.
+	// statePtrList must hold getNumberOfParticles() elements.
 	inline void getStates (vector<State*> &statePtrList)
 	{
-		for (int i=0; i<particleList.size(); i++) {
-			Particle<State> &pt = particleList[i];
-			statePtrList[i] = &(pt.current);
+		for (int i=0; i<numberOfParticle; i++) {
+			statePtrList[i] = &(states[i]);
 		}
 	}
 
 
 	int getNumberOfParticles () const { return numberOfParticle; }
 
-	Particle<State> &getParticle(int num)
-	{
-		return particleList[num];
-	}
-
+	State &getState (int num)
+	{ return states[num]; }
 
-	vector < Particle<State> > &getParticleList () const
-	{ return particleList; }
+	const vector<State> &getStateList () const
+	{ return states; }
 
 
 //	virtual ~ParticleFilter();
@@ -192,10 +278,51 @@ public:
 protected:
 	VehicleBase<State, Observation, MotionCtrl> &vehicle;
 	int numberOfParticle;
-	vector < Particle<State> > particleList;
-};
+	ORB_SLAM2::ThreadPool &threadPool;
 
-#endif /* _PARTICLEFILTER_H_ */
+	vector<State> states;
+	vector<State> resampled;
+	vector<double> weights;
+	vector<double> cumulativeWeights;
+	vector<double> chunkSums;
+
+	vector<std::mt19937_64> chunkEngines;
+	std::mt19937_64 resampleEngine;
+	unsigned int engineGeneration;
+
+	static const int chunkSize = 1024;
+
+	int numberOfChunks () const
+	{ return (numberOfParticle + chunkSize - 1) / chunkSize; }
+
+	// Restarts the generators of the chunks after seedRandom()
+	void reseedEngines ()
+	{
+		if (engineGeneration == randomGeneration())
+			return;
+		engineGeneration = randomGeneration();
+
+		const unsigned int seed = randomSeed();
+		for (size_t c=0; c<chunkEngines.size(); c++) {
+			std::seed_seq sequence {seed, (unsigned int)c};
+			chunkEngines[c].seed (sequence);
+		}
+		std::seed_seq sequence {seed, (unsigned int)chunkEngines.size()};
+		resampleEngine.seed (sequence);
+	}
+
+	template <class Function>
+	void forEachChunk (const Function &f)
+	{
+		threadPool.ParallelFor (numberOfChunks(), [&] (int chunk) {
+			RandomStreamBinding binding (chunkEngines[chunk]);
+			const int begin = chunk * chunkSize;
+			f (begin, std::min (begin+chunkSize, numberOfParticle), chunk);
+		});
+	}
+};
 
 
 }
+
+#endif /* _PARTICLEFILTER_H_ */
@@ -0,0 +1,65 @@
+/*
+ * ThreadPool.h
+ *
+ * Persistent worker threads for the data parallel parts of the tracking
+ * front end (ORB extraction of both stereo images, pyramid levels and
+ * image cells), so no thread is created per frame.
+ */
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+
+namespace ORB_SLAM2
+{
+
+class ThreadPool
+{
+public:
+
+    // Pool shared by the whole process, one worker less than the number of cores
+    // because the calling thread works too
+    static ThreadPool& Instance();
+
+    explicit ThreadPool(int nWorkers);
+    ~ThreadPool();
+
+    // Runs task(0) ... task(n-1) and returns when all of them are done.
+    // The calling thread takes tasks as well, so ParallelFor can be called
+    // from inside a task and from several threads at once.
+    void ParallelFor(int n, const std::function<void(int)> &task);
+
+    int GetThreads() const { return mvWorkers.size()+1; }
+
+protected:
+
+    struct Batch
+    {
+        const std::function<void(int)> *task;
+        int n;
+        std::atomic<int> next;
+        std::atomic<int> done;
+    };
+
+    void Run();
+    void Finish(Batch *pBatch);
+
+    std::vector<std::thread> mvWorkers;
+    std::deque<Batch*> mlBatches;
+    std::mutex mMutex;
+    std::condition_variable mcvWork;
+    std::condition_variable mcvDone;
+    bool mbStop;
+};
+
+} //namespace ORB_SLAM
+
+#endif // THREADPOOL_H
@@ -0,0 +1,128 @@
+/*
+ * pf_benchmark.cc
+ *
+ * Times ParticleFilter::update() for 1k to 100k particles, on one thread
+ * and on the shared thread pool, with a planar constant velocity vehicle
+ * observed by noisy position fixes.
+ *
+ * Usage: pf_benchmark [iterations]
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstdlib>
+#include "ParticleFilter.h"
+
+
+using namespace std;
+
+
+struct PlanarState
+{
+	double x, y, vx, vy;
+};
+
+
+struct Fix
+{
+	double x, y;
+};
+
+
+class PlanarVehicle : public PF::VehicleBase<PlanarState, Fix, double>
+{
+public:
+	PlanarVehicle (double noise) : noise(noise) {}
+
+	PlanarState initializeParticleState () const
+	{
+		PlanarState s;
+		s.x = PF::nrand(5.0);
+		s.y = PF::nrand(5.0);
+		s.vx = 10.0 + PF::nrand(1.0);
+		s.vy = PF::nrand(1.0);
+		return s;
+	}
+
+	PlanarState motionModel (const PlanarState &vstate, const double &dt) const
+	{
+		PlanarState s;
+		s.vx = vstate.vx + PF::nrand(0.2);
+		s.vy = vstate.vy + PF::nrand(0.2);
+		s.x = vstate.x + s.vx*dt + PF::nrand(noise);
+		s.y = vstate.y + s.vy*dt + PF::nrand(noise);
+		return s;
+	}
+
+	double measurementModel (const PlanarState &state, const vector<Fix> &observations) const
+	{
+		double w = 0;
+		for (const Fix &f: observations) {
+			double dx = f.x-state.x, dy = f.y-state.y;
+			w = max(w, exp(-(dx*dx + dy*dy) / (2*noise*noise)));
+		}
+		return max(w, 1e-12);
+	}
+
+private:
+	double noise;
+};
+
+
+static double run (int numParticles, int iterations, ORB_SLAM2::ThreadPool *pool, double &error)
+{
+	const double dt = 0.05;
+	PlanarVehicle vehicle (0.5);
+	PF::ParticleFilter<PlanarState, Fix, double> filter (numParticles, vehicle, pool);
+	filter.initializeParticles();
+
+	double x = 0, y = 0, elapsed = 0;
+	vector<Fix> fixes (1);
+
+	for (int it=0; it<iterations; it++) {
+		x += 10.0*dt;
+		y += 0.5*sin(it*dt);
+		fixes[0].x = x + PF::nrand(0.5);
+		fixes[0].y = y + PF::nrand(0.5);
+
+		auto t0 = chrono::steady_clock::now();
+		filter.update (dt, fixes);
+		elapsed += chrono::duration<double, milli> (chrono::steady_clock::now()-t0).count();
+	}
+
+	double mx = 0, my = 0;
+	for (const PlanarState &s: filter.getStateList()) {
+		mx += s.x;
+		my += s.y;
+	}
+	mx /= numParticles;
+	my /= numParticles;
+	error = sqrt((mx-x)*(mx-x) + (my-y)*(my-y));
+
+	return elapsed / iterations;
+}
+
+
+int main (int argc, char **argv)
+{
+	int iterations = (argc > 1 ? atoi(argv[1]) : 100);
+	ORB_SLAM2::ThreadPool serial (0);
+	ORB_SLAM2::ThreadPool &shared = ORB_SLAM2::ThreadPool::Instance();
+
+	cout << "threads: " << shared.GetThreads() << ", iterations: " << iterations << endl;
+	cout << setw(10) << "particles" << setw(14) << "1 thread ms" << setw(14) << "pool ms"
+		<< setw(10) << "speedup" << setw(12) << "error m" << endl;
+	cout << fixed << setprecision(3);
+
+	const int counts[] = {1000, 10000, 30000, 100000};
+	for (int n: counts) {
+		double errorSerial, errorPool;
+		double ts = run (n, iterations, &serial, errorSerial);
+		double tp = run (n, iterations, &shared, errorPool);
+		cout << setw(10) << n << setw(14) << ts << setw(14) << tp
+			<< setw(10) << ts/tp << setw(12) << errorPool << endl;
+	}
+
+	return 0;
+}
@@ -21,7 +21,7 @@
 #include "Frame.h"
 #include "Converter.h"
 #include "ORBmatcher.h"
-#include <thread>
+#include "ThreadPool.h"
 
 namespace ORB_SLAM2
 {
@@ -74,11 +74,11 @@ Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeSt
     mvLevelSigma2 = mpORBextractorLeft->GetScaleSigmaSquares();
     mvInvLevelSigma2 = mpORBextractorLeft->GetInverseScaleSigmaSquares();
 
-    // ORB extraction
-    thread threadLeft(&Frame::ExtractORB,this,0,imLeft);
-    thread threadRight(&Frame::ExtractORB,this,1,imRight);
-    threadLeft.join();
-    threadRight.join();
+    // ORB extraction, left and right images at the same time on the shared pool
+    ThreadPool::Instance().ParallelFor(2, [&](int flag)
+    {
+        ExtractORB(flag, flag==0 ? imLeft : imRight);
+    });
 
     if(mvKeys.empty())
         return;
@@ -26,6 +26,13 @@
 #include <cstdio>
 #include <exception>
 #include <string>
+#include <cstring>
+#include <streambuf>
+#include <istream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <boost/archive/binary_oarchive.hpp>
 #include <boost/archive/binary_iarchive.hpp>
@@ -38,6 +45,63 @@ using std::string;
 namespace ORB_SLAM2
 {
 
+/*
+ * The map archive is read from a read-only mapping of the file, so the
+ * archive copies straight from the page cache instead of going through
+ * the fstream buffer, and the kernel reads the file ahead in large blocks.
+ */
+class MappedFile
+{
+public:
+	MappedFile (const string &filename) :
+		mData(NULL), mSize(0)
+	{
+		int fd = open (filename.c_str(), O_RDONLY);
+		if (fd < 0)
+			return;
+		struct stat st;
+		if (fstat (fd, &st)==0 && st.st_size > 0) {
+			void *p = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (p != MAP_FAILED) {
+				madvise (p, st.st_size, MADV_SEQUENTIAL);
+				madvise (p, st.st_size, MADV_WILLNEED);
+				mData = (const char*)p;
+				mSize = st.st_size;
+			}
+		}
+		close (fd);
+	}
+
+	~MappedFile()
+	{
+		if (mData != NULL)
+			munmap ((void*)mData, mSize);
+	}
+
+	bool isOpen() const { return mData != NULL; }
+	const char* data() const { return mData; }
+	size_t size() const { return mSize; }
+
+private:
+	MappedFile (const MappedFile&);
+	MappedFile& operator= (const MappedFile&);
+
+	const char *mData;
+	size_t mSize;
+};
+
+
+class MemoryStreamBuffer : public std::streambuf
+{
+public:
+	MemoryStreamBuffer (const char *begin, const char *end)
+	{
+		char *b = const_cast<char*>(begin);
+		setg (b, b, const_cast<char*>(end));
+	}
+};
+
+
 Map::Map():
 	mnMaxKFid(0),
 	mbMapUpdated(false)
@@ -208,16 +272,17 @@ void Map::loadFromDisk(const string &filename, KeyFrameDatabase *kfMemDb)
 	MapFileHeader header;
 
 	cout << "Opening " << filename << " ...\n";
-	fstream mapFileFd;
-	mapFileFd.open (filename.c_str(), fstream::in);
-	if (!mapFileFd.is_open())
+	MappedFile mapFile (filename);
+	if (!mapFile.isOpen() || mapFile.size() < sizeof(header))
 		throw BadMapFile();
-	mapFileFd.read ((char*)&header, sizeof(header));
+	memcpy (&header, mapFile.data(), sizeof(header));
 
 	if (strcmp(header.signature, signature) !=0)
 		throw BadMapFile();
 	cout << "Keyframes: " << header.numOfKeyFrame << ", MapPoint: " << header.numOfMapPoint << endl;
 
+	MemoryStreamBuffer mapBuffer (mapFile.data() + sizeof(header), mapFile.data() + mapFile.size());
+	std::istream mapFileFd (&mapBuffer);
 	boost::archive::binary_iarchive mapArchive (mapFileFd);
 
 	for (unsigned int p=0; p<header.numOfKeyFrame; p++) {
@@ -282,7 +347,6 @@ void Map::loadFromDisk(const string &filename, KeyFrameDatabase *kfMemDb)
 
 	mapArchive >> *kfMemDb;
 
-	mapFileFd.close();
 	mbMapUpdated = true;
 	cout << "Done restoring map" << endl;
 
@@ -61,6 +61,7 @@
 #include <vector>
 
 #include "ORBextractor.h"
+#include "ThreadPool.h"
 
 
 using namespace cv;
@@ -431,6 +432,10 @@ ORBextractor::ORBextractor(int _nfeatures, float _scaleFactor, int _nlevels,
     }
 
     mvImagePyramid.resize(nlevels);
+    mvPyramidBuffer.resize(nlevels);
+    mvBlurredPyramid.resize(nlevels);
+    mvRowKeys.resize(nlevels);
+    mvToDistributeKeys.resize(nlevels);
 
     mnFeaturesPerLevel.resize(nlevels);
     float factor = 1.0f / scaleFactor;
@@ -768,71 +773,93 @@ void ORBextractor::ComputeKeyPointsOctTree(vector<vector<KeyPoint> >& allKeypoin
 
     const float W = 30;
 
+    // Cell grid of every level. FAST runs on rows of cells of all the levels
+    // in parallel, the corners of a row are kept in cell order so the result
+    // is the same as scanning the cells one by one.
+    vector<CellGrid> vGrids(nlevels);
+    mvFastTasks.clear();
     for (int level = 0; level < nlevels; ++level)
     {
-        const int minBorderX = EDGE_THRESHOLD-3;
-        const int minBorderY = minBorderX;
-        const int maxBorderX = mvImagePyramid[level].cols-EDGE_THRESHOLD+3;
-        const int maxBorderY = mvImagePyramid[level].rows-EDGE_THRESHOLD+3;
+        CellGrid &grid = vGrids[level];
+        grid.minBorderX = EDGE_THRESHOLD-3;
+        grid.minBorderY = grid.minBorderX;
+        grid.maxBorderX = mvImagePyramid[level].cols-EDGE_THRESHOLD+3;
+        grid.maxBorderY = mvImagePyramid[level].rows-EDGE_THRESHOLD+3;
+
+        const float width = (grid.maxBorderX-grid.minBorderX);
+        const float height = (grid.maxBorderY-grid.minBorderY);
+
+        grid.nCols = width/W;
+        grid.nRows = height/W;
+        grid.wCell = ceil(width/grid.nCols);
+        grid.hCell = ceil(height/grid.nRows);
+
+        mvRowKeys[level].resize(grid.nRows);
+        for(int i=0; i<grid.nRows; i++)
+            mvFastTasks.push_back(make_pair(level,i));
+    }
+
+    ThreadPool::Instance().ParallelFor(mvFastTasks.size(), [&](int t)
+    {
+        const int level = mvFastTasks[t].first;
+        const int i = mvFastTasks[t].second;
+        const CellGrid &grid = vGrids[level];
 
-        vector<cv::KeyPoint> vToDistributeKeys;
-        vToDistributeKeys.reserve(nfeatures*10);
+        vector<cv::KeyPoint> &vRowKeys = mvRowKeys[level][i];
+        vRowKeys.clear();
 
-        const float width = (maxBorderX-minBorderX);
-        const float height = (maxBorderY-minBorderY);
+        const float iniY =grid.minBorderY+i*grid.hCell;
+        float maxY = iniY+grid.hCell+6;
 
-        const int nCols = width/W;
-        const int nRows = height/W;
-        const int wCell = ceil(width/nCols);
-        const int hCell = ceil(height/nRows);
+        if(iniY>=grid.maxBorderY-3)
+            return;
+        if(maxY>grid.maxBorderY)
+            maxY = grid.maxBorderY;
 
-        for(int i=0; i<nRows; i++)
+        vector<cv::KeyPoint> vKeysCell;
+        for(int j=0; j<grid.nCols; j++)
         {
-            const float iniY =minBorderY+i*hCell;
-            float maxY = iniY+hCell+6;
-
-            if(iniY>=maxBorderY-3)
+            const float iniX =grid.minBorderX+j*grid.wCell;
+            float maxX = iniX+grid.wCell+6;
+            if(iniX>=grid.maxBorderX-6)
                 continue;
-            if(maxY>maxBorderY)
-                maxY = maxBorderY;
+            if(maxX>grid.maxBorderX)
+                maxX = grid.maxBorderX;
 
-            for(int j=0; j<nCols; j++)
-            {
-                const float iniX =minBorderX+j*wCell;
-                float maxX = iniX+wCell+6;
-                if(iniX>=maxBorderX-6)
-                    continue;
-                if(maxX>maxBorderX)
-                    maxX = maxBorderX;
+            vKeysCell.clear();
+            FAST(mvImagePyramid[level].rowRange(iniY,maxY).colRange(iniX,maxX),
+                 vKeysCell,iniThFAST,true);
 
-                vector<cv::KeyPoint> vKeysCell;
+            if(vKeysCell.empty())
+            {
                 FAST(mvImagePyramid[level].rowRange(iniY,maxY).colRange(iniX,maxX),
-                     vKeysCell,iniThFAST,true);
-
-                if(vKeysCell.empty())
-                {
-                    FAST(mvImagePyramid[level].rowRange(iniY,maxY).colRange(iniX,maxX),
-                         vKeysCell,minThFAST,true);
-                }
-
-                if(!vKeysCell.empty())
-                {
-                    for(vector<cv::KeyPoint>::iterator vit=vKeysCell.begin(); vit!=vKeysCell.end();vit++)
-                    {
-                        (*vit).pt.x+=j*wCell;
-                        (*vit).pt.y+=i*hCell;
-                        vToDistributeKeys.push_back(*vit);
-                    }
-                }
+                     vKeysCell,minThFAST,true);
+            }
 
+            for(vector<cv::KeyPoint>::iterator vit=vKeysCell.begin(); vit!=vKeysCell.end();vit++)
+            {
+                (*vit).pt.x+=j*grid.wCell;
+                (*vit).pt.y+=i*grid.hCell;
+                vRowKeys.push_back(*vit);
             }
         }
+    });
+
+    // Distribute the corners and compute the orientations, one level per task
+    ThreadPool::Instance().ParallelFor(nlevels, [&](int level)
+    {
+        const CellGrid &grid = vGrids[level];
+
+        vector<cv::KeyPoint> &vToDistributeKeys = mvToDistributeKeys[level];
+        vToDistributeKeys.clear();
+        for(int i=0; i<grid.nRows; i++)
+            vToDistributeKeys.insert(vToDistributeKeys.end(), mvRowKeys[level][i].begin(), mvRowKeys[level][i].end());
 
         vector<KeyPoint> & keypoints = allKeypoints[level];
         keypoints.reserve(nfeatures);
 
-        keypoints = DistributeOctTree(vToDistributeKeys, minBorderX, maxBorderX,
-                                      minBorderY, maxBorderY,mnFeaturesPerLevel[level], level);
+        keypoints = DistributeOctTree(vToDistributeKeys, grid.minBorderX, grid.maxBorderX,
+                                      grid.minBorderY, grid.maxBorderY,mnFeaturesPerLevel[level], level);
 
         const int scaledPatchSize = PATCH_SIZE*mvScaleFactor[level];
 
@@ -840,16 +867,15 @@ void ORBextractor::ComputeKeyPointsOctTree(vector<vector<KeyPoint> >& allKeypoin
         const int nkps = keypoints.size();
         for(int i=0; i<nkps ; i++)
         {
-            keypoints[i].pt.x+=minBorderX;
-            keypoints[i].pt.y+=minBorderY;
+            keypoints[i].pt.x+=grid.minBorderX;
+            keypoints[i].pt.y+=grid.minBorderY;
             keypoints[i].octave=level;
             keypoints[i].size = scaledPatchSize;
         }
-    }
 
-    // compute orientations
-    for (int level = 0; level < nlevels; ++level)
-        computeOrientation(mvImagePyramid[level], allKeypoints[level], umax);
+        // compute orientations
+        computeOrientation(mvImagePyramid[level], keypoints, umax);
+    });
 }
 
 void ORBextractor::ComputeKeyPointsOld(std::vector<std::vector<KeyPoint> > &allKeypoints)
@@ -1031,14 +1057,6 @@ void ORBextractor::ComputeKeyPointsOld(std::vector<std::vector<KeyPoint> > &allK
         computeOrientation(mvImagePyramid[level], allKeypoints[level], umax);
 }
 
-static void computeDescriptors(const Mat& image, vector<KeyPoint>& keypoints, Mat& descriptors,
-                               const vector<Point>& pattern)
-{
-    descriptors = Mat::zeros((int)keypoints.size(), 32, CV_8UC1);
-
-    for (size_t i = 0; i < keypoints.size(); i++)
-        computeOrbDescriptor(keypoints[i], image, &pattern[0], descriptors.ptr((int)i));
-}
 
 void ORBextractor::operator()( InputArray _image, InputArray _mask, vector<KeyPoint>& _keypoints,
                       OutputArray _descriptors)
@@ -1072,24 +1090,45 @@ void ORBextractor::operator()( InputArray _image, InputArray _mask, vector<KeyPo
     _keypoints.clear();
     _keypoints.reserve(nkeypoints);
 
-    int offset = 0;
-    for (int level = 0; level < nlevels; ++level)
+    // Blur the levels in parallel, the copies are kept between frames
+    ThreadPool::Instance().ParallelFor(nlevels, [&](int level)
     {
-        vector<KeyPoint>& keypoints = allKeypoints[level];
-        int nkeypointsLevel = (int)keypoints.size();
-
-        if(nkeypointsLevel==0)
-            continue;
+        if(allKeypoints[level].empty())
+            return;
 
         // preprocess the resized image
-        Mat workingMat = mvImagePyramid[level].clone();
+        Mat &workingMat = mvBlurredPyramid[level];
+        mvImagePyramid[level].copyTo(workingMat);
         GaussianBlur(workingMat, workingMat, Size(7, 7), 2, 2, BORDER_REFLECT_101);
+    });
 
-        // Compute the descriptors
-        Mat desc = descriptors.rowRange(offset, offset + nkeypointsLevel);
-        computeDescriptors(workingMat, keypoints, desc, pattern);
-
+    // Compute the descriptors in chunks of keypoints of one level
+    const int CHUNK = 64;
+    vector<pair<int,int> > vChunks;
+    vector<int> vOffsets(nlevels);
+    int offset = 0;
+    for (int level = 0; level < nlevels; ++level)
+    {
+        vOffsets[level] = offset;
+        const int nkeypointsLevel = (int)allKeypoints[level].size();
+        for (int k = 0; k < nkeypointsLevel; k += CHUNK)
+            vChunks.push_back(make_pair(level,k));
         offset += nkeypointsLevel;
+    }
+
+    ThreadPool::Instance().ParallelFor(vChunks.size(), [&](int c)
+    {
+        const int level = vChunks[c].first;
+        const vector<KeyPoint>& keypoints = allKeypoints[level];
+        const int end = min(vChunks[c].second+CHUNK, (int)keypoints.size());
+
+        for (int k = vChunks[c].second; k < end; k++)
+            computeOrbDescriptor(keypoints[k], mvBlurredPyramid[level], &pattern[0], descriptors.ptr(vOffsets[level]+k));
+    });
+
+    for (int level = 0; level < nlevels; ++level)
+    {
+        vector<KeyPoint>& keypoints = allKeypoints[level];
 
         // Scale keypoint coordinates
         if (level != 0)
@@ -1111,7 +1150,9 @@ void ORBextractor::ComputePyramid(cv::Mat image)
         float scale = mvInvScaleFactor[level];
         Size sz(cvRound((float)image.cols*scale), cvRound((float)image.rows*scale));
         Size wholeSize(sz.width + EDGE_THRESHOLD*2, sz.height + EDGE_THRESHOLD*2);
-        Mat temp(wholeSize, image.type()), masktemp;
+        // the buffer is only reallocated when the image size changes
+        Mat &temp = mvPyramidBuffer[level];
+        temp.create(wholeSize, image.type());
         mvImagePyramid[level] = temp(Rect(EDGE_THRESHOLD, EDGE_THRESHOLD, sz.width, sz.height));
 
         // Compute the resized image
@@ -28,6 +28,10 @@
 #include "DBoW2/FeatureVector.h"
 
 #include<stdint-gcc.h>
+#include<string.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include<immintrin.h>
+#endif
 
 using namespace std;
 
@@ -38,6 +42,146 @@ const int ORBmatcher::TH_HIGH = 100;
 const int ORBmatcher::TH_LOW = 50;
 const int ORBmatcher::HISTO_LENGTH = 30;
 
+// Hamming distance kernels, one descriptor against a batch of candidates
+// stored back to back. The kernel is picked once from the CPU features, so
+// the binary still runs on CPUs without POPCNT or AVX2.
+
+// Bit set count operation from
+// http://graphics.stanford.edu/~seander/bithacks.html#CountBitsSetParallel
+static void DistancesGeneric(const unsigned char *a, const unsigned char *candidates, int n, int *dists)
+{
+    uint32_t pa[8];
+    memcpy(pa, a, 32);
+    for(int c=0; c<n; c++)
+    {
+        uint32_t pb[8];
+        memcpy(pb, candidates+32*c, 32);
+        int dist=0;
+        for(int i=0; i<8; i++)
+        {
+            unsigned int v = pa[i] ^ pb[i];
+            v = v - ((v >> 1) & 0x55555555);
+            v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+            dist += (((v + (v >> 4)) & 0xF0F0F0F) * 0x1010101) >> 24;
+        }
+        dists[c] = dist;
+    }
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+__attribute__((target("popcnt")))
+static void DistancesPopcnt(const unsigned char *a, const unsigned char *candidates, int n, int *dists)
+{
+    uint64_t pa[4];
+    memcpy(pa, a, 32);
+    for(int c=0; c<n; c++)
+    {
+        uint64_t pb[4];
+        memcpy(pb, candidates+32*c, 32);
+        dists[c] = __builtin_popcountll(pa[0]^pb[0]) + __builtin_popcountll(pa[1]^pb[1]) +
+                   __builtin_popcountll(pa[2]^pb[2]) + __builtin_popcountll(pa[3]^pb[3]);
+    }
+}
+
+__attribute__((target("avx2")))
+static inline __m256i PopcountBytesAVX2(__m256i v)
+{
+    const __m256i lut = _mm256_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,
+                                         0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+    const __m256i low = _mm256_set1_epi8(0x0f);
+    const __m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lut, _mm256_and_si256(v, low)),
+                                        _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(v, 4), low)));
+    return _mm256_sad_epu8(cnt, _mm256_setzero_si256());
+}
+
+__attribute__((target("avx2")))
+static void DistancesAVX2(const unsigned char *a, const unsigned char *candidates, int n, int *dists)
+{
+    const __m256i va = _mm256_loadu_si256((const __m256i*)a);
+    int c=0;
+    for(; c+4<=n; c+=4)
+    {
+        const __m256i s0 = PopcountBytesAVX2(_mm256_xor_si256(va, _mm256_loadu_si256((const __m256i*)(candidates+32*c))));
+        const __m256i s1 = PopcountBytesAVX2(_mm256_xor_si256(va, _mm256_loadu_si256((const __m256i*)(candidates+32*(c+1)))));
+        const __m256i s2 = PopcountBytesAVX2(_mm256_xor_si256(va, _mm256_loadu_si256((const __m256i*)(candidates+32*(c+2)))));
+        const __m256i s3 = PopcountBytesAVX2(_mm256_xor_si256(va, _mm256_loadu_si256((const __m256i*)(candidates+32*(c+3)))));
+        // each 64 bit lane of s0..s3 holds a partial count, pack them as 32 bit pairs and add the lanes
+        const __m256i t01 = _mm256_or_si256(s0, _mm256_slli_epi64(s1, 32));
+        const __m256i t23 = _mm256_or_si256(s2, _mm256_slli_epi64(s3, 32));
+        const __m256i z = _mm256_add_epi32(_mm256_unpacklo_epi64(t01, t23), _mm256_unpackhi_epi64(t01, t23));
+        const __m128i w = _mm_add_epi32(_mm256_castsi256_si128(z), _mm256_extracti128_si256(z, 1));
+        _mm_storeu_si128((__m128i*)(dists+c), w);
+    }
+    for(; c<n; c++)
+    {
+        const __m256i s = PopcountBytesAVX2(_mm256_xor_si256(va, _mm256_loadu_si256((const __m256i*)(candidates+32*c))));
+        const __m128i h = _mm_add_epi64(_mm256_castsi256_si128(s), _mm256_extracti128_si256(s, 1));
+        dists[c] = _mm_cvtsi128_si32(h) + _mm_extract_epi16(h, 4);
+    }
+}
+#endif
+
+typedef void (*DistancesKernel)(const unsigned char *a, const unsigned char *candidates, int n, int *dists);
+
+static DistancesKernel SelectDistancesKernel()
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+        return DistancesAVX2;
+    if(__builtin_cpu_supports("popcnt"))
+        return DistancesPopcnt;
+#endif
+    return DistancesGeneric;
+}
+
+static const DistancesKernel Distances = SelectDistancesKernel();
+
+// Candidate descriptors copied back to back into a 32 byte aligned buffer, so
+// the kernels read them as one stream and no descriptor straddles a cache line.
+// The buffer only grows, it is reused from one map point to the next.
+class PackedDescriptors
+{
+public:
+    PackedDescriptors(): mn(0), mnCapacity(0), mpData(NULL) {}
+
+    void clear() { mn = 0; }
+
+    void push_back(const unsigned char *descriptor)
+    {
+        if(mn==mnCapacity)
+            Grow();
+        memcpy(mpData+32*mn, descriptor, 32);
+        mn++;
+    }
+
+    const unsigned char *data() const { return mpData; }
+    int size() const { return mn; }
+
+private:
+    PackedDescriptors(const PackedDescriptors&);
+    PackedDescriptors &operator=(const PackedDescriptors&);
+
+    void Grow()
+    {
+        const int capacity = max(2*mnCapacity, 64);
+        // 4 more words than needed to move the start to a 32 byte boundary
+        vector<uint64_t> buffer(4*capacity+4);
+        unsigned char *data = (unsigned char*)(((uintptr_t)&buffer[0] + 31) & ~(uintptr_t)31);
+        if(mn>0)
+            memcpy(data, mpData, 32*mn);
+        mBuffer.swap(buffer);
+        mpData = data;
+        mnCapacity = capacity;
+    }
+
+    int mn;
+    int mnCapacity;
+    unsigned char *mpData;
+    vector<uint64_t> mBuffer;
+};
+
+
 ORBmatcher::ORBmatcher(float nnratio, bool checkOri): mfNNratio(nnratio), mbCheckOrientation(checkOri)
 {
 }
@@ -48,6 +192,11 @@ int ORBmatcher::SearchByProjection(Frame &F, const vector<MapPoint*> &vpMapPoint
 
     const bool bFactor = th!=1.0;
 
+    // candidates of the current MapPoint, their distances are computed in one batch
+    vector<size_t> vCandidates;
+    PackedDescriptors vCandidateDescriptors;
+    vector<int> vDists;
+
     for(size_t iMP=0; iMP<vpMapPoints.size(); iMP++)
     {
         MapPoint* pMP = vpMapPoints[iMP];
@@ -79,7 +228,8 @@ int ORBmatcher::SearchByProjection(Frame &F, const vector<MapPoint*> &vpMapPoint
         int bestLevel2 = -1;
         int bestIdx =-1 ;
 
-        // Get best and second matches with near keypoints
+        vCandidates.clear();
+        vCandidateDescriptors.clear();
         for(vector<size_t>::const_iterator vit=vIndices.begin(), vend=vIndices.end(); vit!=vend; vit++)
         {
             const size_t idx = *vit;
@@ -95,9 +245,21 @@ int ORBmatcher::SearchByProjection(Frame &F, const vector<MapPoint*> &vpMapPoint
                     continue;
             }
 
-            const cv::Mat &d = F.mDescriptors.row(idx);
+            vCandidates.push_back(idx);
+            vCandidateDescriptors.push_back(F.mDescriptors.ptr<unsigned char>(idx));
+        }
+
+        if(vCandidates.empty())
+            continue;
 
-            const int dist = DescriptorDistance(MPdescriptor,d);
+        vDists.resize(vCandidates.size());
+        DescriptorDistances(MPdescriptor.ptr<unsigned char>(), vCandidateDescriptors.data(), vCandidates.size(), &vDists[0]);
+
+        // Get best and second matches with near keypoints
+        for(size_t iC=0; iC<vCandidates.size(); iC++)
+        {
+            const size_t idx = vCandidates[iC];
+            const int dist = vDists[iC];
 
             if(dist<bestDist)
             {
@@ -171,6 +333,10 @@ int ORBmatcher::SearchByBoW(KeyFrame* pKF,Frame &F, vector<MapPoint*> &vpMapPoin
         rotHist[i].reserve(500);
     const float factor = 1.0f/HISTO_LENGTH;
 
+    vector<unsigned int> vCandidates;
+    PackedDescriptors vCandidateDescriptors;
+    vector<int> vDists;
+
     // We perform the matching over ORB that belong to the same vocabulary node (at a certain level)
     DBoW2::FeatureVector::const_iterator KFit = vFeatVecKF.begin();
     DBoW2::FeatureVector::const_iterator Fit = F.mFeatVec.begin();
@@ -181,8 +347,8 @@ int ORBmatcher::SearchByBoW(KeyFrame* pKF,Frame &F, vector<MapPoint*> &vpMapPoin
     {
         if(KFit->first == Fit->first)
         {
-            const vector<unsigned int> vIndicesKF = KFit->second;
-            const vector<unsigned int> vIndicesF = Fit->second;
+            const vector<unsigned int> &vIndicesKF = KFit->second;
+            const vector<unsigned int> &vIndicesF = Fit->second;
 
             for(size_t iKF=0; iKF<vIndicesKF.size(); iKF++)
             {
@@ -196,12 +362,12 @@ int ORBmatcher::SearchByBoW(KeyFrame* pKF,Frame &F, vector<MapPoint*> &vpMapPoin
                 if(pMP->isBad())
                     continue;                
 
-                const cv::Mat &dKF= pKF->mDescriptors.row(realIdxKF);
-
                 int bestDist1=256;
                 int bestIdxF =-1 ;
                 int bestDist2=256;
 
+                vCandidates.clear();
+                vCandidateDescriptors.clear();
                 for(size_t iF=0; iF<vIndicesF.size(); iF++)
                 {
                     const unsigned int realIdxF = vIndicesF[iF];
@@ -209,9 +375,18 @@ int ORBmatcher::SearchByBoW(KeyFrame* pKF,Frame &F, vector<MapPoint*> &vpMapPoin
                     if(vpMapPointMatches[realIdxF])
                         continue;
 
-                    const cv::Mat &dF = F.mDescriptors.row(realIdxF);
+                    vCandidates.push_back(realIdxF);
+                    vCandidateDescriptors.push_back(F.mDescriptors.ptr<unsigned char>(realIdxF));
+                }
 
-                    const int dist =  DescriptorDistance(dKF,dF);
+                vDists.resize(vCandidates.size());
+                if(!vCandidates.empty())
+                    DescriptorDistances(pKF->mDescriptors.ptr<unsigned char>(realIdxKF), vCandidateDescriptors.data(), vCandidates.size(), &vDists[0]);
+
+                for(size_t iC=0; iC<vCandidates.size(); iC++)
+                {
+                    const unsigned int realIdxF = vCandidates[iC];
+                    const int dist = vDists[iC];
 
                     if(dist<bestDist1)
                     {
@@ -1348,6 +1523,10 @@ int ORBmatcher::SearchByProjection(Frame &CurrentFrame, const Frame &LastFrame,
     const bool bForward = tlc.at<float>(2)>CurrentFrame.mb && !bMono;
     const bool bBackward = -tlc.at<float>(2)>CurrentFrame.mb && !bMono;
 
+    vector<size_t> vCandidates;
+    PackedDescriptors vCandidateDescriptors;
+    vector<int> vDists;
+
     for(int i=0; i<LastFrame.N; i++)
     {
         MapPoint* pMP = LastFrame.mvpMapPoints[i];
@@ -1397,6 +1576,8 @@ int ORBmatcher::SearchByProjection(Frame &CurrentFrame, const Frame &LastFrame,
                 int bestDist = 256;
                 int bestIdx2 = -1;
 
+                vCandidates.clear();
+                vCandidateDescriptors.clear();
                 for(vector<size_t>::const_iterator vit=vIndices2.begin(), vend=vIndices2.end(); vit!=vend; vit++)
                 {
                     const size_t i2 = *vit;
@@ -1412,9 +1593,18 @@ int ORBmatcher::SearchByProjection(Frame &CurrentFrame, const Frame &LastFrame,
                             continue;
                     }
 
-                    const cv::Mat &d = CurrentFrame.mDescriptors.row(i2);
+                    vCandidates.push_back(i2);
+                    vCandidateDescriptors.push_back(CurrentFrame.mDescriptors.ptr<unsigned char>(i2));
+                }
 
-                    const int dist = DescriptorDistance(dMP,d);
+                vDists.resize(vCandidates.size());
+                if(!vCandidates.empty())
+                    DescriptorDistances(dMP.ptr<unsigned char>(), vCandidateDescriptors.data(), vCandidates.size(), &vDists[0]);
+
+                for(size_t iC=0; iC<vCandidates.size(); iC++)
+                {
+                    const size_t i2 = vCandidates[iC];
+                    const int dist = vDists[iC];
 
                     if(dist<bestDist)
                     {
@@ -1642,24 +1832,17 @@ void ORBmatcher::ComputeThreeMaxima(vector<int>* histo, const int L, int &ind1,
 }
 
 
-// Bit set count operation from
-// http://graphics.stanford.edu/~seander/bithacks.html#CountBitsSetParallel
 int ORBmatcher::DescriptorDistance(const cv::Mat &a, const cv::Mat &b)
 {
-    const int *pa = a.ptr<int32_t>();
-    const int *pb = b.ptr<int32_t>();
-
-    int dist=0;
-
-    for(int i=0; i<8; i++, pa++, pb++)
-    {
-        unsigned  int v = *pa ^ *pb;
-        v = v - ((v >> 1) & 0x55555555);
-        v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
-        dist += (((v + (v >> 4)) & 0xF0F0F0F) * 0x1010101) >> 24;
-    }
+    int dist;
+    Distances(a.ptr<unsigned char>(), b.ptr<unsigned char>(), 1, &dist);
 
     return dist;
 }
 
+void ORBmatcher::DescriptorDistances(const unsigned char *a, const unsigned char *candidates, int n, int *dists)
+{
+    Distances(a, candidates, n, dists);
+}
+
 } //namespace ORB_SLAM
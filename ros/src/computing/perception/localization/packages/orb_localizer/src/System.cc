@@ -26,10 +26,74 @@
 #include <pangolin/pangolin.h>
 #include <iomanip>
 #include <exception>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace ORB_SLAM2
 {
 
+/*
+ * Parsing the text vocabulary takes most of the start up time, so the binary
+ * copy is used instead: either the file given is already binary (.bin), or
+ * a copy with the .bin extension is searched next to the text file and
+ * written there after the first text load.
+ */
+static bool loadVocabulary(ORBVocabulary *vocabulary, const string &vocFile)
+{
+	const string binExt = ".bin";
+	if (vocFile.size() > binExt.size() &&
+		vocFile.compare(vocFile.size()-binExt.size(), binExt.size(), binExt)==0) {
+		cout << endl << "Loading ORB Vocabulary from " << vocFile << endl;
+		return vocabulary->loadFromBinaryFile(vocFile);
+	}
+
+	const size_t extPos = vocFile.find_last_of('.');
+	const size_t dirPos = vocFile.find_last_of('/');
+	const string binFile = (extPos!=string::npos && (dirPos==string::npos || extPos>dirPos) ?
+		vocFile.substr(0, extPos) : vocFile) + binExt;
+
+	// a copy older than the text file is stale and gets rewritten
+	struct stat vocStat, binStat;
+	if (stat(binFile.c_str(), &binStat)==0 &&
+		(stat(vocFile.c_str(), &vocStat)!=0 || binStat.st_mtime >= vocStat.st_mtime)) {
+		cout << endl << "Loading ORB Vocabulary from " << binFile << endl;
+		if (vocabulary->loadFromBinaryFile(binFile))
+			return true;
+		cout << "Binary vocabulary is unusable, falling back to " << vocFile << endl;
+	}
+
+	cout << endl << "Loading ORB Vocabulary. This could take a while..." << endl;
+	if (!vocabulary->loadFromTextFile(vocFile))
+		return false;
+
+	// written to a file of its own and renamed over the copy, so nodes writing
+	// it at the same time do not mix their output, and a reader sees either
+	// a whole old or a whole new file; a partial one would fail the size checks
+	vector<char> tmpName(binFile.begin(), binFile.end());
+	const string suffix = ".XXXXXX";
+	tmpName.insert(tmpName.end(), suffix.begin(), suffix.end());
+	tmpName.push_back('\0');
+	const int fd = mkstemp(&tmpName[0]);
+	if (fd<0) {
+		cout << "Unable to save binary vocabulary to " << binFile << endl;
+		return true;
+	}
+	fchmod(fd, 0644);
+	close(fd);
+
+	const string tmpFile(&tmpName[0]);
+	if (vocabulary->saveToBinaryFile(tmpFile) && rename(tmpFile.c_str(), binFile.c_str())==0)
+		cout << "Binary vocabulary saved to " << binFile << endl;
+	else {
+		remove(tmpFile.c_str());
+		cout << "Unable to save binary vocabulary to " << binFile << endl;
+	}
+	return true;
+}
+
+
 System::System(const string &strVocFile, const string &strSettingsFile, const eSensor sensor,
                const bool bUseViewer,
 			   const string &mpMapFileName,
@@ -66,11 +130,9 @@ System::System(const string &strVocFile, const string &strSettingsFile, const eS
     }
 
     //Load ORB Vocabulary
-    cout << endl << "Loading ORB Vocabulary. This could take a while..." << endl;
-
     mpVocabulary = new ORBVocabulary();
     if (strVocFile.empty() == false) {
-		bool bVocLoad = mpVocabulary->loadFromTextFile(strVocFile);
+		bool bVocLoad = loadVocabulary(mpVocabulary, strVocFile);
 		if(!bVocLoad)
 		{
 			cerr << "Wrong path to vocabulary. " << endl;
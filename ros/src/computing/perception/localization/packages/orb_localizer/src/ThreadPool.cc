@@ -0,0 +1,116 @@
+/*
+ * ThreadPool.cc
+ */
+
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace ORB_SLAM2
+{
+
+ThreadPool& ThreadPool::Instance()
+{
+    static ThreadPool pool(max((int)thread::hardware_concurrency()-1, 0));
+    return pool;
+}
+
+ThreadPool::ThreadPool(int nWorkers):
+    mbStop(false)
+{
+    for(int i=0; i<nWorkers; i++)
+        mvWorkers.push_back(thread(&ThreadPool::Run, this));
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        unique_lock<mutex> lock(mMutex);
+        mbStop = true;
+    }
+    mcvWork.notify_all();
+
+    for(size_t i=0; i<mvWorkers.size(); i++)
+        mvWorkers[i].join();
+}
+
+void ThreadPool::ParallelFor(int n, const function<void(int)> &task)
+{
+    if(n<=0)
+        return;
+
+    if(n==1 || mvWorkers.empty())
+    {
+        for(int i=0; i<n; i++)
+            task(i);
+        return;
+    }
+
+    Batch batch;
+    batch.task = &task;
+    batch.n = n;
+    batch.next = 0;
+    batch.done = 0;
+
+    {
+        unique_lock<mutex> lock(mMutex);
+        mlBatches.push_back(&batch);
+    }
+    mcvWork.notify_all();
+
+    for(int i=batch.next++; i<n; i=batch.next++)
+    {
+        task(i);
+        batch.done++;
+    }
+
+    // the batch lives on this stack, no worker may pick it up after we return
+    unique_lock<mutex> lock(mMutex);
+    deque<Batch*>::iterator it = find(mlBatches.begin(), mlBatches.end(), &batch);
+    if(it!=mlBatches.end())
+        mlBatches.erase(it);
+    mcvDone.wait(lock, [&batch, n]{ return batch.done==n; });
+}
+
+void ThreadPool::Finish(Batch *pBatch)
+{
+    // pBatch may be gone as soon as the last task is counted, so n is read
+    // before and nothing of the batch is touched after the increment. The
+    // owner checks done under mMutex, notifying under it too means the
+    // wake up can not fall between its check and its wait
+    const int n = pBatch->n;
+    if(++pBatch->done==n)
+    {
+        unique_lock<mutex> lock(mMutex);
+        mcvDone.notify_all();
+    }
+}
+
+void ThreadPool::Run()
+{
+    unique_lock<mutex> lock(mMutex);
+    while(true)
+    {
+        mcvWork.wait(lock, [this]{ return mbStop || !mlBatches.empty(); });
+        if(mbStop)
+            return;
+
+        Batch *pBatch = mlBatches.front();
+        const int i = pBatch->next++;
+        if(i>=pBatch->n)
+        {
+            // every task is taken, the owner removes the batch when it waits
+            mlBatches.pop_front();
+            continue;
+        }
+
+        lock.unlock();
+        (*pBatch->task)(i);
+        Finish(pBatch);
+        lock.lock();
+    }
+}
+
+} //namespace ORB_SLAM
@@ -32,11 +32,15 @@
 #include <vector>
 #include <string>
 #include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
 
 #include <ros/ros.h>
 #include <sensor_msgs/LaserScan.h>
 #include <tf/transform_listener.h>
 #include <nav_msgs/OccupancyGrid.h>
+#include <map_msgs/OccupancyGridUpdate.h>
 
 namespace
 {
@@ -52,6 +56,8 @@ int g_scan_size_x = 1000;                  // actual scanning size
 int g_scan_size_y = 1000;
 int g_map_size_x = 500;  // publishing occupancy grid map size
 int g_map_size_y = 500;
+int g_map_shift_margin = 50;  // [cells] the published map moves when the vehicle is further than this from its center
+int g_update_tile_size = 25;  // [cells] changed cells are published per tile of this size
 
 struct Grid
 {
@@ -63,7 +69,19 @@ struct Grid
 
   void calcCoordinate();
   void calcRange();
-  int calcGlobalIndex(const tf::StampedTransform& transform) const;
+  int calcGlobalIndex(double origin_x, double origin_y) const;
+};
+
+// Bounding box of the changed cells of a tile of the published map
+struct ChangedBox
+{
+  int min_x = std::numeric_limits<int>::max();
+  int min_y = std::numeric_limits<int>::max();
+  int max_x = -1;
+  int max_y = -1;
+
+  void add(int x, int y);
+  size_t size() const;
 };
 
 struct Cost
@@ -76,6 +94,11 @@ struct Cost
 };
 
 ros::Publisher g_map_pub;
+ros::Publisher g_map_updates_pub;
+
+// Published map with the updates applied, its stamp is the one of the last scan
+nav_msgs::OccupancyGrid g_map;
+bool g_map_initialized = false;
 tf::TransformListener* g_tf_listenerp;
 
 double calcYawFromQuaternion(const tf::Quaternion& q)
@@ -101,6 +124,22 @@ void Cost::accumulateCost(int occupied_inc, int free_inc)
     occupied = OCCUPIED_MIN;
 }
 
+void ChangedBox::add(int x, int y)
+{
+  min_x = std::min(min_x, x);
+  min_y = std::min(min_y, y);
+  max_x = std::max(max_x, x);
+  max_y = std::max(max_y, y);
+}
+
+size_t ChangedBox::size() const
+{
+  if (max_x < 0)
+    return 0;
+
+  return (max_x - min_x + 1) * (max_y - min_y + 1);
+}
+
 // Calcurate grid's coordinate in sensor frame
 void Grid::calcCoordinate()
 {
@@ -122,39 +161,31 @@ void Grid::calcRange()
   range = sqrt(distance_x * distance_x + distance_y * distance_y);
 }
 
-// Change local index into global index
-int Grid::calcGlobalIndex(const tf::StampedTransform& transform) const
+// Index of a global cell in the cost map, which is a ring buffer of g_scan_size_x * g_scan_size_y cells
+int calcRingIndex(int cell_x, int cell_y)
 {
-  // Calculate index in global frame
-  int ix = (x + transform.getOrigin().x()) / g_resolution;
-  int iy = (y + transform.getOrigin().y()) / g_resolution;
+  int ring_x = cell_x % g_scan_size_x;
+  int ring_y = cell_y % g_scan_size_y;
 
   // Make indexes positive value
-  int global_grid_x = (ix + 100000 * g_scan_size_x) % g_scan_size_x;
-  int global_grid_y = (iy + 100000 * g_scan_size_y) % g_scan_size_y;
-
-  int global_index = global_grid_x + global_grid_y * g_scan_size_x;
+  if (ring_x < 0)
+    ring_x += g_scan_size_x;
+  if (ring_y < 0)
+    ring_y += g_scan_size_y;
 
-  return global_index;
+  return ring_x + ring_y * g_scan_size_x;
 }
 
-int calcGlobalIndex(int grid_x, int grid_y, const tf::StampedTransform& transform)
+// Global cell containing a coordinate in OGM_FRAME
+int calcGlobalCell(double coordinate)
 {
-  // Point coordinate in velodyne(local) frame
-  double local_x = (grid_x - g_scan_size_x / 2.0) * g_resolution;
-  double local_y = (grid_y - g_scan_size_y / 2.0) * g_resolution;
-
-  // Calculate index in global coordinate
-  int ix = (local_x + transform.getOrigin().x()) / g_resolution;
-  int iy = (local_y + transform.getOrigin().y()) / g_resolution;
-
-  // Make indexes positive value
-  int global_grid_x = (ix + 100000 * g_scan_size_x) % g_scan_size_x;
-  int global_grid_y = (iy + 100000 * g_scan_size_y) % g_scan_size_y;
-
-  int global_index = global_grid_x + global_grid_y * g_scan_size_x;
+  return static_cast<int>(std::floor(coordinate / g_resolution));
+}
 
-  return global_index;
+// Change local index into global index
+int Grid::calcGlobalIndex(double origin_x, double origin_y) const
+{
+  return calcRingIndex(calcGlobalCell(x + origin_x), calcGlobalCell(y + origin_y));
 }
 
 void preCasting(const sensor_msgs::LaserScan& scan, std::vector<std::vector<Grid>>* precasted_grids)
@@ -213,49 +244,47 @@ void preCasting(const sensor_msgs::LaserScan& scan, std::vector<std::vector<Grid
 }
 
 
+void clearCost(Cost* cost)
+{
+  cost->occupied = 0;
+  cost->free     = 0;
+  cost->unknown  = true;
+}
+
 // Delete old cost values
-void deleteOldData(std::vector<Cost>* cost_map, double current_x, double current_y, double prev_x, double prev_y)
+// The cost map covers the cells around the vehicle, so when it moves only the strips of cells
+// entering the area are cleared, their ring buffer slots held the cells it left
+void deleteOldData(std::vector<Cost>* cost_map, int current_cell_x, int current_cell_y, int prev_cell_x, int prev_cell_y)
 {
-  double begin_x = current_x;
-  double begin_y = current_y;
-  double end_x = prev_x;
-  double end_y = prev_y;
-
-  if (begin_x > end_x)
-    std::swap(begin_x, end_x);
-  if (begin_y > end_y)
-    std::swap(begin_y, end_y);
-
-  int ibegin_x = begin_x / g_resolution + g_scan_size_x / 2;
-  int ibegin_y = begin_y / g_resolution + g_scan_size_y / 2;
-  int iend_x = end_x / g_resolution + g_scan_size_x / 2;
-  int iend_y = end_y / g_resolution + g_scan_size_y / 2;
-
-  for (int i = ibegin_x; i < iend_x; i++)
+  int begin_x = std::min(current_cell_x, prev_cell_x) + g_scan_size_x / 2;
+  int end_x   = std::max(current_cell_x, prev_cell_x) + g_scan_size_x / 2;
+  int begin_y = std::min(current_cell_y, prev_cell_y) + g_scan_size_y / 2;
+  int end_y   = std::max(current_cell_y, prev_cell_y) + g_scan_size_y / 2;
+
+  // Moved over the whole area
+  if (end_x - begin_x >= g_scan_size_x || end_y - begin_y >= g_scan_size_y)
+  {
+    for (auto& cost : *cost_map)
+      clearCost(&cost);
+    return;
+  }
+
+  for (int i = begin_x; i < end_x; i++)
   {
     for (int j = 0; j < g_scan_size_y; j++)
-    {
-      int global_grid_x = (i + 100000 * g_scan_size_x) % g_scan_size_x;
-      cost_map->at(global_grid_x + j * g_scan_size_x).occupied = 0;
-      cost_map->at(global_grid_x + j * g_scan_size_x).free     = 0;
-      cost_map->at(global_grid_x + j * g_scan_size_x).unknown  = true;
-    }
+      clearCost(&cost_map->at(calcRingIndex(i, j)));
   }
 
-  for (int i = 0; i < g_scan_size_x; i++)
+  for (int j = begin_y; j < end_y; j++)
   {
-    for (int j = ibegin_y; j < iend_y; j++)
-    {
-      int global_grid_y = (j + 100000 * g_scan_size_y) % g_scan_size_y;
-      cost_map->at(i + global_grid_y * g_scan_size_x).occupied = 0;
-      cost_map->at(i + global_grid_y * g_scan_size_x).free     = 0;
-      cost_map->at(i + global_grid_y * g_scan_size_x).unknown  = true;
-    }
+    for (int i = 0; i < g_scan_size_x; i++)
+      clearCost(&cost_map->at(calcRingIndex(i, j)));
   }
 }
 
+// Set the area of the published map, its lower left cell is (origin_cell_x, origin_cell_y)
 void setOccupancyGridMap(nav_msgs::OccupancyGrid* map, const std_msgs::Header& header,
-                         const tf::StampedTransform& transform)
+                         const tf::StampedTransform& transform, int origin_cell_x, int origin_cell_y)
 {
   map->header.stamp = header.stamp;
   map->header.frame_id = OGM_FRAME;
@@ -263,13 +292,22 @@ void setOccupancyGridMap(nav_msgs::OccupancyGrid* map, const std_msgs::Header& h
   map->info.resolution = g_resolution;
   map->info.height = g_map_size_y;
   map->info.width = g_map_size_x;
-  map->info.origin.position.x = transform.getOrigin().x() - (g_map_size_x / 2) * g_resolution;
-  map->info.origin.position.y = transform.getOrigin().y() - (g_map_size_y / 2) * g_resolution;
+  map->info.origin.position.x = origin_cell_x * g_resolution;
+  map->info.origin.position.y = origin_cell_y * g_resolution;
   map->info.origin.position.z = transform.getOrigin().z() - 5;
   map->info.origin.orientation.x = 0;
   map->info.origin.orientation.y = 0;
   map->info.origin.orientation.z = 0;
   map->info.origin.orientation.w = 1;
+  map->data.assign(g_map_size_x * g_map_size_y, -1);
+}
+
+int8_t calcOccupancy(const Cost& cost)
+{
+  if (cost.unknown)
+    return -1;
+
+  return (cost.occupied + 8) * 6;
 }
 
 void createCostMap(const sensor_msgs::LaserScan& scan, const std::vector<std::vector<Grid>>& precasted_grids)
@@ -290,21 +328,17 @@ void createCostMap(const sensor_msgs::LaserScan& scan, const std::vector<std::ve
   // Save costs in this variable
   static std::vector<Cost> cost_map(g_scan_size_x * g_scan_size_y);
 
-  static bool initialized_map = false;
-  static double prev_x = transform.getOrigin().x();
-  static double prev_y = transform.getOrigin().y();
-  static nav_msgs::OccupancyGrid map;
-  setOccupancyGridMap(&map, scan.header, transform);
-  if (!initialized_map)
-  {
-    map.data.resize(g_map_size_x * g_map_size_y, -1);
-    initialized_map = true;
-  }
+  double origin_x = transform.getOrigin().x();
+  double origin_y = transform.getOrigin().y();
+  int cell_x = calcGlobalCell(origin_x);
+  int cell_y = calcGlobalCell(origin_y);
 
   // Since we implement as ring buffer, we have to delete old data regularly
-  deleteOldData(&cost_map, transform.getOrigin().x(), transform.getOrigin().y(), prev_x, prev_y);
-  prev_x = transform.getOrigin().x();
-  prev_y = transform.getOrigin().y();
+  static int prev_cell_x = cell_x;
+  static int prev_cell_y = cell_y;
+  deleteOldData(&cost_map, cell_x, cell_y, prev_cell_x, prev_cell_y);
+  prev_cell_x = cell_x;
+  prev_cell_y = cell_y;
 
   // Vehicle's orientation
   double yaw = calcYawFromQuaternion(transform.getRotation());
@@ -322,62 +356,168 @@ void createCostMap(const sensor_msgs::LaserScan& scan, const std::vector<std::ve
   static int iangle_size = 2 * M_PI / scan.angle_increment;
 
   //----------------- RING OCCUPANCY GRID MAPPING --------------
-  // Accumulate grid costs for each laser scan
-  for (size_t i = 0; i < scan.ranges.size(); i++)
+  // The cells passed by each laser are found in parallel by angle sector,
+  // then the costs are accumulated in scan order as rays share the cells near the sensor
+  int ranges_size = scan.ranges.size();
+  static std::vector<int> ray_precasted_index;
+  static std::vector<int> ray_free_size;
+  static std::vector<int> ray_begin;
+  static std::vector<int> ray_cells;
+  ray_precasted_index.resize(ranges_size);
+  ray_free_size.resize(ranges_size);
+  ray_begin.resize(ranges_size + 1);
+
+#pragma omp parallel for schedule(static)
+  for (int i = 0; i < ranges_size; i++)
   {
     double range = scan.ranges[i];
 
     // Ignore 0 ranges
     if (range == 0)
+    {
+      ray_free_size[i] = -1;
       continue;
+    }
 
     // If laserscan does not reach objects, make a range max
     if (scan.ranges[i] > scan.range_max)
       range = scan.range_max;
 
     int precasted_index = (i + index_offset) % iangle_size;
-    int obstacle_index = -1;
-    for (const auto& g : precasted_grids[precasted_index])
-    {
-      obstacle_index++;
+    const auto& grids = precasted_grids[precasted_index];
 
-      if (g.range > range)
-        break;
+    // Free range, the obstacle is the first grid out of range (or the last one, which is also free)
+    int free_size = 0;
+    while (free_size < static_cast<int>(grids.size()) && grids[free_size].range <= range)
+      free_size++;
 
-      // Free range
-      int global_index = g.calcGlobalIndex(transform);
-      cost_map[global_index].accumulateCost(0, FREE_INCREMENT);
-    }
+    ray_precasted_index[i] = precasted_index;
+    ray_free_size[i] = free_size;
+  }
 
-    // Obstacle
-    int global_index = precasted_grids[precasted_index][obstacle_index].calcGlobalIndex(transform);
-    cost_map[global_index].accumulateCost(OCCUPIED_INCREMENT, 0);
+  ray_begin[0] = 0;
+  for (int i = 0; i < ranges_size; i++)
+    ray_begin[i + 1] = ray_begin[i] + (ray_free_size[i] < 0 ? 0 : ray_free_size[i] + 1);
+  ray_cells.resize(ray_begin[ranges_size]);
+
+#pragma omp parallel for schedule(static)
+  for (int i = 0; i < ranges_size; i++)
+  {
+    if (ray_free_size[i] < 0)
+      continue;
+
+    const auto& grids = precasted_grids[ray_precasted_index[i]];
+    int free_size = ray_free_size[i];
+    int* cells = &ray_cells[ray_begin[i]];
+
+    for (int k = 0; k < free_size; k++)
+      cells[k] = grids[k].calcGlobalIndex(origin_x, origin_y);
 
+    int obstacle_index = std::min(free_size, static_cast<int>(grids.size()) - 1);
+    cells[free_size] = grids[obstacle_index].calcGlobalIndex(origin_x, origin_y);
   }
 
+  for (int i = 0; i < ranges_size; i++)
+  {
+    if (ray_free_size[i] < 0)
+      continue;
+
+    // Free range
+    const int* cells = &ray_cells[ray_begin[i]];
+    for (int k = 0; k < ray_free_size[i]; k++)
+      cost_map[cells[k]].accumulateCost(0, FREE_INCREMENT);
+
+    // Obstacle
+    cost_map[cells[ray_free_size[i]]].accumulateCost(OCCUPIED_INCREMENT, 0);
+  }
 
-  // Begining of grid index of publishing OGM
-  static int origin_index_x = (g_scan_size_x - g_map_size_x) / 2.0;
-  static int origin_index_y = (g_scan_size_y - g_map_size_y) / 2.0;
-  // static int origin_index = origin_index_x + origin_index_y * g_scan_size_x;
+  //----------------- PUBLISH --------------
+  // The published map stays at the same place until the vehicle gets near its border,
+  // so that only the changed cells have to be sent in the mean time
+  nav_msgs::OccupancyGrid& map = g_map;
+  static int map_cell_x;
+  static int map_cell_y;
+  bool map_moved = !g_map_initialized ||
+                   std::abs(cell_x - (map_cell_x + g_map_size_x / 2)) > g_map_shift_margin ||
+                   std::abs(cell_y - (map_cell_y + g_map_size_y / 2)) > g_map_shift_margin;
+  if (map_moved)
+  {
+    map_cell_x = cell_x - g_map_size_x / 2;
+    map_cell_y = cell_y - g_map_size_y / 2;
+    setOccupancyGridMap(&map, scan.header, transform, map_cell_x, map_cell_y);
+    g_map_initialized = true;
+  }
 
-  // Set cost values for publishing OccuppancyGridMap
+  // Ring buffer column of each map column
+  static std::vector<int> ring_columns;
+  ring_columns.resize(g_map_size_x);
+  for (int j = 0; j < g_map_size_x; j++)
+    ring_columns[j] = calcRingIndex(map_cell_x + j, 0);
+
+  // Set cost values for publishing OccuppancyGridMap and keep the box of the changed cells of each tile
+  int tiles_x = (g_map_size_x + g_update_tile_size - 1) / g_update_tile_size;
+  int tiles_y = (g_map_size_y + g_update_tile_size - 1) / g_update_tile_size;
+  std::vector<ChangedBox> changed_tiles(tiles_x * tiles_y);
   for (int i = 0; i < g_map_size_y; i++)
   {
+    int ring_row = calcRingIndex(0, map_cell_y + i);
+    ChangedBox* tile_row = &changed_tiles[(i / g_update_tile_size) * tiles_x];
+
     for (int j = 0; j < g_map_size_x; j++)
     {
-      int scanmap_index_x = origin_index_x + j;
-      int scanmap_index_y = origin_index_y + i;
-
-      int global_index = calcGlobalIndex(scanmap_index_x, scanmap_index_y, transform);
-      if (cost_map[global_index].unknown)
-        map.data[j + i * g_map_size_x] = -1;
-      else
-        map.data[j + i * g_map_size_x] = (cost_map[global_index].occupied + 8) * 6;
+      int8_t value = calcOccupancy(cost_map[ring_row + ring_columns[j]]);
+      if (map.data[j + i * g_map_size_x] != value)
+      {
+        map.data[j + i * g_map_size_x] = value;
+        tile_row[j / g_update_tile_size].add(j, i);
+      }
     }
   }
 
-  g_map_pub.publish(map);
+  size_t update_size = 0;
+  for (const auto& box : changed_tiles)
+    update_size += box.size();
+
+  // A new subscriber gets the whole map up to this scan (see mapConnectCallback)
+  map.header.stamp = scan.header.stamp;
+
+  // Send the whole map when it has moved or the updates would be about as large
+  if (map_moved || 2 * update_size > map.data.size())
+  {
+    g_map_pub.publish(map);
+    return;
+  }
+
+  for (const auto& box : changed_tiles)
+  {
+    if (box.size() == 0)
+      continue;
+
+    map_msgs::OccupancyGridUpdate update;
+    update.header.stamp = scan.header.stamp;
+    update.header.frame_id = OGM_FRAME;
+    update.x = box.min_x;
+    update.y = box.min_y;
+    update.width = box.max_x - box.min_x + 1;
+    update.height = box.max_y - box.min_y + 1;
+    update.data.resize(update.width * update.height);
+
+    for (size_t i = 0; i < update.height; i++)
+    {
+      const int8_t* row = &map.data[update.x + (update.y + i) * g_map_size_x];
+      std::copy(row, row + update.width, &update.data[i * update.width]);
+    }
+
+    g_map_updates_pub.publish(update);
+  }
+}
+
+// The map is not latched, as the latched copy would miss the updates sent since.
+// Each new subscriber receives the current map instead, updates older than it are dropped by the subscriber.
+void mapConnectCallback(const ros::SingleSubscriberPublisher& pub)
+{
+  if (g_map_initialized)
+    pub.publish(g_map);
 }
 
 // Make CostMap from LaserScan message
@@ -416,12 +556,27 @@ int main(int argc, char** argv)
   private_nh.param<int>("scan_size_y", g_scan_size_y, 1000);
   private_nh.param<int>("map_size_x", g_map_size_x, 500);
   private_nh.param<int>("map_size_y", g_map_size_y, 500);
+  private_nh.param<int>("map_shift_margin", g_map_shift_margin, 50);
+  private_nh.param<int>("update_tile_size", g_update_tile_size, 25);
   private_nh.param<std::string>("scan_topic", g_scan_topic, "/scan");
   private_nh.param<std::string>("sensor_frame", g_sensor_frame, "/velodyne");
 
+  // The published map is read from the ring buffer, so it must stay inside the scanned area wherever it is shifted
+  if (g_map_shift_margin < 0 || g_update_tile_size <= 0 ||
+      g_map_size_x / 2 + g_map_shift_margin > g_scan_size_x / 2 ||
+      g_map_size_y / 2 + g_map_shift_margin > g_scan_size_y / 2)
+  {
+    ROS_ERROR("map_size/2 + map_shift_margin (%d, %d) must not exceed scan_size/2 (%d, %d), "
+              "and update_tile_size (%d) must be positive",
+              g_map_size_x / 2 + g_map_shift_margin, g_map_size_y / 2 + g_map_shift_margin, g_scan_size_x / 2,
+              g_scan_size_y / 2, g_update_tile_size);
+    return 1;
+  }
+
   ros::Subscriber laserscan_sub = nh.subscribe(g_scan_topic, 1, laserScanCallback);
 
-  g_map_pub = nh.advertise<nav_msgs::OccupancyGrid>("/ring_ogm", 1);
+  g_map_pub = nh.advertise<nav_msgs::OccupancyGrid>("/ring_ogm", 1, mapConnectCallback);
+  g_map_updates_pub = nh.advertise<map_msgs::OccupancyGridUpdate>("/ring_ogm_updates", 100);
 
   ros::spin();
 
@@ -23,3 +23,81 @@ SimpleNode::SimpleNode(int x, int y, int theta, double gc, double hc)
   , cost(gc + hc)
 {
 }
+
+void OpenList::push(std::vector<AstarNode> &nodes, int index, double cost)
+{
+  int pos = nodes[index].heap_index;
+
+  if (pos < 0) {
+    pos = heap_.size();
+    heap_.push_back(Entry());
+  }
+  else if (cost > heap_[pos].cost) {
+    heap_[pos].cost = cost;
+    siftDown(nodes, pos);
+    return;
+  }
+
+  heap_[pos].cost = cost;
+  heap_[pos].index = index;
+  siftUp(nodes, pos);
+}
+
+int OpenList::pop(std::vector<AstarNode> &nodes)
+{
+  int index = heap_[0].index;
+  nodes[index].heap_index = -1;
+
+  heap_[0] = heap_.back();
+  heap_.pop_back();
+  if (!heap_.empty())
+    siftDown(nodes, 0);
+
+  return index;
+}
+
+void OpenList::clear(std::vector<AstarNode> &nodes)
+{
+  for (const auto &e : heap_)
+    nodes[e.index].heap_index = -1;
+  heap_.clear();
+}
+
+void OpenList::siftUp(std::vector<AstarNode> &nodes, int pos)
+{
+  Entry e = heap_[pos];
+
+  while (pos > 0) {
+    int parent = (pos - 1) / 2;
+    if (!(e.cost < heap_[parent].cost))
+      break;
+    heap_[pos] = heap_[parent];
+    nodes[heap_[pos].index].heap_index = pos;
+    pos = parent;
+  }
+
+  heap_[pos] = e;
+  nodes[e.index].heap_index = pos;
+}
+
+void OpenList::siftDown(std::vector<AstarNode> &nodes, int pos)
+{
+  Entry e = heap_[pos];
+  int size = heap_.size();
+
+  while (true) {
+    int child = 2 * pos + 1;
+    if (child >= size)
+      break;
+    if (child + 1 < size && heap_[child + 1].cost < heap_[child].cost)
+      child++;
+    if (!(heap_[child].cost < e.cost))
+      break;
+    heap_[pos] = heap_[child];
+    nodes[heap_[pos].index].heap_index = pos;
+    pos = child;
+  }
+
+  heap_[pos] = e;
+  nodes[e.index].heap_index = pos;
+}
@@ -3,6 +3,8 @@
 
 #include <tf/transform_listener.h>
 
+#include <vector>
+
 enum class STATUS : uint8_t
 {
   NONE,
@@ -20,6 +22,10 @@ struct AstarNode
   bool back;                         // true if the current direction of the vehicle is back
   uint8_t steering;                  // steering action of this node
   AstarNode *parent = NULL;          // parent node
+  uint32_t generation = 0;           // search which last used this node, nodes of older searches are NONE
+  int heap_index      = -1;          // position in the open list while the node is queued
+  uint32_t collision_map = 0;        // obstacle map for which collision is valid
+  bool collision      = false;       // result of the collision check of this pose
 };
 
 struct WaveFrontNode
@@ -59,6 +65,31 @@ struct SimpleNode
   SimpleNode(int x, int y, int theta, double gc, double hc);
 };
 
+// Binary heap of node indices for the open list
+// The heap position of each queued node is kept in AstarNode::heap_index,
+// so a node is queued only once and its cost is lowered in place
+class OpenList
+{
+ public:
+  bool empty() const { return heap_.empty(); }
+  // Insert the node, or update its cost if it is already queued
+  void push(std::vector<AstarNode> &nodes, int index, double cost);
+  // Remove and return the node with the minimum cost
+  int pop(std::vector<AstarNode> &nodes);
+  void clear(std::vector<AstarNode> &nodes);
+
+ private:
+  struct Entry
+  {
+    double cost;
+    int index;
+  };
+  std::vector<Entry> heap_;
+
+  void siftUp(std::vector<AstarNode> &nodes, int pos);
+  void siftDown(std::vector<AstarNode> &nodes, int pos);
+};
+
 
 namespace astar
 {
@@ -44,6 +44,7 @@ int main(int argc, char **argv)
 
   // ROS subscribers
   ros::Subscriber map_sub = n.subscribe(map_topic, 1, &SearchInfo::mapCallback, &search_info);
+  ros::Subscriber map_update_sub = n.subscribe(map_topic + "_updates", 100, &SearchInfo::mapUpdateCallback, &search_info);
   ros::Subscriber start_sub = n.subscribe("/current_pose", 1, &SearchInfo::currentPoseCallback, &search_info);
   ros::Subscriber goal_sub  = n.subscribe("/move_base_simple/goal", 1, &SearchInfo::goalCallback, &search_info);
 
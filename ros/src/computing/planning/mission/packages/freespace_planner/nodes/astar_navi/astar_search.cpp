@@ -2,6 +2,11 @@
 
 AstarSearch::AstarSearch()
   : node_initialized_(false)
+  , generation_(1)
+  , map_version_(1)
+  , wavefront_valid_(false)
+  , wavefront_goal_x_(-1)
+  , wavefront_goal_y_(-1)
 {
   ros::NodeHandle private_nh_("~");
   private_nh_.param<bool>("use_2dnav_goal", use_2dnav_goal_, true);
@@ -19,6 +24,7 @@ AstarSearch::AstarSearch()
   private_nh_.param<double>("reverse_weight", reverse_weight_, 2.00);
   private_nh_.param<bool>("use_wavefront_heuristic", use_wavefront_heuristic_, true);
   private_nh_.param<double>("reverse_weight", reverse_weight_, 2.00);
+  private_nh_.param<double>("reuse_path_distance", reuse_path_distance_, 1.0);
 
   createStateUpdateTable(angle_size_);
 }
@@ -29,14 +35,36 @@ AstarSearch::~AstarSearch()
 
 void AstarSearch::resizeNode(int width, int height, int angle_size)
 {
-  nodes_.resize(height);
+  nodes_.assign(width * height * angle_size, AstarNode());
+  generation_  = 1;
+  map_version_ = 1;
+}
+
+int AstarSearch::getNodeIndex(int index_x, int index_y, int index_theta) const
+{
+  return (index_y * map_info_.width + index_x) * angle_size_ + index_theta;
+}
 
-  for (int i = 0; i < height; i++)
-    nodes_[i].resize(width);
+// Nodes left by the previous searches are cleared when they are used first
+AstarNode &AstarSearch::getNode(int index)
+{
+  AstarNode &node = nodes_[index];
+
+  if (node.generation != generation_) {
+    node.generation = generation_;
+    node.status     = STATUS::NONE;
+    node.gc         = 0;
+    node.hc         = 0;
+    node.parent     = NULL;
+    node.heap_index = -1;
+  }
+
+  return node;
+}
 
-  for (int i = 0; i < height; i++)
-    for (int j = 0; j < width; j++)
-      nodes_[i][j].resize(angle_size);
+bool AstarSearch::isObstacle(int index_x, int index_y) const
+{
+  return obstacles_[index_y * map_info_.width + index_x];
 }
 
 void AstarSearch::poseToIndex(const geometry_msgs::Pose &pose, int *index_x, int *index_y, int *index_theta)
@@ -172,7 +200,7 @@ void AstarSearch::setPath(const SimpleNode &goal)
   path_.header = header;
 
   // From the goal node to the start node
-  AstarNode *node = &nodes_[goal.index_y][goal.index_x][goal.index_theta];
+  AstarNode *node = &getNode(getNodeIndex(goal.index_x, goal.index_y, goal.index_theta));
 
   while (node != NULL) {
     // Set tf pose
@@ -257,7 +285,7 @@ bool AstarSearch::detectCollision(const SimpleNode &sn)
 
       if (isOutOfRange(index_x, index_y))
         return true;
-      if (nodes_[index_y][index_x][0].status == STATUS::OBS)
+      if (isObstacle(index_x, index_y))
         return true;
     }
   }
@@ -265,12 +293,26 @@ bool AstarSearch::detectCollision(const SimpleNode &sn)
   return false;
 }
 
+// The collision of each node is checked once per obstacle map
+bool AstarSearch::detectCollisionCached(int index, const SimpleNode &sn)
+{
+  AstarNode &node = nodes_[index];
+
+  if (node.collision_map != map_version_) {
+    node.collision_map = map_version_;
+    node.collision     = detectCollision(sn);
+  }
+
+  return node.collision;
+}
+
 bool AstarSearch::calcWaveFrontHeuristic(const SimpleNode &sn)
 {
   // Set start point for wavefront search
   // This is goal for Astar search
-  nodes_[sn.index_y][sn.index_x][0].hc = 0;
-  WaveFrontNode wf_node(sn.index_x, sn.index_y, 1e-10);
+  wavefront_hc_.assign(map_info_.width * map_info_.height, -1.0);
+  wavefront_hc_[sn.index_y * map_info_.width + sn.index_x] = 0;
+  WaveFrontNode wf_node(sn.index_x, sn.index_y, 0);
   std::queue<WaveFrontNode> qu;
   qu.push(wf_node);
 
@@ -288,15 +330,6 @@ bool AstarSearch::calcWaveFrontHeuristic(const SimpleNode &sn)
     astar::getWaveFrontNode( 1, -1, std::hypot(resolution, resolution)),
   };
 
-  // Get start index
-  int start_index_x;
-  int start_index_y;
-  int start_index_theta;
-  poseToIndex(start_pose_local_.pose, &start_index_x, &start_index_y, &start_index_theta);
-
-  // Whether the robot can reach goal
-  bool reachable = false;
-
   // Start wavefront search
   while (!qu.empty()) {
     WaveFrontNode ref = qu.front();
@@ -309,28 +342,34 @@ bool AstarSearch::calcWaveFrontHeuristic(const SimpleNode &sn)
 
       // out of range OR already visited OR obstacle node
       if (isOutOfRange(next.index_x, next.index_y) ||
-          nodes_[next.index_y][next.index_x][0].hc > 0 ||
-          nodes_[next.index_y][next.index_x][0].status == STATUS::OBS)
+          wavefront_hc_[next.index_y * map_info_.width + next.index_x] >= 0 ||
+          isObstacle(next.index_x, next.index_y))
         continue;
 
       // Take the size of robot into account
       if (detectCollisionWaveFront(next))
         continue;
 
-      // Check if we can reach from start to goal
-      if (next.index_x == start_index_x && next.index_y == start_index_y)
-        reachable = true;
-
       // Set wavefront heuristic cost
       next.hc = ref.hc + u.hc;
-      nodes_[next.index_y][next.index_x][0].hc = next.hc;
+      wavefront_hc_[next.index_y * map_info_.width + next.index_x] = next.hc;
 
       qu.push(next);
     }
   }
 
   // End of search
-  return reachable;
+  wavefront_valid_  = true;
+  wavefront_goal_x_ = sn.index_x;
+  wavefront_goal_y_ = sn.index_y;
+
+  // Whether the robot can reach goal
+  int start_index_x;
+  int start_index_y;
+  int start_index_theta;
+  poseToIndex(start_pose_local_.pose, &start_index_x, &start_index_y, &start_index_theta);
+
+  return wavefront_hc_[start_index_y * map_info_.width + start_index_x] >= 0;
 }
 
 // Simple collidion detection for wavefront search
@@ -349,7 +388,7 @@ bool AstarSearch::detectCollisionWaveFront(const WaveFrontNode &ref)
       if (isOutOfRange(index_x, index_y))
         return true;
 
-      if (nodes_[index_y][index_x][0].status == STATUS::OBS)
+      if (isObstacle(index_x, index_y))
         return true;
     }
   }
@@ -363,8 +402,15 @@ void AstarSearch::reset()
   path_.poses.clear();
 
   // Clear queue
-  std::priority_queue<SimpleNode, std::vector<SimpleNode>, std::greater<SimpleNode>> empty;
-  std::swap(openlist_, empty);
+  openlist_.clear(nodes_);
+
+  // Invalidate all nodes at once
+  generation_++;
+  if (generation_ == 0) {
+    for (auto &node : nodes_)
+      node.generation = 0;
+    generation_ = 1;
+  }
 }
 
 void AstarSearch::setMap(const nav_msgs::OccupancyGrid &map)
@@ -391,32 +437,24 @@ void AstarSearch::setMap(const nav_msgs::OccupancyGrid &map)
   tf::poseMsgToTF(ogm_in_map, map2ogm_);
 
   // Initialize node according to map size
-  if (!node_initialized_) {
+  size_t cells = map.info.width * map.info.height;
+  if (!node_initialized_ || nodes_.size() != cells * angle_size_) {
     resizeNode(map.info.width, map.info.height, angle_size_);
     node_initialized_ = true;
   }
 
-  for (size_t i = 0; i < map.info.height; i++) {
-    for (size_t j = 0; j < map.info.width; j++) {
-      // Index of subscribing OccupancyGrid message
-      size_t og_index = i * map.info.width + j;
-      int cost = map.data[og_index];
-
-      // more than threshold or unknown area
-      if (cost > obstacle_threshold_/* || cost < 0 */) {
-        nodes_[i][j][0].status = STATUS::OBS;
-      }
-      else
-      {
-        for (int k = 0; k < angle_size_; k++) {
-          //nodes_[i][j][k].gc     = 0;
-          nodes_[i][j][k].hc     = 0;
-          nodes_[i][j][k].status = STATUS::NONE;
-          nodes_[i][j][k].parent = NULL;
-        }
-      }
+  // Only the obstacles are set per cell, the nodes are cleared lazily (see getNode())
+  std::vector<uint8_t> obstacles(cells);
+  for (size_t i = 0; i < cells; i++) {
+    // more than threshold or unknown area
+    obstacles[i] = map.data[i] > obstacle_threshold_/* || map.data[i] < 0 */;
+  }
 
-    }
+  // The wavefront heuristic has to be computed again if the obstacles have changed
+  if (obstacles != obstacles_) {
+    obstacles_.swap(obstacles);
+    wavefront_valid_ = false;
+    map_version_++;
   }
 
 }
@@ -435,7 +473,8 @@ bool AstarSearch::setStartNode()
     return false;
 
   // Set start node
-  AstarNode &start_node = nodes_[index_y][index_x][index_theta];
+  int start_index = getNodeIndex(index_x, index_y, index_theta);
+  AstarNode &start_node = getNode(start_index);
   start_node.x      = start_pose_local_.pose.position.x;
   start_node.y      = start_pose_local_.pose.position.y;
   start_node.theta  = 2.0 * M_PI / angle_size_ * index_theta;
@@ -446,8 +485,7 @@ bool AstarSearch::setStartNode()
     start_node.hc = astar::calcDistance(start_pose_local_.pose.position.x, start_pose_local_.pose.position.y, goal_pose_local_.pose.position.x, goal_pose_local_.pose.position.y);
 
   // Push start node to openlist
-  start_sn.cost = start_node.gc + start_node.hc;
-  openlist_.push(start_sn);
+  openlist_.push(nodes_, start_index, start_node.gc + start_node.hc);
   return true;
 }
 
@@ -465,9 +503,19 @@ bool AstarSearch::setGoalNode()
   if (isOutOfRange(index_x, index_y) || detectCollision(goal_sn))
     return false;
 
-  // Calculate wavefront heuristic cost
+  // Calculate wavefront heuristic cost, or reuse the one of the previous plan
   if (use_wavefront_heuristic_) {
-    bool wavefront_result = calcWaveFrontHeuristic(goal_sn);
+    bool wavefront_result;
+    if (wavefront_valid_ && wavefront_goal_x_ == index_x && wavefront_goal_y_ == index_y) {
+      int start_index_x;
+      int start_index_y;
+      int start_index_theta;
+      poseToIndex(start_pose_local_.pose, &start_index_x, &start_index_y, &start_index_theta);
+      wavefront_result = wavefront_hc_[start_index_y * map_info_.width + start_index_x] >= 0;
+    } else {
+      wavefront_result = calcWaveFrontHeuristic(goal_sn);
+    }
+
     if (!wavefront_result) {
       ROS_WARN("Goal is not reachable...");
       return false;
@@ -493,16 +541,15 @@ bool AstarSearch::search()
     }
 
     // Pop minimum cost node from openlist
-    SimpleNode sn;
-    sn = openlist_.top();
-    openlist_.pop();
-    nodes_[sn.index_y][sn.index_x][sn.index_theta].status = STATUS::CLOSED;
+    int current_index = openlist_.pop(nodes_);
+    int current_index_theta = current_index % angle_size_;
 
     // Expand nodes from this node
-    AstarNode *current_node = &nodes_[sn.index_y][sn.index_x][sn.index_theta];
+    AstarNode *current_node = &nodes_[current_index];
+    current_node->status = STATUS::CLOSED;
 
     // for each update
-    for (const auto &state : state_update_table_[sn.index_theta]) {
+    for (const auto &state : state_update_table_[current_index_theta]) {
       // Next state
       double next_x     = current_node->x + state.shift_x;
       double next_y     = current_node->y + state.shift_y;
@@ -531,19 +578,25 @@ bool AstarSearch::search()
       SimpleNode next;
       next.index_x     = next_x / map_info_.resolution;
       next.index_y     = next_y / map_info_.resolution;
-      next.index_theta = sn.index_theta + state.index_theta;
+      next.index_theta = current_index_theta + state.index_theta;
       // Avoid invalid index
       next.index_theta = (next.index_theta + angle_size_) % angle_size_;
 
       // Check if the index is valid
-      if (isOutOfRange(next.index_x, next.index_y) || detectCollision(next))
+      if (isOutOfRange(next.index_x, next.index_y))
         continue;
 
-      AstarNode *next_node = &nodes_[next.index_y][next.index_x][next.index_theta];
-      double next_hc       =  nodes_[next.index_y][next.index_x][0].hc;
+      int next_index = getNodeIndex(next.index_x, next.index_y, next.index_theta);
+      if (detectCollisionCached(next_index, next))
+        continue;
+
+      AstarNode *next_node = &getNode(next_index);
+      double next_hc;
 
       // Calculate euclid distance heuristic cost
-      if (!use_wavefront_heuristic_)
+      if (use_wavefront_heuristic_)
+        next_hc = std::max(wavefront_hc_[next.index_y * map_info_.width + next.index_x], 0.0);
+      else
         next_hc = astar::calcDistance(next_x, next_y, goal_pose_local_.pose.position.x, goal_pose_local_.pose.position.y);
 
       // GOAL CHECK
@@ -573,8 +626,7 @@ bool AstarSearch::search()
         next_node->back   = state.back;
         next_node->parent = current_node;
 
-        next.cost = next_node->gc + next_node->hc;
-        openlist_.push(next);
+        openlist_.push(nodes_, next_index, next_node->gc + next_node->hc);
         continue;
       }
 
@@ -590,8 +642,7 @@ bool AstarSearch::search()
           next_node->back   = state.back;
           next_node->parent = current_node;
 
-          next.cost = next_node->gc + next_node->hc;
-          openlist_.push(next);
+          openlist_.push(nodes_, next_index, next_node->gc + next_node->hc);
           continue;
         }
       }
@@ -617,19 +668,89 @@ bool AstarSearch::makePlan(const geometry_msgs::Pose &start_pose, const geometry
 
   if (!setStartNode()) {
     ROS_WARN("Invalid start pose!");
+    previous_path_.poses.clear();
     return false;
   }
 
+  // Replanning: follow the rest of the previous path if it is still valid
+  if (reusePreviousPath())
+    return true;
+
   if (!setGoalNode()) {
     ROS_WARN("Invalid goal pose!");
+    previous_path_.poses.clear();
     return false;
   }
 
   bool result = search();
 
+  if (result)
+    previous_path_ = path_;
+  else
+    previous_path_.poses.clear();
+
   return result;
 }
 
+bool AstarSearch::reusePreviousPath()
+{
+  if (reuse_path_distance_ <= 0 || previous_path_.poses.empty())
+    return false;
+
+  tf::Transform ogm2map = map2ogm_.inverse();
+  static const double one_angle_range = 2.0 * M_PI / angle_size_;
+
+  // The previous path has to end at the current goal
+  geometry_msgs::Pose path_end = previous_path_.poses.back().pose;
+  path_end = astar::transformPose(path_end, ogm2map);
+  if (!isGoal(path_end.position.x, path_end.position.y, astar::modifyTheta(tf::getYaw(path_end.orientation))))
+    return false;
+
+  // Closest pose of the previous path from the start
+  double start_yaw = astar::modifyTheta(tf::getYaw(start_pose_local_.pose.orientation));
+  int closest = -1;
+  double closest_distance = reuse_path_distance_;
+  std::vector<geometry_msgs::Pose> local_poses(previous_path_.poses.size());
+  for (size_t i = 0; i < previous_path_.poses.size(); i++) {
+    local_poses[i] = previous_path_.poses[i].pose;
+    local_poses[i] = astar::transformPose(local_poses[i], ogm2map);
+
+    double distance = astar::calcDistance(start_pose_local_.pose.position.x, start_pose_local_.pose.position.y,
+                                          local_poses[i].position.x, local_poses[i].position.y);
+    double yaw = astar::modifyTheta(tf::getYaw(local_poses[i].orientation));
+    if (distance < closest_distance && astar::calcDiffOfRadian(start_yaw, yaw) < one_angle_range) {
+      closest = i;
+      closest_distance = distance;
+    }
+  }
+
+  if (closest < 0)
+    return false;
+
+  // The rest of the path must still be free in the current map
+  for (size_t i = closest; i < local_poses.size(); i++) {
+    int index_x;
+    int index_y;
+    int index_theta;
+    poseToIndex(local_poses[i], &index_x, &index_y, &index_theta);
+
+    // Path poses are on the descretized angles, round them instead of truncating
+    double yaw  = astar::modifyTheta(tf::getYaw(local_poses[i].orientation));
+    index_theta = static_cast<int>(std::round(yaw / one_angle_range)) % angle_size_;
+    if (isOutOfRange(index_x, index_y) || detectCollision(SimpleNode(index_x, index_y, index_theta, 0, 0)))
+      return false;
+  }
+
+  path_.header.stamp = ros::Time::now();
+  path_.header.frame_id = path_frame_;
+  path_.poses.assign(previous_path_.poses.begin() + closest, previous_path_.poses.end());
+  for (auto &pose : path_.poses)
+    pose.header = path_.header;
+  previous_path_ = path_;
+
+  return true;
+}
+
 // for debug
 void AstarSearch::publishPoseArray(const ros::Publisher &pub, const std::string &frame)
 {
@@ -11,6 +11,7 @@
 #include <tf/transform_broadcaster.h>
 #include <tf/transform_listener.h>
 
+#include <algorithm>
 #include <iostream>
 #include <vector>
 #include <queue>
@@ -36,6 +37,8 @@ class AstarSearch
  private:
   bool search();
   void resizeNode(int width, int height, int angle_size);
+  int getNodeIndex(int index_x, int index_y, int index_theta) const;
+  AstarNode &getNode(int index);
   void createStateUpdateTable(int angle_size);
   void createStateUpdateTableLocal(int angle_size); //
   void poseToIndex(const geometry_msgs::Pose &pose, int *index_x, int *index_y, int *index_theta);
@@ -46,8 +49,11 @@ class AstarSearch
   bool setGoalNode();
   bool isGoal(double x, double y, double theta);
   bool detectCollision(const SimpleNode &sn);
+  bool detectCollisionCached(int index, const SimpleNode &sn);
   bool calcWaveFrontHeuristic(const SimpleNode &sn);
   bool detectCollisionWaveFront(const WaveFrontNode &sn);
+  bool isObstacle(int index_x, int index_y) const;
+  bool reusePreviousPath();
 
   // ROS param
   std::string path_frame_;        // publishing path frame
@@ -64,14 +70,31 @@ class AstarSearch
   double reverse_weight_;
   bool use_wavefront_heuristic_;
   bool use_2dnav_goal_;
+  double reuse_path_distance_;    // meter, keep following the previous path if the start is this close to it (0: always search)
 
   bool node_initialized_;
   std::vector<std::vector<NodeUpdate>> state_update_table_;
   nav_msgs::MapMetaData map_info_;
-  std::vector<std::vector<std::vector<AstarNode>>> nodes_;
-  std::priority_queue<SimpleNode, std::vector<SimpleNode>, std::greater<SimpleNode>> openlist_;
+  // Nodes of all (x, y, theta), see getNodeIndex()
+  // A node is valid only if its generation is the current one, so reset() does not touch them
+  std::vector<AstarNode> nodes_;
+  uint32_t generation_;
+  uint32_t map_version_;  // incremented when the obstacles change
+  OpenList openlist_;
   std::vector<SimpleNode> goallist_;
 
+  // Per cell of the map
+  std::vector<uint8_t> obstacles_;
+  std::vector<double> wavefront_hc_;  // negative if the goal can not be reached from the cell
+
+  // The wavefront heuristic is kept while the obstacles and the goal cell are the same
+  bool wavefront_valid_;
+  int wavefront_goal_x_;
+  int wavefront_goal_y_;
+
+  // Last path found, in path_frame_
+  nav_msgs::Path previous_path_;
+
   // Pose in global(/map) frame
   geometry_msgs::PoseStamped start_pose_;
   geometry_msgs::PoseStamped goal_pose_;
@@ -1,5 +1,7 @@
 #include "search_info_ros.h"
 
+#include <algorithm>
+
 SearchInfo::SearchInfo()
   : map_set_(false)
   , start_set_(false)
@@ -14,6 +16,7 @@ SearchInfo::~SearchInfo()
 void SearchInfo::mapCallback(const nav_msgs::OccupancyGridConstPtr &msg)
 {
   map_ = *msg;
+  full_map_stamp_ = msg->header.stamp;
 
   // TODO: what frame do we use?
   std::string map_frame = "map";
@@ -38,6 +41,33 @@ void SearchInfo::mapCallback(const nav_msgs::OccupancyGridConstPtr &msg)
   map_set_ = true;
 }
 
+// Changed cells of the last map
+void SearchInfo::mapUpdateCallback(const map_msgs::OccupancyGridUpdateConstPtr &msg)
+{
+  // Updates before the first map or older than it are ignored
+  if (map_.data.empty() || msg->header.stamp < full_map_stamp_)
+    return;
+
+  // Malformed patches or patches out of the current map would write out of bounds
+  if (msg->data.size() != static_cast<size_t>(msg->width) * msg->height ||
+      msg->x < 0 || msg->y < 0 ||
+      static_cast<uint32_t>(msg->x) > map_.info.width || msg->width > map_.info.width - msg->x ||
+      static_cast<uint32_t>(msg->y) > map_.info.height || msg->height > map_.info.height - msg->y)
+  {
+    ROS_WARN("Ignored a malformed map update (%d, %d, %u x %u, %zu cells) for a %u x %u map",
+             msg->x, msg->y, msg->width, msg->height, msg->data.size(), map_.info.width, map_.info.height);
+    return;
+  }
+
+  for (size_t i = 0; i < msg->height; i++) {
+    const int8_t *row = &msg->data[i * msg->width];
+    std::copy(row, row + msg->width, &map_.data[(msg->y + i) * map_.info.width + msg->x]);
+  }
+  map_.header.stamp = msg->header.stamp;
+
+  map_set_ = true;
+}
+
 
 void SearchInfo::startCallback(const geometry_msgs::PoseWithCovarianceStampedConstPtr &msg)
 {
@@ -4,6 +4,7 @@
 #include "astar_util.h"
 
 #include <nav_msgs/OccupancyGrid.h>
+#include <map_msgs/OccupancyGridUpdate.h>
 #include <geometry_msgs/PoseStamped.h>
 #include <geometry_msgs/PoseWithCovarianceStamped.h>
 #include <tf/transform_listener.h>
@@ -17,6 +18,7 @@ class SearchInfo
 
   // ROS Callback
   void mapCallback(const nav_msgs::OccupancyGridConstPtr &msg);
+  void mapUpdateCallback(const map_msgs::OccupancyGridUpdateConstPtr &msg);
   void startCallback(const geometry_msgs::PoseWithCovarianceStampedConstPtr &msg);
   void goalCallback(const geometry_msgs::PoseStampedConstPtr &msg);
   void currentPoseCallback(const geometry_msgs::PoseStampedConstPtr &msg);
@@ -34,6 +36,8 @@ class SearchInfo
 
  private:
   nav_msgs::OccupancyGrid map_;
+  // Stamp of the last full map, older updates belong to a previous map
+  ros::Time full_map_stamp_;
   geometry_msgs::PoseStamped start_pose_global_;
   geometry_msgs::PoseStamped goal_pose_global_;
   geometry_msgs::PoseStamped start_pose_local_;
@@ -31,7 +31,9 @@
 #ifndef LANE_PLANNER_VMAP_HPP
 #define LANE_PLANNER_VMAP_HPP
 
+#include <cstdint>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <geometry_msgs/Point.h>
@@ -57,12 +59,38 @@ constexpr int TRAFFIC_LIGHT_UNKNOWN = 2;
 
 constexpr double RADIUS_MAX = 90000000000;
 
+// Lanes of a VectorMap compiled for traversal. Values are indexes into the
+// vectors of the VectorMap, and every id resolves to its first occurrence.
+// Adjacency is stored in CSR form, e.g. the successors of lanes[i] are
+// lanes[next_lanes[j]] for next_offsets[i] <= j < next_offsets[i + 1].
+struct LaneGraph {
+	std::unordered_map<int, int> point_index; // pid
+	std::unordered_map<int, int> node_index; // nid
+	std::unordered_map<int, int> lane_index; // lnid
+	std::unordered_map<int, int> dtlane_index; // did
+	std::unordered_map<int, int> stopline_index; // linkid
+
+	std::unordered_map<int, int> start_index; // pid to row of start_offsets
+	std::vector<int> start_offsets;
+	std::vector<int> start_lanes;
+	std::vector<int> next_offsets; // flid, flid2, flid3 and flid4
+	std::vector<int> next_lanes;
+	std::vector<int> prev_offsets; // blid, blid2, blid3 and blid4
+	std::vector<int> prev_lanes;
+
+	size_t point_size = 0;
+	size_t lane_size = 0;
+	size_t node_size = 0;
+	uint64_t key_hash = 0; // ids the graph was built from, see is_compiled_vmap()
+};
+
 struct VectorMap {
 	std::vector<vector_map::Point> points;
 	std::vector<vector_map::Lane> lanes;
 	std::vector<vector_map::Node> nodes;
 	std::vector<vector_map::StopLine> stoplines;
 	std::vector<vector_map::DTLane> dtlanes;
+	LaneGraph graph;
 };
 
 void write_waypoints(const std::vector<vector_map::Point>& points, double velocity, const std::string& path);
@@ -80,6 +108,9 @@ vector_map::Point create_vector_map_point(const geometry_msgs::Point& gp);
 waypoint_follower::dtlane create_waypoint_follower_dtlane(const vector_map::DTLane& vd);
 vector_map::DTLane create_vector_map_dtlane(const waypoint_follower::dtlane& wd);
 
+LaneGraph create_lane_graph(const VectorMap& vmap);
+bool is_compiled_vmap(const VectorMap& vmap);
+
 VectorMap create_lane_vmap(const VectorMap& vmap, int lno);
 VectorMap create_coarse_vmap_from_lane(const waypoint_follower::lane& lane);
 VectorMap create_coarse_vmap_from_route(const tablet_socket::route_cmd& route);
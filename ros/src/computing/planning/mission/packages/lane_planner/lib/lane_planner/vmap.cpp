@@ -28,6 +28,8 @@
  *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include <algorithm>
+#include <cstdint>
 #include <fstream>
 #include <tuple>
 
@@ -44,6 +46,17 @@ namespace vmap {
 
 namespace {
 
+using IdGroups = std::unordered_map<int, std::vector<int>>;
+
+template <class T, class F>
+IdGroups group_by_id(const std::vector<T>& objs, F get_id);
+template <class T, class F>
+std::unordered_map<int, int> index_by_id(const std::vector<T>& objs, F get_id);
+void append_lanes(const IdGroups& lanes_by_lnid, const std::vector<int>& lnids, std::vector<int>& offsets,
+		  std::vector<int>& lanes);
+void hash_id(uint64_t& hash, int id);
+uint64_t hash_graph_keys(const VectorMap& vmap);
+
 void write_waypoint(const vector_map::Point& point, double yaw, double velocity, const std::string& path,
 		    bool first);
 
@@ -72,6 +85,82 @@ vector_map::Lane find_next_lane(const VectorMap& vmap, int lno, const vector_map
 vector_map::Lane find_next_branching_lane(const VectorMap& vmap, int lno, const vector_map::Lane& lane,
 					  double coarse_angle, double search_radius);
 
+template <class T, class F>
+IdGroups group_by_id(const std::vector<T>& objs, F get_id)
+{
+	IdGroups groups;
+	for (size_t i = 0; i < objs.size(); ++i)
+		groups[get_id(objs[i])].push_back(i);
+
+	return groups;
+}
+
+template <class T, class F>
+std::unordered_map<int, int> index_by_id(const std::vector<T>& objs, F get_id)
+{
+	std::unordered_map<int, int> index;
+	for (size_t i = 0; i < objs.size(); ++i)
+		index.insert(std::make_pair(get_id(objs[i]), i)); // keep first
+
+	return index;
+}
+
+// append one CSR row with the lanes whose lnid is in lnids, in lanes order
+void append_lanes(const IdGroups& lanes_by_lnid, const std::vector<int>& lnids, std::vector<int>& offsets,
+		  std::vector<int>& lanes)
+{
+	size_t begin = lanes.size();
+	for (int lnid : lnids) {
+		if (lnid == 0)
+			continue;
+		auto it = lanes_by_lnid.find(lnid);
+		if (it == lanes_by_lnid.end())
+			continue;
+		lanes.insert(lanes.end(), it->second.begin(), it->second.end());
+	}
+	std::sort(lanes.begin() + begin, lanes.end());
+	lanes.erase(std::unique(lanes.begin() + begin, lanes.end()), lanes.end());
+	offsets.push_back(lanes.size());
+}
+
+// FNV-1a over the bytes of id
+void hash_id(uint64_t& hash, int id)
+{
+	uint32_t v = static_cast<uint32_t>(id);
+	for (int i = 0; i < 4; ++i) {
+		hash ^= (v >> (8 * i)) & 0xff;
+		hash *= 1099511628211ULL;
+	}
+}
+
+// hash every id a LaneGraph is built from, in vectors order, so that any
+// edit or reordering that changes the graph changes the hash
+uint64_t hash_graph_keys(const VectorMap& vmap)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	for (const vector_map::Point& p : vmap.points)
+		hash_id(hash, p.pid);
+	hash_id(hash, -1);
+	for (const vector_map::Node& n : vmap.nodes) {
+		hash_id(hash, n.nid);
+		hash_id(hash, n.pid);
+	}
+	hash_id(hash, -1);
+	for (const vector_map::Lane& l : vmap.lanes) {
+		for (int id : { l.lnid, l.bnid, l.fnid, l.did, l.flid, l.flid2, l.flid3, l.flid4, l.blid, l.blid2,
+				l.blid3, l.blid4 })
+			hash_id(hash, id);
+	}
+	hash_id(hash, -1);
+	for (const vector_map::DTLane& d : vmap.dtlanes)
+		hash_id(hash, d.did);
+	hash_id(hash, -1);
+	for (const vector_map::StopLine& s : vmap.stoplines)
+		hash_id(hash, s.linkid);
+
+	return hash;
+}
+
 void write_waypoint(const vector_map::Point& point, double yaw, double velocity, const std::string& path,
 		    bool first)
 {
@@ -134,17 +223,14 @@ vector_map::Point find_start_point(const VectorMap& vmap, const vector_map::Lane
 	vector_map::Point error;
 	error.pid = -1;
 
-	for (const vector_map::Node& n : vmap.nodes) {
-		if (n.nid != lane.bnid)
-			continue;
-		for (const vector_map::Point& p : vmap.points) {
-			if (p.pid != n.pid)
-				continue;
-			return p;
-		}
-	}
+	auto n = vmap.graph.node_index.find(lane.bnid);
+	if (n == vmap.graph.node_index.end())
+		return error;
+	auto p = vmap.graph.point_index.find(vmap.nodes[n->second].pid);
+	if (p == vmap.graph.point_index.end())
+		return error;
 
-	return error;
+	return vmap.points[p->second];
 }
 
 vector_map::Point find_end_point(const VectorMap& vmap, const vector_map::Lane& lane)
@@ -152,17 +238,14 @@ vector_map::Point find_end_point(const VectorMap& vmap, const vector_map::Lane&
 	vector_map::Point error;
 	error.pid = -1;
 
-	for (const vector_map::Node& n : vmap.nodes) {
-		if (n.nid != lane.fnid)
-			continue;
-		for (const vector_map::Point& p : vmap.points) {
-			if (p.pid != n.pid)
-				continue;
-			return p;
-		}
-	}
+	auto n = vmap.graph.node_index.find(lane.fnid);
+	if (n == vmap.graph.node_index.end())
+		return error;
+	auto p = vmap.graph.point_index.find(vmap.nodes[n->second].pid);
+	if (p == vmap.graph.point_index.end())
+		return error;
 
-	return error;
+	return vmap.points[p->second];
 }
 
 vector_map::Point find_departure_point(const VectorMap& lane_vmap, int lno,
@@ -280,16 +363,15 @@ vector_map::Lane find_lane(const VectorMap& vmap, int lno, const vector_map::Poi
 	vector_map::Lane error;
 	error.lnid = -1;
 
-	for (const vector_map::Node& n : vmap.nodes) {
-		if (n.pid != point.pid)
+	const LaneGraph& g = vmap.graph;
+	auto it = g.start_index.find(point.pid);
+	if (it == g.start_index.end())
+		return error;
+	for (int i = g.start_offsets[it->second]; i < g.start_offsets[it->second + 1]; ++i) {
+		const vector_map::Lane& l = vmap.lanes[g.start_lanes[i]];
+		if (lno != LNO_ALL && l.lno != lno)
 			continue;
-		for (const vector_map::Lane& l : vmap.lanes) {
-			if (lno != LNO_ALL && l.lno != lno)
-				continue;
-			if (l.bnid != n.nid)
-				continue;
-			return l;
-		}
+		return l;
 	}
 
 	return error;
@@ -300,21 +382,22 @@ vector_map::Lane find_prev_lane(const VectorMap& vmap, int lno, const vector_map
 	vector_map::Lane error;
 	error.lnid = -1;
 
-	if (is_merging_lane(lane)) {
-		for (const vector_map::Lane& l : vmap.lanes) {
+	const LaneGraph& g = vmap.graph;
+	auto it = g.lane_index.find(lane.lnid);
+	if (it == g.lane_index.end())
+		return error;
+
+	bool merging = is_merging_lane(lane);
+	for (int i = g.prev_offsets[it->second]; i < g.prev_offsets[it->second + 1]; ++i) {
+		const vector_map::Lane& l = vmap.lanes[g.prev_lanes[i]];
+		if (merging) {
 			if (lno != LNO_ALL && l.lno != lno)
 				continue;
-			if (l.lnid != lane.blid && l.lnid != lane.blid2 && l.lnid != lane.blid3 &&
-			    l.lnid != lane.blid4)
-				continue;
-			return l;
-		}
-	} else {
-		for (const vector_map::Lane& l : vmap.lanes) {
+		} else {
 			if (l.lnid != lane.blid)
 				continue;
-			return l;
 		}
+		return l;
 	}
 
 	return error;
@@ -325,21 +408,22 @@ vector_map::Lane find_next_lane(const VectorMap& vmap, int lno, const vector_map
 	vector_map::Lane error;
 	error.lnid = -1;
 
-	if (is_branching_lane(lane)) {
-		for (const vector_map::Lane& l : vmap.lanes) {
+	const LaneGraph& g = vmap.graph;
+	auto it = g.lane_index.find(lane.lnid);
+	if (it == g.lane_index.end())
+		return error;
+
+	bool branching = is_branching_lane(lane);
+	for (int i = g.next_offsets[it->second]; i < g.next_offsets[it->second + 1]; ++i) {
+		const vector_map::Lane& l = vmap.lanes[g.next_lanes[i]];
+		if (branching) {
 			if (lno != LNO_ALL && l.lno != lno)
 				continue;
-			if (l.lnid != lane.flid && l.lnid != lane.flid2 && l.lnid != lane.flid3 &&
-			    l.lnid != lane.flid4)
-				continue;
-			return l;
-		}
-	} else {
-		for (const vector_map::Lane& l : vmap.lanes) {
+		} else {
 			if (l.lnid != lane.flid)
 				continue;
-			return l;
 		}
+		return l;
 	}
 
 	return error;
@@ -355,29 +439,33 @@ vector_map::Lane find_next_branching_lane(const VectorMap& vmap, int lno, const
 	if (p1.pid < 0)
 		return error;
 
+	const LaneGraph& g = vmap.graph;
+	auto it = g.lane_index.find(lane.lnid);
+	if (it == g.lane_index.end())
+		return error;
+
 	std::vector<std::tuple<vector_map::Point, vector_map::Lane>> candidates;
-	for (const vector_map::Lane& l1 : vmap.lanes) {
+	for (int i = g.next_offsets[it->second]; i < g.next_offsets[it->second + 1]; ++i) {
+		const vector_map::Lane& l1 = vmap.lanes[g.next_lanes[i]];
 		if (lno != LNO_ALL && l1.lno != lno)
 			continue;
-		if (l1.lnid == lane.flid || l1.lnid == lane.flid2 || l1.lnid == lane.flid3 || l1.lnid == lane.flid4) {
-			vector_map::Lane l2 = l1;
-			vector_map::Point p = find_end_point(vmap, l2);
+		vector_map::Lane l2 = l1;
+		vector_map::Point p = find_end_point(vmap, l2);
+		if (p.pid < 0)
+			continue;
+		vector_map::Point p2 = p;
+		double d = hypot(p2.bx - p1.bx, p2.ly - p1.ly);
+		while (d <= search_radius && l2.flid != 0 && !is_branching_lane(l2)) {
+			l2 = find_next_lane(vmap, LNO_ALL, l2);
+			if (l2.lnid < 0)
+				break;
+			p = find_end_point(vmap, l2);
 			if (p.pid < 0)
-				continue;
-			vector_map::Point p2 = p;
-			double d = hypot(p2.bx - p1.bx, p2.ly - p1.ly);
-			while (d <= search_radius && l2.flid != 0 && !is_branching_lane(l2)) {
-				l2 = find_next_lane(vmap, LNO_ALL, l2);
-				if (l2.lnid < 0)
-					break;
-				p = find_end_point(vmap, l2);
-				if (p.pid < 0)
-					break;
-				p2 = p;
-				d = hypot(p2.bx - p1.bx, p2.ly - p1.ly);
-			}
-			candidates.push_back(std::make_tuple(p2, l1));
+				break;
+			p2 = p;
+			d = hypot(p2.bx - p1.bx, p2.ly - p1.ly);
 		}
+		candidates.push_back(std::make_tuple(p2, l1));
 	}
 
 	if (candidates.empty())
@@ -536,38 +624,110 @@ vector_map::DTLane create_vector_map_dtlane(const waypoint_follower::dtlane& wd)
 	return vd;
 }
 
+LaneGraph create_lane_graph(const VectorMap& vmap)
+{
+	LaneGraph graph;
+	graph.point_size = vmap.points.size();
+	graph.lane_size = vmap.lanes.size();
+	graph.node_size = vmap.nodes.size();
+	graph.key_hash = hash_graph_keys(vmap);
+
+	graph.point_index = index_by_id(vmap.points, [](const vector_map::Point& p) { return p.pid; });
+	graph.node_index = index_by_id(vmap.nodes, [](const vector_map::Node& n) { return n.nid; });
+	graph.lane_index = index_by_id(vmap.lanes, [](const vector_map::Lane& l) { return l.lnid; });
+	graph.dtlane_index = index_by_id(vmap.dtlanes, [](const vector_map::DTLane& d) { return d.did; });
+	graph.stopline_index = index_by_id(vmap.stoplines, [](const vector_map::StopLine& s) { return s.linkid; });
+
+	// lanes starting at a point, in nodes order then lanes order
+	IdGroups lanes_by_bnid = group_by_id(vmap.lanes, [](const vector_map::Lane& l) { return l.bnid; });
+	std::vector<std::vector<int>> start_rows;
+	for (const vector_map::Node& n : vmap.nodes) {
+		auto it = graph.start_index.find(n.pid);
+		if (it == graph.start_index.end()) {
+			it = graph.start_index.insert(std::make_pair(n.pid, start_rows.size())).first;
+			start_rows.emplace_back();
+		}
+		auto lanes = lanes_by_bnid.find(n.nid);
+		if (lanes == lanes_by_bnid.end())
+			continue;
+		std::vector<int>& row = start_rows[it->second];
+		row.insert(row.end(), lanes->second.begin(), lanes->second.end());
+	}
+	graph.start_offsets.push_back(0);
+	for (const std::vector<int>& row : start_rows) {
+		graph.start_lanes.insert(graph.start_lanes.end(), row.begin(), row.end());
+		graph.start_offsets.push_back(graph.start_lanes.size());
+	}
+
+	IdGroups lanes_by_lnid = group_by_id(vmap.lanes, [](const vector_map::Lane& l) { return l.lnid; });
+	graph.next_offsets.push_back(0);
+	graph.prev_offsets.push_back(0);
+	for (const vector_map::Lane& l : vmap.lanes) {
+		append_lanes(lanes_by_lnid, { l.flid, l.flid2, l.flid3, l.flid4 }, graph.next_offsets,
+			     graph.next_lanes);
+		append_lanes(lanes_by_lnid, { l.blid, l.blid2, l.blid3, l.blid4 }, graph.prev_offsets,
+			     graph.prev_lanes);
+	}
+
+	return graph;
+}
+
+bool is_compiled_vmap(const VectorMap& vmap)
+{
+	return (vmap.graph.point_size == vmap.points.size() && vmap.graph.lane_size == vmap.lanes.size() &&
+		vmap.graph.node_size == vmap.nodes.size() &&
+		vmap.graph.next_offsets.size() == vmap.lanes.size() + 1 &&
+		vmap.graph.key_hash == hash_graph_keys(vmap));
+}
+
 VectorMap create_lane_vmap(const VectorMap& vmap, int lno)
 {
+	IdGroups nodes_by_nid = group_by_id(vmap.nodes, [](const vector_map::Node& n) { return n.nid; });
+	IdGroups points_by_pid = group_by_id(vmap.points, [](const vector_map::Point& p) { return p.pid; });
+	IdGroups stoplines_by_linkid = group_by_id(vmap.stoplines, [](const vector_map::StopLine& s) { return s.linkid; });
+	IdGroups dtlanes_by_did = group_by_id(vmap.dtlanes, [](const vector_map::DTLane& d) { return d.did; });
+
 	VectorMap lane_vmap;
+	std::vector<int> nodes;
 	for (const vector_map::Lane& l : vmap.lanes) {
 		if (lno != LNO_ALL && l.lno != lno)
 			continue;
 		lane_vmap.lanes.push_back(l);
 
-		for (const vector_map::Node& n : vmap.nodes) {
-			if (n.nid != l.bnid && n.nid != l.fnid)
-				continue;
+		// begin and finish nodes in nodes order
+		nodes.clear();
+		auto b = nodes_by_nid.find(l.bnid);
+		if (b != nodes_by_nid.end())
+			nodes.insert(nodes.end(), b->second.begin(), b->second.end());
+		auto f = nodes_by_nid.find(l.fnid);
+		if (f != nodes_by_nid.end() && l.fnid != l.bnid)
+			nodes.insert(nodes.end(), f->second.begin(), f->second.end());
+		std::sort(nodes.begin(), nodes.end());
+
+		for (int i : nodes) {
+			const vector_map::Node& n = vmap.nodes[i];
 			lane_vmap.nodes.push_back(n);
 
-			for (const vector_map::Point& p : vmap.points) {
-				if (p.pid != n.pid)
-					continue;
-				lane_vmap.points.push_back(p);
-			}
+			auto p = points_by_pid.find(n.pid);
+			if (p == points_by_pid.end())
+				continue;
+			for (int j : p->second)
+				lane_vmap.points.push_back(vmap.points[j]);
 		}
 
-		for (const vector_map::StopLine& s : vmap.stoplines) {
-			if (s.linkid != l.lnid)
-				continue;
-			lane_vmap.stoplines.push_back(s);
+		auto s = stoplines_by_linkid.find(l.lnid);
+		if (s != stoplines_by_linkid.end()) {
+			for (int i : s->second)
+				lane_vmap.stoplines.push_back(vmap.stoplines[i]);
 		}
 
-		for (const vector_map::DTLane& d : vmap.dtlanes) {
-			if (d.did != l.did)
-				continue;
-			lane_vmap.dtlanes.push_back(d);
+		auto d = dtlanes_by_did.find(l.did);
+		if (d != dtlanes_by_did.end()) {
+			for (int i : d->second)
+				lane_vmap.dtlanes.push_back(vmap.dtlanes[i]);
 		}
 	}
+	lane_vmap.graph = create_lane_graph(lane_vmap);
 
 	return lane_vmap;
 }
@@ -602,6 +762,12 @@ VectorMap create_coarse_vmap_from_route(const tablet_socket::route_cmd& route)
 VectorMap create_fine_vmap(const VectorMap& lane_vmap, int lno, const VectorMap& coarse_vmap, double search_radius,
 			   int waypoint_max)
 {
+	if (!is_compiled_vmap(lane_vmap)) {
+		VectorMap compiled_vmap = lane_vmap;
+		compiled_vmap.graph = create_lane_graph(compiled_vmap);
+		return create_fine_vmap(compiled_vmap, lno, coarse_vmap, search_radius, waypoint_max);
+	}
+
 	VectorMap fine_vmap;
 	VectorMap null_vmap;
 
@@ -645,23 +811,17 @@ VectorMap create_fine_vmap(const VectorMap& lane_vmap, int lno, const VectorMap&
 		// last is equal to previous dtlane
 		vector_map::DTLane dtlane;
 		dtlane.did = -1;
-		for (const vector_map::DTLane& d : lane_vmap.dtlanes) {
-			if (d.did == lane.did) {
-				dtlane = d;
-				break;
-			}
-		}
+		auto d = lane_vmap.graph.dtlane_index.find(lane.did);
+		if (d != lane_vmap.graph.dtlane_index.end())
+			dtlane = lane_vmap.dtlanes[d->second];
 		fine_vmap.dtlanes.push_back(dtlane);
 
 		// last is equal to previous stopline
 		vector_map::StopLine stopline;
 		stopline.id = -1;
-		for (const vector_map::StopLine& s : lane_vmap.stoplines) {
-			if (s.linkid == lane.lnid) {
-				stopline = s;
-				break;
-			}
-		}
+		auto s = lane_vmap.graph.stopline_index.find(lane.lnid);
+		if (s != lane_vmap.graph.stopline_index.end())
+			stopline = lane_vmap.stoplines[s->second];
 		fine_vmap.stoplines.push_back(stopline);
 
 		if (finish)
@@ -732,6 +892,12 @@ VectorMap create_fine_vmap(const VectorMap& lane_vmap, int lno, const VectorMap&
 
 std::vector<vector_map::Point> create_branching_points(const VectorMap& vmap)
 {
+	if (!is_compiled_vmap(vmap)) {
+		VectorMap compiled_vmap = vmap;
+		compiled_vmap.graph = create_lane_graph(compiled_vmap);
+		return create_branching_points(compiled_vmap);
+	}
+
 	std::vector<vector_map::Point> branching_points;
 	for (const vector_map::Point& p : vmap.points) {
 		if (!is_branching_point(vmap, p))
@@ -744,6 +910,12 @@ std::vector<vector_map::Point> create_branching_points(const VectorMap& vmap)
 
 std::vector<vector_map::Point> create_merging_points(const VectorMap& vmap)
 {
+	if (!is_compiled_vmap(vmap)) {
+		VectorMap compiled_vmap = vmap;
+		compiled_vmap.graph = create_lane_graph(compiled_vmap);
+		return create_merging_points(compiled_vmap);
+	}
+
 	std::vector<vector_map::Point> merging_points;
 	for (const vector_map::Point& p : vmap.points) {
 		if (!is_merging_point(vmap, p))
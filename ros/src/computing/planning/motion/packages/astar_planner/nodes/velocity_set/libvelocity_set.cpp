@@ -319,3 +319,140 @@ geometry_msgs::Point ObstaclePoints::getObstaclePoint(const EControl &kind) cons
     return point;
   }
 }
+
+void ObstacleGrid::build(const pcl::PointCloud<pcl::PointXYZ> &points, const double &min_cell_size)
+{
+  // keep the grid at most a few cells per point even if some points are far away
+  static constexpr int MAX_CELLS_PER_POINT = 4;
+
+  cell_start_.clear();
+  x_.clear();
+  y_.clear();
+  index_.clear();
+  width_ = height_ = 0;
+
+  double max_x = -std::numeric_limits<double>::max();
+  double max_y = -std::numeric_limits<double>::max();
+  min_x_ = min_y_ = std::numeric_limits<double>::max();
+  int finite_size = 0;
+  for (const auto &p : points)
+  {
+    if (!std::isfinite(p.x) || !std::isfinite(p.y))
+      continue;
+    min_x_ = std::min(min_x_, static_cast<double>(p.x));
+    min_y_ = std::min(min_y_, static_cast<double>(p.y));
+    max_x = std::max(max_x, static_cast<double>(p.x));
+    max_y = std::max(max_y, static_cast<double>(p.y));
+    finite_size++;
+  }
+  if (finite_size == 0)
+    return;
+
+  double area = (max_x - min_x_) * (max_y - min_y_);
+  cell_size_ = std::max(min_cell_size, std::sqrt(area / (static_cast<double>(MAX_CELLS_PER_POINT) * finite_size)));
+  if (cell_size_ <= 0)
+    cell_size_ = 1.0;
+  width_ = static_cast<int>((max_x - min_x_) / cell_size_) + 1;
+  height_ = static_cast<int>((max_y - min_y_) / cell_size_) + 1;
+
+  // counting sort of the points by cell
+  std::vector<int> cells(points.size(), -1);
+  cell_start_.assign(width_ * height_ + 1, 0);
+  for (unsigned int i = 0; i < points.size(); i++)
+  {
+    const pcl::PointXYZ &p = points[i];
+    if (!std::isfinite(p.x) || !std::isfinite(p.y))
+      continue;
+    int cx = std::min(static_cast<int>((p.x - min_x_) / cell_size_), width_ - 1);
+    int cy = std::min(static_cast<int>((p.y - min_y_) / cell_size_), height_ - 1);
+    cells[i] = cy * width_ + cx;
+    cell_start_[cells[i] + 1]++;
+  }
+  for (int c = 0; c < width_ * height_; c++)
+    cell_start_[c + 1] += cell_start_[c];
+
+  std::vector<int> fill(cell_start_.begin(), cell_start_.end() - 1);
+  x_.resize(finite_size);
+  y_.resize(finite_size);
+  index_.resize(finite_size);
+  for (unsigned int i = 0; i < points.size(); i++)
+  {
+    if (cells[i] < 0)
+      continue;
+    int n = fill[cells[i]]++;
+    x_[n] = points[i].x;
+    y_[n] = points[i].y;
+    index_[n] = i;
+  }
+}
+
+bool ObstacleGrid::cellRange(const double &x, const double &y, const double &radius, int *x0, int *y0, int *x1,
+                             int *y1) const
+{
+  if (empty())
+    return false;
+
+  double fx0 = std::floor((x - radius - min_x_) / cell_size_);
+  double fy0 = std::floor((y - radius - min_y_) / cell_size_);
+  double fx1 = std::floor((x + radius - min_x_) / cell_size_);
+  double fy1 = std::floor((y + radius - min_y_) / cell_size_);
+  if (fx1 < 0 || fy1 < 0 || fx0 >= width_ || fy0 >= height_)
+    return false;
+
+  *x0 = std::max(0, static_cast<int>(fx0));
+  *y0 = std::max(0, static_cast<int>(fy0));
+  *x1 = std::min(width_ - 1, static_cast<int>(fx1));
+  *y1 = std::min(height_ - 1, static_cast<int>(fy1));
+  return true;
+}
+
+int ObstacleGrid::countPoints(const double &x, const double &y, const double &min_range, const double &max_range,
+                              const int &limit) const
+{
+  int x0, y0, x1, y1;
+  if (!cellRange(x, y, max_range, &x0, &y0, &x1, &y1))
+    return 0;
+
+  double min_square = min_range < 0 ? -1.0 : min_range * min_range;
+  double max_square = max_range * max_range;
+  int count = 0;
+  for (int cy = y0; cy <= y1; cy++)
+  {
+    for (int n = cell_start_[cy * width_ + x0], end = cell_start_[cy * width_ + x1 + 1]; n < end; n++)
+    {
+      double dx = x_[n] - x;
+      double dy = y_[n] - y;
+      double square = dx * dx + dy * dy;
+      if (square > min_square && square < max_square && ++count > limit)
+        return count;
+    }
+  }
+
+  return count;
+}
+
+void ObstacleGrid::findPoints(const double &x, const double &y, const double &min_range, const double &max_range,
+                              std::vector<int> *indices) const
+{
+  indices->clear();
+  int x0, y0, x1, y1;
+  if (!cellRange(x, y, max_range, &x0, &y0, &x1, &y1))
+    return;
+
+  double min_square = min_range < 0 ? -1.0 : min_range * min_range;
+  double max_square = max_range * max_range;
+  for (int cy = y0; cy <= y1; cy++)
+  {
+    for (int n = cell_start_[cy * width_ + x0], end = cell_start_[cy * width_ + x1 + 1]; n < end; n++)
+    {
+      double dx = x_[n] - x;
+      double dy = y_[n] - y;
+      double square = dx * dx + dy * dy;
+      if (square > min_square && square < max_square)
+        indices->push_back(index_[n]);
+    }
+  }
+
+  // keep the order of the cloud like a linear scan
+  std::sort(indices->begin(), indices->end());
+}
@@ -1,7 +1,10 @@
 #ifndef _VELOCITY_SET_H
 #define _VELOCITY_SET_H
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <limits>
 #include <vector>
 #include <map>
 #include <unordered_map>
@@ -9,6 +12,8 @@
 
 #include <ros/ros.h>
 #include <geometry_msgs/Point.h>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
 #include <vector_map/vector_map.h>
 
 #include "waypoint_follower/libwaypoint_follower.h"
@@ -140,6 +145,44 @@ public:
   }
 };
 
+//////////////////////////////////////
+// 2D grid of obstacle points
+//////////////////////////////////////
+class ObstacleGrid
+{
+private:
+  double min_x_;
+  double min_y_;
+  double cell_size_;
+  int width_;
+  int height_;
+  std::vector<int> cell_start_;  // points of cell c are [cell_start_[c], cell_start_[c + 1])
+  std::vector<float> x_;         // point coordinates ordered by cell
+  std::vector<float> y_;
+  std::vector<int> index_;       // index in the original cloud
+
+  bool cellRange(const double &x, const double &y, const double &radius, int *x0, int *y0, int *x1, int *y1) const;
+
+public:
+  // Bucket the points on the XY plane, cells are at least min_cell_size wide
+  void build(const pcl::PointCloud<pcl::PointXYZ> &points, const double &min_cell_size);
+  // Count points with min_range < distance < max_range, a negative min_range has no lower bound.
+  // Counting stops as soon as the count exceeds limit
+  int countPoints(const double &x, const double &y, const double &min_range, const double &max_range,
+                  const int &limit) const;
+  // Indices of all points with min_range < distance < max_range
+  void findPoints(const double &x, const double &y, const double &min_range, const double &max_range,
+                  std::vector<int> *indices) const;
+  bool empty() const
+  {
+    return index_.empty();
+  }
+
+  ObstacleGrid() : min_x_(0), min_y_(0), cell_size_(1), width_(0), height_(0)
+  {
+  }
+};
+
 inline double calcSquareOfLength(const geometry_msgs::Point &p1, const geometry_msgs::Point &p2)
 {
   return (p1.x - p2.x) * (p1.x - p2.x) + (p1.y - p2.y) * (p1.y - p2.y) + (p1.z - p2.z) * (p1.z - p2.z);
@@ -195,7 +195,7 @@ void displayDetectionRange(const waypoint_follower::lane& lane, const CrossWalk&
 }
 
 // obstacle detection for crosswalk
-EControl crossWalkDetection(const pcl::PointCloud<pcl::PointXYZ>& points, const CrossWalk& crosswalk, const geometry_msgs::PoseStamped& localizer_pose, const int points_threshold, ObstaclePoints* obstacle_points)
+EControl crossWalkDetection(const pcl::PointCloud<pcl::PointXYZ>& points, const ObstacleGrid& grid, const CrossWalk& crosswalk, const geometry_msgs::PoseStamped& localizer_pose, const int points_threshold, ObstaclePoints* obstacle_points)
 {
   int crosswalk_id = crosswalk.getDetectionCrossWalkID();
   double search_radius = crosswalk.getDetectionPoints(crosswalk_id).width / 2;
@@ -204,36 +204,42 @@ EControl crossWalkDetection(const pcl::PointCloud<pcl::PointXYZ>& points, const
   for (const auto &p : crosswalk.getDetectionPoints(crosswalk_id).points)
   {
     geometry_msgs::Point detection_point = calcRelativeCoordinate(p, localizer_pose.pose);
-    tf::Vector3 detection_vector = point2vector(detection_point);
-    detection_vector.setZ(0.0);
 
-    int stop_count = 0;  // the number of points in the detection area
-    for (const auto &p : points)
+    // the number of points in the detection area
+    if (grid.countPoints(detection_point.x, detection_point.y, -1, search_radius, points_threshold) > points_threshold)
     {
-      tf::Vector3 point_vector(p.x, p.y, 0.0);
-      double distance = tf::tfDistance(point_vector, detection_vector);
-      if (distance < search_radius)
+      // like a linear scan, keep only the points up to the one exceeding the threshold
+      std::vector<int> indices;
+      grid.findPoints(detection_point.x, detection_point.y, -1, search_radius, &indices);
+      if (static_cast<int>(indices.size()) > points_threshold + 1)
+        indices.resize(points_threshold + 1);
+      for (const auto &i : indices)
       {
-        stop_count++;
         geometry_msgs::Point point_temp;
-        point_temp.x = p.x;
-        point_temp.y = p.y;
-        point_temp.z = p.z;
-	obstacle_points->setStopPoint(calcAbsoluteCoordinate(point_temp, localizer_pose.pose));
+        point_temp.x = points[i].x;
+        point_temp.y = points[i].y;
+        point_temp.z = points[i].z;
+        obstacle_points->setStopPoint(calcAbsoluteCoordinate(point_temp, localizer_pose.pose));
       }
-      if (stop_count > points_threshold)
-        return EControl::STOP;
+      return EControl::STOP;
     }
-
-    obstacle_points->clearStopPoints();
   }
 
   return EControl::KEEP;  // find no obstacles
 }
 
-int detectStopObstacle(const pcl::PointCloud<pcl::PointXYZ>& points, const int closest_waypoint, const waypoint_follower::lane& lane, const CrossWalk& crosswalk, double stop_range, double points_threshold, const geometry_msgs::PoseStamped& localizer_pose, ObstaclePoints* obstacle_points)
+// Search the stop and the decelerate obstacle in a single pass over the waypoints.
+// Each waypoint is a range query on the grid that stops counting once the threshold is exceeded,
+// the obstacle points are only collected for the detected waypoints.
+void detectObstacles(const pcl::PointCloud<pcl::PointXYZ>& points, const ObstacleGrid& grid, const int closest_waypoint, const waypoint_follower::lane& lane, const CrossWalk& crosswalk, const double stop_range, const double deceleration_range, const int points_threshold, const geometry_msgs::PoseStamped& localizer_pose, int* stop_obstacle_waypoint, int* decelerate_obstacle_waypoint, ObstaclePoints* obstacle_points)
 {
-  int stop_obstacle_waypoint = -1;
+  *stop_obstacle_waypoint = -1;
+  *decelerate_obstacle_waypoint = -1;
+
+  // skip searching deceleration range
+  bool search_decelerate = deceleration_range >= 0.01;
+  bool search_stop = true;
+
   // start search from the closest waypoint
   for (int i = closest_waypoint; i < closest_waypoint + STOP_SEARCH_DISTANCE; i++)
   {
@@ -241,111 +247,79 @@ int detectStopObstacle(const pcl::PointCloud<pcl::PointXYZ>& points, const int c
     if (i >= static_cast<int>(lane.waypoints.size()))
       break;
 
+    if (i >= closest_waypoint + DECELERATION_SEARCH_DISTANCE)
+      search_decelerate = false;
+
+    // both obstacles were found or are out of range
+    if (!search_stop && !search_decelerate)
+      break;
+
     // Detection for cross walk
-    if (i == crosswalk.getDetectionWaypoint())
+    if (search_stop && i == crosswalk.getDetectionWaypoint())
     {
       // found an obstacle in the cross walk
-      if (crossWalkDetection(points, crosswalk, localizer_pose, points_threshold, obstacle_points) == EControl::STOP)
+      if (crossWalkDetection(points, grid, crosswalk, localizer_pose, points_threshold, obstacle_points) == EControl::STOP)
       {
-        stop_obstacle_waypoint = i;
-        break;
+        *stop_obstacle_waypoint = i;
+        search_stop = false;
       }
     }
 
     // waypoint seen by localizer
     geometry_msgs::Point waypoint = calcRelativeCoordinate(lane.waypoints[i].pose.pose.position, localizer_pose.pose);
-    tf::Vector3 tf_waypoint = point2vector(waypoint);
-    tf_waypoint.setZ(0);
 
-    int stop_point_count = 0;
-    for (const auto& p : points)
+    std::vector<int> indices;
+
+    // there is an obstacle if the number of points exceeded the threshold
+    if (search_stop && grid.countPoints(waypoint.x, waypoint.y, -1, stop_range, points_threshold) > points_threshold)
     {
-      tf::Vector3 point_vector(p.x, p.y, 0);
+      *stop_obstacle_waypoint = i;
+      search_stop = false;
 
-      // 2D distance between waypoint and points (obstacle)
-      double dt = tf::tfDistance(point_vector, tf_waypoint);
-      if (dt < stop_range)
+      grid.findPoints(waypoint.x, waypoint.y, -1, stop_range, &indices);
+      for (const auto &n : indices)
       {
-        stop_point_count++;
         geometry_msgs::Point point_temp;
-        point_temp.x = p.x;
-        point_temp.y = p.y;
-        point_temp.z = p.z;
-	obstacle_points->setStopPoint(calcAbsoluteCoordinate(point_temp, localizer_pose.pose));
+        point_temp.x = points[n].x;
+        point_temp.y = points[n].y;
+        point_temp.z = points[n].z;
+        obstacle_points->setStopPoint(calcAbsoluteCoordinate(point_temp, localizer_pose.pose));
       }
     }
 
-    // there is an obstacle if the number of points exceeded the threshold
-    if (stop_point_count > points_threshold)
+    if (search_decelerate && grid.countPoints(waypoint.x, waypoint.y, stop_range, stop_range + deceleration_range, points_threshold) > points_threshold)
     {
-      stop_obstacle_waypoint = i;
-      break;
-    }
-
-    obstacle_points->clearStopPoints();
-
-    // check next waypoint...
-  }
+      *decelerate_obstacle_waypoint = i;
+      search_decelerate = false;
 
-  return stop_obstacle_waypoint;
-}
-
-int detectDecelerateObstacle(const pcl::PointCloud<pcl::PointXYZ>& points, const int closest_waypoint, const waypoint_follower::lane& lane, const double stop_range, const double deceleration_range, const double points_threshold, const geometry_msgs::PoseStamped& localizer_pose, ObstaclePoints* obstacle_points)
-{
-  int decelerate_obstacle_waypoint = -1;
-  // start search from the closest waypoint
-  for (int i = closest_waypoint; i < closest_waypoint + DECELERATION_SEARCH_DISTANCE; i++)
-  {
-    // reach the end of waypoints
-    if (i >= static_cast<int>(lane.waypoints.size()))
-      break;
-
-    // waypoint seen by localizer
-    geometry_msgs::Point waypoint = calcRelativeCoordinate(lane.waypoints[i].pose.pose.position, localizer_pose.pose);
-    tf::Vector3 tf_waypoint = point2vector(waypoint);
-    tf_waypoint.setZ(0);
-
-    int decelerate_point_count = 0;
-    for (const auto& p : points)
-    {
-      tf::Vector3 point_vector(p.x, p.y, 0);
-
-      // 2D distance between waypoint and points (obstacle)
-      double dt = tf::tfDistance(point_vector, tf_waypoint);
-      if (dt > stop_range && dt < stop_range + deceleration_range)
+      grid.findPoints(waypoint.x, waypoint.y, stop_range, stop_range + deceleration_range, &indices);
+      for (const auto &n : indices)
       {
-        decelerate_point_count++;
         geometry_msgs::Point point_temp;
-        point_temp.x = p.x;
-        point_temp.y = p.y;
-        point_temp.z = p.z;
-	obstacle_points->setDeceleratePoint(calcAbsoluteCoordinate(point_temp, localizer_pose.pose));
+        point_temp.x = points[n].x;
+        point_temp.y = points[n].y;
+        point_temp.z = points[n].z;
+        obstacle_points->setDeceleratePoint(calcAbsoluteCoordinate(point_temp, localizer_pose.pose));
       }
     }
 
-    // there is an obstacle if the number of points exceeded the threshold
-    if (decelerate_point_count > points_threshold)
-    {
-      decelerate_obstacle_waypoint = i;
-      break;
-    }
-
-    obstacle_points->clearDeceleratePoints();
-
     // check next waypoint...
   }
-
-  return decelerate_obstacle_waypoint;
 }
 
 
 // Detect an obstacle by using pointcloud
-EControl pointsDetection(const pcl::PointCloud<pcl::PointXYZ>& points, const int closest_waypoint, const waypoint_follower::lane& lane, const CrossWalk& crosswalk, const VelocitySetInfo& vs_info, int* obstacle_waypoint, ObstaclePoints* obstacle_points)
+EControl pointsDetection(const pcl::PointCloud<pcl::PointXYZ>& points, ObstacleGrid* grid, const int closest_waypoint, const waypoint_follower::lane& lane, const CrossWalk& crosswalk, const VelocitySetInfo& vs_info, int* obstacle_waypoint, ObstaclePoints* obstacle_points)
 {
   if (points.empty() == true || closest_waypoint < 0)
     return EControl::KEEP;
 
-  int stop_obstacle_waypoint = detectStopObstacle(points, closest_waypoint, lane, crosswalk, vs_info.getStopRange(), vs_info.getPointsThreshold(), vs_info.getLocalizerPose(), obstacle_points);
+  // index the points once, every query is within the widest detection range
+  grid->build(points, vs_info.getStopRange() + vs_info.getDecelerationRange());
+
+  int stop_obstacle_waypoint = -1;
+  int decelerate_obstacle_waypoint = -1;
+  detectObstacles(points, *grid, closest_waypoint, lane, crosswalk, vs_info.getStopRange(), vs_info.getDecelerationRange(), vs_info.getPointsThreshold(), vs_info.getLocalizerPose(), &stop_obstacle_waypoint, &decelerate_obstacle_waypoint, obstacle_points);
 
   // skip searching deceleration range
   if (vs_info.getDecelerationRange() < 0.01)
@@ -354,8 +328,6 @@ EControl pointsDetection(const pcl::PointCloud<pcl::PointXYZ>& points, const int
     return stop_obstacle_waypoint < 0 ? EControl::KEEP : EControl::STOP;
   }
 
-  int decelerate_obstacle_waypoint = detectDecelerateObstacle(points, closest_waypoint, lane, vs_info.getStopRange(), vs_info.getDecelerationRange(), vs_info.getPointsThreshold(), vs_info.getLocalizerPose(), obstacle_points);
-
   // stop obstacle was not found
   if (stop_obstacle_waypoint < 0)
   {
@@ -388,10 +360,10 @@ EControl pointsDetection(const pcl::PointCloud<pcl::PointXYZ>& points, const int
 
 }
 
-EControl obstacleDetection(int closest_waypoint, const waypoint_follower::lane& lane, const CrossWalk& crosswalk, const VelocitySetInfo vs_info, const ros::Publisher& detection_range_pub, const ros::Publisher& obstacle_pub, int* obstacle_waypoint)
+EControl obstacleDetection(int closest_waypoint, const waypoint_follower::lane& lane, const CrossWalk& crosswalk, const VelocitySetInfo& vs_info, const ros::Publisher& detection_range_pub, const ros::Publisher& obstacle_pub, ObstacleGrid* grid, int* obstacle_waypoint)
 {
   ObstaclePoints obstacle_points;
-  EControl detection_result = pointsDetection(vs_info.getPoints(), closest_waypoint, lane, crosswalk, vs_info, obstacle_waypoint, &obstacle_points);
+  EControl detection_result = pointsDetection(vs_info.getPoints(), grid, closest_waypoint, lane, crosswalk, vs_info, obstacle_waypoint, &obstacle_points);
   displayDetectionRange(lane, crosswalk, closest_waypoint, detection_result, *obstacle_waypoint, vs_info.getStopRange(), vs_info.getDecelerationRange(), detection_range_pub);
 
   static int false_count = 0;
@@ -480,6 +452,7 @@ int main(int argc, char **argv)
   CrossWalk crosswalk;
   VelocitySetPath vs_path;
   VelocitySetInfo vs_info;
+  ObstacleGrid obstacle_grid;  // rebuilt every cycle, kept to reuse its buffers
 
   // velocity set subscriber
   ros::Subscriber waypoints_sub = nh.subscribe("base_waypoints", 1, &VelocitySetPath::waypointsCallback, &vs_path);
@@ -521,7 +494,7 @@ int main(int argc, char **argv)
       crosswalk.setDetectionWaypoint(crosswalk.findClosestCrosswalk(vs_info.getClosestWaypoint(), vs_path.getPrevWaypoints(), STOP_SEARCH_DISTANCE));
 
     int obstacle_waypoint = -1;
-    EControl detection_result = obstacleDetection(vs_info.getClosestWaypoint(), vs_path.getPrevWaypoints(), crosswalk, vs_info, detection_range_pub, obstacle_pub, &obstacle_waypoint);
+    EControl detection_result = obstacleDetection(vs_info.getClosestWaypoint(), vs_path.getPrevWaypoints(), crosswalk, vs_info, detection_range_pub, obstacle_pub, &obstacle_grid, &obstacle_waypoint);
 
     changeWaypoints(vs_info, detection_result, vs_info.getClosestWaypoint(), obstacle_waypoint, temporal_waypoints_pub, &vs_path);
 
@@ -116,7 +116,7 @@ class VelocitySetInfo
     return temporal_waypoints_size_;
   }
 
-  pcl::PointCloud<pcl::PointXYZ> getPoints() const
+  const pcl::PointCloud<pcl::PointXYZ>& getPoints() const
   {
     return points_;
   }
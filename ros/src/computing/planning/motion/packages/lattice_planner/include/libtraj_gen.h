@@ -39,6 +39,8 @@
 #ifndef TRAJECTORYGENERATOR_H
 #define TRAJECTORYGENERATOR_H
 
+#include <vector>
+
 // ---------DEFINE MODE---------//
 //#define GEN_PLOT_FILES
 //#define DEBUG_OUTPUT
@@ -191,6 +193,20 @@ union Command
     double cmd_index[2];
 };
 
+// Warm start table for the parameter search, a grid of goal states in the vehicle frame
+// (sx, sy, theta) and speeds (v) holding the converged s, kappa_1 and kappa_2 of each node
+// Built offline by lattice_table_gen, nodes which did not converge hold NaN
+struct TrajectoryTable
+{
+    // First node, spacing and number of nodes of the sx, sy, theta and v axes
+    double min[4];
+    double step[4];
+    int size[4];
+
+    // Three parameters per node, v is the fastest changing index
+    std::vector<double> params;
+};
+
 
 // ------------FUNCTION DECLARATIONS----------//
 
@@ -231,6 +247,22 @@ union Spline trajectoryGenerator(double sx, double sy, double theta, double v, d
 // plotTraj is used by rViz to compute points for line strip, it is a lighter weight version of nextState
 union State genLineStrip(union State veh, union Spline curvature, double vdes, double t);
 
+// solveParams runs the parameter search from an initial guess, it may be called from several threads at once
+union Spline solveParams(union State veh, union State goal, union Spline curvature, int max_iterations, int *iterations);
+
+// initTable sets up the grid of a warm start table, every node unsolved
+void initTable(struct TrajectoryTable &table, const double min[4], const double max[4], const double step[4]);
+
+// buildTable solves every node of the table with OpenMP and returns the number of converged nodes
+int buildTable(struct TrajectoryTable &table, int max_iterations);
+
+// saveTable and loadTable store the table in a binary file
+bool saveTable(const struct TrajectoryTable &table, const char *path);
+bool loadTable(struct TrajectoryTable &table, const char *path);
+
+// lookupParams interpolates the table at the goal state, curvature is left untouched outside the table
+bool lookupParams(const struct TrajectoryTable &table, union State veh, union State goal, union Spline &curvature);
+
 
 #endif // TRAJECTORYGENERATOR_H
 
@@ -63,8 +63,10 @@
 #include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <limits>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "libtraj_gen.h"
 // #include "trajectorygenerator.h"
 
@@ -724,6 +726,285 @@ union State genLineStrip(union State veh, union Spline curvature, double vdes, d
     return veh_next;
 }
 
+// ------------SOLVE PARAMETERS----------//
+// Newton iterations on s, kappa_1 and kappa_2 until the motion model reaches the goal
+// INPUT: Initial state, goal state, initial guess, iteration limit
+// OUTPUT: Spline parameters, success is FALSE if they did not converge
+// Nothing is logged (flag 0), so solves for several goals can run in parallel
+
+union Spline solveParams(union State veh, union State goal, union Spline curvature, int max_iterations, int *iterations)
+{
+    bool convergence = FALSE;
+    int iteration = 0;
+    double dt = step_size;
+    union State veh_next;
+
+    curvature.success = TRUE;
+
+    while(convergence == FALSE && iteration < max_iterations)
+    {
+        // Set time horizon
+        double horizon = curvature.s/goal.v;
+
+        // Run motion model
+        veh_next = motionModel(veh, goal, curvature, dt, horizon, 0);
+
+        // Determine convergence criteria
+        convergence = checkConvergence(veh_next, goal);
+
+        // If the motion model doesn't get us to the goal compute new parameters
+        if(convergence == FALSE)
+        {
+            curvature = generateCorrection(veh, veh_next, goal, curvature, dt, horizon);
+            iteration++;
+
+            // Escape route for poorly conditioned Jacobian
+            if(curvature.success == FALSE)
+            {
+                break;
+            }
+        }
+    }
+
+    if(iterations != NULL)
+    {
+        *iterations = iteration;
+    }
+
+    curvature.success = convergence;
+    return curvature;
+}
+
+// ------------WARM START TABLE----------//
+// The table stores converged parameters on a grid of goal states, so the
+// parameter search can start next to the solution instead of at the
+// initParams heuristic. Nodes are solved for a vehicle at the origin
+// driving at the goal speed with zero curvature at both ends, the end
+// curvatures of a lookup are taken from the actual states.
+
+// Layout of the table file, followed by the parameters
+struct TableFileHeader
+{
+    char signature[8];
+    int size[4];
+    double min[4];
+    double step[4];
+};
+
+static const char table_signature[8] = {'T', 'R', 'A', 'J', 'T', 'A', 'B', '1'};
+
+static const int table_params = 3;
+
+static int tableNodes(const struct TrajectoryTable &table)
+{
+    return table.size[0]*table.size[1]*table.size[2]*table.size[3];
+}
+
+void initTable(struct TrajectoryTable &table, const double min[4], const double max[4], const double step[4])
+{
+    for(int d=0; d<4; d++)
+    {
+        table.min[d] = min[d];
+        table.step[d] = step[d];
+
+        // At least two nodes per axis so that every query has an interval to interpolate in
+        table.size[d] = std::max(2, (int)floor((max[d] - min[d])/step[d] + 0.5) + 1);
+    }
+
+    table.params.assign(table_params*tableNodes(table), numeric_limits<double>::quiet_NaN());
+}
+
+int buildTable(struct TrajectoryTable &table, int max_iterations)
+{
+    int nodes = tableNodes(table);
+    int solved = 0;
+
+    // Nodes are independent, dynamic schedule because the solve time depends on the goal
+    #pragma omp parallel for schedule(dynamic) reduction(+:solved)
+    for(int n=0; n<nodes; n++)
+    {
+        union State veh;
+        union State goal;
+        for(int i=0; i<7; i++)
+        {
+            veh.state_value[i] = 0.0;
+            goal.state_value[i] = 0.0;
+        }
+
+        // Decode the node index, v changes fastest
+        int index[4];
+        int rest = n;
+        for(int d=3; d>=0; d--)
+        {
+            index[d] = rest % table.size[d];
+            rest = rest / table.size[d];
+        }
+
+        goal.sx = table.min[0] + index[0]*table.step[0];
+        goal.sy = table.min[1] + index[1]*table.step[1];
+        goal.theta = table.min[2] + index[2]*table.step[2];
+        goal.v = table.min[3] + index[3]*table.step[3];
+        goal.vdes = goal.v;
+
+        // The planner runs the motion model at the goal speed
+        veh.v = goal.v;
+        veh.vdes = goal.v;
+
+        union Spline curvature = solveParams(veh, goal, initParams(veh, goal), max_iterations, NULL);
+
+        if(curvature.success == TRUE)
+        {
+            for(int p=0; p<table_params; p++)
+            {
+                table.params[table_params*n + p] = curvature.spline_value[p];
+            }
+            solved++;
+        }
+    }
+
+    return solved;
+}
+
+bool saveTable(const struct TrajectoryTable &table, const char *path)
+{
+    struct TableFileHeader header;
+    memcpy(header.signature, table_signature, sizeof(table_signature));
+    for(int d=0; d<4; d++)
+    {
+        header.size[d] = table.size[d];
+        header.min[d] = table.min[d];
+        header.step[d] = table.step[d];
+    }
+
+    FILE *file = fopen(path, "wb");
+    if(file == NULL)
+    {
+        return false;
+    }
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+        fwrite(table.params.data(), sizeof(double), table.params.size(), file) == table.params.size();
+
+    return fclose(file) == 0 && ok;
+}
+
+bool loadTable(struct TrajectoryTable &table, const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if(file == NULL)
+    {
+        return false;
+    }
+
+    struct TableFileHeader header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+        memcmp(header.signature, table_signature, sizeof(table_signature)) == 0;
+
+    // Reject broken grids before sizing the parameter array
+    for(int d=0; ok && d<4; d++)
+    {
+        ok = header.size[d] >= 2 && header.size[d] <= 10000 && header.step[d] > 0.0;
+    }
+
+    if(ok)
+    {
+        for(int d=0; d<4; d++)
+        {
+            table.size[d] = header.size[d];
+            table.min[d] = header.min[d];
+            table.step[d] = header.step[d];
+        }
+
+        table.params.resize(table_params*tableNodes(table));
+        ok = fread(table.params.data(), sizeof(double), table.params.size(), file) == table.params.size();
+    }
+
+    fclose(file);
+
+    if(!ok)
+    {
+        table.params.clear();
+    }
+
+    return ok;
+}
+
+bool lookupParams(const struct TrajectoryTable &table, union State veh, union State goal, union Spline &curvature)
+{
+    if(table.params.empty())
+    {
+        return false;
+    }
+
+    double query[4] = {goal.sx, goal.sy, goal.theta, goal.v};
+    int base[4];
+    double frac[4];
+
+    for(int d=0; d<4; d++)
+    {
+        double x = (query[d] - table.min[d])/table.step[d];
+
+        // The parameters change slowly with speed, so speeds outside the table use its closest speed
+        if(d == 3)
+        {
+            x = min(max(x, 0.0), (double)(table.size[d] - 1));
+        }
+
+        // Goal poses outside the table (or NaN) keep the caller's guess
+        if(!(x >= 0.0 && x <= table.size[d] - 1))
+        {
+            return false;
+        }
+
+        base[d] = min((int)x, table.size[d] - 2);
+        frac[d] = x - base[d];
+    }
+
+    // Multilinear interpolation over the 16 surrounding nodes, unsolved nodes are left out
+    double sum[table_params] = {0.0, 0.0, 0.0};
+    double weight_sum = 0.0;
+
+    for(int corner=0; corner<16; corner++)
+    {
+        double weight = 1.0;
+        int n = 0;
+        for(int d=0; d<4; d++)
+        {
+            int bit = (corner >> d) & 1;
+            weight *= bit ? frac[d] : 1.0 - frac[d];
+            n = n*table.size[d] + base[d] + bit;
+        }
+
+        const double *node = &table.params[table_params*n];
+        if(weight <= 0.0 || std::isnan(node[0]))
+        {
+            continue;
+        }
+
+        for(int p=0; p<table_params; p++)
+        {
+            sum[p] += weight*node[p];
+        }
+        weight_sum += weight;
+    }
+
+    // Too few solved neighbours to trust the estimate
+    if(weight_sum < 0.5)
+    {
+        return false;
+    }
+
+    for(int p=0; p<table_params; p++)
+    {
+        curvature.spline_value[p] = sum[p]/weight_sum;
+    }
+    curvature.kappa_0 = veh.kappa;
+    curvature.kappa_3 = goal.kappa;
+    curvature.success = TRUE;
+
+    return true;
+}
+
 //------------------MAIN FUNCTION AND HELPER FOR STANDALONE OPERATION------------------------//
 
 #ifdef STANDALONE
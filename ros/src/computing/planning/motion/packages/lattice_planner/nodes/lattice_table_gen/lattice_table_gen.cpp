@@ -0,0 +1,83 @@
+/*
+ *  lattice_table_gen.cpp
+ *  Offline generation of the trajectory warm start table
+*/
+
+/*
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  * Neither the name of Autoware nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+*/
+
+/*
+ * Solves the spline parameters on a grid of goal states and writes them
+ * to a file for the table_file parameter of lattice_trajectory_gen.
+ * Usage: rosrun lattice_planner lattice_table_gen <output file>
+ *
+ * The grid covers the lookahead distances of the waypoint follower, goals
+ * outside of it fall back to the initParams heuristic in the planner.
+ * Nodes are solved in parallel with OpenMP.
+*/
+
+#include <iostream>
+#include <fstream>
+#include "libtraj_gen.h"
+
+using namespace std;
+
+// Grid of goal states: sx, sy (meters), theta (radians) and v (meters/second)
+static const double TABLE_MIN[4] = {4.0, -8.0, -0.6, 1.0};
+static const double TABLE_MAX[4] = {40.0, 8.0, 0.6, 17.0};
+static const double TABLE_STEP[4] = {4.0, 2.0, 0.2, 4.0};
+
+// Same iteration limit as the standalone trajectoryGenerator
+static const int MAX_ITERATIONS = 10;
+
+int main(int argc, char **argv)
+{
+    if(argc != 2)
+    {
+        cerr << "Usage: " << argv[0] << " <output file>" << endl;
+        return 1;
+    }
+
+    struct TrajectoryTable table;
+    initTable(table, TABLE_MIN, TABLE_MAX, TABLE_STEP);
+
+    int nodes = table.params.size()/3;
+    cout << "Solving " << nodes << " goal states..." << endl;
+
+    int solved = buildTable(table, MAX_ITERATIONS);
+    cout << "Converged: " << solved << " of " << nodes << endl;
+
+    if(!saveTable(table, argv[1]))
+    {
+        cerr << "Cannot write " << argv[1] << endl;
+        return 1;
+    }
+
+    cout << "Table written to " << argv[1] << endl;
+    return 0;
+}
@@ -93,6 +93,9 @@ static double g_mkz_info_curvature;
 
 static int SPLINE_INDEX=0;
 
+// Warm start table for the spline parameters, empty if no table_file is given
+static TrajectoryTable g_table;
+
 //config topic
 static int g_param_flag = 0; //0 = waypoint, 1 = Dialog
 static double g_lookahead_threshold = 4.0; //meter
@@ -365,64 +368,21 @@ static union State computeVeh(int old_time, double old_theta, int next_waypoint)
 /////////////////////////////////////////////////////////////////
 static union Spline waypointTrajectory(union State veh, union State goal, union Spline curvature, int next_waypoint)
 {
-    curvature.success=TRUE;  
-    bool convergence=FALSE;
     int iteration = 0;
-    union State veh_next;
-    double dt = step_size;
     veh.v=goal.v;
 
-    // While loop for computing trajectory parameters
-    while(convergence == FALSE && iteration<4)
-    {
-        // Set time horizon
-        double horizon = curvature.s/veh.vdes;
-        ROS_INFO_STREAM("vdes: " << veh.vdes);
-        ROS_INFO_STREAM("horizon: " << horizon);
-
-        // Run motion model
-        veh_next = motionModel(veh, goal, curvature, dt, horizon, 0);
-        
-        // Determine convergence criteria
-        convergence = checkConvergence(veh_next, goal);
-
-        // If the motion model doesn't get us to the goal compute new parameters
-        if(convergence==FALSE)
-        {
-            // Update parameters
-            curvature = generateCorrection(veh, veh_next, goal, curvature, dt, horizon);
-            iteration++;
-
-            // Escape route for poorly conditioned Jacobian
-            if(curvature.success==FALSE)
-            {
-                ROS_INFO_STREAM("Init State: sx "<<veh.sx<<" sy " <<veh.sy<<" theta "<<veh.theta<<" kappa "<<veh.kappa<<" v "<<veh.v);
-                ROS_INFO_STREAM("Goal State: sx "<<goal.sx<<" sy " <<goal.sy<<" theta "<<goal.theta<<" kappa "<<goal.kappa<<" v"<<goal.v);
-                break;
-            }
-        }    
-    }
+    // Compute trajectory parameters, at most 4 iterations
+    curvature = solveParams(veh, goal, curvature, 4, &iteration);
 
-    if(convergence==FALSE)
+    if(curvature.success==FALSE)
     {
-      ROS_INFO_STREAM("Next State: sx "<<veh_next.sx<<" sy " <<veh_next.sy<<" theta "<<veh_next.theta<<" kappa "<<veh_next.kappa<<" v "<<veh_next.v);
-      ROS_INFO_STREAM("Init State: sx "<<veh.sx<<" sy " <<veh.sy<<" theta "<<veh.theta<<" kappa "<<veh.kappa);
-      ROS_INFO_STREAM("Goal State: sx "<<goal.sx<<" sy " <<goal.sy<<" theta "<<goal.theta<<" kappa "<<goal.kappa);
-      curvature.success= FALSE;
+      ROS_INFO_STREAM("Init State: sx "<<veh.sx<<" sy " <<veh.sy<<" theta "<<veh.theta<<" kappa "<<veh.kappa<<" v "<<veh.v);
+      ROS_INFO_STREAM("Goal State: sx "<<goal.sx<<" sy " <<goal.sy<<" theta "<<goal.theta<<" kappa "<<goal.kappa<<" v "<<goal.v);
     }
 
     else
     {
         ROS_INFO_STREAM("Converged in "<<iteration<<" iterations");
-
-        #ifdef LOG_OUTPUT
-        // Set time horizon
-         double horizon = curvature.s/v_0;
-        // Run motion model and log data for plotting
-        veh_next = motionModel(veh, goal, curvature, 0.1, horizon, 1);
-        fmm_sx<<"0.0 \n";
-        fmm_sy<<"0.0 \n";
-        #endif
     }
 
     return curvature;
@@ -528,6 +488,21 @@ int main(int argc, char **argv)
   ROS_INFO_STREAM("prius_mode : " << g_prius_mode);
   ROS_INFO_STREAM("mkz_mode : " << g_mkz_mode);
 
+  // Load the warm start table generated by lattice_table_gen
+  std::string table_file;
+  private_nh.getParam("table_file", table_file);
+  if(!table_file.empty())
+  {
+    if(loadTable(g_table, table_file.c_str()))
+    {
+      ROS_INFO_STREAM("Warm start table: " << table_file);
+    }
+    else
+    {
+      ROS_WARN_STREAM("Cannot load warm start table " << table_file << ", using initParams");
+    }
+  }
+
   // Publish the following topics: 
   g_vis_pub = nh.advertise<visualization_msgs::Marker>("next_waypoint_mark", 1);
   g_stat_pub = nh.advertise<std_msgs::Bool>("wf_stat", 0);
@@ -626,8 +601,9 @@ int main(int argc, char **argv)
             ROS_INFO_STREAM("est kappa: " <<veh_fmm.kappa);
           }
         
-          // Initialize the estimate for the curvature
+          // Initialize the estimate for the curvature, from the table if the goal is inside it
           union Spline curvature = initParams(veh, goal);
+          lookupParams(g_table, veh, goal, curvature);
 
           // Generate a cubic spline (trajectory) for the vehicle to follow
           curvature = waypointTrajectory(veh, goal, curvature, next_waypoint);
@@ -678,27 +654,33 @@ int main(int argc, char **argv)
                 // Likely will change when valid cost map arrives.
                 // Note: pragma indicates parallelization for OpenMP
 
-                // Setup variables
-                union State tempGoal= goal;
-                int i;
-                union Spline extra;
-                
-                // Tell OpenMP how to parallelize (keep i private because it is a counter)
-                #pragma omp parallel for private(i)
+                // Results of the perturbed goals, drawn once all of them are solved
+                union Spline extra[30];
+
+                // Each iteration solves its own goal, so the loop has no shared state
+                #pragma omp parallel for schedule(dynamic)
 
                 // Index through all the predefined perturbations from waypoint
-                for(i=1; i<31; i++)
+                for(int i=0; i<30; i++)
                 {
                   // Shift the y-coordinate of the goal
-                  tempGoal.sy = tempGoal.sy + perturb[i-1];
+                  union State tempGoal = goal;
+                  tempGoal.sy = goal.sy + perturb[i];
+
+                  // Start from the table, or from the trajectory to the waypoint
+                  extra[i] = curvature;
+                  lookupParams(g_table, veh, tempGoal, extra[i]);
 
                   // Compute new spline 
-                  extra= waypointTrajectory(veh, tempGoal, curvature, next_waypoint);
+                  extra[i] = waypointTrajectory(veh, tempGoal, extra[i], next_waypoint);
+                }
 
-                  // Display trajectory
-                  if(veh.v>5.00)
+                // Display trajectories
+                if(veh.v>5.00)
+                {
+                  for(int i=0; i<30; i++)
                   {
-                    drawSpline(extra, veh, i,1);
+                    drawSpline(extra[i], veh, i+1, 1);
                   }
                 }
           }
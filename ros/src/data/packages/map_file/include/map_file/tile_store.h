@@ -0,0 +1,135 @@
+/*
+ *  Copyright (c) 2015, Nagoya University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  * Neither the name of Autoware nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef _TILE_STORE_H_
+#define _TILE_STORE_H_
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <sensor_msgs/PointCloud2.h>
+
+/*
+ * A tile store caches every PCD map tile as a binary file made of a fixed-layout
+ * header followed by the point data in PointCloud2 layout. The cache files are
+ * memory-mapped, so switching tiles needs no parsing and the points are copied
+ * only once, straight into the published message.
+ *
+ * A tile store may be used from several threads. The PCD conversion and the
+ * mapping of a tile are done without holding its lock.
+ */
+
+constexpr char TILE_MAGIC[8] = "PMTILE";
+constexpr uint32_t TILE_VERSION = 1;
+constexpr uint32_t TILE_MAX_FIELDS = 16;
+constexpr uint32_t TILE_FIELD_NAME_SIZE = 32;
+
+struct TileField {
+	char name[TILE_FIELD_NAME_SIZE];
+	uint32_t offset;
+	uint32_t count;
+	uint8_t datatype;
+	uint8_t reserved[7];
+};
+
+struct TileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t field_count;
+	uint32_t point_step;
+	uint32_t is_dense;
+	uint64_t width;
+	uint64_t data_offset;
+	uint64_t data_size;
+	int64_t source_mtime;
+	int64_t source_size;
+	double x_min;
+	double y_min;
+	double z_min;
+	double x_max;
+	double y_max;
+	double z_max;
+	uint8_t reserved[16];
+	TileField fields[TILE_MAX_FIELDS];
+};
+
+static_assert(sizeof(TileField) == 48, "TileField layout must not depend on the compiler");
+static_assert(sizeof(TileHeader) == 128 + 48 * TILE_MAX_FIELDS, "TileHeader layout must not depend on the compiler");
+
+struct TileBounds {
+	double x_min;
+	double y_min;
+	double z_min;
+	double x_max;
+	double y_max;
+	double z_max;
+};
+
+class TileStore {
+public:
+	struct Tile {
+		std::string path;
+		const TileHeader *header;
+		const uint8_t *data;
+		size_t mapped_size;
+	};
+
+private:
+	std::string cache_dir_;
+	std::map<std::string, Tile> tiles_; // keyed by PCD path, guarded by mtx_
+	mutable std::mutex mtx_;
+
+	std::string cache_path(const std::string& pcd_path) const;
+	bool build(const std::string& pcd_path, const std::string& path, const TileBounds *bounds) const;
+	bool map(const std::string& path, Tile& tile) const;
+
+public:
+	explicit TileStore(const std::string& cache_dir);
+	~TileStore();
+
+	TileStore(const TileStore&) = delete;
+	TileStore& operator=(const TileStore&) = delete;
+
+	// Return the tile of a PCD file, converting the PCD into the cache first when the
+	// cache file is missing or older than the PCD. bounds overrides the bounding box
+	// computed from the points (e.g. with the area of arealist.txt).
+	const Tile *get(const std::string& pcd_path, const TileBounds *bounds = NULL);
+
+	// Return the loaded tiles whose bounding box is within margin of (x, y).
+	std::vector<const Tile *> query(double x, double y, double margin) const;
+
+	// Concatenate tiles into cloud. Tiles whose point layout differs from the first one are skipped.
+	static bool create_cloud(const std::vector<const Tile *>& tiles, sensor_msgs::PointCloud2& cloud);
+};
+
+#endif /* _TILE_STORE_H_ */
@@ -0,0 +1,316 @@
+/*
+ *  Copyright (c) 2015, Nagoya University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  * Neither the name of Autoware nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <pcl/io/pcd_io.h>
+#include <ros/console.h>
+
+#include <map_file/tile_store.h>
+
+namespace {
+
+bool stat_file(const std::string& path, struct stat& st)
+{
+	return (stat(path.c_str(), &st) == 0);
+}
+
+bool write_all(int fd, const void *buf, size_t size)
+{
+	const uint8_t *p = static_cast<const uint8_t *>(buf);
+	while (size > 0) {
+		ssize_t n = write(fd, p, size);
+		if (n < 0)
+			return false;
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+int find_field(const sensor_msgs::PointCloud2& cloud, const std::string& name)
+{
+	for (size_t i = 0; i < cloud.fields.size(); ++i) {
+		if (cloud.fields[i].name == name && cloud.fields[i].datatype == sensor_msgs::PointField::FLOAT32)
+			return static_cast<int>(cloud.fields[i].offset);
+	}
+	return -1;
+}
+
+bool same_layout(const TileHeader& a, const TileHeader& b)
+{
+	if (a.point_step != b.point_step || a.field_count != b.field_count)
+		return false;
+	for (uint32_t i = 0; i < a.field_count; ++i) {
+		if (std::strncmp(a.fields[i].name, b.fields[i].name, TILE_FIELD_NAME_SIZE) != 0 ||
+		    a.fields[i].offset != b.fields[i].offset || a.fields[i].count != b.fields[i].count ||
+		    a.fields[i].datatype != b.fields[i].datatype)
+			return false;
+	}
+	return true;
+}
+
+} // namespace
+
+TileStore::TileStore(const std::string& cache_dir)
+	: cache_dir_(cache_dir)
+{
+	mkdir(cache_dir_.c_str(), 0755);
+}
+
+TileStore::~TileStore()
+{
+	for (const auto& entry : tiles_)
+		munmap(const_cast<TileHeader *>(entry.second.header), entry.second.mapped_size);
+}
+
+std::string TileStore::cache_path(const std::string& pcd_path) const
+{
+	std::string name = pcd_path;
+	std::replace(name.begin(), name.end(), '/', '_');
+	return cache_dir_ + "/" + name + ".tile";
+}
+
+bool TileStore::build(const std::string& pcd_path, const std::string& path, const TileBounds *bounds) const
+{
+	struct stat st;
+	if (!stat_file(pcd_path, st))
+		return false;
+
+	sensor_msgs::PointCloud2 cloud;
+	if (pcl::io::loadPCDFile(pcd_path.c_str(), cloud) == -1) {
+		ROS_ERROR_STREAM("load failed " << pcd_path);
+		return false;
+	}
+	if (cloud.fields.size() > TILE_MAX_FIELDS) {
+		ROS_ERROR_STREAM("too many fields in " << pcd_path);
+		return false;
+	}
+
+	TileHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, TILE_MAGIC, sizeof(header.magic));
+	header.version = TILE_VERSION;
+	header.field_count = cloud.fields.size();
+	header.point_step = cloud.point_step;
+	header.is_dense = cloud.is_dense;
+	header.width = static_cast<uint64_t>(cloud.width) * cloud.height;
+	header.data_offset = sizeof(TileHeader);
+	header.data_size = header.width * header.point_step;
+	header.source_mtime = st.st_mtime;
+	header.source_size = st.st_size;
+	for (size_t i = 0; i < cloud.fields.size(); ++i) {
+		std::strncpy(header.fields[i].name, cloud.fields[i].name.c_str(), TILE_FIELD_NAME_SIZE - 1);
+		header.fields[i].offset = cloud.fields[i].offset;
+		header.fields[i].count = cloud.fields[i].count;
+		header.fields[i].datatype = cloud.fields[i].datatype;
+	}
+	if (header.data_size > cloud.data.size()) {
+		ROS_ERROR_STREAM("broken point data in " << pcd_path);
+		return false;
+	}
+
+	if (bounds != NULL) {
+		header.x_min = bounds->x_min;
+		header.y_min = bounds->y_min;
+		header.z_min = bounds->z_min;
+		header.x_max = bounds->x_max;
+		header.y_max = bounds->y_max;
+		header.z_max = bounds->z_max;
+	} else {
+		header.x_min = header.y_min = header.z_min = std::numeric_limits<double>::max();
+		header.x_max = header.y_max = header.z_max = -std::numeric_limits<double>::max();
+		int x_offset = find_field(cloud, "x");
+		int y_offset = find_field(cloud, "y");
+		int z_offset = find_field(cloud, "z");
+		if (x_offset >= 0 && y_offset >= 0 && z_offset >= 0) {
+			for (uint64_t i = 0; i < header.width; ++i) {
+				const uint8_t *point = &cloud.data[i * header.point_step];
+				float x, y, z;
+				std::memcpy(&x, point + x_offset, sizeof(float));
+				std::memcpy(&y, point + y_offset, sizeof(float));
+				std::memcpy(&z, point + z_offset, sizeof(float));
+				header.x_min = std::min(header.x_min, static_cast<double>(x));
+				header.y_min = std::min(header.y_min, static_cast<double>(y));
+				header.z_min = std::min(header.z_min, static_cast<double>(z));
+				header.x_max = std::max(header.x_max, static_cast<double>(x));
+				header.y_max = std::max(header.y_max, static_cast<double>(y));
+				header.z_max = std::max(header.z_max, static_cast<double>(z));
+			}
+		}
+	}
+
+	// Write to a temporary file of our own first, so that a reader never maps a partial tile
+	// and two writers of the same tile do not interleave
+	std::string tmp_path = path + ".XXXXXX";
+	int fd = mkstemp(&tmp_path[0]);
+	if (fd < 0) {
+		ROS_ERROR_STREAM("failed to create " << tmp_path);
+		return false;
+	}
+	fchmod(fd, 0644);
+	bool ok = write_all(fd, &header, sizeof(header)) && write_all(fd, cloud.data.data(), header.data_size);
+	close(fd);
+	if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+		ROS_ERROR_STREAM("failed to write " << path);
+		unlink(tmp_path.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+bool TileStore::map(const std::string& path, Tile& tile) const
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(TileHeader)) {
+		close(fd);
+		return false;
+	}
+
+	void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED)
+		return false;
+
+	const TileHeader *header = static_cast<const TileHeader *>(addr);
+	if (std::memcmp(header->magic, TILE_MAGIC, sizeof(header->magic)) != 0 || header->version != TILE_VERSION ||
+	    header->field_count > TILE_MAX_FIELDS || header->data_offset + header->data_size > static_cast<uint64_t>(st.st_size)) {
+		munmap(addr, st.st_size);
+		return false;
+	}
+
+	tile.header = header;
+	tile.data = static_cast<const uint8_t *>(addr) + header->data_offset;
+	tile.mapped_size = st.st_size;
+	return true;
+}
+
+const TileStore::Tile *TileStore::get(const std::string& pcd_path, const TileBounds *bounds)
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		auto it = tiles_.find(pcd_path);
+		if (it != tiles_.end())
+			return &it->second;
+	}
+
+	std::string path = cache_path(pcd_path);
+	Tile tile;
+	tile.path = pcd_path;
+
+	bool mapped = map(path, tile);
+	if (mapped) {
+		// Rebuild the cache when the PCD was updated after it
+		struct stat st;
+		if (stat_file(pcd_path, st) &&
+		    (st.st_mtime != tile.header->source_mtime || st.st_size != tile.header->source_size)) {
+			munmap(const_cast<TileHeader *>(tile.header), tile.mapped_size);
+			mapped = false;
+		}
+	}
+	if (!mapped) {
+		if (!build(pcd_path, path, bounds) || !map(path, tile))
+			return NULL;
+		ROS_INFO_STREAM("cached " << pcd_path << " in " << path);
+	}
+
+	// Another thread may have loaded the tile meanwhile, keep the first one
+	std::lock_guard<std::mutex> lock(mtx_);
+	auto inserted = tiles_.insert(std::make_pair(pcd_path, tile));
+	if (!inserted.second)
+		munmap(const_cast<TileHeader *>(tile.header), tile.mapped_size);
+	return &inserted.first->second;
+}
+
+std::vector<const TileStore::Tile *> TileStore::query(double x, double y, double margin) const
+{
+	std::vector<const Tile *> ret;
+	std::lock_guard<std::mutex> lock(mtx_);
+	for (const auto& entry : tiles_) {
+		const TileHeader *h = entry.second.header;
+		if ((h->x_min - margin) <= x && x <= (h->x_max + margin) && (h->y_min - margin) <= y && y <= (h->y_max + margin))
+			ret.push_back(&entry.second);
+	}
+	return ret;
+}
+
+bool TileStore::create_cloud(const std::vector<const Tile *>& tiles, sensor_msgs::PointCloud2& cloud)
+{
+	if (tiles.empty())
+		return false;
+
+	const TileHeader& first = *tiles.front()->header;
+	uint64_t width = 0;
+	for (const Tile *tile : tiles) {
+		if (same_layout(first, *tile->header))
+			width += tile->header->width;
+		else
+			ROS_ERROR_STREAM("point layout of " << tile->path << " differs from " << tiles.front()->path);
+	}
+
+	cloud.height = 1;
+	cloud.width = width;
+	cloud.point_step = first.point_step;
+	cloud.row_step = width * first.point_step;
+	cloud.is_bigendian = false;
+	cloud.is_dense = first.is_dense;
+	cloud.fields.resize(first.field_count);
+	for (uint32_t i = 0; i < first.field_count; ++i) {
+		cloud.fields[i].name = std::string(first.fields[i].name, strnlen(first.fields[i].name, TILE_FIELD_NAME_SIZE));
+		cloud.fields[i].offset = first.fields[i].offset;
+		cloud.fields[i].count = first.fields[i].count;
+		cloud.fields[i].datatype = first.fields[i].datatype;
+	}
+
+	// The mapped point data is copied once, straight into the message
+	cloud.data.resize(cloud.row_step);
+	uint8_t *dst = cloud.data.data();
+	for (const Tile *tile : tiles) {
+		if (!same_layout(first, *tile->header))
+			continue;
+		std::memcpy(dst, tile->data, tile->header->data_size);
+		dst += tile->header->data_size;
+	}
+
+	return true;
+}
@@ -29,6 +29,8 @@
 */
 
 #include <condition_variable>
+#include <map>
+#include <memory>
 #include <queue>
 #include <thread>
 
@@ -40,6 +42,9 @@
 #include <waypoint_follower/LaneArray.h>
 
 #include <map_file/get_file.h>
+#include <map_file/tile_store.h>
+#include <map_file/PointsMapManifest.h>
+#include <map_file/PointsMapTile.h>
 
 namespace {
 
@@ -125,6 +130,7 @@ int update_rate;
 int fallback_rate;
 double margin;
 bool can_download;
+bool publish_tiles;
 
 ros::Time gnss_time;
 ros::Time current_time;
@@ -141,6 +147,14 @@ std::vector<std::string> cached_arealist_paths;
 GetFile gf;
 RequestQueue request_queue;
 
+std::unique_ptr<TileStore> tile_store; // thread-safe, created before the download thread starts
+
+ros::Publisher tile_added_pub;
+ros::Publisher tile_removed_pub;
+ros::Publisher manifest_pub;
+std::map<std::string, int> tile_ids;
+std::map<int, map_file::PointsMapTile::ConstPtr> current_tiles;
+
 Tbl read_csv(const std::string& path)
 {
 	std::ifstream ifs(path.c_str());
@@ -234,6 +248,22 @@ void cache_arealist(const Area& area, AreaList& areas)
 	areas.push_back(area);
 }
 
+void cache_tile(const Area& area)
+{
+	if (!tile_store)
+		return;
+
+	TileBounds bounds;
+	bounds.x_min = area.x_min;
+	bounds.y_min = area.y_min;
+	bounds.z_min = area.z_min;
+	bounds.x_max = area.x_max;
+	bounds.y_max = area.y_max;
+	bounds.z_max = area.z_max;
+	if (tile_store->get(area.path, &bounds) == NULL)
+		ROS_ERROR_STREAM("failed to cache " << area.path);
+}
+
 int download(GetFile gf, const std::string& tmp, const std::string& loc, const std::string& filename)
 {
 	std::string pathname;
@@ -302,6 +332,7 @@ void download_map()
 				std::string loc = create_location(x_area, y_area);
 				if (is_downloaded(area.path) ||
 				    download(gf, TEMPORARY_DIRNAME, loc, basename(area.path.c_str())) == 0) {
+					cache_tile(area);
 					std::unique_lock<std::mutex> lock(downloaded_areas_mtx);
 					cache_arealist(area, downloaded_areas);
 				}
@@ -313,6 +344,10 @@ void download_map()
 sensor_msgs::PointCloud2 create_pcd(const geometry_msgs::Point& p)
 {
 	sensor_msgs::PointCloud2 pcd, part;
+	if (tile_store) {
+		TileStore::create_cloud(tile_store->query(p.x, p.y, margin), pcd);
+		return pcd;
+	}
 	std::unique_lock<std::mutex> lock(downloaded_areas_mtx);
 	for (const Area& area : downloaded_areas) {
 		if (is_in_area(p.x, p.y, area, margin)) {
@@ -333,6 +368,22 @@ sensor_msgs::PointCloud2 create_pcd(const geometry_msgs::Point& p)
 sensor_msgs::PointCloud2 create_pcd(const std::vector<std::string>& pcd_paths, int* ret_err = NULL)
 {
 	sensor_msgs::PointCloud2 pcd, part;
+	if (tile_store) {
+		std::vector<const TileStore::Tile *> tiles;
+		for (const std::string& path : pcd_paths) {
+			const TileStore::Tile *tile = tile_store->get(path);
+			if (tile == NULL) {
+				std::cerr << "load failed " << path << std::endl;
+				if (ret_err) *ret_err = 1;
+			} else
+				tiles.push_back(tile);
+			// Following outputs are used for progress bar of Runtime Manager.
+			std::cerr << "load " << path << std::endl;
+			if (!ros::ok()) break;
+		}
+		TileStore::create_cloud(tiles, pcd);
+		return pcd;
+	}
 	for (const std::string& path : pcd_paths) {
 		// Following outputs are used for progress bar of Runtime Manager.
 		if (pcd.width == 0) {
@@ -369,6 +420,115 @@ void publish_pcd(sensor_msgs::PointCloud2 pcd, const int* errp = NULL)
 	}
 }
 
+int get_tile_id(const std::string& path)
+{
+	std::map<std::string, int>::const_iterator it = tile_ids.find(path);
+	if (it == tile_ids.end())
+		it = tile_ids.insert(std::make_pair(path, static_cast<int>(tile_ids.size()))).first;
+	return it->second;
+}
+
+map_file::PointsMapTile::ConstPtr create_tile(const Area& area, int id)
+{
+	map_file::PointsMapTile::Ptr tile(new map_file::PointsMapTile);
+	tile->header.frame_id = "map";
+	tile->header.stamp = ros::Time::now();
+	tile->info.id = id;
+	tile->info.path = area.path;
+	tile->info.min.x = area.x_min;
+	tile->info.min.y = area.y_min;
+	tile->info.min.z = area.z_min;
+	tile->info.max.x = area.x_max;
+	tile->info.max.y = area.y_max;
+	tile->info.max.z = area.z_max;
+
+	if (tile_store) {
+		const TileStore::Tile *t = tile_store->get(area.path);
+		if (t == NULL) {
+			ROS_ERROR_STREAM("failed to load " << area.path);
+			return map_file::PointsMapTile::ConstPtr();
+		}
+		TileStore::create_cloud(std::vector<const TileStore::Tile *>(1, t), tile->points);
+	} else if (pcl::io::loadPCDFile(area.path.c_str(), tile->points) == -1) {
+		ROS_ERROR_STREAM("failed to load " << area.path);
+		return map_file::PointsMapTile::ConstPtr();
+	}
+	tile->points.header = tile->header;
+
+	return tile;
+}
+
+// Publish only the tiles which entered or left the window around p, so that
+// subscribers do not have to deserialize the whole window at every switch.
+void publish_tile_pcd(const geometry_msgs::Point& p)
+{
+	// Only the area list is read under the lock, the tiles are loaded without blocking the download thread
+	AreaList areas;
+	{
+		std::unique_lock<std::mutex> lock(downloaded_areas_mtx);
+		for (const Area& area : downloaded_areas) {
+			if (is_in_area(p.x, p.y, area, margin))
+				areas.push_back(area);
+		}
+	}
+
+	std::map<int, map_file::PointsMapTile::ConstPtr> tiles;
+	std::vector<map_file::PointsMapTile::ConstPtr> added;
+	for (const Area& area : areas) {
+		int id = get_tile_id(area.path);
+		std::map<int, map_file::PointsMapTile::ConstPtr>::const_iterator it = current_tiles.find(id);
+		if (it != current_tiles.end()) {
+			tiles[id] = it->second;
+			continue;
+		}
+		map_file::PointsMapTile::ConstPtr tile = create_tile(area, id);
+		if (tile) {
+			tiles[id] = tile;
+			added.push_back(tile);
+		}
+	}
+
+	bool changed = !added.empty();
+	for (const std::pair<const int, map_file::PointsMapTile::ConstPtr>& kv : current_tiles) {
+		if (tiles.count(kv.first) == 0) {
+			tile_removed_pub.publish(kv.second->info);
+			changed = true;
+		}
+	}
+	for (const map_file::PointsMapTile::ConstPtr& tile : added)
+		tile_added_pub.publish(tile);
+	current_tiles.swap(tiles);
+
+	if (changed) {
+		map_file::PointsMapManifest manifest;
+		manifest.header.frame_id = "map";
+		manifest.header.stamp = ros::Time::now();
+		for (const std::pair<const int, map_file::PointsMapTile::ConstPtr>& kv : current_tiles)
+			manifest.tiles.push_back(kv.second->info);
+		manifest_pub.publish(manifest);
+	}
+
+	if (!current_tiles.empty() && !stat_msg.data) {
+		stat_msg.data = true;
+		stat_pub.publish(stat_msg);
+	}
+}
+
+// Late subscribers receive every tile of the current window once.
+void publish_current_tiles(const ros::SingleSubscriberPublisher& pub)
+{
+	for (const std::pair<const int, map_file::PointsMapTile::ConstPtr>& kv : current_tiles)
+		pub.publish(*kv.second);
+}
+
+void publish_map(const geometry_msgs::Point& p)
+{
+	if (publish_tiles)
+		publish_tile_pcd(p);
+	else
+		publish_pcd(create_pcd(p));
+}
+
 void publish_gnss_pcd(const geometry_msgs::PoseStamped& msg)
 {
 	ros::Time now = ros::Time::now();
@@ -381,7 +541,7 @@ void publish_gnss_pcd(const geometry_msgs::PoseStamped& msg)
 	if (can_download)
 		request_queue.enqueue(msg.pose.position);
 
-	publish_pcd(create_pcd(msg.pose.position));
+	publish_map(msg.pose.position);
 }
 
 void publish_current_pcd(const geometry_msgs::PoseStamped& msg)
@@ -394,7 +554,7 @@ void publish_current_pcd(const geometry_msgs::PoseStamped& msg)
 	if (can_download)
 		request_queue.enqueue(msg.pose.position);
 
-	publish_pcd(create_pcd(msg.pose.position));
+	publish_map(msg.pose.position);
 }
 
 void publish_dragged_pcd(const geometry_msgs::PoseWithCovarianceStamped& msg)
@@ -416,7 +576,7 @@ void publish_dragged_pcd(const geometry_msgs::PoseWithCovarianceStamped& msg)
 	if (can_download)
 		request_queue.enqueue(p);
 
-	publish_pcd(create_pcd(p));
+	publish_map(p);
 }
 
 void request_lookahead_download(const waypoint_follower::LaneArray& msg)
@@ -519,12 +679,27 @@ int main(int argc, char **argv)
 		}
 	}
 
+	std::string tile_cache_dir;
+	n.param<std::string>("points_map_loader/tile_cache_dir", tile_cache_dir, "");
+	if (!tile_cache_dir.empty())
+		tile_store.reset(new TileStore(tile_cache_dir));
+
 	pcd_pub = n.advertise<sensor_msgs::PointCloud2>("points_map", 1, true);
 	stat_pub = n.advertise<std_msgs::Bool>("pmap_stat", 1, true);
 
 	stat_msg.data = false;
 	stat_pub.publish(stat_msg);
 
+	n.param<bool>("points_map_loader/publish_tiles", publish_tiles, false);
+	if (margin < 0)
+		publish_tiles = false;
+	if (publish_tiles) {
+		tile_added_pub = n.advertise<map_file::PointsMapTile>("points_map_tile_added", 100,
+								       publish_current_tiles);
+		tile_removed_pub = n.advertise<map_file::PointsMapTileInfo>("points_map_tile_removed", 100);
+		manifest_pub = n.advertise<map_file::PointsMapManifest>("points_map_manifest", 1, true);
+	}
+
 	ros::Subscriber gnss_sub;
 	ros::Subscriber current_sub;
 	ros::Subscriber initial_sub;
@@ -556,6 +731,9 @@ int main(int argc, char **argv)
 						cache_arealist(area, downloaded_areas);
 				}
 			}
+			// Convert every tile up front, later tile switches only use the mapped cache
+			for (const Area& area : downloaded_areas)
+				cache_tile(area);
 		}
 
 		gnss_time = current_time = ros::Time::now();
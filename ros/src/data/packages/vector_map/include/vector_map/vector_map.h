@@ -31,7 +31,9 @@
 #ifndef VECTOR_MAP_VECTOR_MAP_H
 #define VECTOR_MAP_VECTOR_MAP_H
 
+#include <algorithm>
 #include <fstream>
+#include <stdint.h>
 #include <ros/ros.h>
 #include <geometry_msgs/Point.h>
 #include <geometry_msgs/Quaternion.h>
@@ -236,8 +238,100 @@ public:
   }
 };
 
+// Objects of a category stored contiguously in key order. Ids of a map are
+// mostly dense, so keys are also resolved through a table indexed by id
+// when the ids span no more than twice the number of objects.
+template <class T>
+class ObjectMap
+{
+public:
+  using value_type = std::pair<Key<T>, T>;
+  using const_iterator = typename std::vector<value_type>::const_iterator;
+
+private:
+  std::vector<value_type> items_;
+  std::vector<int> index_;
+  int min_id_;
+
+  static bool compareKey(const value_type& left, const value_type& right)
+  {
+    return left.first < right.first;
+  }
+
+public:
+  ObjectMap()
+    : min_id_(0)
+  {
+  }
+
+  // Objects are searchable after build(). As with std::map, the first object
+  // inserted with a key wins.
+  void insert(const value_type& item)
+  {
+    items_.push_back(item);
+  }
+
+  void build()
+  {
+    std::stable_sort(items_.begin(), items_.end(), compareKey);
+    items_.erase(std::unique(items_.begin(), items_.end(),
+                             [](const value_type& left, const value_type& right)
+                             {
+                               return left.first.getId() == right.first.getId();
+                             }),
+                 items_.end());
+    items_.shrink_to_fit();
+
+    index_.clear();
+    if (items_.empty())
+      return;
+    min_id_ = items_.front().first.getId();
+    long long span = static_cast<long long>(items_.back().first.getId()) - min_id_ + 1;
+    if (span > 2 * static_cast<long long>(items_.size()) + 64)
+      return;
+    index_.assign(span, -1);
+    for (size_t i = 0; i < items_.size(); ++i)
+      index_[items_[i].first.getId() - min_id_] = static_cast<int>(i);
+  }
+
+  const_iterator find(const Key<T>& key) const
+  {
+    if (!index_.empty())
+    {
+      long long offset = static_cast<long long>(key.getId()) - min_id_;
+      if (offset < 0 || offset >= static_cast<long long>(index_.size()) || index_[offset] < 0)
+        return items_.end();
+      return items_.begin() + index_[offset];
+    }
+    auto it = std::lower_bound(items_.begin(), items_.end(), value_type(key, T()), compareKey);
+    if (it == items_.end() || key < it->first)
+      return items_.end();
+    return it;
+  }
+
+  const_iterator begin() const
+  {
+    return items_.begin();
+  }
+
+  const_iterator end() const
+  {
+    return items_.end();
+  }
+
+  bool empty() const
+  {
+    return items_.empty();
+  }
+
+  size_t size() const
+  {
+    return items_.size();
+  }
+};
+
 template <class T, class U>
-using Updater = std::function<void(std::map<Key<T>, T>&, const U&)>;
+using Updater = std::function<void(ObjectMap<T>&, const U&)>;
 
 template <class T>
 using Callback = std::function<void(const T&)>;
@@ -245,6 +339,55 @@ using Callback = std::function<void(const T&)>;
 template <class T>
 using Filter = std::function<bool(const T&)>;
 
+// Returns the planar position of an object, or false if it can not be located
+template <class T>
+using Locator = std::function<bool(const T&, geometry_msgs::Point&)>;
+
+// Uniform grid over the x-y plane. Entries are kept sorted by cell, so a
+// cell is found by binary search and no per-cell container is allocated.
+class SpatialIndex
+{
+private:
+  struct Entry
+  {
+    int64_t cell;
+    int id;
+    double x;
+    double y;
+
+    bool operator<(const Entry& right) const
+    {
+      return cell < right.cell;
+    }
+  };
+
+  double cell_size_;
+  std::vector<Entry> entries_;
+  int min_ix_;
+  int max_ix_;
+  int min_iy_;
+  int max_iy_;
+
+  int computeIndex(double value) const;
+  int64_t computeCell(int ix, int iy) const;
+  void findInCell(int ix, int iy, const geometry_msgs::Point& point, double radius,
+                  std::vector<std::pair<double, int>>& found) const;
+
+public:
+  explicit SpatialIndex(double cell_size = 10.0);
+
+  void clear();
+  void insert(int id, const geometry_msgs::Point& point);
+  void build();
+
+  // Ids of the k nearest entries, nearest first
+  std::vector<int> findNearest(const geometry_msgs::Point& point, size_t k) const;
+  // Ids of the entries within radius, nearest first
+  std::vector<int> findInRadius(const geometry_msgs::Point& point, double radius) const;
+
+  bool empty() const;
+};
+
 template <class T, class U>
 class Handle
 {
@@ -252,15 +395,28 @@ private:
   ros::Subscriber sub_;
   Updater<T, U> update_;
   std::vector<Callback<U>> cbs_;
-  std::map<Key<T>, T> map_;
+  ObjectMap<T> map_;
+  Locator<T> locate_;
+  SpatialIndex index_;
 
   void subscribe(const U& msg)
   {
     update_(map_, msg);
+    map_.build();
+    reindex();
     for (const auto& cb : cbs_)
       cb(msg);
   }
 
+  std::vector<T> findByIds(const std::vector<int>& ids) const
+  {
+    std::vector<T> vector;
+    vector.reserve(ids.size());
+    for (const auto& id : ids)
+      vector.push_back(findByKey(Key<T>(id)));
+    return vector;
+  }
+
 public:
   Handle()
   {
@@ -281,6 +437,26 @@ public:
     cbs_.push_back(cb);
   }
 
+  void registerLocator(const Locator<T>& locate)
+  {
+    locate_ = locate;
+    reindex();
+  }
+
+  void reindex()
+  {
+    if (!locate_)
+      return;
+    index_.clear();
+    geometry_msgs::Point point;
+    for (const auto& pair : map_)
+    {
+      if (locate_(pair.second, point))
+        index_.insert(pair.first.getId(), point);
+    }
+    index_.build();
+  }
+
   T findByKey(const Key<T>& key) const
   {
     auto it = map_.find(key);
@@ -300,10 +476,25 @@ public:
     return vector;
   }
 
+  std::vector<T> findNearest(const geometry_msgs::Point& point, size_t k) const
+  {
+    return findByIds(index_.findNearest(point, k));
+  }
+
+  std::vector<T> findInRadius(const geometry_msgs::Point& point, double radius) const
+  {
+    return findByIds(index_.findInRadius(point, radius));
+  }
+
   bool empty() const
   {
     return map_.empty();
   }
+
+  size_t size() const
+  {
+    return map_.size();
+  }
 };
 
 template <class T>
@@ -325,38 +516,38 @@ std::vector<T> parse(const std::string& csv_file)
 
 namespace
 {
-void updatePoint(std::map<Key<Point>, Point>& map, const PointArray& msg);
-void updateVector(std::map<Key<Vector>, Vector>& map, const VectorArray& msg);
-void updateLine(std::map<Key<Line>, Line>& map, const LineArray& msg);
-void updateArea(std::map<Key<Area>, Area>& map, const AreaArray& msg);
-void updatePole(std::map<Key<Pole>, Pole>& map, const PoleArray& msg);
-void updateBox(std::map<Key<Box>, Box>& map, const BoxArray& msg);
-void updateDTLane(std::map<Key<DTLane>, DTLane>& map, const DTLaneArray& msg);
-void updateNode(std::map<Key<Node>, Node>& map, const NodeArray& msg);
-void updateLane(std::map<Key<Lane>, Lane>& map, const LaneArray& msg);
-void updateWayArea(std::map<Key<WayArea>, WayArea>& map, const WayAreaArray& msg);
-void updateRoadEdge(std::map<Key<RoadEdge>, RoadEdge>& map, const RoadEdgeArray& msg);
-void updateGutter(std::map<Key<Gutter>, Gutter>& map, const GutterArray& msg);
-void updateCurb(std::map<Key<Curb>, Curb>& map, const CurbArray& msg);
-void updateWhiteLine(std::map<Key<WhiteLine>, WhiteLine>& map, const WhiteLineArray& msg);
-void updateStopLine(std::map<Key<StopLine>, StopLine>& map, const StopLineArray& msg);
-void updateZebraZone(std::map<Key<ZebraZone>, ZebraZone>& map, const ZebraZoneArray& msg);
-void updateCrossWalk(std::map<Key<CrossWalk>, CrossWalk>& map, const CrossWalkArray& msg);
-void updateRoadMark(std::map<Key<RoadMark>, RoadMark>& map, const RoadMarkArray& msg);
-void updateRoadPole(std::map<Key<RoadPole>, RoadPole>& map, const RoadPoleArray& msg);
-void updateRoadSign(std::map<Key<RoadSign>, RoadSign>& map, const RoadSignArray& msg);
-void updateSignal(std::map<Key<Signal>, Signal>& map, const SignalArray& msg);
-void updateStreetLight(std::map<Key<StreetLight>, StreetLight>& map, const StreetLightArray& msg);
-void updateUtilityPole(std::map<Key<UtilityPole>, UtilityPole>& map, const UtilityPoleArray& msg);
-void updateGuardRail(std::map<Key<GuardRail>, GuardRail>& map, const GuardRailArray& msg);
-void updateSideWalk(std::map<Key<SideWalk>, SideWalk>& map, const SideWalkArray& msg);
-void updateDriveOnPortion(std::map<Key<DriveOnPortion>, DriveOnPortion>& map, const DriveOnPortionArray& msg);
-void updateCrossRoad(std::map<Key<CrossRoad>, CrossRoad>& map, const CrossRoadArray& msg);
-void updateSideStrip(std::map<Key<SideStrip>, SideStrip>& map, const SideStripArray& msg);
-void updateCurveMirror(std::map<Key<CurveMirror>, CurveMirror>& map, const CurveMirrorArray& msg);
-void updateWall(std::map<Key<Wall>, Wall>& map, const WallArray& msg);
-void updateFence(std::map<Key<Fence>, Fence>& map, const FenceArray& msg);
-void updateRailCrossing(std::map<Key<RailCrossing>, RailCrossing>& map, const RailCrossingArray& msg);
+void updatePoint(ObjectMap<Point>& map, const PointArray& msg);
+void updateVector(ObjectMap<Vector>& map, const VectorArray& msg);
+void updateLine(ObjectMap<Line>& map, const LineArray& msg);
+void updateArea(ObjectMap<Area>& map, const AreaArray& msg);
+void updatePole(ObjectMap<Pole>& map, const PoleArray& msg);
+void updateBox(ObjectMap<Box>& map, const BoxArray& msg);
+void updateDTLane(ObjectMap<DTLane>& map, const DTLaneArray& msg);
+void updateNode(ObjectMap<Node>& map, const NodeArray& msg);
+void updateLane(ObjectMap<Lane>& map, const LaneArray& msg);
+void updateWayArea(ObjectMap<WayArea>& map, const WayAreaArray& msg);
+void updateRoadEdge(ObjectMap<RoadEdge>& map, const RoadEdgeArray& msg);
+void updateGutter(ObjectMap<Gutter>& map, const GutterArray& msg);
+void updateCurb(ObjectMap<Curb>& map, const CurbArray& msg);
+void updateWhiteLine(ObjectMap<WhiteLine>& map, const WhiteLineArray& msg);
+void updateStopLine(ObjectMap<StopLine>& map, const StopLineArray& msg);
+void updateZebraZone(ObjectMap<ZebraZone>& map, const ZebraZoneArray& msg);
+void updateCrossWalk(ObjectMap<CrossWalk>& map, const CrossWalkArray& msg);
+void updateRoadMark(ObjectMap<RoadMark>& map, const RoadMarkArray& msg);
+void updateRoadPole(ObjectMap<RoadPole>& map, const RoadPoleArray& msg);
+void updateRoadSign(ObjectMap<RoadSign>& map, const RoadSignArray& msg);
+void updateSignal(ObjectMap<Signal>& map, const SignalArray& msg);
+void updateStreetLight(ObjectMap<StreetLight>& map, const StreetLightArray& msg);
+void updateUtilityPole(ObjectMap<UtilityPole>& map, const UtilityPoleArray& msg);
+void updateGuardRail(ObjectMap<GuardRail>& map, const GuardRailArray& msg);
+void updateSideWalk(ObjectMap<SideWalk>& map, const SideWalkArray& msg);
+void updateDriveOnPortion(ObjectMap<DriveOnPortion>& map, const DriveOnPortionArray& msg);
+void updateCrossRoad(ObjectMap<CrossRoad>& map, const CrossRoadArray& msg);
+void updateSideStrip(ObjectMap<SideStrip>& map, const SideStripArray& msg);
+void updateCurveMirror(ObjectMap<CurveMirror>& map, const CurveMirrorArray& msg);
+void updateWall(ObjectMap<Wall>& map, const WallArray& msg);
+void updateFence(ObjectMap<Fence>& map, const FenceArray& msg);
+void updateRailCrossing(ObjectMap<RailCrossing>& map, const RailCrossingArray& msg);
 } // namespace
 
 class VectorMap
@@ -401,6 +592,12 @@ private:
 public:
   VectorMap();
 
+  // The subscriber callbacks and spatial indexes refer back to this object, so it must stay where it was built
+  VectorMap(const VectorMap&) = delete;
+  VectorMap(VectorMap&&) = delete;
+  VectorMap& operator=(const VectorMap&) = delete;
+  VectorMap& operator=(VectorMap&&) = delete;
+
   void subscribe(ros::NodeHandle& nh, category_t category);
   void subscribe(ros::NodeHandle& nh, category_t category, const ros::Duration& timeout);
 
@@ -470,6 +667,15 @@ public:
   std::vector<Fence> findByFilter(const Filter<Fence>& filter) const;
   std::vector<RailCrossing> findByFilter(const Filter<RailCrossing>& filter) const;
 
+  // Spatial queries on the x-y plane, available for Point, Lane, Area and Signal.
+  // A Lane is located at its start point, an Area at the centroid of its vertices
+  // and a Signal at the point of its vector. The indexes are rebuilt whenever the
+  // arrays they depend on are updated.
+  template <class T>
+  std::vector<T> findNearest(const geometry_msgs::Point& point, size_t k) const;
+  template <class T>
+  std::vector<T> findInRadius(const geometry_msgs::Point& point, double radius) const;
+
   void registerCallback(const Callback<PointArray>& cb);
   void registerCallback(const Callback<VectorArray>& cb);
   void registerCallback(const Callback<LineArray>& cb);
@@ -504,6 +710,24 @@ public:
   void registerCallback(const Callback<RailCrossingArray>& cb);
 };
 
+template <>
+std::vector<Point> VectorMap::findNearest<Point>(const geometry_msgs::Point& point, size_t k) const;
+template <>
+std::vector<Lane> VectorMap::findNearest<Lane>(const geometry_msgs::Point& point, size_t k) const;
+template <>
+std::vector<Area> VectorMap::findNearest<Area>(const geometry_msgs::Point& point, size_t k) const;
+template <>
+std::vector<Signal> VectorMap::findNearest<Signal>(const geometry_msgs::Point& point, size_t k) const;
+
+template <>
+std::vector<Point> VectorMap::findInRadius<Point>(const geometry_msgs::Point& point, double radius) const;
+template <>
+std::vector<Lane> VectorMap::findInRadius<Lane>(const geometry_msgs::Point& point, double radius) const;
+template <>
+std::vector<Area> VectorMap::findInRadius<Area>(const geometry_msgs::Point& point, double radius) const;
+template <>
+std::vector<Signal> VectorMap::findInRadius<Signal>(const geometry_msgs::Point& point, double radius) const;
+
 extern const double COLOR_VALUE_MIN;
 extern const double COLOR_VALUE_MAX;
 extern const double COLOR_VALUE_MEDIAN;
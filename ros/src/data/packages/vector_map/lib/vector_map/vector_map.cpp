@@ -28,6 +28,9 @@
  *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
 #include <tf/transform_datatypes.h>
 #include <vector_map/vector_map.h>
 
@@ -35,9 +38,9 @@ namespace vector_map
 {
 namespace
 {
-void updatePoint(std::map<Key<Point>, Point>& map, const PointArray& msg)
+void updatePoint(ObjectMap<Point>& map, const PointArray& msg)
 {
-  map = std::map<Key<Point>, Point>();
+  map = ObjectMap<Point>();
   for (const auto& item : msg.data)
   {
     if (item.pid == 0)
@@ -46,9 +49,9 @@ void updatePoint(std::map<Key<Point>, Point>& map, const PointArray& msg)
   }
 }
 
-void updateVector(std::map<Key<Vector>, Vector>& map, const VectorArray& msg)
+void updateVector(ObjectMap<Vector>& map, const VectorArray& msg)
 {
-  map = std::map<Key<Vector>, Vector>();
+  map = ObjectMap<Vector>();
   for (const auto& item : msg.data)
   {
     if (item.vid == 0)
@@ -57,9 +60,9 @@ void updateVector(std::map<Key<Vector>, Vector>& map, const VectorArray& msg)
   }
 }
 
-void updateLine(std::map<Key<Line>, Line>& map, const LineArray& msg)
+void updateLine(ObjectMap<Line>& map, const LineArray& msg)
 {
-  map = std::map<Key<Line>, Line>();
+  map = ObjectMap<Line>();
   for (const auto& item : msg.data)
   {
     if (item.lid == 0)
@@ -68,9 +71,9 @@ void updateLine(std::map<Key<Line>, Line>& map, const LineArray& msg)
   }
 }
 
-void updateArea(std::map<Key<Area>, Area>& map, const AreaArray& msg)
+void updateArea(ObjectMap<Area>& map, const AreaArray& msg)
 {
-  map = std::map<Key<Area>, Area>();
+  map = ObjectMap<Area>();
   for (const auto& item : msg.data)
   {
     if (item.aid == 0)
@@ -79,9 +82,9 @@ void updateArea(std::map<Key<Area>, Area>& map, const AreaArray& msg)
   }
 }
 
-void updatePole(std::map<Key<Pole>, Pole>& map, const PoleArray& msg)
+void updatePole(ObjectMap<Pole>& map, const PoleArray& msg)
 {
-  map = std::map<Key<Pole>, Pole>();
+  map = ObjectMap<Pole>();
   for (const auto& item : msg.data)
   {
     if (item.plid == 0)
@@ -90,9 +93,9 @@ void updatePole(std::map<Key<Pole>, Pole>& map, const PoleArray& msg)
   }
 }
 
-void updateBox(std::map<Key<Box>, Box>& map, const BoxArray& msg)
+void updateBox(ObjectMap<Box>& map, const BoxArray& msg)
 {
-  map = std::map<Key<Box>, Box>();
+  map = ObjectMap<Box>();
   for (const auto& item : msg.data)
   {
     if (item.bid == 0)
@@ -101,9 +104,9 @@ void updateBox(std::map<Key<Box>, Box>& map, const BoxArray& msg)
   }
 }
 
-void updateDTLane(std::map<Key<DTLane>, DTLane>& map, const DTLaneArray& msg)
+void updateDTLane(ObjectMap<DTLane>& map, const DTLaneArray& msg)
 {
-  map = std::map<Key<DTLane>, DTLane>();
+  map = ObjectMap<DTLane>();
   for (const auto& item : msg.data)
   {
     if (item.did == 0)
@@ -112,9 +115,9 @@ void updateDTLane(std::map<Key<DTLane>, DTLane>& map, const DTLaneArray& msg)
   }
 }
 
-void updateNode(std::map<Key<Node>, Node>& map, const NodeArray& msg)
+void updateNode(ObjectMap<Node>& map, const NodeArray& msg)
 {
-  map = std::map<Key<Node>, Node>();
+  map = ObjectMap<Node>();
   for (const auto& item : msg.data)
   {
     if (item.nid == 0)
@@ -123,9 +126,9 @@ void updateNode(std::map<Key<Node>, Node>& map, const NodeArray& msg)
   }
 }
 
-void updateLane(std::map<Key<Lane>, Lane>& map, const LaneArray& msg)
+void updateLane(ObjectMap<Lane>& map, const LaneArray& msg)
 {
-  map = std::map<Key<Lane>, Lane>();
+  map = ObjectMap<Lane>();
   for (const auto& item : msg.data)
   {
     if (item.lnid == 0)
@@ -134,9 +137,9 @@ void updateLane(std::map<Key<Lane>, Lane>& map, const LaneArray& msg)
   }
 }
 
-void updateWayArea(std::map<Key<WayArea>, WayArea>& map, const WayAreaArray& msg)
+void updateWayArea(ObjectMap<WayArea>& map, const WayAreaArray& msg)
 {
-  map = std::map<Key<WayArea>, WayArea>();
+  map = ObjectMap<WayArea>();
   for (const auto& item : msg.data)
   {
     if (item.waid == 0)
@@ -145,9 +148,9 @@ void updateWayArea(std::map<Key<WayArea>, WayArea>& map, const WayAreaArray& msg
   }
 }
 
-void updateRoadEdge(std::map<Key<RoadEdge>, RoadEdge>& map, const RoadEdgeArray& msg)
+void updateRoadEdge(ObjectMap<RoadEdge>& map, const RoadEdgeArray& msg)
 {
-  map = std::map<Key<RoadEdge>, RoadEdge>();
+  map = ObjectMap<RoadEdge>();
   for (const auto& item : msg.data)
   {
     if (item.id == 0)
@@ -156,9 +159,9 @@ void updateRoadEdge(std::map<Key<RoadEdge>, RoadEdge>& map, const RoadEdgeArray&
   }
 }
 
-void updateGutter(std::map<Key<Gutter>, Gutter>& map, const GutterArray& msg)
+void updateGutter(ObjectMap<Gutter>& map, const GutterArray& msg)
 {
-  map = std::map<Key<Gutter>, Gutter>();
+  map = ObjectMap<Gutter>();
   for (const auto& item : msg.data)
   {
     if (item.id == 0)
@@ -167,9 +170,9 @@ void updateGutter(std::map<Key<Gutter>, Gutter>& map, const GutterArray& msg)
   }
 }
 
-void updateCurb(std::map<Key<Curb>, Curb>& map, const CurbArray& msg)
+void updateCurb(ObjectMap<Curb>& map, const CurbArray& msg)
 {
-  map = std::map<Key<Curb>, Curb>();
+  map = ObjectMap<Curb>();
   for (const auto& item : msg.data)
   {
     if (item.id == 0)
@@ -178,9 +181,9 @@ void updateCurb(std::map<Key<Curb>, Curb>& map, const CurbArray& msg)
   }
 }
 
-void updateWhiteLine(std::map<Key<WhiteLine>, WhiteLine>& map, const WhiteLineArray& msg)
+void updateWhiteLine(ObjectMap<WhiteLine>& map, const WhiteLineArray& msg)
 {
-  map = std::map<Key<WhiteLine>, WhiteLine>();
+  map = ObjectMap<WhiteLine>();
   for (const auto& item : msg.data)
   {
     if (item.id == 0)
@@ -189,9 +192,9 @@ void updateWhiteLine(std::map<Key<WhiteLine>, WhiteLine>& map, const WhiteLineAr
   }
 }
 
-void updateStopLine(std::map<Key<StopLine>, StopLine>& map, const StopLineArray& msg)
+void updateStopLine(ObjectMap<StopLine>& map, const StopLineArray& msg)
 {
-  map = std::map<Key<StopLine>, StopLine>();
+  map = ObjectMap<StopLine>();
   for (const auto& item : msg.data)
   {
     if (item.id == 0)
@@ -200,9 +203,9 @@ void updateStopLine(std::map<Key<StopLine>, StopLine>& map, const StopLineArray&
   }
 }
 
-void updateZebraZone(std::map<Key<ZebraZone>, ZebraZone>& map, const ZebraZoneArray& msg)
+void updateZebraZone(ObjectMap<ZebraZone>& map, const ZebraZoneArray& msg)
 {
-  map = std::map<Key<ZebraZone>, ZebraZone>();
+  map = ObjectMap<ZebraZone>();
   for (const auto& item : msg.data)
   {
     if (item.id == 0)
@@ -211,9 +214,9 @@ void updateZebraZone(std::map<Key<ZebraZone>, ZebraZone>& map, const ZebraZoneAr
   }
 }
 
-void updateCrossWalk(std::map<Key<CrossWalk>, CrossWalk>& map, const CrossWalkArray& msg)
+void updateCrossWalk(ObjectMap<CrossWalk>& map, const CrossWalkArray& msg)
 {
-  map = std::map<Key<CrossWalk>, CrossWalk>();
+  map = ObjectMap<CrossWalk>();
   for (const auto& item : msg.data)
   {
     if (item.id == 0)
@@ -222,9 +225,9 @@ void updateCrossWalk(std::map<Key<CrossWalk>, CrossWalk>& map, const CrossWalkAr
   }
 }
 
-void updateRoadMark(std::map<Key<RoadMark>, RoadMark>& map, const RoadMarkArray& msg)
+void updateRoadMark(ObjectMap<RoadMark>& map, const RoadMarkArray& msg)
 {
-  map = std::map<Key<RoadMark>, RoadMark>();
+  map = ObjectMap<RoadMark>();
   for (const auto& item : msg.data)
   {
     if (item.id == 0)
@@ -233,9 +236,9 @@ void updateRoadMark(std::map<Key<RoadMark>, RoadMark>& map, const RoadMarkArray&
   }
 }
 
-void updateRoadPole(std::map<Key<RoadPole>, RoadPole>& map, const RoadPoleArray& msg)
+void updateRoadPole(ObjectMap<RoadPole>& map, const RoadPoleArray& msg)
 {
-  map = std::map<Key<RoadPole>, RoadPole>();
+  map = ObjectMap<RoadPole>();
   for (const auto& item : msg.data)
   {
     if (item.id == 0)
@@ -244,9 +247,9 @@ void updateRoadPole(std::map<Key<RoadPole>, RoadPole>& map, const RoadPoleArray&
   }
 }
 
-void updateRoadSign(std::map<Key<RoadSign>, RoadSign>& map, const RoadSignArray& msg)
+void updateRoadSign(ObjectMap<RoadSign>& map, const RoadSignArray& msg)
 {
-  map = std::map<Key<RoadSign>, RoadSign>();
+  map = ObjectMap<RoadSign>();
   for (const auto& item : msg.data)
   {
     if (item.id == 0)
@@ -255,9 +258,9 @@ void updateRoadSign(std::map<Key<RoadSign>, RoadSign>& map, const RoadSignArray&
   }
 }
 
-void updateSignal(std::map<Key<Signal>, Signal>& map, const SignalArray& msg)
+void updateSignal(ObjectMap<Signal>& map, const SignalArray& msg)
 {
-  map = std::map<Key<Signal>, Signal>();
+  map = ObjectMap<Signal>();
   for (const auto& item : msg.data)
   {
     if (item.id == 0)
@@ -266,9 +269,9 @@ void updateSignal(std::map<Key<Signal>, Signal>& map, const SignalArray& msg)
   }
 }
 
-void updateStreetLight(std::map<Key<StreetLight>, StreetLight>& map, const StreetLightArray& msg)
+void updateStreetLight(ObjectMap<StreetLight>& map, const StreetLightArray& msg)
 {
-  map = std::map<Key<StreetLight>, StreetLight>();
+  map = ObjectMap<StreetLight>();
   for (const auto& item : msg.data)
   {
     if (item.id == 0)
@@ -277,9 +280,9 @@ void updateStreetLight(std::map<Key<StreetLight>, StreetLight>& map, const Stree
   }
 }
 
-void updateUtilityPole(std::map<Key<UtilityPole>, UtilityPole>& map, const UtilityPoleArray& msg)
+void updateUtilityPole(ObjectMap<UtilityPole>& map, const UtilityPoleArray& msg)
 {
-  map = std::map<Key<UtilityPole>, UtilityPole>();
+  map = ObjectMap<UtilityPole>();
   for (const auto& item : msg.data)
   {
     if (item.id == 0)
@@ -288,9 +291,9 @@ void updateUtilityPole(std::map<Key<UtilityPole>, UtilityPole>& map, const Utili
   }
 }
 
-void updateGuardRail(std::map<Key<GuardRail>, GuardRail>& map, const GuardRailArray& msg)
+void updateGuardRail(ObjectMap<GuardRail>& map, const GuardRailArray& msg)
 {
-  map = std::map<Key<GuardRail>, GuardRail>();
+  map = ObjectMap<GuardRail>();
   for (const auto& item : msg.data)
   {
     if (item.id == 0)
@@ -299,9 +302,9 @@ void updateGuardRail(std::map<Key<GuardRail>, GuardRail>& map, const GuardRailAr
   }
 }
 
-void updateSideWalk(std::map<Key<SideWalk>, SideWalk>& map, const SideWalkArray& msg)
+void updateSideWalk(ObjectMap<SideWalk>& map, const SideWalkArray& msg)
 {
-  map = std::map<Key<SideWalk>, SideWalk>();
+  map = ObjectMap<SideWalk>();
   for (const auto& item : msg.data)
   {
     if (item.id == 0)
@@ -310,9 +313,9 @@ void updateSideWalk(std::map<Key<SideWalk>, SideWalk>& map, const SideWalkArray&
   }
 }
 
-void updateDriveOnPortion(std::map<Key<DriveOnPortion>, DriveOnPortion>& map, const DriveOnPortionArray& msg)
+void updateDriveOnPortion(ObjectMap<DriveOnPortion>& map, const DriveOnPortionArray& msg)
 {
-  map = std::map<Key<DriveOnPortion>, DriveOnPortion>();
+  map = ObjectMap<DriveOnPortion>();
   for (const auto& item : msg.data)
   {
     if (item.id == 0)
@@ -321,9 +324,9 @@ void updateDriveOnPortion(std::map<Key<DriveOnPortion>, DriveOnPortion>& map, co
   }
 }
 
-void updateCrossRoad(std::map<Key<CrossRoad>, CrossRoad>& map, const CrossRoadArray& msg)
+void updateCrossRoad(ObjectMap<CrossRoad>& map, const CrossRoadArray& msg)
 {
-  map = std::map<Key<CrossRoad>, CrossRoad>();
+  map = ObjectMap<CrossRoad>();
   for (const auto& item : msg.data)
   {
     if (item.id == 0)
@@ -332,9 +335,9 @@ void updateCrossRoad(std::map<Key<CrossRoad>, CrossRoad>& map, const CrossRoadAr
   }
 }
 
-void updateSideStrip(std::map<Key<SideStrip>, SideStrip>& map, const SideStripArray& msg)
+void updateSideStrip(ObjectMap<SideStrip>& map, const SideStripArray& msg)
 {
-  map = std::map<Key<SideStrip>, SideStrip>();
+  map = ObjectMap<SideStrip>();
   for (const auto& item : msg.data)
   {
     if (item.id == 0)
@@ -343,9 +346,9 @@ void updateSideStrip(std::map<Key<SideStrip>, SideStrip>& map, const SideStripAr
   }
 }
 
-void updateCurveMirror(std::map<Key<CurveMirror>, CurveMirror>& map, const CurveMirrorArray& msg)
+void updateCurveMirror(ObjectMap<CurveMirror>& map, const CurveMirrorArray& msg)
 {
-  map = std::map<Key<CurveMirror>, CurveMirror>();
+  map = ObjectMap<CurveMirror>();
   for (const auto& item : msg.data)
   {
     if (item.id == 0)
@@ -354,9 +357,9 @@ void updateCurveMirror(std::map<Key<CurveMirror>, CurveMirror>& map, const Curve
   }
 }
 
-void updateWall(std::map<Key<Wall>, Wall>& map, const WallArray& msg)
+void updateWall(ObjectMap<Wall>& map, const WallArray& msg)
 {
-  map = std::map<Key<Wall>, Wall>();
+  map = ObjectMap<Wall>();
   for (const auto& item : msg.data)
   {
     if (item.id == 0)
@@ -365,9 +368,9 @@ void updateWall(std::map<Key<Wall>, Wall>& map, const WallArray& msg)
   }
 }
 
-void updateFence(std::map<Key<Fence>, Fence>& map, const FenceArray& msg)
+void updateFence(ObjectMap<Fence>& map, const FenceArray& msg)
 {
-  map = std::map<Key<Fence>, Fence>();
+  map = ObjectMap<Fence>();
   for (const auto& item : msg.data)
   {
     if (item.id == 0)
@@ -376,9 +379,9 @@ void updateFence(std::map<Key<Fence>, Fence>& map, const FenceArray& msg)
   }
 }
 
-void updateRailCrossing(std::map<Key<RailCrossing>, RailCrossing>& map, const RailCrossingArray& msg)
+void updateRailCrossing(ObjectMap<RailCrossing>& map, const RailCrossingArray& msg)
 {
-  map = std::map<Key<RailCrossing>, RailCrossing>();
+  map = ObjectMap<RailCrossing>();
   for (const auto& item : msg.data)
   {
     if (item.id == 0)
@@ -386,8 +389,178 @@ void updateRailCrossing(std::map<Key<RailCrossing>, RailCrossing>& map, const Ra
     map.insert(std::make_pair(Key<RailCrossing>(item.id), item));
   }
 }
+
+bool locatePoint(const Point& point, geometry_msgs::Point& geom_point)
+{
+  geom_point = convertPointToGeomPoint(point);
+  return true;
+}
 } // namespace
 
+SpatialIndex::SpatialIndex(double cell_size)
+  : cell_size_(cell_size)
+{
+  clear();
+}
+
+int SpatialIndex::computeIndex(double value) const
+{
+  return static_cast<int>(std::floor(value / cell_size_));
+}
+
+int64_t SpatialIndex::computeCell(int ix, int iy) const
+{
+  return (static_cast<int64_t>(ix) << 32) | static_cast<uint32_t>(iy);
+}
+
+void SpatialIndex::findInCell(int ix, int iy, const geometry_msgs::Point& point, double radius,
+                              std::vector<std::pair<double, int>>& found) const
+{
+  if (ix < min_ix_ || ix > max_ix_ || iy < min_iy_ || iy > max_iy_)
+    return;
+  Entry key;
+  key.cell = computeCell(ix, iy);
+  auto range = std::equal_range(entries_.begin(), entries_.end(), key);
+  for (auto it = range.first; it != range.second; ++it)
+  {
+    double distance = std::hypot(it->x - point.x, it->y - point.y);
+    if (distance <= radius)
+      found.push_back(std::make_pair(distance, it->id));
+  }
+}
+
+void SpatialIndex::clear()
+{
+  entries_.clear();
+  min_ix_ = std::numeric_limits<int>::max();
+  max_ix_ = std::numeric_limits<int>::min();
+  min_iy_ = std::numeric_limits<int>::max();
+  max_iy_ = std::numeric_limits<int>::min();
+}
+
+void SpatialIndex::insert(int id, const geometry_msgs::Point& point)
+{
+  int ix = computeIndex(point.x);
+  int iy = computeIndex(point.y);
+  Entry entry;
+  entry.cell = computeCell(ix, iy);
+  entry.id = id;
+  entry.x = point.x;
+  entry.y = point.y;
+  entries_.push_back(entry);
+  min_ix_ = std::min(min_ix_, ix);
+  max_ix_ = std::max(max_ix_, ix);
+  min_iy_ = std::min(min_iy_, iy);
+  max_iy_ = std::max(max_iy_, iy);
+}
+
+void SpatialIndex::build()
+{
+  std::sort(entries_.begin(), entries_.end());
+}
+
+std::vector<int> SpatialIndex::findNearest(const geometry_msgs::Point& point, size_t k) const
+{
+  std::vector<int> ids;
+  if (k == 0 || entries_.empty())
+    return ids;
+
+  std::vector<std::pair<double, int>> found;
+  if (k >= entries_.size())
+  {
+    for (const auto& entry : entries_)
+      found.push_back(std::make_pair(std::hypot(entry.x - point.x, entry.y - point.y), entry.id));
+  }
+  else
+  {
+    // Visit rings of cells around the query until the k-th candidate is closer
+    // than any cell that has not been visited yet
+    int cx = computeIndex(point.x);
+    int cy = computeIndex(point.y);
+    int outside_x = std::max(std::max(min_ix_ - cx, cx - max_ix_), 0);
+    int outside_y = std::max(std::max(min_iy_ - cy, cy - max_iy_), 0);
+    int max_ring = std::max(std::max(std::abs(cx - min_ix_), std::abs(cx - max_ix_)),
+                            std::max(std::abs(cy - min_iy_), std::abs(cy - max_iy_)));
+    double infinity = std::numeric_limits<double>::max();
+    for (int ring = std::max(outside_x, outside_y); ring <= max_ring; ++ring)
+    {
+      for (int ix = std::max(cx - ring, min_ix_); ix <= std::min(cx + ring, max_ix_); ++ix)
+      {
+        if (ix == cx - ring || ix == cx + ring)
+        {
+          for (int iy = std::max(cy - ring, min_iy_); iy <= std::min(cy + ring, max_iy_); ++iy)
+            findInCell(ix, iy, point, infinity, found);
+        }
+        else
+        {
+          findInCell(ix, cy - ring, point, infinity, found);
+          findInCell(ix, cy + ring, point, infinity, found);
+        }
+      }
+      if (found.size() >= k)
+      {
+        std::nth_element(found.begin(), found.begin() + k - 1, found.end());
+        if (found[k - 1].first <= ring * cell_size_)
+          break;
+      }
+    }
+  }
+
+  std::sort(found.begin(), found.end());
+  if (found.size() > k)
+    found.resize(k);
+  ids.reserve(found.size());
+  for (const auto& pair : found)
+    ids.push_back(pair.second);
+  return ids;
+}
+
+std::vector<int> SpatialIndex::findInRadius(const geometry_msgs::Point& point, double radius) const
+{
+  std::vector<int> ids;
+  if (radius < 0 || entries_.empty())
+    return ids;
+
+  int ix_begin = std::max(computeIndex(point.x - radius), min_ix_);
+  int ix_end = std::min(computeIndex(point.x + radius), max_ix_);
+  int iy_begin = std::max(computeIndex(point.y - radius), min_iy_);
+  int iy_end = std::min(computeIndex(point.y + radius), max_iy_);
+  if (ix_begin > ix_end || iy_begin > iy_end)
+    return ids;
+
+  std::vector<std::pair<double, int>> found;
+  int64_t cells = static_cast<int64_t>(ix_end - ix_begin + 1) * (iy_end - iy_begin + 1);
+  if (cells > static_cast<int64_t>(entries_.size()))
+  {
+    // The radius covers most of the map, scanning the entries is cheaper
+    for (const auto& entry : entries_)
+    {
+      double distance = std::hypot(entry.x - point.x, entry.y - point.y);
+      if (distance <= radius)
+        found.push_back(std::make_pair(distance, entry.id));
+    }
+  }
+  else
+  {
+    for (int ix = ix_begin; ix <= ix_end; ++ix)
+    {
+      for (int iy = iy_begin; iy <= iy_end; ++iy)
+        findInCell(ix, iy, point, radius, found);
+    }
+  }
+
+  std::sort(found.begin(), found.end());
+  ids.reserve(found.size());
+  for (const auto& pair : found)
+    ids.push_back(pair.second);
+  return ids;
+}
+
+bool SpatialIndex::empty() const
+{
+  return entries_.empty();
+}
+
 bool VectorMap::hasSubscribed(category_t category) const
 {
   if (category & POINT)
@@ -719,6 +892,78 @@ void VectorMap::registerSubscriber(ros::NodeHandle& nh, category_t category)
 
 VectorMap::VectorMap()
 {
+  point_.registerLocator(locatePoint);
+  lane_.registerLocator([this](const Lane& lane, geometry_msgs::Point& geom_point)
+    {
+      Node node = node_.findByKey(Key<Node>(lane.bnid));
+      if (node.nid == 0)
+        return false;
+      Point point = point_.findByKey(Key<Point>(node.pid));
+      if (point.pid == 0)
+        return false;
+      geom_point = convertPointToGeomPoint(point);
+      return true;
+    });
+  area_.registerLocator([this](const Area& area, geometry_msgs::Point& geom_point)
+    {
+      // Follow the lines of the area at most once each
+      Line line = line_.findByKey(Key<Line>(area.slid));
+      double x = 0;
+      double y = 0;
+      double z = 0;
+      int count = 0;
+      while (line.lid != 0 && count <= static_cast<int>(line_.size()))
+      {
+        Point point = point_.findByKey(Key<Point>(line.bpid));
+        if (point.pid == 0)
+          return false;
+        geometry_msgs::Point vertex = convertPointToGeomPoint(point);
+        x += vertex.x;
+        y += vertex.y;
+        z += vertex.z;
+        ++count;
+        if (line.flid == 0 || line.flid == area.slid)
+          break;
+        line = line_.findByKey(Key<Line>(line.flid));
+      }
+      if (count == 0)
+        return false;
+      geom_point.x = x / count;
+      geom_point.y = y / count;
+      geom_point.z = z / count;
+      return true;
+    });
+  signal_.registerLocator([this](const Signal& signal, geometry_msgs::Point& geom_point)
+    {
+      Vector vector = vector_.findByKey(Key<Vector>(signal.vid));
+      if (vector.vid == 0)
+        return false;
+      Point point = point_.findByKey(Key<Point>(vector.pid));
+      if (point.pid == 0)
+        return false;
+      geom_point = convertPointToGeomPoint(point);
+      return true;
+    });
+
+  // Keep the indexes of the objects located through other arrays up to date
+  point_.registerCallback([this](const PointArray&)
+    {
+      lane_.reindex();
+      area_.reindex();
+      signal_.reindex();
+    });
+  node_.registerCallback([this](const NodeArray&)
+    {
+      lane_.reindex();
+    });
+  line_.registerCallback([this](const LineArray&)
+    {
+      area_.reindex();
+    });
+  vector_.registerCallback([this](const VectorArray&)
+    {
+      signal_.reindex();
+    });
 }
 
 void VectorMap::subscribe(ros::NodeHandle& nh, category_t category)
@@ -1064,6 +1309,54 @@ std::vector<RailCrossing> VectorMap::findByFilter(const Filter<RailCrossing>& fi
   return rail_crossing_.findByFilter(filter);
 }
 
+template <>
+std::vector<Point> VectorMap::findNearest<Point>(const geometry_msgs::Point& point, size_t k) const
+{
+  return point_.findNearest(point, k);
+}
+
+template <>
+std::vector<Lane> VectorMap::findNearest<Lane>(const geometry_msgs::Point& point, size_t k) const
+{
+  return lane_.findNearest(point, k);
+}
+
+template <>
+std::vector<Area> VectorMap::findNearest<Area>(const geometry_msgs::Point& point, size_t k) const
+{
+  return area_.findNearest(point, k);
+}
+
+template <>
+std::vector<Signal> VectorMap::findNearest<Signal>(const geometry_msgs::Point& point, size_t k) const
+{
+  return signal_.findNearest(point, k);
+}
+
+template <>
+std::vector<Point> VectorMap::findInRadius<Point>(const geometry_msgs::Point& point, double radius) const
+{
+  return point_.findInRadius(point, radius);
+}
+
+template <>
+std::vector<Lane> VectorMap::findInRadius<Lane>(const geometry_msgs::Point& point, double radius) const
+{
+  return lane_.findInRadius(point, radius);
+}
+
+template <>
+std::vector<Area> VectorMap::findInRadius<Area>(const geometry_msgs::Point& point, double radius) const
+{
+  return area_.findInRadius(point, radius);
+}
+
+template <>
+std::vector<Signal> VectorMap::findInRadius<Signal>(const geometry_msgs::Point& point, double radius) const
+{
+  return signal_.findInRadius(point, radius);
+}
+
 void VectorMap::registerCallback(const Callback<PointArray>& cb)
 {
   point_.registerCallback(cb);
@@ -0,0 +1,164 @@
+/*
+ *  Copyright (c) 2017, Nagoya University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  * Neither the name of Autoware nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <unistd.h>
+#include <vector_map/vector_map.h>
+
+using vector_map::Key;
+using vector_map::ObjectMap;
+using vector_map::Point;
+using vector_map::Lane;
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+double computeMilliseconds(const Clock::time_point& begin, const Clock::time_point& end)
+{
+  return std::chrono::duration<double, std::milli>(end - begin).count();
+}
+
+double getResidentMegabytes()
+{
+  std::ifstream ifs("/proc/self/statm");
+  long size = 0;
+  long resident = 0;
+  ifs >> size >> resident;
+  return static_cast<double>(resident) * sysconf(_SC_PAGESIZE) / (1024 * 1024);
+}
+
+void printResult(const std::string& category, const std::string& storage, double load_ms, double lookup_ns,
+                 double resident_mb, int found)
+{
+  std::cout << category << "\t" << storage << "\tload " << load_ms << " ms\tlookup " << lookup_ns
+            << " ns\tresident " << resident_mb << " MB\tfound " << found << std::endl;
+}
+
+template <class T>
+void benchmark(const std::string& category, const std::vector<T>& objs, const std::function<int(const T&)>& get_id,
+               int lookups)
+{
+  std::mt19937 engine(0);
+  std::uniform_int_distribution<size_t> distribution(0, objs.empty() ? 0 : objs.size() - 1);
+  std::vector<Key<T>> keys;
+  keys.reserve(lookups);
+  for (int i = 0; i < lookups && !objs.empty(); ++i)
+    keys.push_back(Key<T>(get_id(objs[distribution(engine)])));
+
+  // Both maps stay alive so that each resident size delta only counts its own allocations
+  double resident = getResidentMegabytes();
+  Clock::time_point begin = Clock::now();
+  std::map<Key<T>, T> tree_map;
+  for (const auto& obj : objs)
+    tree_map.insert(std::make_pair(Key<T>(get_id(obj)), obj));
+  Clock::time_point end = Clock::now();
+  double tree_load = computeMilliseconds(begin, end);
+  double tree_resident = getResidentMegabytes() - resident;
+
+  int tree_found = 0;
+  begin = Clock::now();
+  for (const auto& key : keys)
+    tree_found += tree_map.find(key) != tree_map.end();
+  end = Clock::now();
+  double tree_lookup = keys.empty() ? 0 : computeMilliseconds(begin, end) * 1e6 / keys.size();
+
+  resident = getResidentMegabytes();
+  begin = Clock::now();
+  ObjectMap<T> object_map;
+  for (const auto& obj : objs)
+    object_map.insert(std::make_pair(Key<T>(get_id(obj)), obj));
+  object_map.build();
+  end = Clock::now();
+  double object_load = computeMilliseconds(begin, end);
+  double object_resident = getResidentMegabytes() - resident;
+
+  int object_found = 0;
+  begin = Clock::now();
+  for (const auto& key : keys)
+    object_found += object_map.find(key) != object_map.end();
+  end = Clock::now();
+  double object_lookup = keys.empty() ? 0 : computeMilliseconds(begin, end) * 1e6 / keys.size();
+
+  printResult(category, "std::map", tree_load, tree_lookup, tree_resident, tree_found);
+  printResult(category, "ObjectMap", object_load, object_lookup, object_resident, object_found);
+}
+
+std::vector<Point> createPoints(int size)
+{
+  std::vector<Point> points(size);
+  for (int i = 0; i < size; ++i)
+  {
+    points[i].pid = i + 1;
+    points[i].bx = i % 1000;
+    points[i].ly = i / 1000;
+  }
+  return points;
+}
+
+std::vector<Lane> createLanes(int size)
+{
+  std::vector<Lane> lanes(size);
+  for (int i = 0; i < size; ++i)
+  {
+    lanes[i].lnid = i + 1;
+    lanes[i].bnid = i + 1;
+    lanes[i].fnid = i + 2;
+  }
+  return lanes;
+}
+} // namespace
+
+// Compares std::map with ObjectMap on the points and lanes of a map.
+// Usage: vector_map_benchmark [point.csv lane.csv]
+// Without arguments, a synthetic map with 400000 points and lanes is used.
+int main(int argc, char **argv)
+{
+  std::vector<Point> points;
+  std::vector<Lane> lanes;
+  if (argc >= 3)
+  {
+    points = vector_map::parse<Point>(argv[1]);
+    lanes = vector_map::parse<Lane>(argv[2]);
+  }
+  else
+  {
+    points = createPoints(400000);
+    lanes = createLanes(400000);
+  }
+
+  const int lookups = 1000000;
+  benchmark<Point>("point", points, [](const Point& point){ return point.pid; }, lookups);
+  benchmark<Lane>("lane", lanes, [](const Lane& lane){ return lane.lnid; }, lookups);
+
+  return 0;
+}
@@ -164,22 +164,6 @@ Point createMedianPoint(const Point& p1, const Point& p2)
   return point;
 }
 
-std::vector<Point> findStartPoints(const VectorMap& vmap)
-{
-  std::vector<Point> start_points;
-  for (const auto& lane : vmap.findByFilter([](const Lane& lane){return true;}))
-  {
-    Node node = vmap.findByKey(Key<Node>(lane.bnid));
-    if (node.nid == 0)
-      continue;
-    Point point = vmap.findByKey(Key<Point>(node.pid));
-    if (point.pid == 0)
-      continue;
-    start_points.push_back(point);
-  }
-  return start_points;
-}
-
 std::vector<Point> findEndPoints(const VectorMap& vmap)
 {
   std::vector<Point> end_points;
@@ -223,17 +207,6 @@ std::vector<Point> findNearPoints(const std::vector<Point>& points, const Point&
   return near_points;
 }
 
-std::vector<Lane> findLanesByStartPoint(const VectorMap& vmap, const Point& start_point)
-{
-  std::vector<Lane> lanes;
-  for (const auto& node : vmap.findByFilter([&start_point](const Node& node){return node.pid == start_point.pid;}))
-  {
-    for (const auto& lane : vmap.findByFilter([&node](const Lane& lane){return lane.bnid == node.nid;}))
-      lanes.push_back(lane);
-  }
-  return lanes;
-}
-
 std::vector<Lane> findLanesByEndPoint(const VectorMap& vmap, const Point& end_point)
 {
   std::vector<Lane> lanes;
@@ -254,21 +227,21 @@ Lane findStartLane(const VectorMap& vmap, const std::vector<Point>& points, doub
   Point bp1 = points[0];
   Point bp2 = points[1];
   double max_score = -DBL_MAX;
-  for (const auto& p1 : findNearPoints(findStartPoints(vmap), bp1, radius))
+  for (const auto& lane : vmap.findInRadius<Lane>(convertPointToGeomPoint(bp1), radius)) // located at start points
   {
-    for (const auto& lane : findLanesByStartPoint(vmap, p1))
+    if (lane.lnid == 0)
+      continue;
+    Point p1 = findStartPoint(vmap, lane);
+    if (p1.pid == 0)
+      continue;
+    Point p2 = findEndPoint(vmap, lane);
+    if (p2.pid == 0)
+      continue;
+    double score = computeScore(bp1, bp2, p1, p2, radius);
+    if (score >= max_score)
     {
-      if (lane.lnid == 0)
-        continue;
-      Point p2 = findEndPoint(vmap, lane);
-      if (p2.pid == 0)
-        continue;
-      double score = computeScore(bp1, bp2, p1, p2, radius);
-      if (score >= max_score)
-      {
-        start_lane = lane;
-        max_score = score;
-      }
+      start_lane = lane;
+      max_score = score;
     }
   }
   return start_lane;
@@ -96,6 +96,7 @@ namespace velodyne_rawdata
   static const int BLOCKS_PER_PACKET = 12;
   static const int PACKET_STATUS_SIZE = 4;
   static const int SCANS_PER_PACKET = (SCANS_PER_BLOCK * BLOCKS_PER_PACKET);
+  static const int MAX_LASERS = 64;
 
   /** \brief Raw Velodyne packet.
    *
@@ -116,6 +117,33 @@ namespace velodyne_rawdata
     uint8_t status[PACKET_STATUS_SIZE]; 
   } raw_packet_t;
 
+  /** \brief Per-laser corrections laid out as structure of arrays.
+   *
+   *  Built once from the calibration, so that the corrections of
+   *  consecutive lasers can be loaded into a vector register at once.
+   *  The two point distance correction is folded into a slope and an
+   *  offset, both zero when it is not available.
+   */
+  struct LaserCorrectionTable
+  {
+    float dist_correction[MAX_LASERS];
+    float cos_vert_correction[MAX_LASERS];
+    float sin_vert_correction[MAX_LASERS];
+    float cos_rot_correction[MAX_LASERS];
+    float sin_rot_correction[MAX_LASERS];
+    float horiz_offset_correction[MAX_LASERS];
+    float vert_offset_correction[MAX_LASERS];
+    float dist_slope_x[MAX_LASERS];
+    float dist_offset_x[MAX_LASERS];
+    float dist_slope_y[MAX_LASERS];
+    float dist_offset_y[MAX_LASERS];
+    float focal_offset[MAX_LASERS];
+    float focal_slope[MAX_LASERS];
+    float min_intensity[MAX_LASERS];
+    float max_intensity[MAX_LASERS];
+    uint16_t laser_ring[MAX_LASERS];
+  };
+
   /** \brief Velodyne data conversion class */
   class RawData
   {
@@ -138,6 +166,9 @@ namespace velodyne_rawdata
     int setup(ros::NodeHandle private_nh);
 
     void unpack(const velodyne_msgs::VelodynePacket &pkt, VPointCloud &pc);
+
+    /** \brief convert all packets of a scan, decoding packets in parallel */
+    void unpack(const velodyne_msgs::VelodyneScan &scan, VPointCloud &pc);
     
     void setParameters(double min_range, double max_range, double view_direction,
                        double view_width);
@@ -161,18 +192,54 @@ namespace velodyne_rawdata
      * Calibration file
      */
     velodyne_pointcloud::Calibration calibration_;
+    LaserCorrectionTable corrections_;
     float sin_rot_table_[ROTATION_MAX_UNITS];
     float cos_rot_table_[ROTATION_MAX_UNITS];
-    
+
+    /** decoded returns of one block, one entry per laser firing */
+    struct BlockBuffer
+    {
+      uint16_t rotation[SCANS_PER_BLOCK];
+      uint16_t ring[SCANS_PER_BLOCK];
+      float x[SCANS_PER_BLOCK];
+      float y[SCANS_PER_BLOCK];
+      float z[SCANS_PER_BLOCK];
+      float intensity[SCANS_PER_BLOCK];
+    };
+
+    void buildCorrectionTable();
+
+    /** convert one packet into points, returns the number written */
+    int unpackPacket(const velodyne_msgs::VelodynePacket &pkt,
+                     VPoint *points) const;
+
     /** add private function to handle the VLP16 **/ 
-    void unpack_vlp16(const velodyne_msgs::VelodynePacket &pkt, VPointCloud &pc);
+    int unpack_vlp16(const velodyne_msgs::VelodynePacket &pkt,
+                     VPoint *points) const;
+
+    uint32_t decodeLanes(const uint8_t *data, int laser, int first,
+                         int lanes, BlockBuffer &buf) const;
+
+    static int emitPoints(const BlockBuffer &buf, uint32_t mask,
+                          VPoint *points);
 
     /** in-line test whether a point is in range */
-    bool pointInRange(float range)
+    bool pointInRange(float range) const
     {
       return (range >= config_.min_range
               && range <= config_.max_range);
     }
+
+    /** in-line test whether a rotation is inside the view */
+    bool angleInRange(int rotation) const
+    {
+      return ((rotation >= config_.min_angle
+               && rotation <= config_.max_angle
+               && config_.min_angle < config_.max_angle)
+              || (config_.min_angle > config_.max_angle
+                  && (rotation <= config_.max_angle
+                      || rotation >= config_.min_angle)));
+    }
   };
 
 } // namespace velodyne_rawdata
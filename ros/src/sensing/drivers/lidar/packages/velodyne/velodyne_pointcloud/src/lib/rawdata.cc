@@ -25,8 +25,13 @@
  *  HDL-64E S2 calibration support provided by Nick Hillier
  */
 
+#include <algorithm>
 #include <fstream>
 #include <math.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include <ros/ros.h>
 #include <ros/package.h>
@@ -103,9 +108,60 @@ namespace velodyne_rawdata
       cos_rot_table_[rot_index] = cosf(rotation);
       sin_rot_table_[rot_index] = sinf(rotation);
     }
+
+    buildCorrectionTable();
    return 0;
   }
 
+  /** Lay out the calibration as structure of arrays for the decoder. */
+  void RawData::buildCorrectionTable()
+  {
+    memset(&corrections_, 0, sizeof(corrections_));
+
+    std::map<int, velodyne_pointcloud::LaserCorrection>::const_iterator it;
+    for (it = calibration_.laser_corrections.begin();
+         it != calibration_.laser_corrections.end(); ++it) {
+      int i = it->first;
+      if (i < 0 || i >= MAX_LASERS) {
+        ROS_WARN_STREAM("ignoring correction of laser " << i);
+        continue;
+      }
+      const velodyne_pointcloud::LaserCorrection &c = it->second;
+
+      corrections_.dist_correction[i] = c.dist_correction;
+      corrections_.cos_vert_correction[i] = c.cos_vert_correction;
+      corrections_.sin_vert_correction[i] = c.sin_vert_correction;
+      corrections_.cos_rot_correction[i] = c.cos_rot_correction;
+      corrections_.sin_rot_correction[i] = c.sin_rot_correction;
+      corrections_.horiz_offset_correction[i] = c.horiz_offset_correction;
+      corrections_.vert_offset_correction[i] = c.vert_offset_correction;
+
+      // Get 2points calibration values, linear interpolation to get
+      // distance correction for X and Y:
+      //   (dist_correction - dist_correction_x) * (xx - 2.4) / (25.04 - 2.4)
+      //     + dist_correction_x - dist_correction
+      // rewritten as slope * xx + offset.
+      if (c.two_pt_correction_available) {
+        float slope_x = (c.dist_correction - c.dist_correction_x) / (25.04 - 2.4);
+        float slope_y = (c.dist_correction - c.dist_correction_y) / (25.04 - 1.93);
+        corrections_.dist_slope_x[i] = slope_x;
+        corrections_.dist_offset_x[i] =
+          c.dist_correction_x - c.dist_correction - slope_x * 2.4;
+        corrections_.dist_slope_y[i] = slope_y;
+        corrections_.dist_offset_y[i] =
+          c.dist_correction_y - c.dist_correction - slope_y * 1.93;
+      }
+
+      corrections_.focal_offset[i] = 256
+        * (1 - c.focal_distance / 13100)
+        * (1 - c.focal_distance / 13100);
+      corrections_.focal_slope[i] = c.focal_slope;
+      corrections_.min_intensity[i] = c.min_intensity;
+      corrections_.max_intensity[i] = c.max_intensity;
+      corrections_.laser_ring[i] = c.laser_ring;
+    }
+  }
+
   /** @brief convert raw packet to point cloud
    *
    *  @param pkt raw packet to unpack
@@ -115,182 +171,300 @@ namespace velodyne_rawdata
                        VPointCloud &pc)
   {
     ROS_DEBUG_STREAM("Received packet, time: " << pkt.stamp);
-    
+
+    size_t base = pc.points.size();
+    pc.points.resize(base + SCANS_PER_PACKET);
+    int n = unpackPacket(pkt, &pc.points[base]);
+    pc.points.resize(base + n);
+    pc.width += n;
+  }
+
+  /** @brief convert all packets of a scan to point cloud
+   *
+   *  Every packet is decoded into its own slot of the output buffer,
+   *  so packets are independent and can be decoded in parallel. The
+   *  slots are compacted afterwards.
+   *
+   *  @param scan raw scan to unpack
+   *  @param pc shared pointer to point cloud (points are appended)
+   */
+  void RawData::unpack(const velodyne_msgs::VelodyneScan &scan,
+                       VPointCloud &pc)
+  {
+    int npackets = scan.packets.size();
+    size_t base = pc.points.size();
+    pc.points.resize(base + npackets * SCANS_PER_PACKET);
+    std::vector<int> counts(npackets);
+
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < npackets; ++i) {
+      counts[i] = unpackPacket(scan.packets[i],
+                               &pc.points[base + i * SCANS_PER_PACKET]);
+    }
+
+    size_t end = base;
+    for (int i = 0; i < npackets; ++i) {
+      size_t slot = base + i * SCANS_PER_PACKET;
+      if (slot != end)
+        std::copy(pc.points.begin() + slot,
+                  pc.points.begin() + slot + counts[i],
+                  pc.points.begin() + end);
+      end += counts[i];
+    }
+    pc.points.resize(end);
+    pc.width += end - base;
+  }
+
+  /** @brief decode consecutive laser returns of one block
+   *
+   *  Lanes [first, first + lanes) of the block are decoded with the
+   *  corrections of lasers [laser, laser + lanes). buf.rotation must be
+   *  set for these lanes.
+   *
+   *  @returns bit mask of the lanes whose distance is in range
+   */
+  uint32_t RawData::decodeLanes(const uint8_t *data, int laser, int first,
+                                int lanes, BlockBuffer &buf) const
+  {
+    const LaserCorrectionTable &t = corrections_;
+    float min_range = config_.min_range;
+    float max_range = config_.max_range;
+    uint32_t mask = 0;
+    int l = first;
+    int end = first + lanes;
+
+#ifdef __SSE2__
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    const __m128 resolution = _mm_set1_ps(DISTANCE_RESOLUTION);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 inv_max = _mm_set1_ps(1.0f / 65535);
+    const __m128 focal = _mm_set1_ps(256.0f);
+    const __m128 min_r = _mm_set1_ps(min_range);
+    const __m128 max_r = _mm_set1_ps(max_range);
+
+    for (; l + 4 <= end; l += 4) {
+      const uint8_t *d = data + l * RAW_SCAN_SIZE;
+      int c = laser + (l - first);
+      const uint16_t *r = buf.rotation + l;
+
+      __m128 raw = _mm_cvtepi32_ps(_mm_setr_epi32(
+        d[0] | (d[1] << 8), d[3] | (d[4] << 8),
+        d[6] | (d[7] << 8), d[9] | (d[10] << 8)));
+      __m128 distance = _mm_add_ps(_mm_mul_ps(raw, resolution),
+                                   _mm_loadu_ps(t.dist_correction + c));
+
+      __m128 cos_vert = _mm_loadu_ps(t.cos_vert_correction + c);
+      __m128 sin_vert = _mm_loadu_ps(t.sin_vert_correction + c);
+      __m128 cos_rot_corr = _mm_loadu_ps(t.cos_rot_correction + c);
+      __m128 sin_rot_corr = _mm_loadu_ps(t.sin_rot_correction + c);
+      __m128 horiz_offset = _mm_loadu_ps(t.horiz_offset_correction + c);
+      __m128 vert_offset = _mm_loadu_ps(t.vert_offset_correction + c);
+
+      __m128 cos_rot = _mm_setr_ps(cos_rot_table_[r[0]], cos_rot_table_[r[1]],
+                                   cos_rot_table_[r[2]], cos_rot_table_[r[3]]);
+      __m128 sin_rot = _mm_setr_ps(sin_rot_table_[r[0]], sin_rot_table_[r[1]],
+                                   sin_rot_table_[r[2]], sin_rot_table_[r[3]]);
+      // cos(a-b) = cos(a)*cos(b) + sin(a)*sin(b)
+      // sin(a-b) = sin(a)*cos(b) - cos(a)*sin(b)
+      __m128 cos_rot_angle = _mm_add_ps(_mm_mul_ps(cos_rot, cos_rot_corr),
+                                        _mm_mul_ps(sin_rot, sin_rot_corr));
+      __m128 sin_rot_angle = _mm_sub_ps(_mm_mul_ps(sin_rot, cos_rot_corr),
+                                        _mm_mul_ps(cos_rot, sin_rot_corr));
+
+      __m128 vert_term = _mm_mul_ps(vert_offset, sin_vert);
+      __m128 xy_distance = _mm_add_ps(_mm_mul_ps(distance, cos_vert), vert_term);
+      __m128 xx = _mm_andnot_ps(sign,
+        _mm_sub_ps(_mm_mul_ps(xy_distance, sin_rot_angle),
+                   _mm_mul_ps(horiz_offset, cos_rot_angle)));
+      __m128 yy = _mm_andnot_ps(sign,
+        _mm_add_ps(_mm_mul_ps(xy_distance, cos_rot_angle),
+                   _mm_mul_ps(horiz_offset, sin_rot_angle)));
+
+      __m128 distance_x = _mm_add_ps(distance,
+        _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(t.dist_slope_x + c), xx),
+                   _mm_loadu_ps(t.dist_offset_x + c)));
+      __m128 distance_y = _mm_add_ps(distance,
+        _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(t.dist_slope_y + c), yy),
+                   _mm_loadu_ps(t.dist_offset_y + c)));
+
+      xy_distance = _mm_add_ps(_mm_mul_ps(distance_x, cos_vert), vert_term);
+      __m128 x = _mm_sub_ps(_mm_mul_ps(xy_distance, sin_rot_angle),
+                            _mm_mul_ps(horiz_offset, cos_rot_angle));
+      xy_distance = _mm_add_ps(_mm_mul_ps(distance_y, cos_vert), vert_term);
+      __m128 y = _mm_add_ps(_mm_mul_ps(xy_distance, cos_rot_angle),
+                            _mm_mul_ps(horiz_offset, sin_rot_angle));
+      __m128 z = _mm_add_ps(_mm_mul_ps(distance_y, sin_vert),
+                            _mm_mul_ps(vert_offset, cos_vert));
+
+      /** Use standard ROS coordinate system (right-hand rule) */
+      _mm_storeu_ps(buf.x + l, y);
+      _mm_storeu_ps(buf.y + l, _mm_xor_ps(x, sign));
+      _mm_storeu_ps(buf.z + l, z);
+
+      /** Intensity Calculation */
+      __m128 u = _mm_sub_ps(one, _mm_mul_ps(raw, inv_max));
+      __m128 intensity = _mm_setr_ps(d[2], d[5], d[8], d[11]);
+      intensity = _mm_add_ps(intensity,
+        _mm_mul_ps(_mm_loadu_ps(t.focal_slope + c),
+          _mm_andnot_ps(sign,
+            _mm_sub_ps(_mm_loadu_ps(t.focal_offset + c),
+                       _mm_mul_ps(focal, _mm_mul_ps(u, u))))));
+      intensity = _mm_max_ps(intensity, _mm_loadu_ps(t.min_intensity + c));
+      intensity = _mm_min_ps(intensity, _mm_loadu_ps(t.max_intensity + c));
+      _mm_storeu_ps(buf.intensity + l, intensity);
+
+      __m128 in_range = _mm_and_ps(_mm_cmpge_ps(distance, min_r),
+                                   _mm_cmple_ps(distance, max_r));
+      mask |= static_cast<uint32_t>(_mm_movemask_ps(in_range)) << l;
+
+      for (int i = 0; i < 4; ++i)
+        buf.ring[l + i] = t.laser_ring[c + i];
+    }
+#endif
+
+    for (; l < end; ++l) {
+      const uint8_t *d = data + l * RAW_SCAN_SIZE;
+      int c = laser + (l - first);
+      uint16_t r = buf.rotation[l];
+
+      float raw = d[0] | (d[1] << 8);
+      float distance = raw * DISTANCE_RESOLUTION + t.dist_correction[c];
+
+      float cos_vert_angle = t.cos_vert_correction[c];
+      float sin_vert_angle = t.sin_vert_correction[c];
+      float horiz_offset = t.horiz_offset_correction[c];
+      float vert_offset = t.vert_offset_correction[c];
+
+      // cos(a-b) = cos(a)*cos(b) + sin(a)*sin(b)
+      // sin(a-b) = sin(a)*cos(b) - cos(a)*sin(b)
+      float cos_rot_angle =
+        cos_rot_table_[r] * t.cos_rot_correction[c] +
+        sin_rot_table_[r] * t.sin_rot_correction[c];
+      float sin_rot_angle =
+        sin_rot_table_[r] * t.cos_rot_correction[c] -
+        cos_rot_table_[r] * t.sin_rot_correction[c];
+
+      /**the new term of 'vert_offset * sin_vert_angle'
+       * was added to the expression due to the mathemathical
+       * model we used.
+       */
+      float xy_distance = distance * cos_vert_angle + vert_offset * sin_vert_angle;
+      float xx = fabsf(xy_distance * sin_rot_angle - horiz_offset * cos_rot_angle);
+      float yy = fabsf(xy_distance * cos_rot_angle + horiz_offset * sin_rot_angle);
+
+      float distance_x = distance + t.dist_slope_x[c] * xx + t.dist_offset_x[c];
+      float distance_y = distance + t.dist_slope_y[c] * yy + t.dist_offset_y[c];
+
+      xy_distance = distance_x * cos_vert_angle + vert_offset * sin_vert_angle;
+      ///the expression wiht '-' is proved to be better than the one with '+'
+      float x = xy_distance * sin_rot_angle - horiz_offset * cos_rot_angle;
+      xy_distance = distance_y * cos_vert_angle + vert_offset * sin_vert_angle;
+      float y = xy_distance * cos_rot_angle + horiz_offset * sin_rot_angle;
+      // Using distance_y is not symmetric, but the velodyne manual
+      // does this.
+      float z = distance_y * sin_vert_angle + vert_offset * cos_vert_angle;
+
+      /** Use standard ROS coordinate system (right-hand rule) */
+      buf.x[l] = y;
+      buf.y[l] = -x;
+      buf.z[l] = z;
+
+      /** Intensity Calculation */
+      float u = 1 - raw / 65535;
+      float intensity = d[2];
+      intensity += t.focal_slope[c] * fabsf(t.focal_offset[c] - 256 * u * u);
+      intensity = std::max(intensity, t.min_intensity[c]);
+      intensity = std::min(intensity, t.max_intensity[c]);
+      buf.intensity[l] = intensity;
+
+      if (distance >= min_range && distance <= max_range)
+        mask |= 1u << l;
+
+      buf.ring[l] = t.laser_ring[c];
+    }
+
+    return mask;
+  }
+
+  /** @brief copy the lanes selected by mask into the output points
+   *
+   *  @returns number of points written
+   */
+  int RawData::emitPoints(const BlockBuffer &buf, uint32_t mask,
+                          VPoint *points)
+  {
+    int n = 0;
+    for (int l = 0; l < SCANS_PER_BLOCK; ++l) {
+      if (!(mask & (1u << l)))
+        continue;
+      VPoint &point = points[n++];
+      point.x = buf.x[l];
+      point.y = buf.y[l];
+      point.z = buf.z[l];
+      point.intensity = (uint8_t) buf.intensity[l];
+      point.ring = buf.ring[l];
+    }
+    return n;
+  }
+
+  /** @brief convert raw packet to points
+   *
+   *  @param pkt raw packet to unpack
+   *  @param points room for SCANS_PER_PACKET points
+   *  @returns number of points written
+   */
+  int RawData::unpackPacket(const velodyne_msgs::VelodynePacket &pkt,
+                            VPoint *points) const
+  {
     /** special parsing for the VLP16 **/
     if (calibration_.num_lasers == 16)
-    {
-      unpack_vlp16(pkt, pc);
-      return;
-    }
-    
+      return unpack_vlp16(pkt, points);
+
     const raw_packet_t *raw = (const raw_packet_t *) &pkt.data[0];
+    BlockBuffer buf;
+    int n = 0;
 
     for (int i = 0; i < BLOCKS_PER_PACKET; i++) {
+      const raw_block_t &block = raw->blocks[i];
+
+      /*condition added to avoid calculating points which are not
+        in the interesting defined area (min_angle < area < max_angle)*/
+      if (!angleInRange(block.rotation))
+        continue;
 
       // upper bank lasers are numbered [0..31]
       // NOTE: this is a change from the old velodyne_common implementation
       int bank_origin = 0;
-      if (raw->blocks[i].header == LOWER_BANK) {
+      if (block.header == LOWER_BANK) {
         // lower bank lasers are [32..63]
         bank_origin = 32;
       }
 
-      for (int j = 0, k = 0; j < SCANS_PER_BLOCK; j++, k += RAW_SCAN_SIZE) {
-        
-        float x, y, z;
-        float intensity;
-        uint8_t laser_number;       ///< hardware laser number
-
-        laser_number = j + bank_origin;
-        velodyne_pointcloud::LaserCorrection &corrections = 
-          calibration_.laser_corrections[laser_number];
-
-        /** Position Calculation */
-
-        union two_bytes tmp;
-        tmp.bytes[0] = raw->blocks[i].data[k];
-        tmp.bytes[1] = raw->blocks[i].data[k+1];
-        /*condition added to avoid calculating points which are not
-          in the interesting defined area (min_angle < area < max_angle)*/
-        if ((raw->blocks[i].rotation >= config_.min_angle 
-             && raw->blocks[i].rotation <= config_.max_angle 
-             && config_.min_angle < config_.max_angle)
-             ||(config_.min_angle > config_.max_angle 
-             && (raw->blocks[i].rotation <= config_.max_angle 
-             || raw->blocks[i].rotation >= config_.min_angle))){
-          float distance = tmp.uint * DISTANCE_RESOLUTION;
-          distance += corrections.dist_correction;
-  
-          float cos_vert_angle = corrections.cos_vert_correction;
-          float sin_vert_angle = corrections.sin_vert_correction;
-          float cos_rot_correction = corrections.cos_rot_correction;
-          float sin_rot_correction = corrections.sin_rot_correction;
-  
-          // cos(a-b) = cos(a)*cos(b) + sin(a)*sin(b)
-          // sin(a-b) = sin(a)*cos(b) - cos(a)*sin(b)
-          float cos_rot_angle = 
-            cos_rot_table_[raw->blocks[i].rotation] * cos_rot_correction + 
-            sin_rot_table_[raw->blocks[i].rotation] * sin_rot_correction;
-          float sin_rot_angle = 
-            sin_rot_table_[raw->blocks[i].rotation] * cos_rot_correction - 
-            cos_rot_table_[raw->blocks[i].rotation] * sin_rot_correction;
-  
-          float horiz_offset = corrections.horiz_offset_correction;
-          float vert_offset = corrections.vert_offset_correction;
-  
-          // Compute the distance in the xy plane (w/o accounting for rotation)
-          /**the new term of 'vert_offset * sin_vert_angle'
-           * was added to the expression due to the mathemathical
-           * model we used.
-           */
-          float xy_distance = distance * cos_vert_angle + vert_offset * sin_vert_angle;
-  
-          // Calculate temporal X, use absolute value.
-          float xx = xy_distance * sin_rot_angle - horiz_offset * cos_rot_angle;
-          // Calculate temporal Y, use absolute value
-          float yy = xy_distance * cos_rot_angle + horiz_offset * sin_rot_angle;
-          if (xx < 0) xx=-xx;
-          if (yy < 0) yy=-yy;
-    
-          // Get 2points calibration values,Linear interpolation to get distance
-          // correction for X and Y, that means distance correction use
-          // different value at different distance
-          float distance_corr_x = 0;
-          float distance_corr_y = 0;
-          if (corrections.two_pt_correction_available) {
-            distance_corr_x = 
-              (corrections.dist_correction - corrections.dist_correction_x)
-                * (xx - 2.4) / (25.04 - 2.4) 
-              + corrections.dist_correction_x;
-            distance_corr_x -= corrections.dist_correction;
-            distance_corr_y = 
-              (corrections.dist_correction - corrections.dist_correction_y)
-                * (yy - 1.93) / (25.04 - 1.93)
-              + corrections.dist_correction_y;
-            distance_corr_y -= corrections.dist_correction;
-          }
-  
-          float distance_x = distance + distance_corr_x;
-          /**the new term of 'vert_offset * sin_vert_angle'
-           * was added to the expression due to the mathemathical
-           * model we used.
-           */
-          xy_distance = distance_x * cos_vert_angle + vert_offset * sin_vert_angle ;
-          ///the expression wiht '-' is proved to be better than the one with '+'
-          x = xy_distance * sin_rot_angle - horiz_offset * cos_rot_angle;
-  
-          float distance_y = distance + distance_corr_y;
-          xy_distance = distance_y * cos_vert_angle + vert_offset * sin_vert_angle ;
-          /**the new term of 'vert_offset * sin_vert_angle'
-           * was added to the expression due to the mathemathical
-           * model we used.
-           */
-          y = xy_distance * cos_rot_angle + horiz_offset * sin_rot_angle;
-  
-          // Using distance_y is not symmetric, but the velodyne manual
-          // does this.
-          /**the new term of 'vert_offset * cos_vert_angle'
-           * was added to the expression due to the mathemathical
-           * model we used.
-           */
-          z = distance_y * sin_vert_angle + vert_offset*cos_vert_angle;
-  
-          /** Use standard ROS coordinate system (right-hand rule) */
-          float x_coord = y;
-          float y_coord = -x;
-          float z_coord = z;
-  
-          /** Intensity Calculation */
-  
-          float min_intensity = corrections.min_intensity;
-          float max_intensity = corrections.max_intensity;
-  
-          intensity = raw->blocks[i].data[k+2];
-  
-          float focal_offset = 256 
-                             * (1 - corrections.focal_distance / 13100) 
-                             * (1 - corrections.focal_distance / 13100);
-          float focal_slope = corrections.focal_slope;
-          intensity += focal_slope * (abs(focal_offset - 256 * 
-            (1 - static_cast<float>(tmp.uint)/65535)*(1 - static_cast<float>(tmp.uint)/65535)));
-          intensity = (intensity < min_intensity) ? min_intensity : intensity;
-          intensity = (intensity > max_intensity) ? max_intensity : intensity;
-  
-          if (pointInRange(distance)) {
-  
-            // convert polar coordinates to Euclidean XYZ
-            VPoint point;
-            point.ring = corrections.laser_ring;
-            point.x = x_coord;
-            point.y = y_coord;
-            point.z = z_coord;
-            point.intensity = (uint8_t) intensity;
-  
-            // append this point to the cloud
-            pc.points.push_back(point);
-            ++pc.width;
-          }
-        }
-      }
+      std::fill(buf.rotation, buf.rotation + SCANS_PER_BLOCK, block.rotation);
+      uint32_t mask = decodeLanes(block.data, bank_origin, 0,
+                                  SCANS_PER_BLOCK, buf);
+      n += emitPoints(buf, mask, points + n);
     }
+
+    return n;
   }
   
-  /** @brief convert raw VLP16 packet to point cloud
+  /** @brief convert raw VLP16 packet to points
    *
    *  @param pkt raw packet to unpack
-   *  @param pc shared pointer to point cloud (points are appended)
+   *  @param points room for SCANS_PER_PACKET points
+   *  @returns number of points written
    */
-  void RawData::unpack_vlp16(const velodyne_msgs::VelodynePacket &pkt,
-                             VPointCloud &pc)
+  int RawData::unpack_vlp16(const velodyne_msgs::VelodynePacket &pkt,
+                            VPoint *points) const
   {
     float azimuth;
     float azimuth_diff;
-    float last_azimuth_diff;
+    float last_azimuth_diff = 0;
     float azimuth_corrected_f;
     int azimuth_corrected;
-    float x, y, z;
-    float intensity;
-    uint8_t dsr;
+    BlockBuffer buf;
+    int n = 0;
     
     const raw_packet_t *raw = (const raw_packet_t *) &pkt.data[0];
 
@@ -304,144 +478,33 @@ namespace velodyne_rawdata
         azimuth_diff = last_azimuth_diff;
       }
 
-      for (int firing=0, k=0; firing < VLP16_FIRINGS_PER_BLOCK; firing++){
-        for (int dsr=0; dsr < VLP16_SCANS_PER_FIRING; dsr++, k+=RAW_SCAN_SIZE){
-          velodyne_pointcloud::LaserCorrection &corrections = 
-            calibration_.laser_corrections[dsr];
-
-          /** Position Calculation */
-          union two_bytes tmp;
-          tmp.bytes[0] = raw->blocks[block].data[k];
-          tmp.bytes[1] = raw->blocks[block].data[k+1];
-          
+      uint32_t in_view = 0;
+      for (int firing=0, l=0; firing < VLP16_FIRINGS_PER_BLOCK; firing++){
+        for (int dsr=0; dsr < VLP16_SCANS_PER_FIRING; dsr++, l++){
           /** correct for the laser rotation as a function of timing during the firings **/
           azimuth_corrected_f = azimuth + (azimuth_diff * ((dsr*VLP16_DSR_TOFFSET) + (firing*VLP16_FIRING_TOFFSET)) / VLP16_BLOCK_TDURATION);
           azimuth_corrected = ((int)round(azimuth_corrected_f)) % 36000;
-          
+          buf.rotation[l] = azimuth_corrected;
+
           /*condition added to avoid calculating points which are not
             in the interesting defined area (min_angle < area < max_angle)*/
-          if ((azimuth_corrected >= config_.min_angle 
-               && azimuth_corrected <= config_.max_angle 
-               && config_.min_angle < config_.max_angle)
-               ||(config_.min_angle > config_.max_angle 
-               && (azimuth_corrected <= config_.max_angle 
-               || azimuth_corrected >= config_.min_angle))){
-            float distance = tmp.uint * DISTANCE_RESOLUTION;
-            distance += corrections.dist_correction;
-            
-            float cos_vert_angle = corrections.cos_vert_correction;
-            float sin_vert_angle = corrections.sin_vert_correction;
-            float cos_rot_correction = corrections.cos_rot_correction;
-            float sin_rot_correction = corrections.sin_rot_correction;
-    
-            // cos(a-b) = cos(a)*cos(b) + sin(a)*sin(b)
-            // sin(a-b) = sin(a)*cos(b) - cos(a)*sin(b)
-            float cos_rot_angle = 
-              cos_rot_table_[azimuth_corrected] * cos_rot_correction + 
-              sin_rot_table_[azimuth_corrected] * sin_rot_correction;
-            float sin_rot_angle = 
-              sin_rot_table_[azimuth_corrected] * cos_rot_correction - 
-              cos_rot_table_[azimuth_corrected] * sin_rot_correction;
-    
-            float horiz_offset = corrections.horiz_offset_correction;
-            float vert_offset = corrections.vert_offset_correction;
-    
-            // Compute the distance in the xy plane (w/o accounting for rotation)
-            /**the new term of 'vert_offset * sin_vert_angle'
-             * was added to the expression due to the mathemathical
-             * model we used.
-             */
-            float xy_distance = distance * cos_vert_angle + vert_offset * sin_vert_angle;
-    
-            // Calculate temporal X, use absolute value.
-            float xx = xy_distance * sin_rot_angle - horiz_offset * cos_rot_angle;
-            // Calculate temporal Y, use absolute value
-            float yy = xy_distance * cos_rot_angle + horiz_offset * sin_rot_angle;
-            if (xx < 0) xx=-xx;
-            if (yy < 0) yy=-yy;
-      
-            // Get 2points calibration values,Linear interpolation to get distance
-            // correction for X and Y, that means distance correction use
-            // different value at different distance
-            float distance_corr_x = 0;
-            float distance_corr_y = 0;
-            if (corrections.two_pt_correction_available) {
-              distance_corr_x = 
-                (corrections.dist_correction - corrections.dist_correction_x)
-                  * (xx - 2.4) / (25.04 - 2.4) 
-                + corrections.dist_correction_x;
-              distance_corr_x -= corrections.dist_correction;
-              distance_corr_y = 
-                (corrections.dist_correction - corrections.dist_correction_y)
-                  * (yy - 1.93) / (25.04 - 1.93)
-                + corrections.dist_correction_y;
-              distance_corr_y -= corrections.dist_correction;
-            }
-    
-            float distance_x = distance + distance_corr_x;
-            /**the new term of 'vert_offset * sin_vert_angle'
-             * was added to the expression due to the mathemathical
-             * model we used.
-             */
-            xy_distance = distance_x * cos_vert_angle + vert_offset * sin_vert_angle ;
-            x = xy_distance * sin_rot_angle - horiz_offset * cos_rot_angle;
-    
-            float distance_y = distance + distance_corr_y;
-            /**the new term of 'vert_offset * sin_vert_angle'
-             * was added to the expression due to the mathemathical
-             * model we used.
-             */
-            xy_distance = distance_y * cos_vert_angle + vert_offset * sin_vert_angle ;
-            y = xy_distance * cos_rot_angle + horiz_offset * sin_rot_angle;
-    
-            // Using distance_y is not symmetric, but the velodyne manual
-            // does this.
-            /**the new term of 'vert_offset * cos_vert_angle'
-             * was added to the expression due to the mathemathical
-             * model we used.
-             */
-            z = distance_y * sin_vert_angle + vert_offset*cos_vert_angle;
-  
-    
-            /** Use standard ROS coordinate system (right-hand rule) */
-            float x_coord = y;
-            float y_coord = -x;
-            float z_coord = z;
-    
-            /** Intensity Calculation */
-    
-            float min_intensity = corrections.min_intensity;
-            float max_intensity = corrections.max_intensity;
-    
-            intensity = raw->blocks[block].data[k+2];
-    
-            float focal_offset = 256 
-                               * (1 - corrections.focal_distance / 13100) 
-                               * (1 - corrections.focal_distance / 13100);
-            float focal_slope = corrections.focal_slope;
-            intensity += focal_slope * (abs(focal_offset - 256 * 
-              (1 - tmp.uint/65535)*(1 - tmp.uint/65535)));
-            intensity = (intensity < min_intensity) ? min_intensity : intensity;
-            intensity = (intensity > max_intensity) ? max_intensity : intensity;
-    
-            if (pointInRange(distance)) {
-    
-              // convert polar coordinates to Euclidean XYZ
-              VPoint point;
-              point.ring = corrections.laser_ring;
-              point.x = x_coord;
-              point.y = y_coord;
-              point.z = z_coord;
-              point.intensity = (uint8_t) intensity;
-    
-              // append this point to the cloud
-              pc.points.push_back(point);
-              ++pc.width;
-            }
-          }
+          if (angleInRange(azimuth_corrected))
+            in_view |= 1u << l;
         }
       }
+      if (in_view == 0)
+        continue;
+
+      // both firings of a block use lasers [0..15]
+      uint32_t mask = 0;
+      for (int firing = 0; firing < VLP16_FIRINGS_PER_BLOCK; firing++)
+        mask |= decodeLanes(raw->blocks[block].data, 0,
+                            firing * VLP16_SCANS_PER_FIRING,
+                            VLP16_SCANS_PER_FIRING, buf);
+      n += emitPoints(buf, mask & in_view, points + n);
     }
+
+    return n;
   }  
 
 } // namespace velodyne_rawdata
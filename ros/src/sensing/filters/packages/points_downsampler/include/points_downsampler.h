@@ -0,0 +1,118 @@
+/*
+ *  Copyright (c) 2015, Nagoya University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  * Neither the name of Autoware nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef _POINTS_DOWNSAMPLER_H_
+#define _POINTS_DOWNSAMPLER_H_
+
+#include <sensor_msgs/PointCloud2.h>
+
+#include <stdint.h>
+#include <vector>
+
+// Downsampling shared by the points_downsampler nodes. Reads the input PointCloud2 in place and writes
+// a PointXYZI cloud (same layout as pcl::toROSMsg) to the output message, without PCL conversions.
+// The points are selected by ring, by random (stride) or distance sampling, then optionally merged
+// into voxel centroids. Work buffers are kept between frames.
+class PointsDownsampler
+{
+public:
+  enum SamplingMode
+  {
+    SAMPLING_NONE,
+    SAMPLING_RANDOM,
+    SAMPLING_DISTANCE
+  };
+
+  PointsDownsampler();
+
+  // keep the points whose ring is a multiple of ring_div, 1 or less keeps all
+  void setRingDivision(int ring_div) { ring_div_ = ring_div; }
+  // pick sample_num points, 0 or less disables the sampling
+  void setSampling(SamplingMode mode, int sample_num)
+  {
+    sampling_mode_ = mode;
+    sample_num_ = sample_num;
+  }
+  // leaf sizes below 0.1 disable the voxel grid, the same limit as before with pcl::VoxelGrid
+  void setLeafSize(double leaf_size) { leaf_size_ = leaf_size; }
+
+  void filter(const sensor_msgs::PointCloud2& input, sensor_msgs::PointCloud2& output);
+
+  // points after the ring and sampling selection, before the voxel grid
+  size_t getSelectedSize() const { return selected_size_; }
+  // largest ring number in the last input
+  int getRingMax() const { return ring_max_; }
+
+private:
+  struct Field
+  {
+    int offset;
+    uint8_t datatype;
+  };
+
+  struct Voxel
+  {
+    double x, y, z, intensity;
+    int num;
+  };
+
+  // voxel key -> accumulated voxel, open addressing, voxels in the order they are first hit
+  struct VoxelTable
+  {
+    std::vector<uint64_t> keys;
+    std::vector<int> slots;
+    std::vector<Voxel> voxels;
+
+    void clear(size_t capacity);
+    Voxel& find(uint64_t key);
+  };
+
+  int ring_div_;
+  SamplingMode sampling_mode_;
+  int sample_num_;
+  double leaf_size_;
+
+  Field x_, y_, z_, intensity_, ring_;
+  size_t selected_size_;
+  int ring_max_;
+
+  std::vector<int> indices_;
+  std::vector<int> sampled_;
+  std::vector<float> weights_;  // squared distance of each point in indices_, for distance sampling
+  std::vector<VoxelTable> tables_;
+
+  bool parseFields(const sensor_msgs::PointCloud2& input);
+  bool keepRing(const uint8_t* point) const;
+  void select(const sensor_msgs::PointCloud2& input);
+  void writePoints(const sensor_msgs::PointCloud2& input, sensor_msgs::PointCloud2& output);
+  void writeVoxels(const sensor_msgs::PointCloud2& input, sensor_msgs::PointCloud2& output);
+};
+
+#endif  // _POINTS_DOWNSAMPLER_H_
@@ -0,0 +1,438 @@
+/*
+ *  Copyright (c) 2015, Nagoya University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  * Neither the name of Autoware nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "points_downsampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// output layout of pcl::PointXYZI
+static const int OUTPUT_POINT_STEP = 32;
+static const int OUTPUT_INTENSITY_OFFSET = 16;
+
+// bits of each voxel coordinate in the key
+static const int VOXEL_BITS = 21;
+static const int64_t VOXEL_OFFSET = 1 << (VOXEL_BITS - 1);
+static const uint64_t VOXEL_MASK = (1ULL << VOXEL_BITS) - 1;
+
+static const size_t MIN_TABLE_CAPACITY = 1024;
+
+static float readField(const uint8_t* point, int offset, uint8_t datatype)
+{
+  const uint8_t* p = point + offset;
+  switch (datatype)
+  {
+    case sensor_msgs::PointField::FLOAT32:
+    {
+      float v;
+      std::memcpy(&v, p, sizeof(v));
+      return v;
+    }
+    case sensor_msgs::PointField::FLOAT64:
+    {
+      double v;
+      std::memcpy(&v, p, sizeof(v));
+      return v;
+    }
+    case sensor_msgs::PointField::INT8:
+      return *reinterpret_cast<const int8_t*>(p);
+    case sensor_msgs::PointField::UINT8:
+      return *p;
+    case sensor_msgs::PointField::INT16:
+    {
+      int16_t v;
+      std::memcpy(&v, p, sizeof(v));
+      return v;
+    }
+    case sensor_msgs::PointField::UINT16:
+    {
+      uint16_t v;
+      std::memcpy(&v, p, sizeof(v));
+      return v;
+    }
+    case sensor_msgs::PointField::INT32:
+    {
+      int32_t v;
+      std::memcpy(&v, p, sizeof(v));
+      return v;
+    }
+    case sensor_msgs::PointField::UINT32:
+    {
+      uint32_t v;
+      std::memcpy(&v, p, sizeof(v));
+      return v;
+    }
+  }
+  return 0;
+}
+
+static const uint8_t* pointAt(const sensor_msgs::PointCloud2& cloud, size_t i)
+{
+  return &cloud.data[(i / cloud.width) * cloud.row_step + (i % cloud.width) * cloud.point_step];
+}
+
+static void writePoint(uint8_t* dst, float x, float y, float z, float intensity)
+{
+  // x, y, z, 1 then intensity and padding, as pcl::PointXYZI
+  const float data[8] = { x, y, z, 1.0f, intensity, 0.0f, 0.0f, 0.0f };
+  std::memcpy(dst, data, sizeof(data));
+}
+
+static int threadNum()
+{
+#ifdef _OPENMP
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+static int teamNum()
+{
+#ifdef _OPENMP
+  return omp_get_num_threads();
+#else
+  return 1;
+#endif
+}
+
+static int threadId()
+{
+#ifdef _OPENMP
+  return omp_get_thread_num();
+#else
+  return 0;
+#endif
+}
+
+void PointsDownsampler::VoxelTable::clear(size_t capacity)
+{
+  size_t n = MIN_TABLE_CAPACITY;
+  while (n < capacity)
+    n <<= 1;
+  slots.assign(n, -1);
+  keys.clear();
+  voxels.clear();
+}
+
+PointsDownsampler::Voxel& PointsDownsampler::VoxelTable::find(uint64_t key)
+{
+  // keep the table at most half full
+  if (2 * (voxels.size() + 1) > slots.size())
+  {
+    slots.assign(slots.size() * 2, -1);
+    size_t mask = slots.size() - 1;
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+      size_t s = ((keys[i] * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+      while (slots[s] >= 0)
+        s = (s + 1) & mask;
+      slots[s] = i;
+    }
+  }
+
+  size_t mask = slots.size() - 1;
+  size_t s = ((key * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+  while (slots[s] >= 0)
+  {
+    if (keys[slots[s]] == key)
+      return voxels[slots[s]];
+    s = (s + 1) & mask;
+  }
+
+  slots[s] = voxels.size();
+  keys.push_back(key);
+  Voxel v = { 0.0, 0.0, 0.0, 0.0, 0 };
+  voxels.push_back(v);
+  return voxels.back();
+}
+
+PointsDownsampler::PointsDownsampler()
+  : ring_div_(1), sampling_mode_(SAMPLING_NONE), sample_num_(0), leaf_size_(0.0), selected_size_(0), ring_max_(0)
+{
+}
+
+bool PointsDownsampler::parseFields(const sensor_msgs::PointCloud2& input)
+{
+  Field none = { -1, 0 };
+  x_ = y_ = z_ = intensity_ = ring_ = none;
+
+  for (size_t i = 0; i < input.fields.size(); i++)
+  {
+    const sensor_msgs::PointField& f = input.fields[i];
+    Field field = { (int)f.offset, f.datatype };
+    if (f.name == "x")
+      x_ = field;
+    else if (f.name == "y")
+      y_ = field;
+    else if (f.name == "z")
+      z_ = field;
+    else if (f.name == "intensity")
+      intensity_ = field;
+    else if (f.name == "ring")
+      ring_ = field;
+  }
+
+  return x_.offset >= 0 && y_.offset >= 0 && z_.offset >= 0;
+}
+
+bool PointsDownsampler::keepRing(const uint8_t* point) const
+{
+  if (ring_div_ <= 1 || ring_.offset < 0)
+    return true;
+  return (int)readField(point, ring_.offset, ring_.datatype) % ring_div_ == 0;
+}
+
+void PointsDownsampler::select(const sensor_msgs::PointCloud2& input)
+{
+  const size_t points_num = input.width * input.height;
+  const bool use_weights = sampling_mode_ == SAMPLING_DISTANCE && sample_num_ > 0;
+
+  // the squared distances for distance sampling are read in the same pass as the ring selection
+  double w_total = 0.0;
+  indices_.clear();
+  weights_.clear();
+  for (size_t i = 0; i < points_num; i++)
+  {
+    const uint8_t* p = pointAt(input, i);
+    if (ring_.offset >= 0)
+      ring_max_ = std::max(ring_max_, (int)readField(p, ring_.offset, ring_.datatype));
+    if (!keepRing(p))
+      continue;
+    indices_.push_back(i);
+    if (use_weights)
+    {
+      const float x = readField(p, x_.offset, x_.datatype);
+      const float y = readField(p, y_.offset, y_.datatype);
+      const float z = readField(p, z_.offset, z_.datatype);
+      weights_.push_back(x * x + y * y + z * z);
+      w_total += weights_.back();
+    }
+  }
+
+  const int n = indices_.size();
+  if (sample_num_ <= 0 || n == 0)
+    return;
+
+  if (sampling_mode_ == SAMPLING_RANDOM)
+  {
+    // every step-th point, at most sample_num
+    const int step = std::max(n / sample_num_, 1);
+    int m = 0;
+    for (int i = 0; i < n && m < sample_num_; i += step)
+      indices_[m++] = indices_[i];
+    indices_.resize(m);
+  }
+  else if (sampling_mode_ == SAMPLING_DISTANCE)
+  {
+    // sample_num points at equal steps of the accumulated squared distance
+    const double w_step = w_total / sample_num_;
+
+    sampled_.clear();
+    int item = 0;
+    double c = 0.0;
+    for (int m = 0; m < sample_num_; m++)
+    {
+      while (m * w_step > c && item + 1 < n)
+      {
+        item++;
+        c += weights_[item];
+      }
+      // the same point can be picked more than once, as before
+      sampled_.push_back(indices_[item]);
+    }
+    indices_.swap(sampled_);
+  }
+}
+
+void PointsDownsampler::writePoints(const sensor_msgs::PointCloud2& input, sensor_msgs::PointCloud2& output)
+{
+  const int n = indices_.size();
+  output.data.resize(n * OUTPUT_POINT_STEP);
+
+#pragma omp parallel for schedule(static)
+  for (int i = 0; i < n; i++)
+  {
+    const uint8_t* p = pointAt(input, indices_[i]);
+    writePoint(&output.data[i * OUTPUT_POINT_STEP], readField(p, x_.offset, x_.datatype),
+               readField(p, y_.offset, y_.datatype), readField(p, z_.offset, z_.datatype),
+               intensity_.offset >= 0 ? readField(p, intensity_.offset, intensity_.datatype) : 0.0f);
+  }
+
+  output.width = n;
+  output.is_dense = input.is_dense;
+}
+
+void PointsDownsampler::writeVoxels(const sensor_msgs::PointCloud2& input, sensor_msgs::PointCloud2& output)
+{
+  // without sampling the ring selection is done here, in the same pass as binning
+  const bool use_indices = sampling_mode_ != SAMPLING_NONE && sample_num_ > 0;
+  const long n = use_indices ? indices_.size() : input.width * input.height;
+  const float inverse_leaf_size = 1.0f / leaf_size_;
+  const int threads_num = threadNum();
+
+  size_t capacity = 0;
+  for (size_t t = 0; t < tables_.size(); t++)
+    capacity = std::max(capacity, 2 * tables_[t].voxels.size());
+  tables_.resize(threads_num);
+
+  long selected = 0;
+  int ring_max = ring_max_;
+  int team_num = 1;
+
+#pragma omp parallel reduction(+ : selected) reduction(max : ring_max)
+  {
+    VoxelTable& table = tables_[threadId()];
+    table.clear(capacity);
+    if (threadId() == 0)
+      team_num = teamNum();
+
+#pragma omp for schedule(static)
+    for (long i = 0; i < n; i++)
+    {
+      const uint8_t* p = pointAt(input, use_indices ? indices_[i] : i);
+      if (!use_indices)
+      {
+        if (ring_.offset >= 0)
+          ring_max = std::max(ring_max, (int)readField(p, ring_.offset, ring_.datatype));
+        if (!keepRing(p))
+          continue;
+        selected++;
+      }
+
+      const float x = readField(p, x_.offset, x_.datatype);
+      const float y = readField(p, y_.offset, y_.datatype);
+      const float z = readField(p, z_.offset, z_.datatype);
+      if (!std::isfinite(x) || !std::isfinite(y) || !std::isfinite(z))
+        continue;
+
+      const int64_t ix = (int64_t)std::floor(x * inverse_leaf_size) + VOXEL_OFFSET;
+      const int64_t iy = (int64_t)std::floor(y * inverse_leaf_size) + VOXEL_OFFSET;
+      const int64_t iz = (int64_t)std::floor(z * inverse_leaf_size) + VOXEL_OFFSET;
+      if (ix < 0 || iy < 0 || iz < 0 || (uint64_t)ix > VOXEL_MASK || (uint64_t)iy > VOXEL_MASK ||
+          (uint64_t)iz > VOXEL_MASK)
+        continue;
+
+      Voxel& v = table.find(((uint64_t)ix << (2 * VOXEL_BITS)) | ((uint64_t)iy << VOXEL_BITS) | (uint64_t)iz);
+      v.x += x;
+      v.y += y;
+      v.z += z;
+      if (intensity_.offset >= 0)
+        v.intensity += readField(p, intensity_.offset, intensity_.datatype);
+      v.num++;
+    }
+  }
+
+  if (!use_indices)
+  {
+    selected_size_ = selected;
+    ring_max_ = ring_max;
+  }
+
+  // merge into the first table, in thread order so that the output is stable
+  VoxelTable& merged = tables_[0];
+  for (int t = 1; t < team_num; t++)
+  {
+    const VoxelTable& table = tables_[t];
+    for (size_t i = 0; i < table.voxels.size(); i++)
+    {
+      Voxel& v = merged.find(table.keys[i]);
+      v.x += table.voxels[i].x;
+      v.y += table.voxels[i].y;
+      v.z += table.voxels[i].z;
+      v.intensity += table.voxels[i].intensity;
+      v.num += table.voxels[i].num;
+    }
+  }
+
+  const int voxels_num = merged.voxels.size();
+  output.data.resize(voxels_num * OUTPUT_POINT_STEP);
+
+#pragma omp parallel for schedule(static)
+  for (int i = 0; i < voxels_num; i++)
+  {
+    const Voxel& v = merged.voxels[i];
+    writePoint(&output.data[i * OUTPUT_POINT_STEP], v.x / v.num, v.y / v.num, v.z / v.num, v.intensity / v.num);
+  }
+
+  output.width = voxels_num;
+  output.is_dense = true;
+}
+
+void PointsDownsampler::filter(const sensor_msgs::PointCloud2& input, sensor_msgs::PointCloud2& output)
+{
+  output.header = input.header;
+  output.height = 1;
+  output.width = 0;
+  output.is_bigendian = false;
+  output.point_step = OUTPUT_POINT_STEP;
+  output.fields.resize(4);
+  const char* names[4] = { "x", "y", "z", "intensity" };
+  const int offsets[4] = { 0, 4, 8, OUTPUT_INTENSITY_OFFSET };
+  for (int i = 0; i < 4; i++)
+  {
+    output.fields[i].name = names[i];
+    output.fields[i].offset = offsets[i];
+    output.fields[i].datatype = sensor_msgs::PointField::FLOAT32;
+    output.fields[i].count = 1;
+  }
+
+  ring_max_ = 0;
+  selected_size_ = 0;
+
+  if (!parseFields(input))
+  {
+    output.data.clear();
+    output.row_step = 0;
+    output.is_dense = true;
+    return;
+  }
+
+  const bool use_voxel = leaf_size_ >= 0.1;
+  const bool use_sampling = sampling_mode_ != SAMPLING_NONE && sample_num_ > 0;
+
+  if (!use_voxel || use_sampling)
+  {
+    select(input);
+    selected_size_ = indices_.size();
+  }
+
+  if (use_voxel)
+    writeVoxels(input, output);
+  else
+    writePoints(input, output);
+
+  output.row_step = output.point_step * output.width;
+}
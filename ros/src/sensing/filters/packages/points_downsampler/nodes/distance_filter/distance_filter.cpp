@@ -31,17 +31,20 @@
 #include <ros/ros.h>
 #include <sensor_msgs/PointCloud2.h>
 
-#include <pcl/point_types.h>
-#include <pcl_conversions/pcl_conversions.h>
-#include <pcl/filters/voxel_grid.h>
-
 #include <runtime_manager/ConfigDistanceFilter.h>
 
 #include <points_downsampler/PointsDownsamplerInfo.h>
+#include "points_downsampler.h"
 
 #include <chrono>
+#include <fstream>
+
+#ifdef BUILD_NODELET
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+#endif
 
-ros::Publisher filtered_points_pub;
+static ros::Publisher filtered_points_pub;
 
 static int sample_num = 1000;
 
@@ -50,12 +53,17 @@ static points_downsampler::PointsDownsamplerInfo points_downsampler_info_msg;
 
 static std::chrono::time_point<std::chrono::system_clock> filter_start, filter_end;
 
+static PointsDownsampler downsampler;
+
 static bool _output_log = false;
 static std::ofstream ofs;
 static std::string filename;
 
 static std::string POINTS_TOPIC;
 
+static ros::Subscriber config_sub;
+static ros::Subscriber scan_sub;
+
 static void config_callback(const runtime_manager::ConfigDistanceFilter::ConstPtr& input)
 {
   sample_num = input->sample_num;
@@ -63,55 +71,21 @@ static void config_callback(const runtime_manager::ConfigDistanceFilter::ConstPt
 
 static void scan_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
 {
-  pcl::PointXYZI sampled_p;
-  pcl::PointCloud<pcl::PointXYZI> scan;
-
-  pcl::fromROSMsg(*input, scan);
-  pcl::PointCloud<pcl::PointXYZI>::Ptr filtered_scan_ptr(new pcl::PointCloud<pcl::PointXYZI>());
-  filtered_scan_ptr->header = scan.header;
-
-  int points_num = scan.size();
-
-  double w_total = 0.0;
-  double w_step = 0.0;
-  int m = 0;
-  double c = 0.0;
+  sensor_msgs::PointCloud2::Ptr filtered_msg(new sensor_msgs::PointCloud2);
 
   filter_start = std::chrono::system_clock::now();
 
-  for (pcl::PointCloud<pcl::PointXYZI>::const_iterator item = scan.begin(); item != scan.end(); item++)
-  {
-    w_total += item->x * item->x + item->y * item->y + item->z * item->z;
-  }
-  w_step = w_total / sample_num;
-
-  pcl::PointCloud<pcl::PointXYZI>::const_iterator item = scan.begin();
-  for (m = 0; m < sample_num; m++)
-  {
-    while (m * w_step > c)
-    {
-      item++;
-      c += item->x * item->x + item->y * item->y + item->z * item->z;
-    }
-    sampled_p.x = item->x;
-    sampled_p.y = item->y;
-    sampled_p.z = item->z;
-    sampled_p.intensity = item->intensity;
-    filtered_scan_ptr->points.push_back(sampled_p);
-  }
-
-  sensor_msgs::PointCloud2 filtered_msg;
-  pcl::toROSMsg(*filtered_scan_ptr, filtered_msg);
+  downsampler.setSampling(PointsDownsampler::SAMPLING_DISTANCE, sample_num);
+  downsampler.filter(*input, *filtered_msg);
 
   filter_end = std::chrono::system_clock::now();
 
-  filtered_msg.header = input->header;
   filtered_points_pub.publish(filtered_msg);
 
   points_downsampler_info_msg.header = input->header;
   points_downsampler_info_msg.filter_name = "distance_filter";
-  points_downsampler_info_msg.original_points_size = points_num;
-  points_downsampler_info_msg.filtered_points_size = filtered_scan_ptr->size();
+  points_downsampler_info_msg.original_points_size = input->width * input->height;
+  points_downsampler_info_msg.filtered_points_size = filtered_msg->width;
   points_downsampler_info_msg.original_ring_size = 0;
   points_downsampler_info_msg.original_ring_size = 0;
   points_downsampler_info_msg.exe_time = std::chrono::duration_cast<std::chrono::microseconds>(filter_end - filter_start).count() / 1000.0;
@@ -136,13 +110,8 @@ static void scan_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
 
 }
 
-int main(int argc, char** argv)
+static void setup(ros::NodeHandle& nh, ros::NodeHandle& private_nh)
 {
-  ros::init(argc, argv, "distance_filter");
-
-  ros::NodeHandle nh;
-  ros::NodeHandle private_nh("~");
-
   private_nh.getParam("points_topic", POINTS_TOPIC);
   private_nh.getParam("output_log", _output_log);
   if(_output_log == true){
@@ -159,10 +128,35 @@ int main(int argc, char** argv)
   points_downsampler_info_pub = nh.advertise<points_downsampler::PointsDownsamplerInfo>("/points_downsampler_info", 1000);
 
   // Subscribers
-  ros::Subscriber config_sub = nh.subscribe("config/distance_filter", 10, config_callback);
-  ros::Subscriber scan_sub = nh.subscribe(POINTS_TOPIC, 10, scan_callback);
+  config_sub = nh.subscribe("config/distance_filter", 10, config_callback);
+  scan_sub = nh.subscribe(POINTS_TOPIC, 10, scan_callback);
+}
+
+#ifdef BUILD_NODELET
+namespace points_downsampler
+{
+class DistanceFilterNodelet : public nodelet::Nodelet
+{
+  virtual void onInit()
+  {
+    setup(getNodeHandle(), getPrivateNodeHandle());
+  }
+};
+}  // namespace points_downsampler
+
+PLUGINLIB_EXPORT_CLASS(points_downsampler::DistanceFilterNodelet, nodelet::Nodelet)
+#else
+int main(int argc, char** argv)
+{
+  ros::init(argc, argv, "distance_filter");
+
+  ros::NodeHandle nh;
+  ros::NodeHandle private_nh("~");
+
+  setup(nh, private_nh);
 
   ros::spin();
 
   return 0;
 }
+#endif
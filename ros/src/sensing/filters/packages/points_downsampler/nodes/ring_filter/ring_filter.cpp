@@ -31,37 +31,43 @@
 #include <ros/ros.h>
 #include <sensor_msgs/PointCloud2.h>
 
-#include <pcl/point_types.h>
-#include <pcl_conversions/pcl_conversions.h>
-#include <pcl/filters/voxel_grid.h>
-
-#include <velodyne_pointcloud/point_types.h>
-
 #include <runtime_manager/ConfigRingFilter.h>
 
 #include <points_downsampler/PointsDownsamplerInfo.h>
+#include "points_downsampler.h"
 
 #include <chrono>
+#include <fstream>
+
+#ifdef BUILD_NODELET
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+#endif
 
-ros::Publisher filtered_points_pub;
+static ros::Publisher filtered_points_pub;
 
 // Leaf size of VoxelGrid filter.
 static double voxel_leaf_size = 2.0;
 
-int ring_max = 0;
-int ring_div = 3;
+static int ring_max = 0;
+static int ring_div = 3;
 
 static ros::Publisher points_downsampler_info_pub;
 static points_downsampler::PointsDownsamplerInfo points_downsampler_info_msg;
 
 static std::chrono::time_point<std::chrono::system_clock> filter_start, filter_end;
 
+static PointsDownsampler downsampler;
+
 static bool _output_log = false;
 static std::ofstream ofs;
 static std::string filename;
 
 static std::string POINTS_TOPIC;
 
+static ros::Subscriber config_sub;
+static ros::Subscriber scan_sub;
+
 static void config_callback(const runtime_manager::ConfigRingFilter::ConstPtr& input)
 {
   ring_div = input->ring_div;
@@ -70,69 +76,27 @@ static void config_callback(const runtime_manager::ConfigRingFilter::ConstPtr& i
 
 static void scan_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
 {
-  pcl::PointXYZI p;
-  pcl::PointCloud<pcl::PointXYZI> scan;
-  pcl::PointCloud<velodyne_pointcloud::PointXYZIR> tmp;
-  sensor_msgs::PointCloud2 filtered_msg;
-
-  pcl::fromROSMsg(*input, scan);
-  pcl::fromROSMsg(*input, tmp);
+  sensor_msgs::PointCloud2::Ptr filtered_msg(new sensor_msgs::PointCloud2);
 
   filter_start = std::chrono::system_clock::now();
 
-  scan.points.clear();
-
-  for (pcl::PointCloud<velodyne_pointcloud::PointXYZIR>::const_iterator item = tmp.begin(); item != tmp.end(); item++)
+  // if voxel_leaf_size < 0.1 the points are only selected by ring
+  downsampler.setRingDivision(ring_div);
+  downsampler.setLeafSize(voxel_leaf_size);
+  downsampler.filter(*input, *filtered_msg);
+  if (downsampler.getRingMax() > ring_max)
   {
-    p.x = (double)item->x;
-    p.y = (double)item->y;
-    p.z = (double)item->z;
-    p.intensity = (double)item->intensity;
-    if (item->ring % ring_div == 0)
-    {
-      scan.points.push_back(p);
-    }
-    if (item->ring > ring_max)
-    {
-      ring_max = item->ring;
-    }
-  }
-
-  pcl::PointCloud<pcl::PointXYZI>::Ptr scan_ptr(new pcl::PointCloud<pcl::PointXYZI>(scan));
-  pcl::PointCloud<pcl::PointXYZI>::Ptr filtered_scan_ptr(new pcl::PointCloud<pcl::PointXYZI>());
-
-  // if voxel_leaf_size < 0.1 voxel_grid_filter cannot down sample (It is specification in PCL)
-  if (voxel_leaf_size >= 0.1)
-  {
-    // Downsampling the velodyne scan using VoxelGrid filter
-    pcl::VoxelGrid<pcl::PointXYZI> voxel_grid_filter;
-    voxel_grid_filter.setLeafSize(voxel_leaf_size, voxel_leaf_size, voxel_leaf_size);
-    voxel_grid_filter.setInputCloud(scan_ptr);
-    voxel_grid_filter.filter(*filtered_scan_ptr);
-
-    pcl::toROSMsg(*filtered_scan_ptr, filtered_msg);
-  }
-  else
-  {
-    pcl::toROSMsg(*scan_ptr, filtered_msg);
+    ring_max = downsampler.getRingMax();
   }
 
   filter_end = std::chrono::system_clock::now();
 
-  filtered_msg.header = input->header;
   filtered_points_pub.publish(filtered_msg);
 
   points_downsampler_info_msg.header = input->header;
   points_downsampler_info_msg.filter_name = "ring_filter";
-  points_downsampler_info_msg.original_points_size = scan.size();
-  if (voxel_leaf_size >= 0.1)
-  {
-    points_downsampler_info_msg.filtered_points_size = filtered_scan_ptr->size();
-  }
-  else
-  {
-    points_downsampler_info_msg.filtered_points_size = scan_ptr->size();
-  }
+  points_downsampler_info_msg.original_points_size = downsampler.getSelectedSize();
+  points_downsampler_info_msg.filtered_points_size = filtered_msg->width;
   points_downsampler_info_msg.original_ring_size = ring_max;
   points_downsampler_info_msg.filtered_ring_size = ring_max / ring_div;
   points_downsampler_info_msg.exe_time = std::chrono::duration_cast<std::chrono::microseconds>(filter_end - filter_start).count() / 1000.0;
@@ -157,13 +121,8 @@ static void scan_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
 
 }
 
-int main(int argc, char** argv)
+static void setup(ros::NodeHandle& nh, ros::NodeHandle& private_nh)
 {
-  ros::init(argc, argv, "ring_filter");
-
-  ros::NodeHandle nh;
-  ros::NodeHandle private_nh("~");
-
   private_nh.getParam("points_topic", POINTS_TOPIC);
   private_nh.getParam("output_log", _output_log);
   if(_output_log == true){
@@ -180,10 +139,35 @@ int main(int argc, char** argv)
   points_downsampler_info_pub = nh.advertise<points_downsampler::PointsDownsamplerInfo>("/points_downsampler_info", 1000);
 
   // Subscribers
-  ros::Subscriber config_sub = nh.subscribe("config/ring_filter", 10, config_callback);
-  ros::Subscriber scan_sub = nh.subscribe(POINTS_TOPIC, 10, scan_callback);
+  config_sub = nh.subscribe("config/ring_filter", 10, config_callback);
+  scan_sub = nh.subscribe(POINTS_TOPIC, 10, scan_callback);
+}
+
+#ifdef BUILD_NODELET
+namespace points_downsampler
+{
+class RingFilterNodelet : public nodelet::Nodelet
+{
+  virtual void onInit()
+  {
+    setup(getNodeHandle(), getPrivateNodeHandle());
+  }
+};
+}  // namespace points_downsampler
+
+PLUGINLIB_EXPORT_CLASS(points_downsampler::RingFilterNodelet, nodelet::Nodelet)
+#else
+int main(int argc, char** argv)
+{
+  ros::init(argc, argv, "ring_filter");
+
+  ros::NodeHandle nh;
+  ros::NodeHandle private_nh("~");
+
+  setup(nh, private_nh);
 
   ros::spin();
 
   return 0;
 }
+#endif
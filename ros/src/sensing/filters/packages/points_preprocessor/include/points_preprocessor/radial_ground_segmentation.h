@@ -0,0 +1,106 @@
+/*
+ *  Copyright (c) 2015, Nagoya University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  * Neither the name of Autoware nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef RADIAL_GROUND_SEGMENTATION_H_
+#define RADIAL_GROUND_SEGMENTATION_H_
+
+#include <sensor_msgs/PointCloud2.h>
+#include <pcl/point_cloud.h>
+
+#include <cmath>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+class RadialGroundSegmentation
+{
+public:
+	RadialGroundSegmentation();
+
+	/* height of the sensor over the ground, the first ground point is searched around -sensor_height */
+	void SetSensorHeight(double in_sensor_height) { sensor_height_ = in_sensor_height; }
+	/* max slope (radians) between consecutive ground points */
+	void SetLocalMaxSlope(double in_slope) { local_max_slope_ = in_slope; }
+	/* max slope (radians) of the ground seen from the sensor */
+	void SetGeneralMaxSlope(double in_slope) { general_max_slope_ = in_slope; }
+	/* height tolerance (meters) added to both slopes */
+	void SetHeightThreshold(double in_threshold) { height_threshold_ = in_threshold; }
+	/* azimuth width of a sector (radians) */
+	void SetSectorAngle(double in_angle) { sector_angle_ = in_angle; }
+
+	/* classify the points of the cloud, the indices are sorted.
+	   returns false, with no indices, if the cloud has no x, y or z field */
+	bool Segment(const sensor_msgs::PointCloud2& in_cloud,
+				std::vector<int>& out_ground_indices,
+				std::vector<int>& out_no_ground_indices);
+
+	template <typename PointT>
+	void Segment(const pcl::PointCloud<PointT>& in_cloud,
+				std::vector<int>& out_ground_indices,
+				std::vector<int>& out_no_ground_indices)
+	{
+		size_t points_num = in_cloud.points.size();
+		x_.resize(points_num);
+		y_.resize(points_num);
+		z_.resize(points_num);
+		ring_.clear();
+		for (size_t i = 0; i < points_num; i++)
+		{
+			x_[i] = in_cloud.points[i].x;
+			y_[i] = in_cloud.points[i].y;
+			z_[i] = in_cloud.points[i].z;
+		}
+		Classify(out_ground_indices, out_no_ground_indices);
+	}
+
+private:
+	double sensor_height_;
+	double local_max_slope_;
+	double general_max_slope_;
+	double height_threshold_;
+	double sector_angle_;
+
+	/* points of the current cloud, ring_ is empty without the ring field */
+	std::vector<float> x_;
+	std::vector<float> y_;
+	std::vector<float> z_;
+	std::vector<uint16_t> ring_;
+
+	/* points of each sector, sector s is [sector_start_[s], sector_start_[s+1]) of sector_points_ */
+	std::vector<int> sector_of_point_;
+	std::vector<int> sector_start_;
+	std::vector<int> sector_points_;
+	std::vector<uint8_t> ground_;
+
+	void Classify(std::vector<int>& out_ground_indices, std::vector<int>& out_no_ground_indices);
+	void ClassifySector(int in_sector, std::vector<std::pair<float, int> >& in_out_order);
+};
+
+#endif /* RADIAL_GROUND_SEGMENTATION_H_ */
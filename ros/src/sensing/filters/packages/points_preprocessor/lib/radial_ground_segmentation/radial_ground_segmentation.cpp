@@ -0,0 +1,252 @@
+/*
+ *  Copyright (c) 2015, Nagoya University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  * Neither the name of Autoware nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "points_preprocessor/radial_ground_segmentation.h"
+
+#include <algorithm>
+#include <cstring>
+
+#define RADIAL_DIVIDER_ANGLE	0.18	// degrees, about the horizontal resolution of the velodyne
+#define MAX_RING				1000	// rings above this are treated as a cloud without ring
+
+static const uint8_t NO_GROUND = 0;
+static const uint8_t GROUND = 1;
+
+/* value of a numeric field, 0 for unsupported types */
+static float ReadField(const uint8_t* in_point, const sensor_msgs::PointField& in_field)
+{
+	const uint8_t* p = in_point + in_field.offset;
+	switch (in_field.datatype)
+	{
+	case sensor_msgs::PointField::FLOAT32:
+	{
+		float v;
+		std::memcpy(&v, p, sizeof(v));
+		return v;
+	}
+	case sensor_msgs::PointField::FLOAT64:
+	{
+		double v;
+		std::memcpy(&v, p, sizeof(v));
+		return v;
+	}
+	case sensor_msgs::PointField::INT8:
+		return *reinterpret_cast<const int8_t*>(p);
+	case sensor_msgs::PointField::UINT8:
+		return *p;
+	case sensor_msgs::PointField::INT16:
+	{
+		int16_t v;
+		std::memcpy(&v, p, sizeof(v));
+		return v;
+	}
+	case sensor_msgs::PointField::UINT16:
+	{
+		uint16_t v;
+		std::memcpy(&v, p, sizeof(v));
+		return v;
+	}
+	case sensor_msgs::PointField::INT32:
+	{
+		int32_t v;
+		std::memcpy(&v, p, sizeof(v));
+		return v;
+	}
+	case sensor_msgs::PointField::UINT32:
+	{
+		uint32_t v;
+		std::memcpy(&v, p, sizeof(v));
+		return v;
+	}
+	}
+	return 0;
+}
+
+RadialGroundSegmentation::RadialGroundSegmentation() :
+		sensor_height_(1.8),
+		local_max_slope_(0.35),
+		general_max_slope_(0.35),
+		height_threshold_(0.2),
+		sector_angle_(RADIAL_DIVIDER_ANGLE * M_PI / 180.0)
+{
+}
+
+bool RadialGroundSegmentation::Segment(const sensor_msgs::PointCloud2& in_cloud,
+			std::vector<int>& out_ground_indices,
+			std::vector<int>& out_no_ground_indices)
+{
+	const sensor_msgs::PointField* x_field = NULL;
+	const sensor_msgs::PointField* y_field = NULL;
+	const sensor_msgs::PointField* z_field = NULL;
+	const sensor_msgs::PointField* ring_field = NULL;
+	for (size_t i = 0; i < in_cloud.fields.size(); i++)
+	{
+		const sensor_msgs::PointField& field = in_cloud.fields[i];
+		if (field.name == "x")
+			x_field = &field;
+		else if (field.name == "y")
+			y_field = &field;
+		else if (field.name == "z")
+			z_field = &field;
+		else if (field.name == "ring")
+			ring_field = &field;
+	}
+
+	if (x_field == NULL || y_field == NULL || z_field == NULL)
+	{
+		out_ground_indices.clear();
+		out_no_ground_indices.clear();
+		return false;
+	}
+
+	size_t points_num = (size_t)in_cloud.width * in_cloud.height;
+
+	x_.resize(points_num);
+	y_.resize(points_num);
+	z_.resize(points_num);
+	ring_.resize(ring_field != NULL ? points_num : 0);
+	for (size_t i = 0; i < points_num; i++)
+	{
+		const uint8_t* point = &in_cloud.data[(i / in_cloud.width) * in_cloud.row_step + (i % in_cloud.width) * in_cloud.point_step];
+		x_[i] = ReadField(point, *x_field);
+		y_[i] = ReadField(point, *y_field);
+		z_[i] = ReadField(point, *z_field);
+		if (ring_field != NULL)
+			ring_[i] = (uint16_t)std::min(std::max(ReadField(point, *ring_field), 0.0f), (float)MAX_RING);
+	}
+
+	Classify(out_ground_indices, out_no_ground_indices);
+	return true;
+}
+
+void RadialGroundSegmentation::Classify(std::vector<int>& out_ground_indices, std::vector<int>& out_no_ground_indices)
+{
+	int points_num = (int)x_.size();
+	int sectors_num = std::max(1, (int)std::ceil(2 * M_PI / sector_angle_));
+
+	/*BUCKET THE POINTS BY SECTOR (counting sort, the points keep their order in the sector)*/
+	sector_of_point_.resize(points_num);
+	sector_start_.assign(sectors_num + 1, 0);
+	ground_.assign(points_num, NO_GROUND);
+
+#pragma omp parallel for
+	for (int i = 0; i < points_num; i++)
+	{
+		int sector = -1;
+		if (std::isfinite(x_[i]) && std::isfinite(y_[i]) && std::isfinite(z_[i]))
+		{
+			sector = (int)((std::atan2(y_[i], x_[i]) + M_PI) / sector_angle_);
+			sector = std::min(std::max(sector, 0), sectors_num - 1);
+		}
+		sector_of_point_[i] = sector;
+	}
+
+	for (int i = 0; i < points_num; i++)
+	{
+		if (sector_of_point_[i] >= 0)
+			sector_start_[sector_of_point_[i] + 1]++;
+	}
+	for (int s = 0; s < sectors_num; s++)
+		sector_start_[s + 1] += sector_start_[s];
+
+	sector_points_.resize(sector_start_[sectors_num]);
+	std::vector<int> fill(sector_start_.begin(), sector_start_.end() - 1);
+	for (int i = 0; i < points_num; i++)
+	{
+		if (sector_of_point_[i] >= 0)
+			sector_points_[fill[sector_of_point_[i]]++] = i;
+	}
+
+	/*WALK EVERY SECTOR OUTWARDS, each sector only writes the labels of its own points*/
+#pragma omp parallel
+	{
+		std::vector<std::pair<float, int> > order;
+#pragma omp for schedule(dynamic, 16)
+		for (int s = 0; s < sectors_num; s++)
+			ClassifySector(s, order);
+	}
+
+	out_ground_indices.clear();
+	out_no_ground_indices.clear();
+	for (int i = 0; i < points_num; i++)
+	{
+		if (ground_[i] == GROUND)
+			out_ground_indices.push_back(i);
+		else
+			out_no_ground_indices.push_back(i);
+	}
+}
+
+void RadialGroundSegmentation::ClassifySector(int in_sector, std::vector<std::pair<float, int> >& in_out_order)
+{
+	int begin = sector_start_[in_sector];
+	int end = sector_start_[in_sector + 1];
+	if (begin == end)
+		return;
+
+	/*lower rings hit the ground closer to the sensor, so with the ring field the points are walked
+	  ring by ring and by distance inside a ring, otherwise only by distance*/
+	in_out_order.clear();
+	for (int k = begin; k < end; k++)
+	{
+		int i = sector_points_[k];
+		float radius = std::sqrt(x_[i] * x_[i] + y_[i] * y_[i]);
+		in_out_order.push_back(std::make_pair(ring_.empty() ? radius : ring_[i] * 1000.0f + std::min(radius, 999.0f), i));
+	}
+	std::sort(in_out_order.begin(), in_out_order.end());
+
+	double local_slope = std::tan(local_max_slope_);
+	double general_slope = std::tan(general_max_slope_);
+
+	/*the walk starts on the ground below the sensor*/
+	double prev_radius = 0.0;
+	double prev_height = -sensor_height_;
+	for (size_t k = 0; k < in_out_order.size(); k++)
+	{
+		int i = in_out_order[k].second;
+		double radius = std::sqrt(x_[i] * x_[i] + y_[i] * y_[i]);
+		double height = z_[i];
+
+		/*points closer than the previous ground point (next ring on an obstacle) are compared at the same distance*/
+		double local_height = local_slope * std::max(radius - prev_radius, 0.0) + height_threshold_;
+		double general_height = general_slope * radius + height_threshold_;
+
+		if (std::fabs(height - prev_height) <= local_height && std::fabs(height + sensor_height_) <= general_height)
+		{
+			ground_[i] = GROUND;
+			/*the reference only moves outwards, so that rings stacked on a wall cannot climb it step by step*/
+			if (radius > prev_radius + height_threshold_)
+			{
+				prev_radius = radius;
+				prev_height = height;
+			}
+		}
+	}
+}
@@ -5,18 +5,22 @@
  *      Author: ne0
  */
 #include <ros/ros.h>
-#include <pcl_conversions/pcl_conversions.h>
-#include <pcl/filters/extract_indices.h>
-#include <pcl/segmentation/sac_segmentation.h>
-#include <sensor_msgs/point_cloud_conversion.h>
-#include <sensor_msgs/PointCloud.h>
 #include <sensor_msgs/PointCloud2.h>
 
+#include <algorithm>
+
+#include "points_preprocessor/radial_ground_segmentation.h"
+
+#ifdef BUILD_NODELET
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+#endif
+
 
 class GroundFilter
 {
 public:
-	GroundFilter();
+	GroundFilter(ros::NodeHandle node_handle);
 
 private:
 
@@ -31,19 +35,21 @@ private:
 
 	double 			points_distance_;
 	double 			angle_threshold_;
+	double 			sensor_height_;
 
+	RadialGroundSegmentation	ground_segmentation_;
+	std::vector<int>			ground_indices_;
+	std::vector<int>			no_ground_indices_;
 
-	void VelodyneCallback(const sensor_msgs::PointCloud2::Ptr& in_sensor_cloud_ptr);
-	void RemoveFloor(const pcl::PointCloud<pcl::PointXYZ>::Ptr in_cloud_ptr,
-				pcl::PointCloud<pcl::PointXYZ>::Ptr out_nofloor_cloud_ptr,
-				pcl::PointCloud<pcl::PointXYZ>::Ptr out_onlyfloor_cloud_ptr,
-				float in_max_height,
-				float in_floor_max_angle);
+	void VelodyneCallback(const sensor_msgs::PointCloud2::ConstPtr& in_sensor_cloud_ptr);
+	void ExtractPoints(const sensor_msgs::PointCloud2& in_cloud,
+				const std::vector<int>& in_indices,
+				sensor_msgs::PointCloud2& out_cloud);
 
 };
 
-GroundFilter::GroundFilter() :
-		node_handle_("~")
+GroundFilter::GroundFilter(ros::NodeHandle node_handle) :
+		node_handle_(node_handle)
 {
 
 	node_handle_.param<std::string>("subscribe_topic",  subscribe_topic_,  "/points_clipped");
@@ -51,89 +57,91 @@ GroundFilter::GroundFilter() :
 	node_handle_.param("remove_floor",  floor_removal_,  true);
 	node_handle_.param("points_distance",  points_distance_,  0.2);
 	node_handle_.param("angle_threshold",  angle_threshold_,  0.35);
+	node_handle_.param("sensor_height",  sensor_height_,  1.8);
+
+	ground_segmentation_.SetHeightThreshold(points_distance_);
+	ground_segmentation_.SetLocalMaxSlope(angle_threshold_);
+	ground_segmentation_.SetGeneralMaxSlope(angle_threshold_);
+	ground_segmentation_.SetSensorHeight(sensor_height_);
 
 	cloud_sub_ = node_handle_.subscribe(subscribe_topic_, 10, &GroundFilter::VelodyneCallback, this);
 	cloud_lanes_pub_ = node_handle_.advertise<sensor_msgs::PointCloud2>( "/points_lanes", 10);
 	cloud_ground_pub_ = node_handle_.advertise<sensor_msgs::PointCloud2>( "/points_ground", 10);
 }
 
-void GroundFilter::RemoveFloor(const pcl::PointCloud<pcl::PointXYZ>::Ptr in_cloud_ptr,
-		pcl::PointCloud<pcl::PointXYZ>::Ptr out_nofloor_cloud_ptr,
-		pcl::PointCloud<pcl::PointXYZ>::Ptr out_onlyfloor_cloud_ptr,
-		float in_max_distance,
-		float in_floor_max_angle)
+/*copies the points of in_indices, keeping all the fields of the input (ring, intensity...)*/
+void GroundFilter::ExtractPoints(const sensor_msgs::PointCloud2& in_cloud,
+		const std::vector<int>& in_indices,
+		sensor_msgs::PointCloud2& out_cloud)
 {
-	pcl::SACSegmentation<pcl::PointXYZ> seg;
-	pcl::PointIndices::Ptr inliers (new pcl::PointIndices);
-	pcl::ModelCoefficients::Ptr coefficients (new pcl::ModelCoefficients);
-
-	seg.setOptimizeCoefficients (true);
-	seg.setModelType(pcl::SACMODEL_PERPENDICULAR_PLANE);
-	seg.setMethodType(pcl::SAC_RANSAC);
-	seg.setMaxIterations(100);
-	seg.setAxis(Eigen::Vector3f(0,0,1));
-	seg.setEpsAngle(in_floor_max_angle);
-
-	seg.setDistanceThreshold (in_max_distance);//floor distance
-	seg.setOptimizeCoefficients(true);
-	seg.setInputCloud(in_cloud_ptr);
-	seg.segment(*inliers, *coefficients);
-	if (inliers->indices.size () == 0)
+	out_cloud.header = in_cloud.header;
+	out_cloud.fields = in_cloud.fields;
+	out_cloud.is_bigendian = in_cloud.is_bigendian;
+	out_cloud.is_dense = in_cloud.is_dense;
+	out_cloud.point_step = in_cloud.point_step;
+	out_cloud.height = 1;
+	out_cloud.width = in_indices.size();
+	out_cloud.row_step = out_cloud.point_step * out_cloud.width;
+	out_cloud.data.resize(out_cloud.row_step);
+
+	for (size_t i = 0; i < in_indices.size(); i++)
 	{
-		std::cout << "Could not estimate a planar model for the given dataset." << std::endl;
+		size_t index = in_indices[i];
+		const uint8_t* point = &in_cloud.data[(index / in_cloud.width) * in_cloud.row_step + (index % in_cloud.width) * in_cloud.point_step];
+		std::copy(point, point + in_cloud.point_step, &out_cloud.data[i * out_cloud.point_step]);
 	}
-
-	/*REMOVE THE FLOOR FROM THE CLOUD*/
-	pcl::ExtractIndices<pcl::PointXYZ> extract;
-	extract.setInputCloud (in_cloud_ptr);
-	extract.setIndices(inliers);
-	extract.setNegative(true);//true removes the indices, false leaves only the indices
-	extract.filter(*out_nofloor_cloud_ptr);
-
-	/*EXTRACT THE FLOOR FROM THE CLOUD*/
-	extract.setNegative(false);//true removes the indices, false leaves only the indices
-	extract.filter(*out_onlyfloor_cloud_ptr);
 }
 
-void GroundFilter::VelodyneCallback(const sensor_msgs::PointCloud2::Ptr& in_sensor_cloud_ptr)
+void GroundFilter::VelodyneCallback(const sensor_msgs::PointCloud2::ConstPtr& in_sensor_cloud_ptr)
 {
-	pcl::PointCloud<pcl::PointXYZ>::Ptr current_sensor_cloud_ptr (new pcl::PointCloud<pcl::PointXYZ>);
-	pcl::PointCloud<pcl::PointXYZ>::Ptr ground_cloud_ptr (new pcl::PointCloud<pcl::PointXYZ>);
-	pcl::PointCloud<pcl::PointXYZ>::Ptr lanes_cloud_ptr (new pcl::PointCloud<pcl::PointXYZ>);
-	pcl::PointCloud<pcl::PointXYZ>::Ptr output_cloud_ptr (new pcl::PointCloud<pcl::PointXYZ>);
-
-	pcl::fromROSMsg(*in_sensor_cloud_ptr, *current_sensor_cloud_ptr);
-
+	/*GROUND AND NON GROUND INDICES, the ring field is used when the input has it*/
+	if (!ground_segmentation_.Segment(*in_sensor_cloud_ptr, ground_indices_, no_ground_indices_))
+	{
+		ROS_WARN_THROTTLE(10, "ground_filter: %s has no x, y or z field, the cloud is not published", subscribe_topic_.c_str());
+		return;
+	}
 
-	RemoveFloor(current_sensor_cloud_ptr, lanes_cloud_ptr, ground_cloud_ptr, points_distance_, angle_threshold_);
+	sensor_msgs::PointCloud2::Ptr cloud_ground_msg(new sensor_msgs::PointCloud2);
+	ExtractPoints(*in_sensor_cloud_ptr, ground_indices_, *cloud_ground_msg);
+	cloud_ground_pub_.publish(cloud_ground_msg);
 
 	if (!floor_removal_)
-		output_cloud_ptr = current_sensor_cloud_ptr;
-	else
-		output_cloud_ptr = lanes_cloud_ptr;
-
-	sensor_msgs::PointCloud2 cloud_ground_msg;
-	sensor_msgs::PointCloud2 cloud_output_msg;
-
-	pcl::toROSMsg(*ground_cloud_ptr, cloud_ground_msg);
-	pcl::toROSMsg(*output_cloud_ptr, cloud_output_msg);
-
-	cloud_ground_msg.header=in_sensor_cloud_ptr->header;
-	cloud_ground_pub_.publish(cloud_ground_msg);
+	{
+		cloud_lanes_pub_.publish(in_sensor_cloud_ptr);
+		return;
+	}
 
-	cloud_output_msg.header=in_sensor_cloud_ptr->header;
+	sensor_msgs::PointCloud2::Ptr cloud_output_msg(new sensor_msgs::PointCloud2);
+	ExtractPoints(*in_sensor_cloud_ptr, no_ground_indices_, *cloud_output_msg);
 	cloud_lanes_pub_.publish(cloud_output_msg);
 }
 
+#ifdef BUILD_NODELET
+namespace points_preprocessor
+{
+class GroundFilterNodelet : public nodelet::Nodelet
+{
+	boost::shared_ptr<GroundFilter> filter_;
+
+	virtual void onInit()
+	{
+		filter_.reset(new GroundFilter(getPrivateNodeHandle()));
+	}
+};
+} // namespace points_preprocessor
+
+PLUGINLIB_EXPORT_CLASS(points_preprocessor::GroundFilterNodelet, nodelet::Nodelet)
+#else
 int main(int argc, char **argv)
 {
 
 	ros::init(argc, argv, "ground_filter");
-	GroundFilter node;
+	GroundFilter node(ros::NodeHandle("~"));
 	ros::spin();
 
 	return 0;
 }
+#endif
 
 
 
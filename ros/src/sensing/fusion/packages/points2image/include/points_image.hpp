@@ -35,6 +35,23 @@
 #include <sensor_msgs/PointCloud2.h>
 #include "points2image/PointsImage.h"
 
+/* Camera model flattened to floats, so that projection does not touch cv::Mat per point */
+struct ProjectionParams {
+	float R[9];		/* lidar to camera rotation, row major */
+	float T[3];		/* lidar to camera translation */
+	float fx, fy, cx, cy;	/* intrinsics */
+	float k1, k2, p1, p2, k3;	/* distortion */
+};
+
+ProjectionParams
+create_projection_params(const cv::Mat& cameraExtrinsicMat,
+			 const cv::Mat& cameraMat, const cv::Mat& distCoeff);
+
+points2image::PointsImage
+pointcloud2_to_image(const sensor_msgs::PointCloud2ConstPtr& pointclound2,
+		     const ProjectionParams& params,
+		     const cv::Size& imageSize);
+
 points2image::PointsImage
 pointcloud2_to_image(const sensor_msgs::PointCloud2ConstPtr& pointclound2,
 		     const cv::Mat& cameraExtrinsicMat,
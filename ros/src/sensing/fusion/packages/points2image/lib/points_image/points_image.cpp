@@ -31,12 +31,147 @@
 #include <vector>
 #include <points_image.hpp>
 #include <stdint.h>
+#include <string.h>
 #include <iostream>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#define MIN_DEPTH	2.5f	/* points closer to the camera are dropped */
+
+namespace {
+
+int
+find_field_offset(const sensor_msgs::PointCloud2& pointcloud2, const std::string& name, int default_offset)
+{
+	for (const sensor_msgs::PointField& field : pointcloud2.fields) {
+		if (field.name == name && field.datatype == sensor_msgs::PointField::FLOAT32)
+			return field.offset;
+	}
+	return default_offset;
+}
+
+inline float
+read_float(const uint8_t *p)
+{
+	float value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+/* Projects points [begin, end) of the SoA buffers. Points behind MIN_DEPTH
+ * or outside the image get row -1. */
+void
+project_points(const float *x, const float *y, const float *z, int begin, int end,
+	       const ProjectionParams& p, int w, int h,
+	       int *cols, int *rows, float *depths)
+{
+	int i = begin;
+#ifdef __SSE2__
+	const __m128 r0 = _mm_set1_ps(p.R[0]), r1 = _mm_set1_ps(p.R[1]), r2 = _mm_set1_ps(p.R[2]);
+	const __m128 r3 = _mm_set1_ps(p.R[3]), r4 = _mm_set1_ps(p.R[4]), r5 = _mm_set1_ps(p.R[5]);
+	const __m128 r6 = _mm_set1_ps(p.R[6]), r7 = _mm_set1_ps(p.R[7]), r8 = _mm_set1_ps(p.R[8]);
+	const __m128 t0 = _mm_set1_ps(p.T[0]), t1 = _mm_set1_ps(p.T[1]), t2 = _mm_set1_ps(p.T[2]);
+	const __m128 k1 = _mm_set1_ps(p.k1), k2 = _mm_set1_ps(p.k2), k3 = _mm_set1_ps(p.k3);
+	const __m128 p1 = _mm_set1_ps(p.p1), p2 = _mm_set1_ps(p.p2);
+	const __m128 fx = _mm_set1_ps(p.fx), fy = _mm_set1_ps(p.fy);
+	const __m128 cx = _mm_set1_ps(p.cx), cy = _mm_set1_ps(p.cy);
+	const __m128 one = _mm_set1_ps(1.0f), two = _mm_set1_ps(2.0f), half = _mm_set1_ps(0.5f);
+	const __m128 min_depth = _mm_set1_ps(MIN_DEPTH);
+	const __m128i minus_one = _mm_set1_epi32(-1);
+	const __m128i width = _mm_set1_epi32(w), height = _mm_set1_epi32(h);
+	for (; i + 4 <= end; i += 4) {
+		__m128 px = _mm_loadu_ps(x + i);
+		__m128 py = _mm_loadu_ps(y + i);
+		__m128 pz = _mm_loadu_ps(z + i);
+		__m128 qx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r0, px), _mm_mul_ps(r1, py)), _mm_add_ps(_mm_mul_ps(r2, pz), t0));
+		__m128 qy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r3, px), _mm_mul_ps(r4, py)), _mm_add_ps(_mm_mul_ps(r5, pz), t1));
+		__m128 qz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r6, px), _mm_mul_ps(r7, py)), _mm_add_ps(_mm_mul_ps(r8, pz), t2));
+
+		__m128 tx = _mm_div_ps(qx, qz);
+		__m128 ty = _mm_div_ps(qy, qz);
+		__m128 txy = _mm_mul_ps(tx, ty);
+		__m128 rr = _mm_add_ps(_mm_mul_ps(tx, tx), _mm_mul_ps(ty, ty));
+		__m128 dist = _mm_add_ps(one, _mm_mul_ps(rr, _mm_add_ps(k1, _mm_mul_ps(rr, _mm_add_ps(k2, _mm_mul_ps(rr, k3))))));
+		__m128 ix = _mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, dist), _mm_mul_ps(_mm_mul_ps(two, p1), txy)),
+				       _mm_mul_ps(p2, _mm_add_ps(rr, _mm_mul_ps(two, _mm_mul_ps(tx, tx)))));
+		__m128 iy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ty, dist), _mm_mul_ps(p1, _mm_add_ps(rr, _mm_mul_ps(two, _mm_mul_ps(ty, ty))))),
+				       _mm_mul_ps(_mm_mul_ps(two, p2), txy));
+		__m128i col = _mm_cvttps_epi32(_mm_add_ps(_mm_add_ps(_mm_mul_ps(fx, ix), cx), half));
+		__m128i row = _mm_cvttps_epi32(_mm_add_ps(_mm_add_ps(_mm_mul_ps(fy, iy), cy), half));
+
+		__m128i inside = _mm_castps_si128(_mm_cmpgt_ps(qz, min_depth));
+		inside = _mm_and_si128(inside, _mm_cmpgt_epi32(col, minus_one));
+		inside = _mm_and_si128(inside, _mm_cmplt_epi32(col, width));
+		inside = _mm_and_si128(inside, _mm_cmpgt_epi32(row, minus_one));
+		inside = _mm_and_si128(inside, _mm_cmplt_epi32(row, height));
+		row = _mm_or_si128(_mm_and_si128(inside, row), _mm_andnot_si128(inside, minus_one));
+
+		_mm_storeu_si128((__m128i *)(cols + i), col);
+		_mm_storeu_si128((__m128i *)(rows + i), row);
+		_mm_storeu_ps(depths + i, qz);
+	}
+#endif
+	for (; i < end; ++i) {
+		float qx = p.R[0] * x[i] + p.R[1] * y[i] + p.R[2] * z[i] + p.T[0];
+		float qy = p.R[3] * x[i] + p.R[4] * y[i] + p.R[5] * z[i] + p.T[1];
+		float qz = p.R[6] * x[i] + p.R[7] * y[i] + p.R[8] * z[i] + p.T[2];
+		rows[i] = -1;
+		depths[i] = qz;
+		if (!(qz > MIN_DEPTH))
+			continue;
+
+		float tx = qx / qz;
+		float ty = qy / qz;
+		float rr = tx * tx + ty * ty;
+		float dist = 1 + rr * (p.k1 + rr * (p.k2 + rr * p.k3));
+		float ix = tx * dist + 2 * p.p1 * tx * ty + p.p2 * (rr + 2 * tx * tx);
+		float iy = ty * dist + p.p1 * (rr + 2 * ty * ty) + 2 * p.p2 * tx * ty;
+		int col = int(p.fx * ix + p.cx + 0.5f);
+		int row = int(p.fy * iy + p.cy + 0.5f);
+		if (0 <= col && col < w && 0 <= row && row < h) {
+			cols[i] = col;
+			rows[i] = row;
+		}
+	}
+}
+
+} /* namespace */
+
+ProjectionParams
+create_projection_params(const cv::Mat& cameraExtrinsicMat,
+			 const cv::Mat& cameraMat, const cv::Mat& distCoeff)
+{
+	ProjectionParams params;
+
+	cv::Mat invR = cameraExtrinsicMat(cv::Rect(0,0,3,3)).t();
+	cv::Mat invT = -invR*(cameraExtrinsicMat(cv::Rect(3,0,1,3)));
+	for (int row = 0; row < 3; ++row) {
+		for (int col = 0; col < 3; ++col)
+			params.R[row * 3 + col] = float(invR.at<double>(row, col));
+		params.T[row] = float(invT.at<double>(row));
+	}
+
+	params.fx = float(cameraMat.at<double>(0,0));
+	params.fy = float(cameraMat.at<double>(1,1));
+	params.cx = float(cameraMat.at<double>(0,2));
+	params.cy = float(cameraMat.at<double>(1,2));
+
+	params.k1 = float(distCoeff.at<double>(0));
+	params.k2 = float(distCoeff.at<double>(1));
+	params.p1 = float(distCoeff.at<double>(2));
+	params.p2 = float(distCoeff.at<double>(3));
+	params.k3 = float(distCoeff.at<double>(4));
+
+	return params;
+}
 
 points2image::PointsImage
 pointcloud2_to_image(const sensor_msgs::PointCloud2ConstPtr& pointcloud2,
-		     const cv::Mat& cameraExtrinsicMat,
-		     const cv::Mat& cameraMat, const cv::Mat& distCoeff,
+		     const ProjectionParams& params,
 		     const cv::Size& imageSize)
 {
 	int w = imageSize.width;
@@ -51,81 +186,117 @@ pointcloud2_to_image(const sensor_msgs::PointCloud2ConstPtr& pointcloud2,
 	msg.min_height.assign(w * h, 0);
 	msg.max_height.assign(w * h, 0);
 
-	cv::Mat invR = cameraExtrinsicMat(cv::Rect(0,0,3,3)).t();
-	cv::Mat invT = -invR*(cameraExtrinsicMat(cv::Rect(3,0,1,3)));
-	uintptr_t cp = (uintptr_t)pointcloud2->data.data();
-
 	msg.max_y = -1;
 	msg.min_y = h;
 
 	msg.image_height = imageSize.height;
 	msg.image_width = imageSize.width;
 
-	for (uint32_t y = 0; y < pointcloud2->height; ++y) {
-		for (uint32_t x = 0; x < pointcloud2->width; ++x) {
-			float* fp = (float *)(cp + (x + y*pointcloud2->width) * pointcloud2->point_step);
-			double intensity = fp[4];
+	/* read the cloud into SoA buffers */
+	const uint8_t *cp = pointcloud2->data.data();
+	int size = pointcloud2->width * pointcloud2->height;
+	int step = pointcloud2->point_step;
+	int x_offset = find_field_offset(*pointcloud2, "x", 0);
+	int y_offset = find_field_offset(*pointcloud2, "y", 4);
+	int z_offset = find_field_offset(*pointcloud2, "z", 8);
+	int intensity_offset = find_field_offset(*pointcloud2, "intensity", 16);
+
+	std::vector<float> xs(size), ys(size), zs(size);
+	std::vector<int> cols(size), rows(size);
+	std::vector<float> depths(size);
 
-			cv::Mat point(1, 3, CV_64F);
-			point.at<double>(0) = double(fp[0]);
-			point.at<double>(1) = double(fp[1]);
-			point.at<double>(2) = double(fp[2]);
-			point = point * invR.t() + invT.t();
+	#pragma omp parallel for
+	for (int i = 0; i < size; ++i) {
+		const uint8_t *fp = cp + i * step;
+		xs[i] = read_float(fp + x_offset);
+		ys[i] = read_float(fp + y_offset);
+		zs[i] = read_float(fp + z_offset);
+	}
 
-			if (point.at<double>(2) <= 2.5) {
+	/* project in batches */
+	const int batch = 1024;
+	#pragma omp parallel for schedule(static)
+	for (int begin = 0; begin < size; begin += batch) {
+		int end = begin + batch < size ? begin + batch : size;
+		project_points(xs.data(), ys.data(), zs.data(), begin, end, params, w, h,
+			       cols.data(), rows.data(), depths.data());
+	}
+
+	/* z-buffer: every thread owns a band of image rows, so pixels are
+	 * written without locks and the nearest point wins. Points are first
+	 * counting sorted by band, keeping cloud order within a band, so each
+	 * thread only visits its own points. */
+	bool vscan = (pointcloud2->height == 2);
+	int width = pointcloud2->width;
+	int bands = 1;
+#ifdef _OPENMP
+	bands = omp_get_max_threads();
+#endif
+	if (bands > h)
+		bands = h > 0 ? h : 1;
+
+	std::vector<int> band_of_row(h);
+	for (int band = 0; band < bands; ++band) {
+		for (int py = h * band / bands; py < h * (band + 1) / bands; ++py)
+			band_of_row[py] = band;
+	}
+	std::vector<int> band_offsets(bands + 1, 0);
+	for (int i = 0; i < size; ++i) {
+		if (rows[i] >= 0)
+			++band_offsets[band_of_row[rows[i]] + 1];
+	}
+	for (int band = 0; band < bands; ++band)
+		band_offsets[band + 1] += band_offsets[band];
+	std::vector<int> band_points(band_offsets[bands]);
+	std::vector<int> band_fill(band_offsets.begin(), band_offsets.end() - 1);
+	for (int i = 0; i < size; ++i) {
+		if (rows[i] >= 0)
+			band_points[band_fill[band_of_row[rows[i]]]++] = i;
+	}
+
+	int max_y = -1;
+	int min_y = h;
+	#pragma omp parallel for schedule(static, 1) reduction(max:max_y) reduction(min:min_y)
+	for (int band = 0; band < bands; ++band) {
+		for (int j = band_offsets[band]; j < band_offsets[band + 1]; ++j) {
+			int i = band_points[j];
+			int py = rows[i];
+			int pid = py * w + cols[i];
+			float distance = depths[i] * 100;
+			if (msg.distance[pid] != 0 && msg.distance[pid] <= distance)
 				continue;
-			}
 
-			double tmpx = point.at<double>(0) / point.at<double>(2);
-			double tmpy = point.at<double>(1)/point.at<double>(2);
-			double r2 = tmpx * tmpx + tmpy * tmpy;
-			double tmpdist = 1 + distCoeff.at<double>(0) * r2
-				+ distCoeff.at<double>(1) * r2 * r2
-				+ distCoeff.at<double>(4) * r2 * r2 * r2;
-
-			cv::Point2d imagepoint;
-			imagepoint.x = tmpx * tmpdist
-				+ 2 * distCoeff.at<double>(2) * tmpx * tmpy
-				+ distCoeff.at<double>(3) * (r2 + 2 * tmpx * tmpx);
-			imagepoint.y = tmpy * tmpdist
-				+ distCoeff.at<double>(2) * (r2 + 2 * tmpy * tmpy)
-				+ 2 * distCoeff.at<double>(3) * tmpx * tmpy;
-			imagepoint.x = cameraMat.at<double>(0,0) * imagepoint.x + cameraMat.at<double>(0,2);
-			imagepoint.y = cameraMat.at<double>(1,1) * imagepoint.y + cameraMat.at<double>(1,2);
-
-			int px = int(imagepoint.x + 0.5);
-			int py = int(imagepoint.y + 0.5);
-			if(0 <= px && px < w && 0 <= py && py < h)
-			{
-				int pid = py * w + px;
-				if(msg.distance[pid] == 0 ||
-				   msg.distance[pid] > point.at<double>(2))
-				{
-					msg.distance[pid] = float(point.at<double>(2) * 100);
-					msg.intensity[pid] = float(intensity);
-
-					msg.max_y = py > msg.max_y ? py : msg.max_y;
-					msg.min_y = py < msg.min_y ? py : msg.min_y;
-
-				}
-				if (0 == y && pointcloud2->height == 2)//process simultaneously min and max during the first layer
-				{
-					float* fp2 = (float *)(cp + (x + (y+1)*pointcloud2->width) * pointcloud2->point_step);
-					msg.min_height[pid] = fp[2];
-					msg.max_height[pid] = fp2[2];
-				}
-				else
-				{
-					msg.min_height[pid] = -1.25;
-					msg.max_height[pid] = 0;
-				}
+			msg.distance[pid] = distance;
+			msg.intensity[pid] = read_float(cp + i * step + intensity_offset);
+			max_y = py > max_y ? py : max_y;
+			min_y = py < min_y ? py : min_y;
+
+			if (vscan && i < width) { /* min and max of a vscan column are its two layers */
+				msg.min_height[pid] = zs[i];
+				msg.max_height[pid] = zs[i + width];
+			} else {
+				msg.min_height[pid] = -1.25;
+				msg.max_height[pid] = 0;
 			}
 		}
 	}
+	msg.max_y = max_y;
+	msg.min_y = min_y;
 
 	return msg;
 }
 
+points2image::PointsImage
+pointcloud2_to_image(const sensor_msgs::PointCloud2ConstPtr& pointcloud2,
+		     const cv::Mat& cameraExtrinsicMat,
+		     const cv::Mat& cameraMat, const cv::Mat& distCoeff,
+		     const cv::Size& imageSize)
+{
+	return pointcloud2_to_image(pointcloud2,
+				    create_projection_params(cameraExtrinsicMat, cameraMat, distCoeff),
+				    imageSize);
+}
+
 /*points2image::CameraExtrinsic
 pointcloud2_to_3d_calibration(const sensor_msgs::PointCloud2ConstPtr& pointcloud2,
 			      const cv::Mat& cameraExtrinsicMat)
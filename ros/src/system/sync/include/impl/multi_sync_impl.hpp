@@ -0,0 +1,167 @@
+#include <std_msgs/Float64.h>
+#include <boost/bind.hpp>
+#include <algorithm>
+
+template<typename T>
+static bool stamp_less(const typename T::ConstPtr& msg, const ros::Time& stamp) {
+    return msg->header.stamp < stamp;
+}
+
+template<typename T>
+SyncTopicBuffer<T>::SyncTopicBuffer(ros::NodeHandle& nh, const std::string sub_topic, const std::string pub_topic, size_t capacity, ArrivalCallback on_arrival) :
+    capacity_(capacity), selected_(0), on_arrival_(on_arrival)
+{
+    sub_ = nh.subscribe(sub_topic, 1, &SyncTopicBuffer::callback, this);
+    pub_ = nh.advertise<T>(pub_topic, 5);
+}
+
+template<typename T>
+bool SyncTopicBuffer<T>::empty() const {
+    return buf_.empty();
+}
+
+template<typename T>
+ros::Time SyncTopicBuffer<T>::newest() const {
+    return buf_.back()->header.stamp;
+}
+
+template<typename T>
+ros::Time SyncTopicBuffer<T>::select(const ros::Time& stamp) {
+    typename std::deque<typename T::ConstPtr>::iterator it = std::lower_bound(buf_.begin(), buf_.end(), stamp, stamp_less<T>);
+    if (it == buf_.end()) {
+        --it;
+    } else if (it != buf_.begin() && stamp - (*(it-1))->header.stamp <= (*it)->header.stamp - stamp) {
+        /* the older one wins a tie */
+        --it;
+    }
+    selected_ = it - buf_.begin();
+    return (*it)->header.stamp;
+}
+
+template<typename T>
+void SyncTopicBuffer<T>::publish() {
+    pub_.publish(buf_[selected_]);
+}
+
+template<typename T>
+void SyncTopicBuffer<T>::trim() {
+    published_ = buf_[selected_]->header.stamp;
+    buf_.erase(buf_.begin(), buf_.begin() + selected_ + 1);
+    selected_ = 0;
+}
+
+template<typename T>
+void SyncTopicBuffer<T>::callback(const typename T::ConstPtr& msg) {
+    if (!published_.isZero() && msg->header.stamp <= published_) {
+        ROS_DEBUG("drop a message not newer than the published one");
+        return;
+    }
+
+    /* messages mostly arrive in order, so this is an append */
+    typename std::deque<typename T::ConstPtr>::iterator it = buf_.end();
+    if (!buf_.empty() && msg->header.stamp < buf_.back()->header.stamp)
+        it = std::upper_bound(buf_.begin(), buf_.end(), msg, [](const typename T::ConstPtr& a, const typename T::ConstPtr& b) {
+            return a->header.stamp < b->header.stamp;
+        });
+    buf_.insert(it, msg);
+    if (buf_.size() > capacity_)
+        buf_.pop_front();
+    selected_ = 0;
+
+    on_arrival_();
+}
+
+template<typename TReq>
+MultiSynchronizer<TReq>::MultiSynchronizer(const std::string req_topic, const std::string ns, size_t buffer_size) :
+    buffer_size_(buffer_size)
+{
+    ros::NodeHandle private_nh("~");
+    double timeout;
+    private_nh.param("max_skew", max_skew_, -1.0);
+    private_nh.param("timeout", timeout, 3.0);
+
+    /* the first set is published without waiting for a request */
+    is_req_ = true;
+
+    req_sub_ = nh_.subscribe(req_topic, 1, &MultiSynchronizer::req_callback, this);
+    sync_time_diff_pub_ = nh_.advertise<std_msgs::Float64>("/"+ns+"/time_diff", 5);
+    timeout_timer_ = nh_.createTimer(ros::Duration(timeout), &MultiSynchronizer::timeout_callback, this);
+}
+
+template<typename TReq>
+template<typename T>
+void MultiSynchronizer<TReq>::addTopic(const std::string sub_topic, const std::string pub_topic) {
+    topics_.push_back(boost::shared_ptr<SyncTopic>(new SyncTopicBuffer<T>(nh_, sub_topic, pub_topic, buffer_size_,
+                                                                          boost::bind(&MultiSynchronizer::arrival_callback, this))));
+}
+
+template<typename TReq>
+void MultiSynchronizer<TReq>::run() {
+    ros::spin();
+}
+
+template<typename TReq>
+bool MultiSynchronizer<TReq>::publish() {
+    if (topics_.empty())
+        return false;
+
+    ros::Time pivot = ros::TIME_MAX;
+    for (size_t i = 0; i < topics_.size(); i++) {
+        if (topics_[i]->empty()) {
+            ROS_DEBUG("ring buffer %zu is empty", i);
+            return false;
+        }
+        pivot = std::min(pivot, topics_[i]->newest());
+    }
+
+    ros::Time oldest = pivot;
+    ros::Time latest = pivot;
+    for (size_t i = 0; i < topics_.size(); i++) {
+        ros::Time stamp = topics_[i]->select(pivot);
+        oldest = std::min(oldest, stamp);
+        latest = std::max(latest, stamp);
+    }
+
+    std_msgs::Float64 time_diff;
+    time_diff.data = (latest - oldest).toSec();
+    if (max_skew_ >= 0 && time_diff.data > max_skew_) {
+        ROS_DEBUG("skew %f exceeds %f, waiting...", time_diff.data, max_skew_);
+        return false;
+    }
+
+    ROS_DEBUG("publish");
+    for (size_t i = 0; i < topics_.size(); i++) {
+        topics_[i]->publish();
+        topics_[i]->trim();
+    }
+    sync_time_diff_pub_.publish(time_diff);
+
+    is_req_ = false;
+    /* restart the timeout */
+    timeout_timer_.stop();
+    timeout_timer_.start();
+    return true;
+}
+
+template<typename TReq>
+void MultiSynchronizer<TReq>::arrival_callback() {
+    if (is_req_)
+        publish();
+}
+
+template<typename TReq>
+void MultiSynchronizer<TReq>::req_callback(const typename TReq::ConstPtr& req_msg) {
+    ROS_DEBUG("catch publish request");
+    is_req_ = true;
+    if (!publish())
+        ROS_DEBUG("waitting...");
+}
+
+template<typename TReq>
+void MultiSynchronizer<TReq>::timeout_callback(const ros::TimerEvent& event) {
+    if (is_req_)
+        return;
+    ROS_DEBUG("timeout");
+    is_req_ = true;
+    publish();
+}
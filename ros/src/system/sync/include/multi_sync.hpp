@@ -0,0 +1,94 @@
+#ifndef _MULTI_SYNC_HEADER_
+#define _MULTI_SYNC_HEADER_
+#include "ros/ros.h"
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <deque>
+#include <string>
+#include <vector>
+
+/*
+ * Buffer of one synchronized topic, kept sorted by header stamp so that the
+ * message closest to a stamp is found by binary search.
+ */
+class SyncTopic
+{
+public:
+    virtual ~SyncTopic() {}
+    virtual bool empty() const = 0;
+    virtual ros::Time newest() const = 0;
+    /* select the message closest to stamp and return its stamp */
+    virtual ros::Time select(const ros::Time& stamp) = 0;
+    virtual void publish() = 0;
+    /* drop the selected message and the older ones, so that the next set is all new data */
+    virtual void trim() = 0;
+};
+
+template<typename T>
+class SyncTopicBuffer : public SyncTopic
+{
+public:
+    typedef boost::function<void()> ArrivalCallback;
+
+    SyncTopicBuffer(ros::NodeHandle& nh, const std::string sub_topic, const std::string pub_topic, size_t capacity, ArrivalCallback on_arrival);
+    bool empty() const;
+    ros::Time newest() const;
+    ros::Time select(const ros::Time& stamp);
+    void publish();
+    void trim();
+
+private:
+    std::deque<typename T::ConstPtr> buf_;
+    size_t capacity_;
+    size_t selected_;
+    /* stamp of the last published message, older arrivals are dropped */
+    ros::Time published_;
+    ros::Subscriber sub_;
+    ros::Publisher pub_;
+    ArrivalCallback on_arrival_;
+
+    void callback(const typename T::ConstPtr& msg);
+};
+
+/*
+ * Synchronizes any number of topics for a node that requests the next set of
+ * messages by publishing TReq when it has finished processing the previous one.
+ *
+ * A pending request is answered from the arrival callbacks as soon as every
+ * topic has data: the pivot is the oldest of the newest stamps of the topics,
+ * and each topic publishes its message closest to the pivot. Sets whose stamps
+ * spread more than ~max_skew seconds are held back until newer data arrives
+ * (a negative value accepts any skew). If no request comes within ~timeout
+ * seconds the next set is published anyway.
+ *
+ * Published messages leave the buffers, so a request is only answered once
+ * every topic has received a message newer than the one it last published.
+ */
+template<typename TReq>
+class MultiSynchronizer
+{
+public:
+    MultiSynchronizer(const std::string req_topic, const std::string ns, size_t buffer_size = 10);
+    template<typename T>
+    void addTopic(const std::string sub_topic, const std::string pub_topic);
+    void run();
+
+private:
+    ros::NodeHandle nh_;
+    std::vector<boost::shared_ptr<SyncTopic> > topics_;
+    size_t buffer_size_;
+    double max_skew_;
+    bool is_req_;
+    ros::Subscriber req_sub_;
+    ros::Publisher sync_time_diff_pub_;
+    ros::Timer timeout_timer_;
+
+    bool publish();
+    void arrival_callback();
+    void req_callback(const typename TReq::ConstPtr& req_msg);
+    void timeout_callback(const ros::TimerEvent& event);
+};
+
+#include "impl/multi_sync_impl.hpp"
+
+#endif